@@ -30,203 +30,781 @@
  */
 
 #include "CAN.h"
+#include "CAN_backend.h"
+
+#include <inttypes.h>
+#include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
 
-#include "driver/twai.h"
-#include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "CAN_config.h"
 
 static const char *TAG = "CAN";
+static CAN_backend_t backend;
 static TaskHandle_t rx_task_handle = NULL;
+static CAN_rx_callback_t rx_callback = NULL;
+static void *rx_callback_arg = NULL;
+static CAN_trace_hook_t trace_hook = NULL;
+
+// Requested filter, applied by the RX task; guarded by filter_mux
+static uint32_t filter_ids[CAN_FILTER_MAX_IDS];
+static uint8_t filter_count;
+static bool filter_extended;
+static bool filter_pending;
+
+// Filter the driver is installed with, only touched by the RX task (and CAN_init before it)
+static uint32_t active_ids[CAN_FILTER_MAX_IDS];
+static uint8_t active_count;
+static bool active_extended;
+
+static CAN_filter_stats_t filter_stats;
+static portMUX_TYPE filter_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static CAN_rx_stats_t rx_stats;
+// The driver's loss counters restart with every install, totals of earlier installs
+static uint32_t rx_missed_base;
+static uint32_t rx_overrun_base;
+static portMUX_TYPE rx_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Error state and bus-off recovery, driven by the alert task; guarded by bus_mux
+static CAN_bus_stats_t bus_stats;
+static CAN_bus_event_t bus_events[CAN_BUS_EVENT_LOG];
+static uint32_t bus_event_count; // all transitions, the log keeps the latest
+static int64_t bus_off_us;       // start of the current bus-off
+static int64_t bus_recovered_us; // end of the last recovery, 0 none yet
+static int64_t recovery_at_us;   // scheduled recovery start, 0 none
+static portMUX_TYPE bus_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Transmitting tasks register in driver_users, so a filter change never
+// closes the backend under them; new users back off while reopening
+static uint32_t driver_users;
+static bool driver_reinstalling;
 
-// Convert CAN speed enum to TWAI timing config
-static void get_twai_timing(CAN_speed_t speed, twai_timing_config_t *t_config) {
-    switch (speed) {
-        case CAN_SPEED_100KBPS:
-            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_100KBITS();
-            break;
-        case CAN_SPEED_125KBPS:
-            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_125KBITS();
-            break;
-        case CAN_SPEED_250KBPS:
-            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_250KBITS();
-            break;
-        case CAN_SPEED_500KBPS:
-            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_500KBITS();
-            break;
-        case CAN_SPEED_800KBPS:
-            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_800KBITS();
-            break;
-        case CAN_SPEED_1000KBPS:
-            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_1MBITS();
-            break;
-        default:
-            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_500KBITS();
-            break;
+#define TX_RING_SIZE CONFIG_ESP_CAN_TX_RING_SIZE
+#if CONFIG_ESP_CAN_TX_BULK_RESERVE >= CONFIG_ESP_CAN_TX_RING_SIZE
+#error "CONFIG_ESP_CAN_TX_BULK_RESERVE must leave room for bulk traffic in the TX ring"
+#endif
+#define TX_NONE 0xFF
+// Alert wait, bounds how late an expired frame is dropped while the bus is quiet
+#define TX_SWEEP_MS 10
+
+typedef struct {
+    CAN_frame_t frame;
+    int64_t queued_us;
+    int64_t deadline_us;
+    uint32_t key;        // arbitration order, lower wins
+    uint32_t seq;        // queue order among equal keys
+    CAN_tx_callback_t callback;
+    void *arg;
+    uint8_t tx_class;
+    bool used;
+} tx_entry_t;
+
+// Frames waiting for transmission; the backend gets one at a time so the
+// ring, not the controller's FIFO, decides the order. Guarded by tx_mux
+static tx_entry_t tx_ring[TX_RING_SIZE];
+static uint8_t tx_count;
+static uint8_t tx_in_flight = TX_NONE;
+static uint32_t tx_seq;
+static CAN_tx_stats_t tx_stats;
+static portMUX_TYPE tx_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t alert_task_handle = NULL;
+
+static bool driver_acquire(void) {
+    __atomic_add_fetch(&driver_users, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&driver_reinstalling, __ATOMIC_SEQ_CST)) {
+        __atomic_sub_fetch(&driver_users, 1, __ATOMIC_SEQ_CST);
+        return false;
     }
-    
-    // Disable triple sampling temporarily for testing
-    t_config->triple_sampling = false;
+    return true;
 }
 
-// RX task that reads TWAI messages and puts them in the queue
-static void twai_rx_task(void *arg) {
-    twai_message_t rx_msg;
-    CAN_frame_t can_frame;
-    
+static void driver_release(void) {
+    __atomic_sub_fetch(&driver_users, 1, __ATOMIC_SEQ_CST);
+}
+
+// Software filter for what the hardware filter lets through
+static bool filter_match(const CAN_frame_t *frame) {
+    if (active_count == 0) {
+        return true;
+    }
+    if ((frame->FIR.B.FF == CAN_frame_ext) != active_extended) {
+        return false;
+    }
+    for (uint8_t i = 0; i < active_count; i++) {
+        if (active_ids[i] == frame->MsgID) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Open the backend with the requested filter
+static int open_backend(void) {
+    portENTER_CRITICAL(&filter_mux);
+    memcpy(active_ids, filter_ids, sizeof(active_ids));
+    active_count = filter_count;
+    active_extended = filter_extended;
+    filter_pending = false;
+    portEXIT_CRITICAL(&filter_mux);
+
+    CAN_filter_stats_t hw;
+    if (backend.ops->open(backend.ctx, active_ids, active_count, active_extended, &hw) != 0) {
+        ESP_LOGE(TAG, "Failed to open %s backend", backend.ops->name);
+        return -1;
+    }
+
+    portENTER_CRITICAL(&filter_mux);
+    filter_stats.hw_code = hw.hw_code;
+    filter_stats.hw_mask = hw.hw_mask;
+    filter_stats.hw_dual = hw.hw_dual;
+    filter_stats.hw_width = hw.hw_width;
+    portEXIT_CRITICAL(&filter_mux);
+    return 0;
+}
+
+// Order in which frames would win arbitration: base ID, then a standard
+// frame before an extended one, then the extended ID bits
+static uint32_t tx_key(const CAN_frame_t *frame) {
+    if (frame->FIR.B.FF == CAN_frame_ext) {
+        return ((frame->MsgID >> 18) << 19) | (1 << 18) | (frame->MsgID & 0x3FFFF);
+    }
+    return (frame->MsgID & 0x7FF) << 19;
+}
+
+static bool tx_before(const tx_entry_t *a, const tx_entry_t *b) {
+    if (a->tx_class != b->tx_class) {
+        return a->tx_class < b->tx_class;
+    }
+    // Bulk traffic keeps its order, a replayed trace goes out as recorded
+    if (a->tx_class == CAN_TX_RESPONSE && a->key != b->key) {
+        return a->key < b->key;
+    }
+    return (int32_t)(a->seq - b->seq) < 0;
+}
+
+// Next frame to transmit, skipping expired ones; tx_mux held
+static uint8_t tx_select(int64_t now) {
+    uint8_t best = TX_NONE;
+    for (uint8_t i = 0; i < TX_RING_SIZE; i++) {
+        const tx_entry_t *e = &tx_ring[i];
+        if (!e->used || now >= e->deadline_us) {
+            continue;
+        }
+        if (best == TX_NONE || tx_before(e, &tx_ring[best])) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Hand the next frame to the controller unless one is already in flight
+static void tx_kick(void) {
+    CAN_frame_t frame;
+
+    portENTER_CRITICAL(&tx_mux);
+    uint8_t next = (tx_in_flight == TX_NONE) ? tx_select(esp_timer_get_time()) : TX_NONE;
+    if (next != TX_NONE) {
+        tx_in_flight = next;
+        frame = tx_ring[next].frame;
+    }
+    portEXIT_CRITICAL(&tx_mux);
+    if (next == TX_NONE) {
+        return;
+    }
+
+    // Single shot: the alert task repeats failed attempts and can give up at the deadline
+    int ret = -1;
+    if (driver_acquire()) {
+        ret = backend.ops->transmit(backend.ctx, &frame);
+        driver_release();
+    }
+    if (ret != 0) {
+        // Bus not running (bus off, reopening), the alert task tries again.
+        // tx_kick also runs in the RX task: meanwhile an event batch may
+        // have completed this slot and put another frame in flight
+        portENTER_CRITICAL(&tx_mux);
+        if (tx_in_flight == next) {
+            tx_in_flight = TX_NONE;
+        }
+        portEXIT_CRITICAL(&tx_mux);
+    }
+}
+
+// The frame in flight has left the controller, or was lost
+static void tx_complete(bool success) {
+    tx_entry_t done;
+    bool finished = false;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&tx_mux);
+    if (tx_in_flight != TX_NONE) {
+        tx_entry_t *e = &tx_ring[tx_in_flight];
+        if (success) {
+            done = *e;
+            finished = true;
+            e->used = false;
+            tx_count--;
+
+            uint32_t latency = (uint32_t)(now - done.queued_us);
+            tx_stats.sent++;
+            tx_stats.last_us = latency;
+            tx_stats.total_us += latency;
+            if (latency > tx_stats.max_us) {
+                tx_stats.max_us = latency;
+            }
+        } else {
+            tx_stats.retries++; // stays queued until sent or expired
+        }
+        tx_in_flight = TX_NONE;
+    }
+    portEXIT_CRITICAL(&tx_mux);
+
+    if (!finished) {
+        return;
+    }
+    CAN_trace_hook_t hook = __atomic_load_n(&trace_hook, __ATOMIC_RELAXED);
+    if (hook != NULL) {
+        hook(&done.frame, now, CAN_TRACE_TX);
+    }
+    if (done.callback != NULL) {
+        done.callback(&done.frame, CAN_TX_DONE, (uint32_t)(now - done.queued_us), done.arg);
+    }
+}
+
+// Drop frames past their deadline
+static void tx_expire(void) {
+    int64_t now = esp_timer_get_time();
+
+    for (uint8_t i = 0; i < TX_RING_SIZE && tx_count > 0; i++) {
+        tx_entry_t done;
+        bool expired = false;
+
+        portENTER_CRITICAL(&tx_mux);
+        tx_entry_t *e = &tx_ring[i];
+        if (e->used && i != tx_in_flight && now >= e->deadline_us) {
+            done = *e;
+            expired = true;
+            e->used = false;
+            tx_count--;
+            tx_stats.expired++;
+        }
+        portEXIT_CRITICAL(&tx_mux);
+
+        if (expired && done.callback != NULL) {
+            done.callback(&done.frame, CAN_TX_EXPIRED, (uint32_t)(now - done.queued_us), done.arg);
+        }
+    }
+}
+
+// Record a state transition; bus_mux held
+static void bus_enter(CAN_bus_state_t state, int64_t now) {
+    if (bus_stats.state == state) {
+        return;
+    }
+    bus_stats.state = state;
+    bus_events[bus_event_count % CAN_BUS_EVENT_LOG] = (CAN_bus_event_t){ .time_us = now, .state = state };
+    bus_event_count++;
+}
+
+// Follow the controller's error state; the backend is held
+static void bus_handle_events(uint32_t events, int64_t now) {
+    if (events & CAN_EVENT_ABOVE_WARN) {
+        portENTER_CRITICAL(&bus_mux);
+        if (bus_stats.state == CAN_BUS_ACTIVE) {
+            bus_enter(CAN_BUS_WARNING, now);
+        }
+        portEXIT_CRITICAL(&bus_mux);
+    }
+    if (events & CAN_EVENT_ERR_PASSIVE) {
+        portENTER_CRITICAL(&bus_mux);
+        bus_stats.error_passive++;
+        bus_enter(CAN_BUS_PASSIVE, now);
+        portEXIT_CRITICAL(&bus_mux);
+        ESP_LOGW(TAG, "Error passive");
+    }
+    if (events & CAN_EVENT_BUS_OFF) {
+        portENTER_CRITICAL(&bus_mux);
+        // Recover at once, unless the bus went off again soon after the last recovery
+        uint32_t backoff = 0;
+        if (bus_recovered_us != 0 && now - bus_recovered_us < CONFIG_ESP_CAN_RECOVERY_BACKOFF_MAX_MS * 1000LL) {
+            backoff = bus_stats.backoff_ms ? bus_stats.backoff_ms * 2 : CONFIG_ESP_CAN_RECOVERY_BACKOFF_MIN_MS;
+            if (backoff > CONFIG_ESP_CAN_RECOVERY_BACKOFF_MAX_MS) {
+                backoff = CONFIG_ESP_CAN_RECOVERY_BACKOFF_MAX_MS;
+            }
+        }
+        bus_stats.bus_off++;
+        bus_stats.backoff_ms = backoff;
+        bus_off_us = now;
+        recovery_at_us = now + backoff * 1000LL;
+        bus_enter(CAN_BUS_OFF, now);
+        portEXIT_CRITICAL(&bus_mux);
+        ESP_LOGE(TAG, "Bus off, recovering in %" PRIu32 " ms", backoff);
+    }
+    if (events & CAN_EVENT_RECOVERED) {
+        int ret = backend.ops->restart ? backend.ops->restart(backend.ctx) : 0;
+        portENTER_CRITICAL(&bus_mux);
+        uint32_t recover_us = (uint32_t)(now - bus_off_us);
+        if (ret == 0) {
+            bus_stats.recoveries++;
+            bus_stats.recover_last_us = recover_us;
+            bus_stats.recover_total_us += recover_us;
+            if (recover_us > bus_stats.recover_max_us) {
+                bus_stats.recover_max_us = recover_us;
+            }
+            bus_recovered_us = now;
+            bus_enter(CAN_BUS_ACTIVE, now);
+        }
+        portEXIT_CRITICAL(&bus_mux);
+        if (ret == 0) {
+            ESP_LOGI(TAG, "Bus recovered after %" PRIu32 " us", recover_us);
+        }
+    }
+    if (events & CAN_EVENT_ERR_ACTIVE) {
+        portENTER_CRITICAL(&bus_mux);
+        if (bus_stats.state == CAN_BUS_PASSIVE) {
+            bus_enter(CAN_BUS_WARNING, now);
+        }
+        portEXIT_CRITICAL(&bus_mux);
+    }
+    if (events & CAN_EVENT_BELOW_WARN) {
+        portENTER_CRITICAL(&bus_mux);
+        if (bus_stats.state == CAN_BUS_WARNING || bus_stats.state == CAN_BUS_PASSIVE) {
+            bus_enter(CAN_BUS_ACTIVE, now);
+        }
+        portEXIT_CRITICAL(&bus_mux);
+    }
+}
+
+// Start a bus-off recovery once its backoff has passed; the backend is held
+static void bus_recover_due(int64_t now) {
+    portENTER_CRITICAL(&bus_mux);
+    bool due = recovery_at_us != 0 && now >= recovery_at_us;
+    if (due) {
+        recovery_at_us = 0;
+    }
+    portEXIT_CRITICAL(&bus_mux);
+    if (!due) {
+        return;
+    }
+
+    // Backends without recover restart the controller by themselves
+    if (backend.ops->recover == NULL || backend.ops->recover(backend.ctx) == 0) {
+        portENTER_CRITICAL(&bus_mux);
+        bus_enter(CAN_BUS_RECOVERING, now);
+        portEXIT_CRITICAL(&bus_mux);
+    }
+}
+
+// Bus state changes and transmit completions, blocking on the backend's events
+static void can_alert_task(void *arg) {
     while (1) {
-        // Check for alerts (Bus Off, Error Passive, etc.)
-        uint32_t alerts;
-        if (twai_read_alerts(&alerts, 0) == ESP_OK) {
-            if (alerts & TWAI_ALERT_BUS_OFF) {
-                ESP_LOGE(TAG, "Bus Off condition occurred. Initiating recovery...");
-                twai_initiate_recovery();
+        uint32_t events = 0;
+        int ret = -1;
+        if (driver_acquire()) {
+            ret = backend.ops->wait_events(backend.ctx, &events, TX_SWEEP_MS);
+            int64_t now = esp_timer_get_time();
+            if (ret == 0) {
+                bus_handle_events(events, now);
             }
-            if (alerts & TWAI_ALERT_BUS_RECOVERED) {
-                ESP_LOGI(TAG, "Bus Recovered. Restarting TWAI driver...");
-                twai_start();
+            bus_recover_due(now);
+            driver_release();
+        }
+        if (ret != 0) {
+            vTaskDelay(1); // backend is being reopened
+        }
+
+        // One completion per batch for the frame in flight; a frame sent
+        // before the bus went off still counts as sent
+        if (ret == 0) {
+            if (events & CAN_EVENT_TX_DONE) {
+                tx_complete(true);
+            } else if (events & (CAN_EVENT_BUS_OFF | CAN_EVENT_TX_FAILED)) {
+                tx_complete(false);
             }
         }
 
+        tx_expire();
+        tx_kick();
+    }
+}
+
+// Backends take their filter when opened, e.g. the TWAI driver must be reinstalled
+static void reopen_backend(void) {
+    __atomic_store_n(&driver_reinstalling, true, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&driver_users, __ATOMIC_SEQ_CST) != 0) {
+        vTaskDelay(1);
+    }
+    CAN_backend_status_t status;
+    if (backend.ops->get_status(backend.ctx, &status) == 0) {
+        portENTER_CRITICAL(&rx_mux);
+        rx_missed_base += status.rx_missed;
+        rx_overrun_base += status.rx_overrun;
+        portEXIT_CRITICAL(&rx_mux);
+    }
+    backend.ops->close(backend.ctx);
+    open_backend();
+    __atomic_store_n(&driver_reinstalling, false, __ATOMIC_SEQ_CST);
+
+    // The reopened controller starts error active, a pending recovery is moot
+    portENTER_CRITICAL(&bus_mux);
+    recovery_at_us = 0;
+    bus_enter(CAN_BUS_ACTIVE, esp_timer_get_time());
+    portEXIT_CRITICAL(&bus_mux);
+
+    // A frame in flight was discarded on close
+    tx_complete(false);
+}
+
+// Burst histogram bin of a burst of `length` frames
+static uint8_t burst_bin(uint32_t length) {
+    uint8_t bin = 0;
+    while (bin < CAN_RX_BURST_BINS - 1 && length > (1u << bin)) {
+        bin++;
+    }
+    return bin;
+}
+
+// Update the receive counters; `taken` frames were just taken from the
+// backend, a burst of `burst_end` frames (if not 0) has ended
+static void rx_account(uint32_t taken, uint32_t burst_end) {
+    CAN_backend_status_t status;
+    bool have_status = backend.ops->get_status(backend.ctx, &status) == 0;
+
+    portENTER_CRITICAL(&rx_mux);
+    rx_stats.received += taken;
+    if (burst_end > 0) {
+        rx_stats.bursts[burst_bin(burst_end)]++;
+    }
+    if (have_status) {
+        if (status.msgs_to_rx + taken > rx_stats.driver_hwm) {
+            rx_stats.driver_hwm = status.msgs_to_rx + taken;
+        }
+        rx_stats.driver_missed = rx_missed_base + status.rx_missed;
+        rx_stats.hw_overruns = rx_overrun_base + status.rx_overrun;
+    }
+    portEXIT_CRITICAL(&rx_mux);
+}
+
+// RX task that receives frames and hands them to the callback or queue
+static void can_rx_task(void *arg) {
+    CAN_frame_t can_frame;
+    int64_t burst_last_us = 0;
+    uint32_t burst_length = 0;
+    
+    while (1) {
+        if (filter_pending) {
+            reopen_backend();
+        }
+
         // Wait for message to be received
-        if (twai_receive(&rx_msg, pdMS_TO_TICKS(100)) == ESP_OK) {
-            // Convert TWAI message to CAN frame format
-            can_frame.MsgID = rx_msg.identifier;
-            can_frame.FIR.B.DLC = rx_msg.data_length_code;
-            can_frame.FIR.B.FF = rx_msg.extd ? CAN_frame_ext : CAN_frame_std;
-            can_frame.FIR.B.RTR = rx_msg.rtr ? CAN_RTR : CAN_no_RTR;
-            
-            // Copy data
-            for (int i = 0; i < rx_msg.data_length_code && i < 8; i++) {
-                can_frame.data.u8[i] = rx_msg.data[i];
+        if (backend.ops->receive(backend.ctx, &can_frame, 100) != 0) {
+            rx_account(0, burst_length);
+            burst_length = 0;
+            continue;
+        }
+
+        // Arrival as seen by this task: a backlog in the backend's queue counts as a burst
+        int64_t rx_time_us = esp_timer_get_time();
+        uint32_t burst_end = 0;
+        if (burst_length > 0 && rx_time_us - burst_last_us > CONFIG_ESP_CAN_RX_BURST_GAP_US) {
+            burst_end = burst_length;
+            burst_length = 0;
+        }
+        burst_length++;
+        burst_last_us = rx_time_us;
+
+        bool accepted = filter_match(&can_frame);
+        portENTER_CRITICAL(&filter_mux);
+        filter_stats.hw_accepted++;
+        if (!accepted) {
+            filter_stats.sw_rejected++;
+        }
+        portEXIT_CRITICAL(&filter_mux);
+
+        if (accepted) {
+            CAN_trace_hook_t hook = __atomic_load_n(&trace_hook, __ATOMIC_RELAXED);
+            if (hook != NULL) {
+                hook(&can_frame, rx_time_us, CAN_TRACE_RX);
             }
             
-            // Send to queue if configured
-            if (CAN_cfg.rx_queue != NULL) {
-                xQueueSendToBack(CAN_cfg.rx_queue, &can_frame, 0);
+            // Hand the frame to the consumer in this task, or send to queue if configured
+            if (rx_callback != NULL) {
+                rx_callback(&can_frame, rx_time_us, rx_callback_arg);
+            } else if (CAN_cfg.rx_queue != NULL) {
+                CAN_rx_enqueue(CAN_cfg.rx_queue, &can_frame);
             }
         }
+
+        // Bookkeeping after the frame has been handled, so it never delays a response
+        rx_account(1, burst_end);
     }
 }
 
-int CAN_init() {
-    // Get TWAI timing configuration based on speed
-    twai_timing_config_t t_config;
-    get_twai_timing(CAN_cfg.speed, &t_config);
+int CAN_rx_enqueue(QueueHandle_t queue, const void *item) {
+    bool sent = xQueueSendToBack(queue, item, 0) == pdTRUE;
+    UBaseType_t waiting = uxQueueMessagesWaiting(queue);
+    
+    portENTER_CRITICAL(&rx_mux);
+    if (!sent) {
+        rx_stats.queue_drops++;
+    }
+    if (waiting > rx_stats.queue_hwm) {
+        rx_stats.queue_hwm = waiting;
+    }
+    portEXIT_CRITICAL(&rx_mux);
     
-    // Configure TWAI general settings
-    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(
-        (gpio_num_t)CAN_cfg.tx_pin_id, 
-        (gpio_num_t)CAN_cfg.rx_pin_id, 
-        TWAI_MODE_NORMAL
-    );
-    g_config.alerts_enabled = TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED | TWAI_ALERT_ERR_PASS | 
-                              TWAI_ALERT_BUS_ERROR | TWAI_ALERT_TX_FAILED | TWAI_ALERT_TX_SUCCESS;
-
-    // Configure TWAI filter to accept all messages
-    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    return sent ? 0 : -1;
+}
+
+void CAN_get_rx_stats(CAN_rx_stats_t *stats) {
+    portENTER_CRITICAL(&rx_mux);
+    *stats = rx_stats;
+    portEXIT_CRITICAL(&rx_mux);
+    stats->driver_depth = CONFIG_ESP_CAN_RX_QUEUE_LEN;
+    stats->queue_depth = CONFIG_ESP_CAN_RX_APP_QUEUE_LEN;
+}
+
+// Backend selected in menuconfig
+static int default_backend(CAN_backend_t *b) {
+#if CONFIG_ESP_CAN_BACKEND_LOOPBACK
+    return CAN_backend_loopback(false, b);
+#elif CONFIG_ESP_CAN_BACKEND_SOCKETCAN
+    return CAN_backend_socketcan(CONFIG_ESP_CAN_SOCKETCAN_IFNAME, b);
+#else
+    CAN_backend_twai(&CAN_cfg, b);
+    return 0;
+#endif
+}
+
+int CAN_set_backend(const CAN_backend_t *b) {
+    if (alert_task_handle != NULL) {
+        return -1;
+    }
     
-    // Install TWAI driver
-    esp_err_t ret = twai_driver_install(&g_config, &t_config, &f_config);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to install TWAI driver: %s", esp_err_to_name(ret));
+    backend = *b;
+    return 0;
+}
+
+const CAN_backend_t *CAN_get_backend(void) {
+    return &backend;
+}
+
+int CAN_init() {
+    if (backend.ops == NULL && default_backend(&backend) != 0) {
+        ESP_LOGE(TAG, "Failed to create the CAN backend");
+        return -1;
+    }
+    if (open_backend() != 0) {
         return -1;
     }
     
-    // Start TWAI driver
-    ret = twai_start();
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to start TWAI driver: %s", esp_err_to_name(ret));
-        twai_driver_uninstall();
+    ESP_LOGI(TAG, "%s backend started", backend.ops->name);
+    
+    xTaskCreate(can_alert_task, "can_alert", 3072, NULL, 6, &alert_task_handle);
+    
+    // Create RX task if a consumer is configured
+    if (rx_callback != NULL || CAN_cfg.rx_queue != NULL) {
+        xTaskCreate(can_rx_task, "can_rx", 4096, NULL, 5, &rx_task_handle);
+    }
+    
+    return 0;
+}
+
+int CAN_set_rx_callback(CAN_rx_callback_t callback, void *arg) {
+    if (rx_task_handle != NULL) {
         return -1;
     }
     
-    ESP_LOGI(TAG, "TWAI driver started on TX:%d RX:%d at %d kbps", 
-             CAN_cfg.tx_pin_id, CAN_cfg.rx_pin_id, CAN_cfg.speed);
+    rx_callback = callback;
+    rx_callback_arg = arg;
+    return 0;
+}
+
+void CAN_set_trace_hook(CAN_trace_hook_t hook) {
+    __atomic_store_n(&trace_hook, hook, __ATOMIC_RELAXED);
+}
+
+int CAN_queue_frame(const CAN_frame_t *p_frame, const CAN_tx_options_t *options) {
+    int64_t now = esp_timer_get_time();
+    // Bulk traffic leaves room for responses
+    uint8_t limit = (options->tx_class == CAN_TX_BULK) ? TX_RING_SIZE - CONFIG_ESP_CAN_TX_BULK_RESERVE : TX_RING_SIZE;
     
-    // Create RX task if queue is configured
-    if (CAN_cfg.rx_queue != NULL) {
-        xTaskCreate(twai_rx_task, "twai_rx", 4096, NULL, 5, &rx_task_handle);
+    portENTER_CRITICAL(&tx_mux);
+    if (tx_count >= limit) {
+        tx_stats.full++;
+        portEXIT_CRITICAL(&tx_mux);
+        return -1;
+    }
+    tx_entry_t *e = tx_ring;
+    while (e->used) {
+        e++;
     }
+    e->frame = *p_frame;
+    e->queued_us = now;
+    e->deadline_us = now + (options->deadline_us ? options->deadline_us : CONFIG_ESP_CAN_TX_DEADLINE_MS * 1000);
+    e->key = tx_key(p_frame);
+    e->seq = tx_seq++;
+    e->callback = options->callback;
+    e->arg = options->arg;
+    e->tx_class = options->tx_class;
+    e->used = true;
+    tx_count++;
+    tx_stats.queued++;
+    portEXIT_CRITICAL(&tx_mux);
     
+    tx_kick();
     return 0;
 }
 
 int CAN_write_frame(const CAN_frame_t *p_frame) {
-    // Convert CAN frame to TWAI message
-    twai_message_t tx_msg = {
-        .identifier = p_frame->MsgID,
-        .data_length_code = p_frame->FIR.B.DLC,
-        .extd = (p_frame->FIR.B.FF == CAN_frame_ext) ? 1 : 0,
-        .rtr = (p_frame->FIR.B.RTR == CAN_RTR) ? 1 : 0,
-        .ss = 0,
-        .self = 0,
-        .dlc_non_comp = 0,
+    const CAN_tx_options_t options = {
+        .tx_class = CAN_TX_RESPONSE,
+        .deadline_us = CONFIG_ESP_CAN_TX_DEADLINE_MS * 1000,
     };
     
-    // Copy data
-    for (int i = 0; i < p_frame->FIR.B.DLC && i < 8; i++) {
-        tx_msg.data[i] = p_frame->data.u8[i];
+    if (CAN_queue_frame(p_frame, &options) != 0) {
+        ESP_LOGW(TAG, "Failed to transmit: TX ring full");
+        return -1;
     }
     
-    // Transmit message with 1 second timeout
-    esp_err_t ret = twai_transmit(&tx_msg, pdMS_TO_TICKS(1000));
-    if (ret != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to transmit: %s", esp_err_to_name(ret));
+    return 0;
+}
+
+int CAN_try_write_frame(const CAN_frame_t *p_frame) {
+    const CAN_tx_options_t options = {
+        .tx_class = CAN_TX_BULK,
+        .deadline_us = CONFIG_ESP_CAN_TX_BULK_DEADLINE_MS * 1000,
+    };
+    
+    return CAN_queue_frame(p_frame, &options);
+}
+
+int CAN_cancel(CAN_tx_callback_t callback, void *arg) {
+    int64_t now = esp_timer_get_time();
+    int cancelled = 0;
+
+    portENTER_CRITICAL(&tx_mux);
+    for (uint8_t i = 0; i < TX_RING_SIZE; i++) {
+        tx_entry_t *e = &tx_ring[i];
+        if (!e->used || e->callback != callback || e->arg != arg) {
+            continue;
+        }
+        if (i == tx_in_flight) {
+            // Already with the controller: it completes silently, or is
+            // dropped instead of repeated if the attempt fails
+            e->callback = NULL;
+            e->deadline_us = now;
+            continue;
+        }
+        e->used = false;
+        tx_count--;
+        cancelled++;
+    }
+    tx_stats.cancelled += cancelled;
+    portEXIT_CRITICAL(&tx_mux);
+    return cancelled;
+}
+
+void CAN_get_tx_stats(CAN_tx_stats_t *stats) {
+    portENTER_CRITICAL(&tx_mux);
+    *stats = tx_stats;
+    portEXIT_CRITICAL(&tx_mux);
+}
+
+void CAN_get_bus_stats(CAN_bus_stats_t *stats) {
+    portENTER_CRITICAL(&bus_mux);
+    *stats = bus_stats;
+    portEXIT_CRITICAL(&bus_mux);
+}
+
+size_t CAN_get_bus_events(CAN_bus_event_t *events, size_t max) {
+    portENTER_CRITICAL(&bus_mux);
+    size_t count = bus_event_count < CAN_BUS_EVENT_LOG ? bus_event_count : CAN_BUS_EVENT_LOG;
+    if (count > max) {
+        count = max;
+    }
+    for (size_t i = 0; i < count; i++) {
+        events[i] = bus_events[(bus_event_count - count + i) % CAN_BUS_EVENT_LOG];
+    }
+    portEXIT_CRITICAL(&bus_mux);
+    return count;
+}
+
+int CAN_set_filter(const uint32_t *ids, size_t count, bool extended) {
+    if (count > CAN_FILTER_MAX_IDS || (ids == NULL && count > 0)) {
         return -1;
     }
     
+    portENTER_CRITICAL(&filter_mux);
+    bool changed = count != filter_count || extended != filter_extended;
+    for (size_t i = 0; i < count; i++) {
+        changed |= ids[i] != filter_ids[i];
+        filter_ids[i] = ids[i];
+    }
+    filter_count = count;
+    filter_extended = extended;
+    filter_pending |= changed;
+    portEXIT_CRITICAL(&filter_mux);
+    
     return 0;
 }
 
+void CAN_get_filter_stats(CAN_filter_stats_t *stats) {
+    portENTER_CRITICAL(&filter_mux);
+    *stats = filter_stats;
+    portEXIT_CRITICAL(&filter_mux);
+}
+
 int CAN_stop() {
-    // Stop RX task
+    // Stop RX and alert tasks
     if (rx_task_handle != NULL) {
         vTaskDelete(rx_task_handle);
         rx_task_handle = NULL;
     }
-    
-    // Stop TWAI driver
-    esp_err_t ret = twai_stop();
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to stop TWAI: %s", esp_err_to_name(ret));
+    if (alert_task_handle != NULL) {
+        vTaskDelete(alert_task_handle);
+        alert_task_handle = NULL;
     }
     
-    // Uninstall TWAI driver
-    ret = twai_driver_uninstall();
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to uninstall TWAI: %s", esp_err_to_name(ret));
-        return -1;
-    }
+    backend.ops->close(backend.ctx);
     
-    ESP_LOGI(TAG, "TWAI driver stopped");
+    ESP_LOGI(TAG, "%s backend stopped", backend.ops->name);
     return 0;
 }
 
 void CAN_print_diagnostics(void) {
-    twai_status_info_t status_info;
+    CAN_backend_status_t status_info;
     
-    if (twai_get_status_info(&status_info) == ESP_OK) {
+    if (backend.ops != NULL && backend.ops->get_status(backend.ctx, &status_info) == 0) {
+        portENTER_CRITICAL(&bus_mux);
+        CAN_bus_state_t state = bus_stats.state;
+        portEXIT_CRITICAL(&bus_mux);
+        
         printf("\n========== CAN BUS DIAGNOSTICS ==========\n");
+        printf("Backend: %s\n", backend.ops->name);
         printf("State: ");
-        switch (status_info.state) {
-            case TWAI_STATE_RUNNING:
+        switch (state) {
+            case CAN_BUS_ACTIVE:
                 printf("RUNNING\n");
                 break;
-            case TWAI_STATE_BUS_OFF:
+            case CAN_BUS_WARNING:
+                printf("RUNNING (error warning)\n");
+                break;
+            case CAN_BUS_PASSIVE:
+                printf("RUNNING (error passive)\n");
+                break;
+            case CAN_BUS_OFF:
                 printf("BUS OFF (CRITICAL - Too many errors!)\n");
                 break;
-            case TWAI_STATE_RECOVERING:
+            case CAN_BUS_RECOVERING:
                 printf("RECOVERING\n");
                 break;
-            case TWAI_STATE_STOPPED:
-                printf("STOPPED\n");
-                break;
             default:
                 printf("UNKNOWN\n");
                 break;
@@ -236,11 +814,11 @@ void CAN_print_diagnostics(void) {
         printf("RX Error Counter: %lu\n", (unsigned long)status_info.rx_error_counter);
         printf("Messages in TX Queue: %lu\n", (unsigned long)status_info.msgs_to_tx);
         printf("Messages in RX Queue: %lu\n", (unsigned long)status_info.msgs_to_rx);
-        printf("TX Failed Count: %lu\n", (unsigned long)status_info.tx_failed_count);
-        printf("RX Missed Count: %lu\n", (unsigned long)status_info.rx_missed_count);
-        printf("RX Overrun Count: %lu\n", (unsigned long)status_info.rx_overrun_count);
-        printf("Arbitration Lost Count: %lu\n", (unsigned long)status_info.arb_lost_count);
-        printf("Bus Error Count: %lu\n", (unsigned long)status_info.bus_error_count);
+        printf("TX Failed Count: %lu\n", (unsigned long)status_info.tx_failed);
+        printf("RX Missed Count: %lu\n", (unsigned long)status_info.rx_missed);
+        printf("RX Overrun Count: %lu\n", (unsigned long)status_info.rx_overrun);
+        printf("Arbitration Lost Count: %lu\n", (unsigned long)status_info.arb_lost);
+        printf("Bus Error Count: %lu\n", (unsigned long)status_info.bus_errors);
         
         // Interpret error counters
         printf("\n--- DIAGNOSIS ---\n");
@@ -263,7 +841,7 @@ void CAN_print_diagnostics(void) {
             printf("✓ RX Error Counter: OK\n");
         }
         
-        if (status_info.state == TWAI_STATE_BUS_OFF) {
+        if (state == CAN_BUS_OFF) {
             printf("\n🔴 BUS OFF STATE - CAN controller has shut down!\n");
             printf("   This means too many consecutive errors occurred.\n");
             printf("   Fix hardware issues, then restart the device.\n");
@@ -0,0 +1,152 @@
+/**
+ * \file
+ * \brief In-process loopback backend, see CAN_backend.h
+ *
+ * Nothing leaves the process: received frames come from
+ * CAN_loopback_inject, transmitted frames go to the tap and, with echo,
+ * back into the receive queue. Every transmission succeeds at once.
+ */
+
+#include "CAN_backend.h"
+
+#include <stdlib.h>
+
+#include "freertos/event_groups.h"
+
+typedef struct {
+    QueueHandle_t rx;
+    EventGroupHandle_t events;
+    bool echo;
+    bool open;
+    CAN_loopback_tap_t tap;
+    void *tap_arg;
+    uint32_t rx_missed; // since open
+} loopback_t;
+
+// Queue a frame for loopback_receive, counting it as missed on a full queue
+static bool loopback_deliver(loopback_t *lb, const CAN_frame_t *frame) {
+    if (xQueueSendToBack(lb->rx, frame, 0) != pdTRUE) {
+        __atomic_add_fetch(&lb->rx_missed, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+static int loopback_open(void *ctx, const uint32_t *ids, size_t count, bool extended, CAN_filter_stats_t *hw) {
+    loopback_t *lb = ctx;
+
+    // No filter in front of the queue, CAN.c filters in software
+    hw->hw_code = 0;
+    hw->hw_mask = UINT32_MAX;
+    hw->hw_dual = false;
+    hw->hw_width = UINT32_MAX;
+
+    lb->rx_missed = 0;
+    xEventGroupClearBits(lb->events, CAN_EVENT_ALL);
+    __atomic_store_n(&lb->open, true, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static void loopback_close(void *ctx) {
+    loopback_t *lb = ctx;
+
+    __atomic_store_n(&lb->open, false, __ATOMIC_SEQ_CST);
+    xQueueReset(lb->rx);
+}
+
+static int loopback_transmit(void *ctx, const CAN_frame_t *frame) {
+    loopback_t *lb = ctx;
+
+    if (!__atomic_load_n(&lb->open, __ATOMIC_SEQ_CST)) {
+        return -1;
+    }
+    if (lb->tap != NULL) {
+        lb->tap(frame, lb->tap_arg);
+    }
+    if (lb->echo) {
+        loopback_deliver(lb, frame);
+    }
+    xEventGroupSetBits(lb->events, CAN_EVENT_TX_DONE);
+    return 0;
+}
+
+static int loopback_receive(void *ctx, CAN_frame_t *frame, uint32_t timeout_ms) {
+    loopback_t *lb = ctx;
+
+    return xQueueReceive(lb->rx, frame, pdMS_TO_TICKS(timeout_ms)) == pdTRUE ? 0 : -1;
+}
+
+static int loopback_wait_events(void *ctx, uint32_t *events, uint32_t timeout_ms) {
+    loopback_t *lb = ctx;
+
+    if (!__atomic_load_n(&lb->open, __ATOMIC_SEQ_CST)) {
+        *events = 0;
+        return -1;
+    }
+    *events = xEventGroupWaitBits(lb->events, CAN_EVENT_ALL, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeout_ms)) & CAN_EVENT_ALL;
+    return 0;
+}
+
+static int loopback_get_status(void *ctx, CAN_backend_status_t *status) {
+    loopback_t *lb = ctx;
+
+    *status = (CAN_backend_status_t){
+        .msgs_to_rx = uxQueueMessagesWaiting(lb->rx),
+        .rx_missed = __atomic_load_n(&lb->rx_missed, __ATOMIC_RELAXED),
+    };
+    return 0;
+}
+
+static const CAN_backend_ops_t loopback_ops = {
+    .name = "loopback",
+    .open = loopback_open,
+    .close = loopback_close,
+    .transmit = loopback_transmit,
+    .receive = loopback_receive,
+    .wait_events = loopback_wait_events,
+    .get_status = loopback_get_status,
+};
+
+int CAN_backend_loopback(bool echo, CAN_backend_t *backend) {
+    loopback_t *lb = calloc(1, sizeof(loopback_t));
+    if (lb == NULL) {
+        return -1;
+    }
+
+    lb->rx = xQueueCreate(CONFIG_ESP_CAN_RX_QUEUE_LEN, sizeof(CAN_frame_t));
+    lb->events = xEventGroupCreate();
+    if (lb->rx == NULL || lb->events == NULL) {
+        if (lb->rx != NULL) {
+            vQueueDelete(lb->rx);
+        }
+        if (lb->events != NULL) {
+            vEventGroupDelete(lb->events);
+        }
+        free(lb);
+        return -1;
+    }
+    lb->echo = echo;
+
+    backend->ops = &loopback_ops;
+    backend->ctx = lb;
+    return 0;
+}
+
+int CAN_loopback_inject(const CAN_backend_t *backend, const CAN_frame_t *frame) {
+    loopback_t *lb = backend->ctx;
+
+    if (backend->ops != &loopback_ops || !__atomic_load_n(&lb->open, __ATOMIC_SEQ_CST)) {
+        return -1;
+    }
+    return loopback_deliver(lb, frame) ? 0 : -1;
+}
+
+void CAN_loopback_set_tap(const CAN_backend_t *backend, CAN_loopback_tap_t tap, void *arg) {
+    loopback_t *lb = backend->ctx;
+
+    if (backend->ops != &loopback_ops) {
+        return;
+    }
+    lb->tap_arg = arg;
+    lb->tap = tap;
+}
@@ -0,0 +1,254 @@
+/**
+ * \file
+ * \brief SocketCAN backend for the linux target, see CAN_backend.h
+ *
+ * A raw CAN socket on a Linux interface (can0, vcan0, ...). The kernel
+ * filters the requested IDs exactly and restarts a bus-off controller by
+ * itself (`ip link set can0 type can restart-ms ...`); its error frames
+ * are turned into backend events. A frame counts as transmitted once the
+ * kernel has accepted it.
+ */
+
+#include "CAN_backend.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/error.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+
+static const char *TAG = "CAN_socketcan";
+
+typedef struct {
+    char ifname[IF_NAMESIZE];
+    int fd; // -1 while closed
+    EventGroupHandle_t events;
+    uint32_t rx_missed; // dropped by the socket since open
+    uint32_t tx_failed;
+} socketcan_t;
+
+static int socketcan_open(void *ctx, const uint32_t *ids, size_t count, bool extended, CAN_filter_stats_t *hw) {
+    socketcan_t *sc = ctx;
+
+    int fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "socket: %s", strerror(errno));
+        return -1;
+    }
+
+    struct sockaddr_can addr = { .can_family = AF_CAN, .can_ifindex = (int)if_nametoindex(sc->ifname) };
+    if (addr.can_ifindex == 0) {
+        ESP_LOGE(TAG, "No interface %s", sc->ifname);
+        close(fd);
+        return -1;
+    }
+
+    // Exact kernel filter; no filters at all receives everything
+    if (count > 0) {
+        struct can_filter filters[CAN_FILTER_MAX_IDS];
+        for (size_t i = 0; i < count; i++) {
+            filters[i].can_id = extended ? (ids[i] | CAN_EFF_FLAG) : ids[i];
+            filters[i].can_mask = (extended ? CAN_EFF_MASK : CAN_SFF_MASK) | CAN_EFF_FLAG;
+        }
+        setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, count * sizeof(filters[0]));
+    }
+    can_err_mask_t err_mask = CAN_ERR_CRTL | CAN_ERR_BUSOFF | CAN_ERR_RESTARTED;
+    setsockopt(fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &err_mask, sizeof(err_mask));
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        ESP_LOGE(TAG, "bind %s: %s", sc->ifname, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    hw->hw_code = 0;
+    hw->hw_mask = 0;
+    hw->hw_dual = false;
+    hw->hw_width = count > 0 ? (uint32_t)count : UINT32_MAX;
+
+    sc->rx_missed = 0;
+    sc->tx_failed = 0;
+    xEventGroupClearBits(sc->events, CAN_EVENT_ALL);
+    __atomic_store_n(&sc->fd, fd, __ATOMIC_SEQ_CST);
+    ESP_LOGI(TAG, "SocketCAN on %s, %lu ID(s) accepted", sc->ifname, (unsigned long)hw->hw_width);
+    return 0;
+}
+
+static void socketcan_close(void *ctx) {
+    socketcan_t *sc = ctx;
+
+    int fd = __atomic_exchange_n(&sc->fd, -1, __ATOMIC_SEQ_CST);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static int socketcan_transmit(void *ctx, const CAN_frame_t *frame) {
+    socketcan_t *sc = ctx;
+    struct can_frame cf = {0};
+
+    int fd = __atomic_load_n(&sc->fd, __ATOMIC_SEQ_CST);
+    if (fd < 0) {
+        return -1;
+    }
+
+    cf.can_id = frame->MsgID;
+    if (frame->FIR.B.FF == CAN_frame_ext) {
+        cf.can_id |= CAN_EFF_FLAG;
+    }
+    if (frame->FIR.B.RTR == CAN_RTR) {
+        cf.can_id |= CAN_RTR_FLAG;
+    }
+    cf.can_dlc = frame->FIR.B.DLC > 8 ? 8 : frame->FIR.B.DLC;
+    memcpy(cf.data, frame->data.u8, cf.can_dlc);
+
+    if (send(fd, &cf, sizeof(cf), MSG_DONTWAIT) != sizeof(cf)) {
+        // Interface queue full or down: report a failed attempt, CAN.c retries
+        __atomic_add_fetch(&sc->tx_failed, 1, __ATOMIC_RELAXED);
+        xEventGroupSetBits(sc->events, CAN_EVENT_TX_FAILED);
+        return 0;
+    }
+    xEventGroupSetBits(sc->events, CAN_EVENT_TX_DONE);
+    return 0;
+}
+
+// Turn a kernel error frame into backend events
+static void socketcan_error_frame(socketcan_t *sc, const struct can_frame *cf) {
+    uint32_t events = 0;
+
+    if (cf->can_id & CAN_ERR_BUSOFF) {
+        events |= CAN_EVENT_BUS_OFF;
+    }
+    if (cf->can_id & CAN_ERR_RESTARTED) {
+        events |= CAN_EVENT_RECOVERED;
+    }
+    if (cf->can_id & CAN_ERR_CRTL) {
+        uint8_t ctrl = cf->data[1];
+        if (ctrl & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING)) {
+            events |= CAN_EVENT_ABOVE_WARN;
+        }
+        if (ctrl & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE)) {
+            events |= CAN_EVENT_ERR_PASSIVE;
+        }
+#ifdef CAN_ERR_CRTL_ACTIVE
+        if (ctrl & CAN_ERR_CRTL_ACTIVE) {
+            events |= CAN_EVENT_ERR_ACTIVE | CAN_EVENT_BELOW_WARN;
+        }
+#endif
+    }
+    if (events != 0) {
+        xEventGroupSetBits(sc->events, events);
+    }
+}
+
+static int socketcan_receive(void *ctx, CAN_frame_t *frame, uint32_t timeout_ms) {
+    socketcan_t *sc = ctx;
+    struct can_frame cf;
+    char control[CMSG_SPACE(sizeof(uint32_t))];
+    struct iovec iov = { .iov_base = &cf, .iov_len = sizeof(cf) };
+
+    int fd = __atomic_load_n(&sc->fd, __ATOMIC_SEQ_CST);
+    if (fd < 0) {
+        vTaskDelay(pdMS_TO_TICKS(timeout_ms));
+        return -1;
+    }
+
+    while (1) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, (int)timeout_ms) <= 0) {
+            return -1;
+        }
+
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        if (recvmsg(fd, &msg, MSG_DONTWAIT) != sizeof(cf)) {
+            return -1;
+        }
+
+        // Socket drop counter, attached to every frame
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t dropped;
+                memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+                __atomic_store_n(&sc->rx_missed, dropped, __ATOMIC_RELAXED);
+            }
+        }
+
+        if (cf.can_id & CAN_ERR_FLAG) {
+            socketcan_error_frame(sc, &cf);
+            continue;
+        }
+
+        frame->MsgID = cf.can_id & ((cf.can_id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+        frame->FIR.B.FF = (cf.can_id & CAN_EFF_FLAG) ? CAN_frame_ext : CAN_frame_std;
+        frame->FIR.B.RTR = (cf.can_id & CAN_RTR_FLAG) ? CAN_RTR : CAN_no_RTR;
+        frame->FIR.B.DLC = cf.can_dlc;
+        memcpy(frame->data.u8, cf.data, 8);
+        return 0;
+    }
+}
+
+static int socketcan_wait_events(void *ctx, uint32_t *events, uint32_t timeout_ms) {
+    socketcan_t *sc = ctx;
+
+    if (__atomic_load_n(&sc->fd, __ATOMIC_SEQ_CST) < 0) {
+        *events = 0;
+        return -1;
+    }
+    *events = xEventGroupWaitBits(sc->events, CAN_EVENT_ALL, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeout_ms)) & CAN_EVENT_ALL;
+    return 0;
+}
+
+static int socketcan_get_status(void *ctx, CAN_backend_status_t *status) {
+    socketcan_t *sc = ctx;
+
+    *status = (CAN_backend_status_t){
+        .rx_missed = __atomic_load_n(&sc->rx_missed, __ATOMIC_RELAXED),
+        .tx_failed = __atomic_load_n(&sc->tx_failed, __ATOMIC_RELAXED),
+    };
+    return 0;
+}
+
+static const CAN_backend_ops_t socketcan_ops = {
+    .name = "SocketCAN",
+    .open = socketcan_open,
+    .close = socketcan_close,
+    .transmit = socketcan_transmit,
+    .receive = socketcan_receive,
+    .wait_events = socketcan_wait_events,
+    .get_status = socketcan_get_status,
+};
+
+int CAN_backend_socketcan(const char *ifname, CAN_backend_t *backend) {
+    socketcan_t *sc = calloc(1, sizeof(socketcan_t));
+    if (sc == NULL) {
+        return -1;
+    }
+
+    sc->events = xEventGroupCreate();
+    if (sc->events == NULL) {
+        free(sc);
+        return -1;
+    }
+    strncpy(sc->ifname, ifname, sizeof(sc->ifname) - 1);
+    sc->fd = -1;
+
+    backend->ops = &socketcan_ops;
+    backend->ctx = sc;
+    return 0;
+}
@@ -0,0 +1,280 @@
+/**
+ * \file
+ * \brief TWAI controller backend, see CAN_backend.h
+ */
+
+#include "CAN_backend.h"
+
+#include "driver/twai.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+
+static const char *TAG = "CAN_twai";
+
+// Convert CAN speed enum to TWAI timing config
+static void get_twai_timing(CAN_speed_t speed, twai_timing_config_t *t_config) {
+    switch (speed) {
+        case CAN_SPEED_100KBPS:
+            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_100KBITS();
+            break;
+        case CAN_SPEED_125KBPS:
+            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_125KBITS();
+            break;
+        case CAN_SPEED_250KBPS:
+            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_250KBITS();
+            break;
+        case CAN_SPEED_500KBPS:
+            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_500KBITS();
+            break;
+        case CAN_SPEED_800KBPS:
+            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_800KBITS();
+            break;
+        case CAN_SPEED_1000KBPS:
+            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_1MBITS();
+            break;
+        default:
+            *t_config = (twai_timing_config_t)TWAI_TIMING_CONFIG_500KBITS();
+            break;
+    }
+
+    // Disable triple sampling temporarily for testing
+    t_config->triple_sampling = false;
+}
+
+// Tightest code/don't care pair matching all of ids[0 .. count)
+static void filter_group(const uint32_t *ids, size_t count, uint32_t *code, uint32_t *dont_care) {
+    *dont_care = 0;
+    for (size_t i = 1; i < count; i++) {
+        *dont_care |= ids[i] ^ ids[0];
+    }
+    *code = ids[0] & ~*dont_care;
+}
+
+// Choose between one filter over all IDs and two filters over a split of the
+// sorted IDs, whichever lets fewer IDs through. Returns that number of IDs.
+static uint32_t filter_compute(const uint32_t *ids, size_t count, bool extended, twai_filter_config_t *f_config) {
+    uint32_t sorted[CAN_FILTER_MAX_IDS];
+    uint32_t code, dont_care;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t j = i;
+        while (j > 0 && sorted[j - 1] > ids[i]) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = ids[i];
+    }
+
+    filter_group(sorted, count, &code, &dont_care);
+    uint64_t single_width = 1ULL << __builtin_popcount(dont_care);
+
+    // Single filter: ID in the top bits, RTR and data bytes don't care
+    int id_shift = extended ? 3 : 21;
+    f_config->single_filter = true;
+    f_config->acceptance_code = code << id_shift;
+    f_config->acceptance_mask = (dont_care << id_shift) | ((1U << id_shift) - 1);
+
+    // Dual filters compare the whole 11-bit ID, but only ID[28:13] of a 29-bit one
+    int key_shift = extended ? 13 : 0;
+    uint32_t keys[CAN_FILTER_MAX_IDS];
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = sorted[i] >> key_shift;
+    }
+
+    uint64_t best_width = single_width;
+    for (size_t split = 1; split < count; split++) {
+        uint32_t code1, dont_care1, code2, dont_care2;
+        filter_group(keys, split, &code1, &dont_care1);
+        filter_group(&keys[split], count - split, &code2, &dont_care2);
+
+        uint64_t width = ((1ULL << __builtin_popcount(dont_care1)) + (1ULL << __builtin_popcount(dont_care2))) << key_shift;
+        if (width >= best_width) {
+            continue;
+        }
+        best_width = width;
+        f_config->single_filter = false;
+        if (extended) {
+            f_config->acceptance_code = (code1 << 16) | code2;
+            f_config->acceptance_mask = (dont_care1 << 16) | dont_care2;
+        } else {
+            // Filter 1 holds the ID in [31:21], filter 2 in [15:5]; RTR and data bits don't care
+            f_config->acceptance_code = (code1 << 21) | (code2 << 5);
+            f_config->acceptance_mask = (dont_care1 << 21) | 0x1F0000 | (dont_care2 << 5) | 0x1F;
+        }
+    }
+
+    return (uint32_t)best_width;
+}
+
+// Install and start the driver
+static int twai_backend_open(void *ctx, const uint32_t *ids, size_t count, bool extended, CAN_filter_stats_t *hw) {
+    const CAN_device_t *cfg = ctx;
+
+    // Get TWAI timing configuration based on speed
+    twai_timing_config_t t_config;
+    get_twai_timing(cfg->speed, &t_config);
+
+    // Configure TWAI general settings
+    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(
+        (gpio_num_t)cfg->tx_pin_id,
+        (gpio_num_t)cfg->rx_pin_id,
+        TWAI_MODE_NORMAL
+    );
+    g_config.rx_queue_len = CONFIG_ESP_CAN_RX_QUEUE_LEN;
+    g_config.alerts_enabled = TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED | TWAI_ALERT_ERR_PASS |
+                              TWAI_ALERT_ERR_ACTIVE | TWAI_ALERT_ABOVE_ERR_WARN | TWAI_ALERT_BELOW_ERR_WARN |
+                              TWAI_ALERT_BUS_ERROR | TWAI_ALERT_TX_FAILED | TWAI_ALERT_TX_SUCCESS;
+
+    // Accept all messages unless the IDs of interest are known
+    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    uint32_t width = UINT32_MAX;
+    if (count > 0) {
+        width = filter_compute(ids, count, extended, &f_config);
+    }
+    hw->hw_code = f_config.acceptance_code;
+    hw->hw_mask = f_config.acceptance_mask;
+    hw->hw_dual = !f_config.single_filter;
+    hw->hw_width = width;
+
+    // Install TWAI driver
+    esp_err_t ret = twai_driver_install(&g_config, &t_config, &f_config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to install TWAI driver: %s", esp_err_to_name(ret));
+        return -1;
+    }
+
+    // Start TWAI driver
+    ret = twai_start();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start TWAI driver: %s", esp_err_to_name(ret));
+        twai_driver_uninstall();
+        return -1;
+    }
+
+    ESP_LOGI(TAG, "TWAI driver started on TX:%d RX:%d at %d kbps",
+             cfg->tx_pin_id, cfg->rx_pin_id, cfg->speed);
+    ESP_LOGI(TAG, "TWAI filter %s code 0x%08lx mask 0x%08lx, %lu ID(s) accepted",
+             f_config.single_filter ? "single" : "dual", (unsigned long)f_config.acceptance_code,
+             (unsigned long)f_config.acceptance_mask, (unsigned long)width);
+    return 0;
+}
+
+static void twai_backend_close(void *ctx) {
+    twai_stop();
+    twai_driver_uninstall();
+}
+
+static int twai_backend_transmit(void *ctx, const CAN_frame_t *frame) {
+    twai_message_t tx_msg = {0};
+
+    tx_msg.identifier = frame->MsgID;
+    tx_msg.data_length_code = frame->FIR.B.DLC;
+    tx_msg.extd = (frame->FIR.B.FF == CAN_frame_ext) ? 1 : 0;
+    tx_msg.rtr = (frame->FIR.B.RTR == CAN_RTR) ? 1 : 0;
+    // Single shot: CAN.c repeats failed attempts and can give up at the deadline
+    tx_msg.ss = 1;
+
+    // Copy data
+    for (int i = 0; i < frame->FIR.B.DLC && i < 8; i++) {
+        tx_msg.data[i] = frame->data.u8[i];
+    }
+
+    return twai_transmit(&tx_msg, 0) == ESP_OK ? 0 : -1;
+}
+
+static int twai_backend_receive(void *ctx, CAN_frame_t *frame, uint32_t timeout_ms) {
+    twai_message_t rx_msg;
+
+    if (twai_receive(&rx_msg, pdMS_TO_TICKS(timeout_ms)) != ESP_OK) {
+        return -1;
+    }
+
+    // Convert TWAI message to CAN frame format
+    frame->MsgID = rx_msg.identifier;
+    frame->FIR.B.DLC = rx_msg.data_length_code;
+    frame->FIR.B.FF = rx_msg.extd ? CAN_frame_ext : CAN_frame_std;
+    frame->FIR.B.RTR = rx_msg.rtr ? CAN_RTR : CAN_no_RTR;
+
+    // Copy data
+    for (int i = 0; i < rx_msg.data_length_code && i < 8; i++) {
+        frame->data.u8[i] = rx_msg.data[i];
+    }
+    return 0;
+}
+
+static int twai_backend_wait_events(void *ctx, uint32_t *events, uint32_t timeout_ms) {
+    static const struct {
+        uint32_t alert;
+        uint32_t event;
+    } map[] = {
+        { TWAI_ALERT_TX_SUCCESS, CAN_EVENT_TX_DONE },
+        { TWAI_ALERT_TX_FAILED, CAN_EVENT_TX_FAILED },
+        { TWAI_ALERT_ABOVE_ERR_WARN, CAN_EVENT_ABOVE_WARN },
+        { TWAI_ALERT_ERR_PASS, CAN_EVENT_ERR_PASSIVE },
+        { TWAI_ALERT_BUS_OFF, CAN_EVENT_BUS_OFF },
+        { TWAI_ALERT_BUS_RECOVERED, CAN_EVENT_RECOVERED },
+        { TWAI_ALERT_ERR_ACTIVE, CAN_EVENT_ERR_ACTIVE },
+        { TWAI_ALERT_BELOW_ERR_WARN, CAN_EVENT_BELOW_WARN },
+    };
+    uint32_t alerts = 0;
+
+    *events = 0;
+    esp_err_t ret = twai_read_alerts(&alerts, pdMS_TO_TICKS(timeout_ms));
+    if (ret == ESP_ERR_INVALID_STATE) {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(map) / sizeof(map[0]); i++) {
+        if (alerts & map[i].alert) {
+            *events |= map[i].event;
+        }
+    }
+    return 0;
+}
+
+static int twai_backend_recover(void *ctx) {
+    return twai_initiate_recovery() == ESP_OK ? 0 : -1;
+}
+
+static int twai_backend_restart(void *ctx) {
+    esp_err_t ret = twai_start();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to restart after recovery: %s", esp_err_to_name(ret));
+        return -1;
+    }
+    return 0;
+}
+
+static int twai_backend_get_status(void *ctx, CAN_backend_status_t *status) {
+    twai_status_info_t info;
+
+    if (twai_get_status_info(&info) != ESP_OK) {
+        return -1;
+    }
+    status->msgs_to_tx = info.msgs_to_tx;
+    status->msgs_to_rx = info.msgs_to_rx;
+    status->tx_error_counter = info.tx_error_counter;
+    status->rx_error_counter = info.rx_error_counter;
+    status->tx_failed = info.tx_failed_count;
+    status->rx_missed = info.rx_missed_count;
+    status->rx_overrun = info.rx_overrun_count;
+    status->arb_lost = info.arb_lost_count;
+    status->bus_errors = info.bus_error_count;
+    return 0;
+}
+
+static const CAN_backend_ops_t twai_backend_ops = {
+    .name = "TWAI",
+    .open = twai_backend_open,
+    .close = twai_backend_close,
+    .transmit = twai_backend_transmit,
+    .receive = twai_backend_receive,
+    .wait_events = twai_backend_wait_events,
+    .recover = twai_backend_recover,
+    .restart = twai_backend_restart,
+    .get_status = twai_backend_get_status,
+};
+
+void CAN_backend_twai(const CAN_device_t *cfg, CAN_backend_t *backend) {
+    backend->ops = &twai_backend_ops;
+    backend->ctx = (void *)cfg;
+}
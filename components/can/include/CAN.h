@@ -29,9 +29,14 @@
 #ifndef __DRIVERS_CAN_H__
 #define __DRIVERS_CAN_H__
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "CAN_config.h"
 
+/** \brief Most IDs a receive filter can be set up for, see CAN_set_filter */
+#define CAN_FILTER_MAX_IDS 16
+
 /**
  * \brief CAN frame type (standard/extended)
  */
@@ -70,6 +75,147 @@ typedef struct {
 	} data;
 } CAN_frame_t;
 
+/** \brief Receive filter counters and the hardware filter in use */
+typedef struct {
+	uint32_t hw_accepted; /**< \brief Frames let through by the hardware filter */
+	uint32_t sw_rejected; /**< \brief Of those, frames dropped by the software filter */
+	uint32_t hw_code;     /**< \brief TWAI acceptance code */
+	uint32_t hw_mask;     /**< \brief TWAI acceptance mask, set bits are don't care */
+	uint32_t hw_width;    /**< \brief Number of IDs the hardware filter accepts */
+	bool hw_dual;         /**< \brief Dual filter mode */
+} CAN_filter_stats_t;
+
+/** \brief Outcome of a queued transmission */
+typedef enum {
+	CAN_TX_DONE = 0,   /**< \brief Frame is on the wire */
+	CAN_TX_EXPIRED = 1 /**< \brief Deadline passed before the frame could be sent */
+} CAN_tx_status_t;
+
+/** \brief Transmission class, responses always go first */
+typedef enum {
+	CAN_TX_RESPONSE = 0, /**< \brief Answers to a request */
+	CAN_TX_BULK = 1      /**< \brief Background traffic, e.g. a trace replay, sent in queue order */
+} CAN_tx_class_t;
+
+/**
+ * \brief Transmit completion callback, called from the CAN alert task
+ *
+ * \param	frame	Transmitted (or dropped) frame
+ * \param	status	See #CAN_tx_status_t
+ * \param	latency_us	Time from CAN_queue_frame to the end of transmission (or the drop)
+ * \param	arg	Argument given with the frame
+ */
+typedef void (*CAN_tx_callback_t)(const CAN_frame_t *frame, CAN_tx_status_t status, uint32_t latency_us, void *arg);
+
+/** \brief Options for CAN_queue_frame */
+typedef struct {
+	CAN_tx_class_t tx_class;    /**< \brief Transmission class */
+	uint32_t deadline_us;       /**< \brief Drop the frame if not sent within this time, 0 CONFIG_ESP_CAN_TX_DEADLINE_MS */
+	CAN_tx_callback_t callback; /**< \brief Optional completion callback */
+	void *arg;                  /**< \brief Passed to the callback */
+} CAN_tx_options_t;
+
+/** \brief Transmit counters */
+typedef struct {
+	uint32_t queued;    /**< \brief Frames accepted into the TX ring */
+	uint32_t sent;      /**< \brief Frames transmitted */
+	uint32_t retries;   /**< \brief Attempts that failed and were repeated */
+	uint32_t expired;   /**< \brief Frames dropped at their deadline */
+	uint32_t cancelled; /**< \brief Frames dropped by CAN_cancel */
+	uint32_t full;      /**< \brief Frames refused because the ring was full */
+	uint32_t last_us;   /**< \brief Queue-to-wire latency of the last frame */
+	uint32_t max_us;    /**< \brief Largest queue-to-wire latency */
+	uint64_t total_us;  /**< \brief Sum of all queue-to-wire latencies */
+} CAN_tx_stats_t;
+
+/** \brief Burst histogram bins: bursts of 1, 2, 3-4, 5-8, 9-16, 17-32 and more frames */
+#define CAN_RX_BURST_BINS 7
+
+/** \brief Receive counters, from the controller to the application queue */
+typedef struct {
+	uint32_t received;      /**< \brief Frames taken from the driver */
+	uint32_t hw_overruns;   /**< \brief Frames lost in the controller's RX FIFO */
+	uint32_t driver_missed; /**< \brief Frames lost on a full driver RX queue */
+	uint32_t driver_hwm;    /**< \brief Most frames seen waiting in the driver RX queue */
+	uint32_t driver_depth;  /**< \brief Driver RX queue length */
+	uint32_t queue_drops;   /**< \brief Frames lost on a full application queue, see CAN_rx_enqueue */
+	uint32_t queue_hwm;     /**< \brief Most frames seen waiting in the application queue */
+	uint32_t queue_depth;   /**< \brief Application queue length */
+	uint32_t bursts[CAN_RX_BURST_BINS]; /**< \brief Bursts of frames less than CONFIG_ESP_CAN_RX_BURST_GAP_US apart, by length */
+} CAN_rx_stats_t;
+
+/** \brief Controller error state */
+typedef enum {
+	CAN_BUS_ACTIVE = 0,    /**< \brief Error active, the normal state */
+	CAN_BUS_WARNING = 1,   /**< \brief An error counter is above the warning limit (96) */
+	CAN_BUS_PASSIVE = 2,   /**< \brief Error passive, an error counter is above 127 */
+	CAN_BUS_OFF = 3,       /**< \brief Bus off, waiting for the recovery backoff */
+	CAN_BUS_RECOVERING = 4 /**< \brief Bus off, recovery in progress */
+} CAN_bus_state_t;
+
+/** \brief Bus state transitions kept, see CAN_get_bus_events */
+#define CAN_BUS_EVENT_LOG 16
+
+/** \brief Bus state transition */
+typedef struct {
+	int64_t time_us;       /**< \brief esp_timer time of the transition */
+	CAN_bus_state_t state; /**< \brief State entered */
+} CAN_bus_event_t;
+
+/** \brief Bus error and recovery counters */
+typedef struct {
+	CAN_bus_state_t state;     /**< \brief Current state */
+	uint32_t error_passive;    /**< \brief Times the controller went error passive */
+	uint32_t bus_off;          /**< \brief Times the controller went bus off */
+	uint32_t recoveries;       /**< \brief Completed bus-off recoveries */
+	uint32_t backoff_ms;       /**< \brief Delay before the last recovery */
+	uint32_t recover_last_us;  /**< \brief Bus off to running again, last recovery */
+	uint32_t recover_max_us;   /**< \brief Slowest recovery */
+	uint64_t recover_total_us; /**< \brief Sum of all recovery times */
+} CAN_bus_stats_t;
+
+/**
+ * \brief Receive callback, see CAN_set_rx_callback
+ *
+ * \param	frame	Received frame, only valid during the call
+ * \param	rx_time_us	esp_timer time the driver handed the frame over
+ * \param	arg	Argument given to CAN_set_rx_callback
+ */
+typedef void (*CAN_rx_callback_t)(const CAN_frame_t *frame, int64_t rx_time_us, void *arg);
+
+/** \brief Direction of a frame passed to the trace hook */
+typedef enum {
+	CAN_TRACE_RX = 0, /**< Received and accepted by the filter */
+	CAN_TRACE_TX = 1  /**< Transmitted on the bus */
+} CAN_trace_dir_t;
+
+/**
+ * \brief Trace hook, see CAN_set_trace_hook
+ *
+ * \param	frame	Frame, only valid during the call
+ * \param	time_us	esp_timer time of reception or end of transmission
+ * \param	dir	Direction of the frame
+ */
+typedef void (*CAN_trace_hook_t)(const CAN_frame_t *frame, int64_t time_us, CAN_trace_dir_t dir);
+
+/**
+ * \brief Queue a received frame (or an item built from it) without blocking
+ *
+ * Counts the frame as dropped when the queue is full and tracks the queue's
+ * high-water mark, see #CAN_rx_stats_t. Used for CAN_cfg.rx_queue, and by
+ * receive callbacks that hand frames to another task.
+ *
+ * \param	queue	Queue of CONFIG_ESP_CAN_RX_APP_QUEUE_LEN entries
+ * \param	item	Item to copy into the queue
+ * \return  0 Item has been queued, -1 the queue is full
+ */
+int CAN_rx_enqueue(QueueHandle_t queue, const void *item);
+
+/**
+ * \brief Read the receive counters
+ */
+void CAN_get_rx_stats(CAN_rx_stats_t *stats);
+
 /**
  * \brief Initialize the CAN Module
  *
@@ -78,13 +224,120 @@ typedef struct {
 int CAN_init(void);
 
 /**
- * \brief Send a can frame
+ * \brief Dispatch received frames to a callback instead of CAN_cfg.rx_queue
+ *
+ * The callback runs in the CAN RX task for every accepted frame, so the
+ * frame is handled without a queue copy and a second task switch. It must
+ * not block for long; frames arriving meanwhile wait in the driver.
+ *
+ * \param	callback	Called with every received frame
+ * \param	arg	Passed to the callback
+ * \return  0 Callback has been set, -1 CAN_init has already been called
+ */
+int CAN_set_rx_callback(CAN_rx_callback_t callback, void *arg);
+
+/**
+ * \brief Pass every received and every transmitted frame to a hook
+ *
+ * Received frames are traced in the CAN RX task before they are handled,
+ * transmitted ones in the CAN alert task, so the hook may run on two tasks
+ * at once and must neither block nor take long. May be called at any time;
+ * without a hook (NULL) tracing costs one test per frame.
+ *
+ * \param	hook	Called with every frame, NULL to stop tracing
+ */
+void CAN_set_trace_hook(CAN_trace_hook_t hook);
+
+/**
+ * \brief Queue a can frame for transmission without blocking
+ *
+ * Frames wait in a ring and are handed to the controller one at a time:
+ * responses before bulk traffic, responses by CAN ID the way arbitration
+ * would order them, bulk traffic and responses of equal ID in the order
+ * they were queued. A failed attempt is
+ * repeated until the frame's deadline passes; every frame has one.
+ *
+ * \param	p_frame	Pointer to the frame to be send, see #CAN_frame_t
+ * \param	options	Class, deadline and completion callback, see #CAN_tx_options_t
+ * \return  0 Frame has been queued, -1 the ring is full
+ */
+int CAN_queue_frame(const CAN_frame_t *p_frame, const CAN_tx_options_t *options);
+
+/**
+ * \brief Send a can frame as a response
+ *
+ * Queues the frame with CONFIG_ESP_CAN_TX_DEADLINE_MS, see CAN_queue_frame.
  *
  * \param	p_frame	Pointer to the frame to be send, see #CAN_frame_t
- * \return  0 Frame has been written to the module
+ * \return  0 Frame has been queued
  */
 int CAN_write_frame(const CAN_frame_t *p_frame);
 
+/**
+ * \brief Queue a can frame as bulk traffic
+ *
+ * Queues the frame with CONFIG_ESP_CAN_TX_BULK_DEADLINE_MS, see CAN_queue_frame.
+ *
+ * \param	p_frame	Pointer to the frame to be send, see #CAN_frame_t
+ * \return  0 Frame has been queued, -1 the ring has no room for bulk traffic
+ */
+int CAN_try_write_frame(const CAN_frame_t *p_frame);
+
+/**
+ * \brief Drop the queued frames of a sender
+ *
+ * Every frame queued with this callback and argument is removed from the
+ * ring without calling the callback. A frame already handed to the
+ * controller cannot be recalled: it completes without the callback, or is
+ * dropped if the attempt fails.
+ *
+ * \param	callback	Callback the frames were queued with
+ * \param	arg	Argument the frames were queued with
+ * \return  Number of frames removed from the ring
+ */
+int CAN_cancel(CAN_tx_callback_t callback, void *arg);
+
+/**
+ * \brief Read the transmit counters
+ */
+void CAN_get_tx_stats(CAN_tx_stats_t *stats);
+
+/**
+ * \brief Read the bus error and recovery counters
+ */
+void CAN_get_bus_stats(CAN_bus_stats_t *stats);
+
+/**
+ * \brief Read the latest bus state transitions, oldest first
+ *
+ * \param	events	Receives up to `max` transitions
+ * \param	max	Size of `events`
+ * \return  Number of transitions written, at most CAN_BUS_EVENT_LOG
+ */
+size_t CAN_get_bus_events(CAN_bus_event_t *events, size_t max);
+
+/**
+ * \brief Receive only the given IDs
+ *
+ * The tightest hardware acceptance filter (single or dual) covering the IDs
+ * is derived and installed, frames it lets through by mistake are dropped
+ * in software. May be called before CAN_init; afterwards the RX task
+ * reinstalls the driver with the new filter; a frame in transmission is
+ * repeated afterwards.
+ * Frames rejected in hardware are never seen, so they cannot be counted.
+ *
+ * \param	ids	IDs to receive
+ * \param	count	Number of IDs, at most CAN_FILTER_MAX_IDS; 0 receives everything
+ * \param	extended	IDs are 29 bit, frames of the other format are dropped
+ * \return  0 Filter has been accepted
+ */
+int CAN_set_filter(const uint32_t *ids, size_t count, bool extended);
+
+/**
+ * \brief Read the receive filter counters
+ */
+void CAN_get_filter_stats(CAN_filter_stats_t *stats);
+
 /**
  * \brief Stops the CAN Module
  *
@@ -0,0 +1,159 @@
+/**
+ * \file
+ * \brief CAN backends
+ *
+ * CAN.c keeps the transmit ring, the receive filter, the counters and the
+ * bus state; everything that talks to a controller goes through a backend:
+ * an ops table plus the instance handle passed to every op. Backends:
+ *  - TWAI, the ESP32 controller (not on the linux target)
+ *  - SocketCAN, a Linux CAN or vcan interface (linux target only)
+ *  - loopback, in process: frames are injected by the application and
+ *    transmitted frames are handed to a tap, optionally received back
+ *
+ * The backend is chosen with CONFIG_ESP_CAN_BACKEND or CAN_set_backend.
+ */
+
+#ifndef __DRIVERS_CAN_BACKEND_H__
+#define __DRIVERS_CAN_BACKEND_H__
+
+#include "CAN.h"
+
+/** \brief The frame given to transmit is on the wire */
+#define CAN_EVENT_TX_DONE     (1u << 0)
+/** \brief The frame given to transmit could not be sent */
+#define CAN_EVENT_TX_FAILED   (1u << 1)
+/** \brief An error counter went above the warning limit */
+#define CAN_EVENT_ABOVE_WARN  (1u << 2)
+/** \brief The controller went error passive */
+#define CAN_EVENT_ERR_PASSIVE (1u << 3)
+/** \brief The controller went bus off */
+#define CAN_EVENT_BUS_OFF     (1u << 4)
+/** \brief Bus-off recovery has completed, see CAN_backend_ops_t::restart */
+#define CAN_EVENT_RECOVERED   (1u << 5)
+/** \brief The controller is error active again */
+#define CAN_EVENT_ERR_ACTIVE  (1u << 6)
+/** \brief The error counters are below the warning limit again */
+#define CAN_EVENT_BELOW_WARN  (1u << 7)
+/** \brief All events */
+#define CAN_EVENT_ALL         0xFFu
+
+/** \brief Controller counters; they restart when the backend is opened */
+typedef struct {
+	uint32_t msgs_to_tx;       /**< \brief Frames waiting in the backend for transmission */
+	uint32_t msgs_to_rx;       /**< \brief Frames waiting in the backend to be received */
+	uint32_t tx_error_counter; /**< \brief Transmit error counter */
+	uint32_t rx_error_counter; /**< \brief Receive error counter */
+	uint32_t tx_failed;        /**< \brief Failed transmissions */
+	uint32_t rx_missed;        /**< \brief Frames lost on a full receive queue */
+	uint32_t rx_overrun;       /**< \brief Frames lost in the controller */
+	uint32_t arb_lost;         /**< \brief Lost arbitrations */
+	uint32_t bus_errors;       /**< \brief Bus errors */
+} CAN_backend_status_t;
+
+/**
+ * \brief Backend operations, all take the instance handle as `ctx`
+ *
+ * receive is only called from the CAN RX task, wait_events, recover and
+ * restart only from the CAN alert task; transmit may be called from any
+ * task, but never concurrently with open or close.
+ */
+typedef struct {
+	const char *name; /**< \brief Shown in logs */
+
+	/**
+	 * \brief Start the bus receiving the given IDs
+	 *
+	 * The backend may let more IDs through, CAN.c drops them in software.
+	 * `hw` receives what the backend filters: code, mask, width, dual.
+	 * \return 0 on success
+	 */
+	int (*open)(void *ctx, const uint32_t *ids, size_t count, bool extended, CAN_filter_stats_t *hw);
+
+	/** \brief Stop the bus, discarding frames in transmission */
+	void (*close)(void *ctx);
+
+	/**
+	 * \brief Start sending one frame, single shot, without waiting
+	 *
+	 * The outcome is reported as CAN_EVENT_TX_DONE or CAN_EVENT_TX_FAILED.
+	 * \return 0 the frame has been handed over, -1 the bus is not running
+	 */
+	int (*transmit)(void *ctx, const CAN_frame_t *frame);
+
+	/** \return 0 a frame has been received, -1 none within `timeout_ms` */
+	int (*receive)(void *ctx, CAN_frame_t *frame, uint32_t timeout_ms);
+
+	/**
+	 * \brief Wait up to `timeout_ms` for events, see CAN_EVENT_TX_DONE etc.
+	 * \return 0 `events` is set (0 on timeout), -1 the backend is not open
+	 */
+	int (*wait_events)(void *ctx, uint32_t *events, uint32_t timeout_ms);
+
+	/** \brief Begin bus-off recovery; NULL if the backend recovers by itself */
+	int (*recover)(void *ctx);
+
+	/** \brief Resume after CAN_EVENT_RECOVERED; NULL if nothing is to be done */
+	int (*restart)(void *ctx);
+
+	/** \return 0 `status` has been filled in */
+	int (*get_status)(void *ctx, CAN_backend_status_t *status);
+} CAN_backend_ops_t;
+
+/** \brief Backend instance */
+typedef struct {
+	const CAN_backend_ops_t *ops; /**< \brief Operations */
+	void *ctx;                    /**< \brief Instance handle passed to the operations */
+} CAN_backend_t;
+
+/** \brief Called with every frame the loopback backend transmits */
+typedef void (*CAN_loopback_tap_t)(const CAN_frame_t *frame, void *arg);
+
+/**
+ * \brief Use `backend` instead of the one selected in menuconfig
+ *
+ * \return 0 Backend has been set, -1 CAN_init has already been called
+ */
+int CAN_set_backend(const CAN_backend_t *backend);
+
+/**
+ * \brief Backend in use, valid after CAN_set_backend or CAN_init
+ */
+const CAN_backend_t *CAN_get_backend(void);
+
+#if !CONFIG_IDF_TARGET_LINUX
+/**
+ * \brief TWAI controller backend with the pins and speed of `cfg`
+ */
+void CAN_backend_twai(const CAN_device_t *cfg, CAN_backend_t *backend);
+#else
+/**
+ * \brief SocketCAN backend on a Linux CAN interface, e.g. "vcan0"
+ *
+ * \return 0 Backend has been created
+ */
+int CAN_backend_socketcan(const char *ifname, CAN_backend_t *backend);
+#endif
+
+/**
+ * \brief In-process loopback backend
+ *
+ * \param	echo	Transmitted frames are also received
+ * \return 0 Backend has been created
+ */
+int CAN_backend_loopback(bool echo, CAN_backend_t *backend);
+
+/**
+ * \brief Hand a frame to a loopback backend as if it had been received
+ *
+ * \return 0 Frame has been queued, -1 the backend is not open or its queue is full
+ */
+int CAN_loopback_inject(const CAN_backend_t *backend, const CAN_frame_t *frame);
+
+/**
+ * \brief Observe the frames a loopback backend transmits
+ *
+ * The tap runs in the transmitting task and must not block.
+ */
+void CAN_loopback_set_tap(const CAN_backend_t *backend, CAN_loopback_tap_t tap, void *arg);
+
+#endif /* __DRIVERS_CAN_BACKEND_H__ */
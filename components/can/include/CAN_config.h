@@ -29,12 +29,18 @@
 #ifndef __DRIVERS_CAN_CFG_H__
 #define __DRIVERS_CAN_CFG_H__
 
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
-#include "driver/gpio.h"
 #include "freertos/semphr.h"
 
+#if CONFIG_IDF_TARGET_LINUX
+typedef int gpio_num_t; /* no pins on the linux target, kept for CAN_device_t */
+#else
+#include "driver/gpio.h"
+#endif
+
 /** \brief CAN Node Bus speed */
 typedef enum {
 	CAN_SPEED_100KBPS = 100,  /**< \brief CAN Node runs at 100kBit/s. */
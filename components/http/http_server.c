@@ -16,12 +16,15 @@
  */
 
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
 #include <sys/lock.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/event_groups.h"
 #include <sys/queue.h>
 
@@ -36,6 +39,18 @@
 
 #define HTTP_PARSE_BUF_MAX_LEN 256
 
+/* The accept loop only hands connections over (or turns them away) */
+#define HTTP_ACCEPT_TASK_STACK_SIZE 2560
+
+/* Arena allocations are aligned for the structures placed in it */
+#define HTTP_ARENA_ALIGN sizeof(void*)
+
+/* Path parameters (":name" and a trailing "*") per URI pattern */
+#define HTTP_ROUTE_MAX_PARAMS 8
+
+/* An idle kept-alive connection checks this often whether another one waits for its worker */
+#define HTTP_IDLE_POLL_MS 100
+
 typedef enum {
     HTTP_PARSING_URI,                //!< HTTP_PARSING_URI
     HTTP_PARSING_HEADER_NAME,        //!< HTTP_PARSING_HEADER_NAME
@@ -55,6 +70,14 @@ typedef struct http_header_t {
 
 typedef SLIST_HEAD(http_header_list_t, http_header_t) http_header_list_t;
 
+/* Bump allocator for everything that lives as long as one request */
+typedef struct {
+    char* base;
+    size_t size;
+    size_t used;
+    size_t high_water;      /* most used by a request on this connection */
+} http_arena_t;
+
 typedef struct {
     http_handler_fn_t cb;
     void* ctx;
@@ -66,12 +89,35 @@ typedef struct http_handler_t{
     int events;
     http_handler_fn_t cb;
     void* ctx;
-    SLIST_ENTRY(http_handler_t) list_entry;
+    int param_count;
+    const char* param_names[HTTP_ROUTE_MAX_PARAMS];    /* point into param_buf */
+    char* param_buf;
+    struct http_handler_t* next;    /* other methods of the same route */
 } http_handler_t;
 
+/* Route table: a trie over path segments, built at registration.
+ * Nodes and handlers are only ever added, and are published with a release
+ * store once complete, so lookups walk it without taking handlers_lock. */
+typedef struct http_route_t {
+    char* segment;                  /* literal segment, NULL for ":name" and "*" */
+    uint32_t hash;                  /* of the lowercased segment */
+    struct http_route_t* next;      /* next literal child of the same parent */
+    struct http_route_t* children;  /* literal segments below */
+    struct http_route_t* param;     /* ":name" below, matches any one segment */
+    struct http_route_t* wildcard;  /* "*" below, matches the rest of the path */
+    http_handler_t* handlers;       /* registered on this exact path, latest first */
+} http_route_t;
+
+/* A path segment captured by ":name" or "*" */
+typedef struct {
+    const char* value;
+    size_t len;
+} http_route_param_t;
+
 
 struct http_context_ {
     http_server_t server;
+    http_arena_t arena;             /* URI, headers, arguments, response headers */
     http_state_t state;
     int event;
     char* uri;
@@ -85,21 +131,45 @@ struct http_context_ {
     size_t expected_response_size;
     size_t accumulated_response_size;
     http_handler_t* handler;
+    http_route_t* route;            /* set while the path matched, even if the method didn't */
     const char* data_ptr;
     size_t data_size;
     http_header_list_t request_args;
+    http_header_list_t request_params;
+    bool keep_alive;                /* connection stays open after the current response */
+    bool chunked;                   /* response body goes out with chunked transfer encoding */
 };
 
+/* Received data not parsed yet; may hold the start of pipelined requests */
+typedef struct {
+    struct netbuf* inbuf;
+    char* data;
+    u16_t len;
+    u16_t parsed;
+} http_rx_buf_t;
+
 
 struct http_server_context_ {
     int port;
+    int recv_timeout_ms;
+    int keep_alive_timeout_ms;
+    int max_requests_per_connection;
     err_t server_task_err;
     struct netconn* server_conn;
     TaskHandle_t task;
     EventGroupHandle_t start_done;
-    SLIST_HEAD(, http_handler_t) handlers;
-    _lock_t handlers_lock;
-    struct http_context_ connection_context;
+    http_route_t routes;                    /* root of the route trie, "/" */
+    _lock_t handlers_lock;                  /* serializes registrations, lookups don't take it */
+    int max_connections;
+    struct http_context_* connections;      /* one context per connection being served */
+    QueueHandle_t free_connections;         /* contexts without a connection */
+    QueueHandle_t pending_connections;      /* contexts with an accepted connection, NULL stops a worker */
+    int worker_count;
+    SemaphoreHandle_t workers_done;         /* given by each worker as it exits */
+    char* arena_memory;                     /* arenas of all connection contexts */
+    size_t arena_size;
+    uint32_t arena_failures;
+    uint32_t requests;
 };
 
 #define SERVER_STARTED_BIT BIT(0)
@@ -107,10 +177,62 @@ struct http_server_context_ {
 
 
 static const char* http_response_code_to_str(int code);
-static esp_err_t add_keyval_pair(http_header_list_t *list, const char* name, const char* val);
+static esp_err_t add_keyval_pair(http_context_t ctx, http_header_list_t *list, const char* name, const char* val);
+static http_header_t* add_urlencoded_pair(http_context_t ctx, http_header_list_t *list,
+        const char* name, size_t name_len, const char* val, size_t val_len);
 
 static const char* TAG = "http_server";
 
+/* FNV-1a, case insensitive like the matching */
+static uint32_t http_segment_hash(const char* segment, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ (uint8_t) tolower((unsigned char) segment[i])) * 16777619u;
+    }
+    return hash;
+}
+
+/* Finds or adds the node for one pattern segment; called under handlers_lock */
+static http_route_t* http_route_add(http_route_t* parent, const char* segment, size_t len)
+{
+    http_route_t** slot;
+    uint32_t hash = 0;
+
+    if (segment[0] == ':') {
+        slot = &parent->param;
+    } else if (len == 1 && segment[0] == '*') {
+        slot = &parent->wildcard;
+    } else {
+        hash = http_segment_hash(segment, len);
+        for (http_route_t* it = parent->children; it != NULL; it = it->next) {
+            if (it->hash == hash && strncasecmp(it->segment, segment, len) == 0 && it->segment[len] == 0) {
+                return it;
+            }
+        }
+        slot = &parent->children;
+    }
+    if (*slot != NULL && slot != &parent->children) {
+        return *slot;
+    }
+
+    http_route_t* route = calloc(1, sizeof(*route));
+    if (route == NULL) {
+        return NULL;
+    }
+    if (slot == &parent->children) {
+        route->segment = strndup(segment, len);
+        if (route->segment == NULL) {
+            free(route);
+            return NULL;
+        }
+        route->hash = hash;
+        route->next = parent->children;
+    }
+    __atomic_store_n(slot, route, __ATOMIC_RELEASE);
+    return route;
+}
+
 esp_err_t http_register_handler(http_server_t server,
         const char* uri_pattern, int method,
         int events, http_handler_fn_t callback, void* callback_arg)
@@ -121,30 +243,173 @@ esp_err_t http_register_handler(http_server_t server,
     }
 
     new_handler->uri_pattern = strdup(uri_pattern);
+    /* Split copy of the pattern, parameter names point into it */
+    new_handler->param_buf = strdup(uri_pattern);
+    if (new_handler->uri_pattern == NULL || new_handler->param_buf == NULL) {
+        free(new_handler->uri_pattern);
+        free(new_handler->param_buf);
+        free(new_handler);
+        return ESP_ERR_NO_MEM;
+    }
     new_handler->cb = callback;
     new_handler->ctx = callback_arg;
     new_handler->method = method;
     new_handler->events = events;
 
+    esp_err_t err = ESP_OK;
     _lock_acquire(&server->handlers_lock);
-    /* FIXME: Handlers will be checked in the reverse order */
-    SLIST_INSERT_HEAD(&server->handlers, new_handler, list_entry);
+    http_route_t* route = &server->routes;
+    char* segment = new_handler->param_buf;
+    while (route != NULL && *segment != 0) {
+        if (*segment == '/') {
+            *segment++ = 0;
+            continue;
+        }
+        size_t len = strcspn(segment, "/");
+        bool wildcard = (len == 1 && segment[0] == '*');
+        if (segment[0] == ':' || wildcard) {
+            if (new_handler->param_count == HTTP_ROUTE_MAX_PARAMS
+                    || (wildcard && segment[len] != 0)) {
+                err = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            new_handler->param_names[new_handler->param_count++] = wildcard ? segment : segment + 1;
+        }
+        route = http_route_add(route, segment, len);
+        segment += len;
+    }
+    if (err == ESP_OK && route == NULL) {
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err == ESP_OK) {
+        /* The latest registration for a method shadows earlier ones */
+        new_handler->next = route->handlers;
+        __atomic_store_n(&route->handlers, new_handler, __ATOMIC_RELEASE);
+    }
     _lock_release(&server->handlers_lock);
-    return ESP_OK;
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Can't register '%s': %s", uri_pattern, esp_err_to_name(err));
+        free(new_handler->uri_pattern);
+        free(new_handler->param_buf);
+        free(new_handler);
+    }
+    return err;
 }
 
-static http_handler_t* http_find_handler(http_server_t server, const char* uri, int method)
+/* Matches the rest of a path below route: literal segments before ":name"
+ * before "*", falling back when a branch has no route for the whole path.
+ * Returns a route with handlers, the captured segments go to params. */
+static http_route_t* http_route_match(http_route_t* route, const char* path,
+        http_route_param_t* params, int param_count)
 {
-    http_handler_t* it;
-    _lock_acquire(&server->handlers_lock);
-    SLIST_FOREACH(it, &server->handlers, list_entry) {
-        if (strcasecmp(uri, it->uri_pattern) == 0
-            && method == it->method) {
+    while (*path == '/') {
+        ++path;
+    }
+    if (*path == 0) {
+        if (__atomic_load_n(&route->handlers, __ATOMIC_ACQUIRE) != NULL) {
+            return route;
+        }
+    } else {
+        size_t len = strcspn(path, "/");
+        uint32_t hash = http_segment_hash(path, len);
+        http_route_t* it = __atomic_load_n(&route->children, __ATOMIC_ACQUIRE);
+        for (; it != NULL; it = it->next) {
+            if (it->hash == hash && strncasecmp(it->segment, path, len) == 0 && it->segment[len] == 0) {
+                http_route_t* found = http_route_match(it, path + len, params, param_count);
+                if (found != NULL) {
+                    return found;
+                }
+                break;
+            }
+        }
+        it = __atomic_load_n(&route->param, __ATOMIC_ACQUIRE);
+        if (it != NULL && param_count < HTTP_ROUTE_MAX_PARAMS) {
+            params[param_count].value = path;
+            params[param_count].len = len;
+            http_route_t* found = http_route_match(it, path + len, params, param_count + 1);
+            if (found != NULL) {
+                return found;
+            }
+        }
+    }
+    http_route_t* wildcard = __atomic_load_n(&route->wildcard, __ATOMIC_ACQUIRE);
+    if (wildcard != NULL && param_count < HTTP_ROUTE_MAX_PARAMS
+            && __atomic_load_n(&wildcard->handlers, __ATOMIC_ACQUIRE) != NULL) {
+        params[param_count].value = path;
+        params[param_count].len = strlen(path);
+        return wildcard;
+    }
+    return NULL;
+}
+
+/* Resolves the route and handler of the request, and its path parameters */
+static void http_find_handler(http_context_t ctx)
+{
+    http_route_param_t params[HTTP_ROUTE_MAX_PARAMS];
+    int method = (int) ctx->parser.method;
+
+    ctx->route = http_route_match(&ctx->server->routes, ctx->uri, params, 0);
+    if (ctx->route == NULL) {
+        return;
+    }
+    http_handler_t* it = __atomic_load_n(&ctx->route->handlers, __ATOMIC_ACQUIRE);
+    for (; it != NULL; it = it->next) {
+        if (it->method == method) {
             break;
         }
     }
-    _lock_release(&server->handlers_lock);
-    return it;
+    ctx->handler = it;
+    if (it == NULL) {
+        return;
+    }
+    for (int i = 0; i < it->param_count; ++i) {
+        const char* name = it->param_names[i];
+        /* Names are taken as they are, they come from the pattern */
+        http_header_t* param = add_urlencoded_pair(ctx, &ctx->request_params, NULL, strlen(name),
+                params[i].value, params[i].len);
+        if (param != NULL) {
+            strcpy(param->name, name);
+        }
+    }
+}
+
+static void* arena_alloc(http_context_t ctx, size_t size)
+{
+    http_arena_t* arena = &ctx->arena;
+    size_t start = (arena->used + HTTP_ARENA_ALIGN - 1) & ~(HTTP_ARENA_ALIGN - 1);
+    if (start > arena->size || size > arena->size - start) {
+        ESP_LOGW(TAG, "Request arena full, %d bytes used, %d more requested", arena->used, size);
+        __atomic_add_fetch(&ctx->server->arena_failures, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    arena->used = start + size;
+    return arena->base + start;
+}
+
+static char* arena_strdup(http_context_t ctx, const char* str)
+{
+    size_t len = strlen(str) + 1;
+    char* copy = arena_alloc(ctx, len);
+    if (copy != NULL) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+/* Everything allocated for the request just answered goes at once */
+static void arena_reset(http_context_t ctx)
+{
+    http_arena_t* arena = &ctx->arena;
+    if (arena->used > arena->high_water) {
+        __atomic_store_n(&arena->high_water, arena->used, __ATOMIC_RELAXED);
+    }
+    arena->used = 0;
+}
+
+void* http_request_alloc(http_context_t ctx, size_t size)
+{
+    return arena_alloc(ctx, size);
 }
 
 static int append_parse_buffer(http_context_t ctx, const char* at, size_t length)
@@ -169,7 +434,7 @@ static void clear_parse_buffer(http_context_t ctx)
 
 static void header_name_done(http_context_t ctx)
 {
-    ctx->request_header_tmp = strdup(ctx->parse_buffer);
+    ctx->request_header_tmp = arena_strdup(ctx, ctx->parse_buffer);
     clear_parse_buffer(ctx);
 }
 
@@ -177,9 +442,10 @@ static void header_value_done(http_context_t ctx)
 {
     const char* value = ctx->parse_buffer;
     const char* name = ctx->request_header_tmp;
-    ESP_LOGD(TAG, "Got header: '%s': '%s'", name, value);
-    add_keyval_pair(&ctx->request_headers, name, value);
-    free(ctx->request_header_tmp);
+    if (name != NULL) {
+        ESP_LOGD(TAG, "Got header: '%s': '%s'", name, value);
+        add_keyval_pair(ctx, &ctx->request_headers, name, value);
+    }
     ctx->request_header_tmp = NULL;
     clear_parse_buffer(ctx);
 }
@@ -202,10 +468,15 @@ static bool invoke_handler(http_context_t ctx, int event)
 }
 
 
+static void uri_done(http_context_t ctx);
+
 static int http_headers_done_cb(http_parser* parser)
 {
     http_context_t ctx = (http_context_t) parser->data;
-    if (ctx->state == HTTP_PARSING_HEADER_VALUE) {
+    if (ctx->state == HTTP_PARSING_URI) {
+        /* Request without headers */
+        uri_done(ctx);
+    } else if (ctx->state == HTTP_PARSING_HEADER_VALUE) {
         header_value_done(ctx);
     }
     invoke_handler(ctx, HTTP_HANDLE_HEADERS);
@@ -224,35 +495,61 @@ static int parse_hex_digit(char hex)
     }
 }
 
-static char* urldecode(const char* str, size_t len)
+/* Decodes in place; returns false on a malformed escape */
+static bool urldecode(char* str)
 {
-    ESP_LOGV(TAG, "urldecode: '%.*s'", len, str);
+    ESP_LOGV(TAG, "urldecode: '%s'", str);
 
-    const char* end = str + len;
-    char* out = calloc(1, len + 1);
-    char* p_out = out;
-    while (str != end) {
+    char* out = str;
+    char* p_out = str;
+    while (*str) {
         char c = *str++;
-        if (c != '%') {
-            *p_out = c;
-        } else {
-            if (str + 2 > end) {
+        if (c == '%') {
+            if (str[0] == 0 || str[1] == 0) {
                 /* Unexpected end of string */
-                return NULL;
+                return false;
             }
             int high = parse_hex_digit(*str++);
             int low = parse_hex_digit(*str++);
             if (high == -1 || low == -1) {
                 /* Unexpected character */
-                return NULL;
+                return false;
             }
-            *p_out = high * 16 + low;
+            c = high * 16 + low;
         }
-        ++p_out;
+        *p_out++ = c;
     }
     *p_out = 0;
     ESP_LOGV(TAG, "urldecode result: '%s'", out);
-    return out;
+    return true;
+}
+
+/* Adds a pair with the value copied into the arena and decoded there.
+ * A NULL name only reserves name_len bytes for it. */
+static http_header_t* add_urlencoded_pair(http_context_t ctx, http_header_list_t *list,
+        const char* name, size_t name_len, const char* val, size_t val_len)
+{
+    http_header_t* pair = arena_alloc(ctx, sizeof(http_header_t) + name_len + 1 + val_len + 1);
+    if (pair == NULL) {
+        return NULL;
+    }
+    pair->name = (char*) (pair + 1);
+    pair->value = pair->name + name_len + 1;
+    pair->name[0] = 0;
+    if (name != NULL) {
+        memcpy(pair->name, name, name_len);
+        pair->name[name_len] = 0;
+        if (!urldecode(pair->name)) {
+            return NULL;
+        }
+    }
+    memcpy(pair->value, val, val_len);
+    pair->value[val_len] = 0;
+    if (!urldecode(pair->value)) {
+        return NULL;
+    }
+    SLIST_INSERT_HEAD(list, pair, list_entry);
+    return pair;
 }
 
 static void parse_urlencoded_args(http_context_t ctx, const char* str, size_t len)
@@ -262,34 +559,31 @@ static void parse_urlencoded_args(http_context_t ctx, const char* str, size_t le
     const int READING_VAL = 2;
     int state = READING_KEY;
     const char* token_start = str;
-    char* key = NULL;
-    char* value = NULL;
+    const char* key = NULL;
+    size_t key_len = 0;
     for (const char* pos = str; pos < end; ++pos) {
         char c = *pos;
         if (c == '=' && state == READING_KEY) {
-            key = urldecode(token_start, pos - token_start);
+            key = token_start;
+            key_len = pos - token_start;
             state = READING_VAL;
             token_start = pos + 1;
         } else if (c == '&' && state == READING_VAL) {
-            value = urldecode(token_start, pos - token_start);
+            http_header_t* arg = add_urlencoded_pair(ctx, &ctx->request_args,
+                    key, key_len, token_start, pos - token_start);
+            if (arg != NULL) {
+                ESP_LOGD(TAG, "Got request argument, '%s': '%s'", arg->name, arg->value);
+            }
             state = READING_KEY;
             token_start = pos + 1;
-            ESP_LOGD(TAG, "Got request argument, '%s': '%s'", key, value);
-            add_keyval_pair(&ctx->request_args, key, value);
-            free(key);
-            key = NULL;
-            free(value);
-            value = NULL;
         }
     }
     if (state == READING_VAL) {
-        value = urldecode(token_start, end - token_start);
-        ESP_LOGD(TAG, "Got request argument, '%s': '%s'", key, value);
-        add_keyval_pair(&ctx->request_args, key, value);
-        free(key);
-        key = NULL;
-        free(value);
-        value = NULL;
+        http_header_t* arg = add_urlencoded_pair(ctx, &ctx->request_args,
+                key, key_len, token_start, end - token_start);
+        if (arg != NULL) {
+            ESP_LOGD(TAG, "Got request argument, '%s': '%s'", arg->name, arg->value);
+        }
     }
 }
 
@@ -301,13 +595,18 @@ static void uri_done(http_context_t ctx)
         *query_str = 0;
         ++query_str;
     }
-    ctx->uri = strdup(ctx->parse_buffer);
+    ctx->uri = arena_strdup(ctx, ctx->parse_buffer);
+    if (ctx->uri == NULL) {
+        /* No handler, answered with a 404 */
+        clear_parse_buffer(ctx);
+        return;
+    }
     ESP_LOGD(TAG, "Got URI: '%s'", ctx->uri);
     if (query_str) {
         parse_urlencoded_args(ctx, query_str, strlen(query_str));
     }
 
-    ctx->handler = http_find_handler(ctx->server, ctx->uri, (int) ctx->parser.method);
+    http_find_handler(ctx);
     invoke_handler(ctx, HTTP_HANDLE_URI);
     clear_parse_buffer(ctx);
 }
@@ -355,9 +654,20 @@ static int http_message_done_cb(http_parser* parser)
     ESP_LOGV(TAG, "%s", __func__);
     http_context_t ctx = (http_context_t) parser->data;
     ctx->state = HTTP_REQUEST_DONE;
+    /* Stop here, pipelined requests are parsed once this one is answered */
+    http_parser_pause(parser, 1);
     return 0;
 }
 
+static const http_parser_settings s_parser_settings = {
+        .on_url = &http_url_cb,
+        .on_headers_complete = &http_headers_done_cb,
+        .on_header_field = &http_header_name_cb,
+        .on_header_value = &http_header_value_cb,
+        .on_body = &http_body_cb,
+        .on_message_complete = &http_message_done_cb
+};
+
 const char* http_request_get_header(http_context_t ctx, const char* name)
 {
     http_header_t* it;
@@ -396,6 +706,17 @@ const char* http_request_get_arg_value(http_context_t ctx, const char* name)
     return NULL;
 }
 
+const char* http_request_get_param(http_context_t ctx, const char* name)
+{
+    http_header_t* it;
+    SLIST_FOREACH(it, &ctx->request_params, list_entry) {
+        if (strcmp(name, it->name) == 0) {
+            return it->value;
+        }
+    }
+    return NULL;
+}
+
 esp_err_t http_request_get_data(http_context_t ctx, const char** out_data_ptr, size_t* out_size)
 {
     if (ctx->event != HTTP_HANDLE_DATA) {
@@ -453,11 +774,8 @@ static esp_err_t lwip_err_to_esp_err(err_t e)
 
 static void headers_list_clear(http_header_list_t* list)
 {
-    http_header_t  *it, *next;
-    SLIST_FOREACH_SAFE(it, list, list_entry, next) {
-        SLIST_REMOVE(list, it, http_header_t, list_entry);
-        free(it); /* frees memory allocated for header, name, and value */
-    }
+    /* Entries are in the arena, reclaimed with it */
+    SLIST_INIT(list);
 }
 
 static esp_err_t http_add_content_length_header(http_context_t http_ctx, size_t value)
@@ -467,10 +785,38 @@ static esp_err_t http_add_content_length_header(http_context_t http_ctx, size_t
     return http_response_set_header(http_ctx, "Content-length", size_str);
 }
 
+/* Decides how the client finds the end of the body: Content-length,
+ * chunked encoding, or the connection closing */
+static esp_err_t http_add_connection_headers(http_context_t http_ctx)
+{
+    bool http_1_1 = http_ctx->parser.http_major == 1 && http_ctx->parser.http_minor >= 1;
+    if (http_ctx->keep_alive && http_ctx->expected_response_size == HTTP_RESPONSE_SIZE_UNKNOWN) {
+        if (http_1_1) {
+            http_ctx->chunked = true;
+            return http_response_set_header(http_ctx, "Transfer-Encoding", "chunked");
+        }
+        http_ctx->keep_alive = false;
+    }
+    if (!http_ctx->keep_alive) {
+        return http_response_set_header(http_ctx, "Connection", "close");
+    }
+    if (!http_1_1) {
+        return http_response_set_header(http_ctx, "Connection", "keep-alive");
+    }
+    return ESP_OK;
+}
+
 static esp_err_t http_send_response_headers(http_context_t http_ctx)
 {
     assert(http_ctx->state == HTTP_COLLECTING_RESPONSE_HEADERS);
 
+    if (http_ctx->response_code > 0) {
+        esp_err_t err = http_add_connection_headers(http_ctx);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
     /* Calculate total size of all the headers, allocate a buffer */
     size_t total_headers_size = 0;
 
@@ -486,7 +832,9 @@ static esp_err_t http_send_response_headers(http_context_t http_ctx)
         total_headers_size += strlen(it->name) + strlen(it->value) + 4 /* ": ", CRLF */;
     }
     total_headers_size += 3; /* Final CRLF, '\0' terminator */
-    char* headers_buf = calloc(1, total_headers_size);
+    /* Only needed until written, given back to the arena below */
+    size_t arena_mark = http_ctx->arena.used;
+    char* headers_buf = arena_alloc(http_ctx, total_headers_size);
     if (headers_buf == NULL) {
         return ESP_ERR_NO_MEM;
     }
@@ -500,6 +848,8 @@ static esp_err_t http_send_response_headers(http_context_t http_ctx)
         assert(len < buf_size);
         buf_size -= len;
         buf_ptr += len;
+        /* Status line is out */
+        http_ctx->response_code = 0;
     }
 
     /* Write response headers */
@@ -519,7 +869,7 @@ static esp_err_t http_send_response_headers(http_context_t http_ctx)
     headers_list_clear(&http_ctx->response_headers);
 
     err_t err = netconn_write(http_ctx->conn, headers_buf, strlen(headers_buf), NETCONN_COPY);
-    free(headers_buf);
+    http_ctx->arena.used = arena_mark;
 
     http_ctx->state = HTTP_SENDING_RESPONSE_BODY;
 
@@ -563,7 +913,24 @@ esp_err_t http_response_write(http_context_t http_ctx, const http_buffer_t* buff
     }
     const int flag = buffer->data_is_persistent ? NETCONN_NOCOPY : NETCONN_COPY;
     size_t len = buffer->size ? buffer->size : strlen((const char*) buffer->data);
-    err_t rc = netconn_write(http_ctx->conn, buffer->data, len, flag);
+    err_t rc;
+    if (http_ctx->chunked) {
+        if (len == 0) {
+            /* An empty chunk would end the body */
+            return ESP_OK;
+        }
+        char chunk_header[12];
+        int header_len = snprintf(chunk_header, sizeof(chunk_header), "%x\r\n", (unsigned) len);
+        rc = netconn_write(http_ctx->conn, chunk_header, header_len, NETCONN_COPY | NETCONN_MORE);
+        if (rc == ERR_OK) {
+            rc = netconn_write(http_ctx->conn, buffer->data, len, flag | NETCONN_MORE);
+        }
+        if (rc == ERR_OK) {
+            rc = netconn_write(http_ctx->conn, "\r\n", 2, NETCONN_NOCOPY);
+        }
+    } else {
+        rc = netconn_write(http_ctx->conn, buffer->data, len, flag);
+    }
     if (rc != ESP_OK) {
         ESP_LOGD(TAG, "netconn_write rc=%d", rc);
     } else {
@@ -575,18 +942,31 @@ esp_err_t http_response_write(http_context_t http_ctx, const http_buffer_t* buff
 
 esp_err_t http_response_end(http_context_t http_ctx)
 {
+    esp_err_t err = ESP_OK;
     size_t expected = http_ctx->expected_response_size;
     size_t actual = http_ctx->accumulated_response_size;
     if (expected != HTTP_RESPONSE_SIZE_UNKNOWN && expected != actual) {
         ESP_LOGW(TAG, "Expected response size: %d, actual: %d", expected, actual);
+        /* The client can't tell where the next response starts */
+        http_ctx->keep_alive = false;
+    }
+    if (http_ctx->state == HTTP_COLLECTING_RESPONSE_HEADERS && http_ctx->response_code > 0) {
+        /* Nothing was written, the headers are still due */
+        err = http_send_response_headers(http_ctx);
+    }
+    if (err == ESP_OK && http_ctx->chunked) {
+        err = lwip_err_to_esp_err(netconn_write(http_ctx->conn, "0\r\n\r\n", 5, NETCONN_NOCOPY));
+        http_ctx->chunked = false;
     }
     http_ctx->state = HTTP_DONE;
-    return ESP_OK;
+    return err;
 }
 
 esp_err_t http_response_begin_multipart(http_context_t http_ctx, const char* content_type, size_t response_size)
 {
     if (http_ctx->state == HTTP_COLLECTING_RESPONSE_HEADERS) {
+        /* Parts are only delimited by the boundary, the response ends with the connection */
+        http_ctx->keep_alive = false;
         http_send_response_headers(http_ctx);
         http_ctx->response_code = 0;
     }
@@ -610,13 +990,13 @@ esp_err_t http_response_end_multipart(http_context_t http_ctx, const char* bound
     return ret;
 }
 
-static esp_err_t add_keyval_pair(http_header_list_t *list, const char* name, const char* val)
+static esp_err_t add_keyval_pair(http_context_t ctx, http_header_list_t *list, const char* name, const char* val)
 {
     size_t name_len = strlen(name) + 1;
     size_t val_len = strlen(val) + 1;
     /* Allocate memory for the structure, name, and value, in one go */
     size_t buf_len = sizeof(http_header_t) + name_len + val_len;
-    char* buf = (char*) calloc(1, buf_len);
+    char* buf = (char*) arena_alloc(ctx, buf_len);
     if (buf == NULL) {
         return ESP_ERR_NO_MEM;
     }
@@ -631,7 +1011,7 @@ static esp_err_t add_keyval_pair(http_header_list_t *list, const char* name, con
 
 esp_err_t http_response_set_header(http_context_t http_ctx, const char* name, const char* val)
 {
-    return add_keyval_pair(&http_ctx->response_headers, name, val);
+    return add_keyval_pair(http_ctx, &http_ctx->response_headers, name, val);
 }
 
 
@@ -646,6 +1026,37 @@ static void http_send_not_found_response(http_context_t http_ctx)
     http_response_end(http_ctx);
 }
 
+/* The path has handlers, but not for this method */
+static void http_send_method_not_allowed_response(http_context_t http_ctx)
+{
+    char allow[64] = "";
+    size_t len = 0;
+    http_handler_t* it = __atomic_load_n(&http_ctx->route->handlers, __ATOMIC_ACQUIRE);
+    for (; it != NULL && len < sizeof(allow); it = it->next) {
+        len += snprintf(allow + len, sizeof(allow) - len, "%s%s",
+                len > 0 ? ", " : "", http_method_str((enum http_method) it->method));
+    }
+    http_response_begin(http_ctx, 405, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+    http_response_set_header(http_ctx, "Allow", allow);
+    const http_buffer_t buf = {
+            .data = "Method not allowed",
+            .data_is_persistent = true
+    };
+    http_response_write(http_ctx, &buf);
+    http_response_end(http_ctx);
+}
+
+static void http_send_bad_request_response(http_context_t http_ctx)
+{
+    http_response_begin(http_ctx, 400, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+    const http_buffer_t buf = {
+            .data = "Bad request",
+            .data_is_persistent = true
+    };
+    http_response_write(http_ctx, &buf);
+    http_response_end(http_ctx);
+}
+
 
 static const char* http_response_code_to_str(int code)
 {
@@ -663,73 +1074,172 @@ static const char* http_response_code_to_str(int code)
 }
 
 
-static void http_handle_connection(http_server_t server, struct netconn *conn)
+/* Waits for the next request on a kept-alive connection. Gives up after
+ * the keep-alive timeout, or as soon as another connection waits for a worker */
+static err_t http_wait_next_request(http_context_t ctx, struct netbuf **inbuf)
 {
-    struct netbuf *inbuf = NULL;
-    char *buf;
-    u16_t buflen;
-    err_t err = ERR_OK;
+    http_server_t server = ctx->server;
+    int idle_ms = 0;
+    err_t err;
 
-    /* Single threaded server, one context only */
-    http_context_t ctx = &server->connection_context;
+    netconn_set_recvtimeout(ctx->conn, HTTP_IDLE_POLL_MS);
+    do {
+        err = netconn_recv(ctx->conn, inbuf);
+        idle_ms += HTTP_IDLE_POLL_MS;
+    } while (err == ERR_TIMEOUT && idle_ms < server->keep_alive_timeout_ms
+            && uxQueueMessagesWaiting(server->pending_connections) == 0);
+    netconn_set_recvtimeout(ctx->conn, server->recv_timeout_ms);
+    return err;
+}
 
-    /* Initialize context */
-    ctx->state = HTTP_PARSING_URI;
-    ctx->conn = conn;
-    http_parser_init(&ctx->parser, HTTP_REQUEST);
-    ctx->parser.data = ctx;
-    ctx->server = server;
-
-    const http_parser_settings parser_settings = {
-            .on_url = &http_url_cb,
-            .on_headers_complete = &http_headers_done_cb,
-            .on_header_field = &http_header_name_cb,
-            .on_header_value = &http_header_value_cb,
-            .on_body = &http_body_cb,
-            .on_message_complete = &http_message_done_cb
-    };
+/* Parses until one request is complete; data following it stays in rx */
+static err_t http_receive_request(http_context_t ctx, http_rx_buf_t* rx, bool idle)
+{
+    err_t err;
 
     while (ctx->state != HTTP_REQUEST_DONE) {
-        err = netconn_recv(conn, &inbuf);
-        if (err != ERR_OK) {
-            break;
-        }
-
-        err = netbuf_data(inbuf, (void**) &buf, &buflen);
-        if (err != ERR_OK) {
-            break;
-        }
-
-        size_t parsed_bytes = http_parser_execute(&ctx->parser, &parser_settings, buf, buflen);
-        if (parsed_bytes < buflen) {
-            break;
+        if (rx->parsed == rx->len) {
+            if (rx->inbuf == NULL || netbuf_next(rx->inbuf) < 0) {
+                if (rx->inbuf) {
+                    netbuf_delete(rx->inbuf);
+                    rx->inbuf = NULL;
+                }
+                if (idle) {
+                    err = http_wait_next_request(ctx, &rx->inbuf);
+                    idle = false;
+                } else {
+                    err = netconn_recv(ctx->conn, &rx->inbuf);
+                }
+                if (err != ERR_OK) {
+                    return err;
+                }
+            }
+            err = netbuf_data(rx->inbuf, (void**) &rx->data, &rx->len);
+            if (err != ERR_OK) {
+                return err;
+            }
+            rx->parsed = 0;
         }
-    }
 
-    if (err == ERR_OK) {
-        ctx->state = HTTP_COLLECTING_RESPONSE_HEADERS;
-        if (ctx->handler == NULL) {
-            http_send_not_found_response(ctx);
-        } else {
-            invoke_handler(ctx, HTTP_HANDLE_RESPONSE);
+        rx->parsed += http_parser_execute(&ctx->parser, &s_parser_settings,
+                rx->data + rx->parsed, rx->len - rx->parsed);
+        enum http_errno parser_err = HTTP_PARSER_ERRNO(&ctx->parser);
+        if (parser_err == HPE_PAUSED) {
+            http_parser_pause(&ctx->parser, 0);
+        } else if (parser_err != HPE_OK) {
+            ESP_LOGD(TAG, "Parse error: %s", http_errno_name(parser_err));
+            return ERR_VAL;
         }
     }
+    return ERR_OK;
+}
 
+/* Drops everything belonging to the request just answered */
+static void http_request_done(http_context_t ctx)
+{
     headers_list_clear(&ctx->request_headers);
     headers_list_clear(&ctx->request_args);
+    headers_list_clear(&ctx->request_params);
+    headers_list_clear(&ctx->response_headers);
 
-    free(ctx->uri);
+    ctx->request_header_tmp = NULL;
     ctx->uri = NULL;
     ctx->handler = NULL;
+    ctx->route = NULL;
+    ctx->response_code = 0;
+    ctx->chunked = false;
+    clear_parse_buffer(ctx);
+    arena_reset(ctx);
+}
+
+static void http_handle_connection(http_context_t ctx)
+{
+    http_rx_buf_t rx = { 0 };
+    err_t err = ERR_OK;
+    int requests = 0;
+    struct netconn *conn = ctx->conn;
+
+    /* The parser carries over from one request to the next */
+    http_parser_init(&ctx->parser, HTTP_REQUEST);
+    ctx->parser.data = ctx;
+
+    do {
+        ctx->state = HTTP_PARSING_URI;
+        ctx->keep_alive = false;
+        err = http_receive_request(ctx, &rx, requests > 0);
+        if (err == ERR_VAL) {
+            ctx->state = HTTP_COLLECTING_RESPONSE_HEADERS;
+            http_send_bad_request_response(ctx);
+        } else if (err == ERR_OK) {
+            requests++;
+            __atomic_add_fetch(&ctx->server->requests, 1, __ATOMIC_RELAXED);
+            /* Let a waiting connection have the worker rather than keep this one */
+            ctx->keep_alive = http_should_keep_alive(&ctx->parser)
+                    && requests < ctx->server->max_requests_per_connection
+                    && uxQueueMessagesWaiting(ctx->server->pending_connections) == 0;
+            ctx->state = HTTP_COLLECTING_RESPONSE_HEADERS;
+            if (ctx->handler != NULL) {
+                invoke_handler(ctx, HTTP_HANDLE_RESPONSE);
+            } else if (ctx->route != NULL) {
+                http_send_method_not_allowed_response(ctx);
+            } else {
+                http_send_not_found_response(ctx);
+            }
+            if (ctx->state != HTTP_DONE) {
+                /* Unfinished response, the next one would run into it */
+                ctx->keep_alive = false;
+            }
+        }
+        http_request_done(ctx);
+    } while (ctx->keep_alive);
+
     if (err != ERR_CLSD) {
         netconn_close(conn);
     }
-    if (inbuf) {
-        netbuf_delete(inbuf);
+    if (rx.inbuf) {
+        netbuf_delete(rx.inbuf);
     }
 }
 
 
+/* All connection contexts are in use: answer without reading the request */
+static void http_reject_connection(struct netconn *conn)
+{
+    static const char response[] =
+            "HTTP/1.1 503 Service Unavailable\r\n"
+            "Content-length: 0\r\n"
+            "Connection: close\r\n\r\n";
+    netconn_write(conn, response, sizeof(response) - 1, NETCONN_NOCOPY);
+    netconn_close(conn);
+}
+
+/* Serves the connections the accept loop hands over, one at a time */
+static void http_worker(void *arg)
+{
+    http_server_t server = (http_server_t) arg;
+    http_context_t ctx;
+
+    while (xQueueReceive(server->pending_connections, &ctx, portMAX_DELAY) == pdTRUE && ctx != NULL) {
+        http_handle_connection(ctx);
+        netconn_delete(ctx->conn);
+        ctx->conn = NULL;
+        xQueueSend(server->free_connections, &ctx, portMAX_DELAY);
+    }
+    xSemaphoreGive(server->workers_done);
+    vTaskDelete(NULL);
+}
+
+static void http_stop_workers(http_server_t server, int count)
+{
+    http_context_t stop = NULL;
+    for (int i = 0; i < count; i++) {
+        xQueueSend(server->pending_connections, &stop, portMAX_DELAY);
+    }
+    for (int i = 0; i < count; i++) {
+        xSemaphoreTake(server->workers_done, portMAX_DELAY);
+    }
+}
+
 static void http_server(void *arg)
 {
     http_server_t ctx = (http_server_t) arg;
@@ -755,8 +1265,22 @@ static void http_server(void *arg)
     do {
         err = netconn_accept(ctx->server_conn, &client_conn);
         if (err == ERR_OK) {
-            http_handle_connection(ctx, client_conn);
-            netconn_delete(client_conn);
+            http_context_t conn_ctx;
+            if (xQueueReceive(ctx->free_connections, &conn_ctx, 0) != pdTRUE) {
+                ESP_LOGW(TAG, "%d connections open, rejecting", ctx->max_connections);
+                http_reject_connection(client_conn);
+                netconn_delete(client_conn);
+                continue;
+            }
+            /* A stalled client gives up its worker after the timeout */
+            if (ctx->recv_timeout_ms > 0) {
+                netconn_set_recvtimeout(client_conn, ctx->recv_timeout_ms);
+#if LWIP_SO_SNDTIMEO
+                netconn_set_sendtimeout(client_conn, ctx->recv_timeout_ms);
+#endif
+            }
+            conn_ctx->conn = client_conn;
+            xQueueSend(ctx->pending_connections, &conn_ctx, portMAX_DELAY);
         }
     } while (err == ERR_OK);
 
@@ -772,6 +1296,25 @@ out:
     vTaskDelete(NULL);
 }
 
+static void http_server_free(http_server_t ctx)
+{
+    if (ctx->workers_done) {
+        vSemaphoreDelete(ctx->workers_done);
+    }
+    if (ctx->pending_connections) {
+        vQueueDelete(ctx->pending_connections);
+    }
+    if (ctx->free_connections) {
+        vQueueDelete(ctx->free_connections);
+    }
+    if (ctx->start_done) {
+        vEventGroupDelete(ctx->start_done);
+    }
+    free(ctx->arena_memory);
+    free(ctx->connections);
+    free(ctx);
+}
+
 esp_err_t http_server_start(const http_server_options_t* options, http_server_t* out_server)
 {
     http_server_t ctx = calloc(1, sizeof(*ctx));
@@ -780,20 +1323,58 @@ esp_err_t http_server_start(const http_server_options_t* options, http_server_t*
     }
 
     ctx->port = options->port;
+    ctx->recv_timeout_ms = options->recv_timeout_ms;
+    ctx->keep_alive_timeout_ms = options->keep_alive_timeout_ms;
+    ctx->max_requests_per_connection = options->max_requests_per_connection;
+    ctx->max_connections = options->max_connections;
+    ctx->worker_count = options->worker_count;
     ctx->start_done = xEventGroupCreate();
-    if (ctx->start_done == NULL) {
-        free(ctx);
+    ctx->connections = calloc(ctx->max_connections, sizeof(*ctx->connections));
+    /* Requests allocate from here only, nothing comes from the heap once running */
+    ctx->arena_size = options->arena_size;
+    ctx->arena_memory = malloc(ctx->max_connections * ctx->arena_size);
+    ctx->free_connections = xQueueCreate(ctx->max_connections, sizeof(http_context_t));
+    /* Room for every connection plus a stop request per worker */
+    ctx->pending_connections = xQueueCreate(ctx->max_connections + ctx->worker_count, sizeof(http_context_t));
+    ctx->workers_done = xSemaphoreCreateCounting(ctx->worker_count, 0);
+    if (ctx->start_done == NULL || ctx->connections == NULL || ctx->arena_memory == NULL
+            || ctx->free_connections == NULL
+            || ctx->pending_connections == NULL || ctx->workers_done == NULL) {
+        http_server_free(ctx);
         return ESP_ERR_NO_MEM;
     }
 
+    for (int i = 0; i < ctx->max_connections; i++) {
+        http_context_t conn_ctx = &ctx->connections[i];
+        conn_ctx->server = ctx;
+        conn_ctx->arena.base = ctx->arena_memory + i * ctx->arena_size;
+        conn_ctx->arena.size = ctx->arena_size;
+        xQueueSend(ctx->free_connections, &conn_ctx, 0);
+    }
+
+    for (int i = 0; i < ctx->worker_count; i++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "httpd_%d", i);
+        int ret = xTaskCreatePinnedToCore(&http_worker, name,
+                options->task_stack_size, ctx,
+                options->task_priority,
+                NULL,
+                options->task_affinity);
+        if (ret != pdPASS) {
+            http_stop_workers(ctx, i);
+            http_server_free(ctx);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
     int ret = xTaskCreatePinnedToCore(&http_server, "httpd",
-            options->task_stack_size, ctx,
+            HTTP_ACCEPT_TASK_STACK_SIZE, ctx,
             options->task_priority,
             &ctx->task,
             options->task_affinity);
     if (ret != pdPASS) {
-        vEventGroupDelete(ctx->start_done);
-        free(ctx);
+        http_stop_workers(ctx, ctx->worker_count);
+        http_server_free(ctx);
         return ESP_ERR_NO_MEM;
     }
 
@@ -801,8 +1382,8 @@ esp_err_t http_server_start(const http_server_options_t* options, http_server_t*
     if (bits & SERVER_DONE_BIT) {
         /* Error happened, task is deleted */
         esp_err_t err = lwip_err_to_esp_err(ctx->server_task_err);
-        vEventGroupDelete(ctx->start_done);
-        free(ctx);
+        http_stop_workers(ctx, ctx->worker_count);
+        http_server_free(ctx);
         return err;
     }
 
@@ -815,6 +1396,21 @@ esp_err_t http_server_stop(http_server_t server)
     /* FIXME: figure out a thread safe way to do this */
     netconn_close(server->server_conn);
     xEventGroupWaitBits(server->start_done, SERVER_DONE_BIT, 0, 0, portMAX_DELAY);
-    free(server);
+    /* Connections already handed over are served before the workers stop */
+    http_stop_workers(server, server->worker_count);
+    http_server_free(server);
+    return ESP_OK;
+}
+
+esp_err_t http_server_get_stats(http_server_t server, http_server_stats_t* out_stats)
+{
+    out_stats->requests = __atomic_load_n(&server->requests, __ATOMIC_RELAXED);
+    out_stats->arena_size = server->arena_size;
+    out_stats->arena_high_water = 0;
+    for (int i = 0; i < server->max_connections; i++) {
+        size_t high_water = __atomic_load_n(&server->connections[i].arena.high_water, __ATOMIC_RELAXED);
+        out_stats->arena_high_water = MAX(out_stats->arena_high_water, high_water);
+    }
+    out_stats->arena_failures = __atomic_load_n(&server->arena_failures, __ATOMIC_RELAXED);
     return ESP_OK;
 }
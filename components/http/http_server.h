@@ -53,8 +53,14 @@ typedef void (* http_handler_fn_t)(http_context_t http_ctx, void* ctx);
 typedef struct {
     int port;               /*!< TCP Port to listen on */
     int task_affinity;      /*!< Server task affinity (CPU number of tskNO_AFFINITY */
-    int task_stack_size;    /*!< Server task stack size, in bytes */
+    int task_stack_size;    /*!< Worker task stack size, in bytes; handlers run on the workers */
     int task_priority;      /*!< Server task priority */
+    int worker_count;       /*!< Worker tasks, each serves one connection at a time */
+    int max_connections;    /*!< Connections open at the same time, further ones get a 503 */
+    int recv_timeout_ms;    /*!< A connection that sends nothing for this long is closed, 0 waits forever */
+    int keep_alive_timeout_ms;          /*!< Idle time allowed between requests on a persistent connection */
+    int max_requests_per_connection;    /*!< A persistent connection is closed after this many requests */
+    size_t arena_size;      /*!< Per connection memory for the URI, headers, arguments and http_request_alloc */
 } http_server_options_t;
 
 /** Default initializer for http_server_options_t */
@@ -63,10 +69,20 @@ typedef struct {
     .task_affinity = tskNO_AFFINITY, \
     .task_stack_size = 4096, \
     .task_priority = 1, \
+    .worker_count = 2, \
+    .max_connections = 4, \
+    .recv_timeout_ms = 5000, \
+    .keep_alive_timeout_ms = 10000, \
+    .max_requests_per_connection = 1000, \
+    .arena_size = 3072, \
 }
 
 /**
  * @brief initialize HTTP server, start listening
+ *
+ * Connections are served by options->worker_count tasks, so handlers may be
+ * called for different connections at the same time.
+ *
  * @param options  pointer to http server options, can point to a temporary
  * @param[out] output, handle of the server; pass it to http_server_stop do
  *             delete the server.
@@ -77,6 +93,23 @@ typedef struct {
  */
 esp_err_t http_server_start(const http_server_options_t* options, http_server_t* out_server);
 
+/** Server statistics, see http_server_get_stats */
+typedef struct {
+    uint32_t requests;          /*!< requests answered */
+    size_t arena_size;          /*!< per connection, options->arena_size */
+    size_t arena_high_water;    /*!< most arena memory a single request used */
+    uint32_t arena_failures;    /*!< allocations that didn't fit; the header, argument or buffer was dropped */
+} http_server_stats_t;
+
+/**
+ * @brief Get request and memory statistics of a running server
+ * @param server handle obtained from http_server_start
+ * @param[out] out_stats  filled with the statistics
+ * @return
+ *  - ESP_OK on success
+ */
+esp_err_t http_server_get_stats(http_server_t server, http_server_stats_t* out_stats);
+
 /**
  * @brief Stop the previously started server
  * @param server handle obtained from http_server_start
@@ -91,10 +124,17 @@ esp_err_t http_server_stop(http_server_t server);
  * The handler will be called when a client makes a request with matching URI
  * and HTTP method.
  *
- * @note Currently only matches full URIs, doesn't support regex
+ * The pattern is matched segment by segment, ignoring case and empty
+ * segments. A ":name" segment matches any one segment and a final "*"
+ * matches the rest of the path; http_request_get_param returns what they
+ * matched. Literal segments take precedence over ":name", which takes
+ * precedence over "*". A request for a path that only has handlers for
+ * other methods gets a 405 response.
+ * Registering the same pattern and method again replaces the handler.
  *
  * @param server  Server handle to register the handler for
- * @param uri_pattern URI pattern to match
+ * @param uri_pattern URI pattern to match, e.g. "/api/ecu/:id/pid/:pid",
+ *                    or "/static" followed by a "*" segment
  * @param method one of HTTP_GET, HTTP_POST, HTTP_PUT, etc
  * @param events  a bit mask of HTTP_HANDLE_X events for which the handler
  *                should be called
@@ -103,6 +143,7 @@ esp_err_t http_server_stop(http_server_t server);
  * @return
  *  - ESP_OK on success
  *  - ESP_ERR_NO_MEM if out of memory
+ *  - ESP_ERR_INVALID_ARG if "*" isn't the last segment or there are too many parameters
  */
 esp_err_t http_register_handler(http_server_t server, const char* uri_pattern, int method,
                                 int events, http_handler_fn_t callback, void* callback_arg);
@@ -138,6 +179,27 @@ esp_err_t http_register_form_handler(http_server_t server, const char* uri_patte
  */
 const char* http_request_get_arg_value(http_context_t http_ctx, const char* name);
 
+/**
+ * @brief Get value of a path parameter of the URI pattern
+ * @param http_ctx  context passed to the handler
+ * @param name  parameter name without the ':', or "*" for the rest of the path
+ * @return  pointer to the URL-decoded value, valid until the end of request;
+ *          NULL if the pattern has no such parameter
+ */
+const char* http_request_get_param(http_context_t http_ctx, const char* name);
+
+/**
+ * @brief Allocate memory that lives until the end of the request
+ *
+ * Comes from the connection's arena, like the request headers and
+ * arguments, and is released with them. Nothing needs to be freed.
+ *
+ * @param http_ctx  context passed to the handler
+ * @param size  number of bytes
+ * @return  pointer aligned for any structure, NULL if the arena is full
+ */
+void* http_request_alloc(http_context_t http_ctx, size_t size);
+
 /**
  * @brief Get request method
  * @param http_ctx  context passed to the handler
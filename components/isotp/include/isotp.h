@@ -0,0 +1,135 @@
+/**
+ * @file isotp.h
+ * @brief ISO 15765-2 (ISO-TP) transport layer
+ *
+ * Segments payloads of up to 4095 bytes into First Frame / Consecutive Frames
+ * and paces them according to the block size (BS) and separation time (STmin)
+ * of the tester's flow control frames. One transmit session is kept per
+ * tester address; STmin gaps and the N_Bs/N_As timeouts run on esp_timer, so
+ * the caller never busy-waits. Each Consecutive Frame is queued once the CAN
+ * driver reports the previous one transmitted, so a transfer holds a single
+ * slot of the CAN TX ring and waits, rather than fails, while the ring is full.
+ *
+ * In the other direction, multi-frame requests from testers are reassembled
+ * in a per-tester receive buffer, with our own flow control (configurable BS
+ * and STmin) and the N_Cr timeout. Complete PDUs are handed to the registered
+ * handler as a pointer into that buffer, without copying.
+ */
+
+#ifndef __ISOTP_H__
+#define __ISOTP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "CAN.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \brief Largest payload representable by a 12-bit First Frame length */
+#define ISOTP_MAX_PAYLOAD 4095
+
+/** \brief Protocol Control Information types (high nibble of the first byte) */
+#define ISOTP_PCI_SF 0x00 /**< \brief Single Frame */
+#define ISOTP_PCI_FF 0x10 /**< \brief First Frame */
+#define ISOTP_PCI_CF 0x20 /**< \brief Consecutive Frame */
+#define ISOTP_PCI_FC 0x30 /**< \brief Flow Control */
+
+/** \brief Flow status of a Flow Control frame */
+typedef enum {
+	ISOTP_FS_CTS = 0,      /**< \brief Continue to send */
+	ISOTP_FS_WAIT = 1,     /**< \brief Wait for the next flow control */
+	ISOTP_FS_OVERFLOW = 2, /**< \brief Receiver buffer overflow, abort */
+} isotp_flow_status_t;
+
+/** \brief Addressing of one transfer, seen from the emulator */
+typedef struct {
+	uint32_t tx_id; /**< \brief CAN ID our frames (data or flow control) are sent on */
+	uint32_t rx_id; /**< \brief CAN ID the tester's frames arrive on, identifies the session */
+	bool extended;  /**< \brief true for 29-bit identifiers */
+} isotp_addr_t;
+
+/**
+ * \brief Handler for complete PDUs received from a tester
+ *
+ * Called from the task that feeds isotp_on_frame(). `pdu` points into the
+ * receive buffer of the tester's session (or into the frame, for Single
+ * Frames) and is only valid until the handler returns. The handler may call
+ * isotp_send().
+ */
+typedef void (*isotp_pdu_handler_t)(const isotp_addr_t *addr, const uint8_t *pdu, size_t len, void *arg);
+
+/** \brief Transmit statistics */
+typedef struct {
+	uint32_t completed;     /**< \brief Multi-frame transfers finished */
+	uint32_t aborted;       /**< \brief Transfers replaced by a newer one for the same tester */
+	uint32_t timeouts;      /**< \brief N_Bs expired waiting for flow control, or N_As sending a Consecutive Frame */
+	uint32_t overflows;     /**< \brief Flow control with FS=OVFLW received */
+	uint32_t wait_exceeded; /**< \brief More than N_WFTmax FS=WAIT frames received */
+	uint32_t no_session;    /**< \brief No free session for a new tester */
+	uint32_t rx_completed;  /**< \brief PDUs delivered to the handler */
+	uint32_t rx_timeouts;   /**< \brief N_Cr expired while waiting for a Consecutive Frame */
+	uint32_t rx_sn_errors;  /**< \brief Consecutive Frames with a wrong sequence number */
+	uint32_t rx_overflows;  /**< \brief First Frames rejected with FS=OVFLW */
+} isotp_stats_t;
+
+/**
+ * \brief Create the transmit/receive sessions and their timers
+ *
+ * \param handler  called for every complete PDU received, see #isotp_pdu_handler_t
+ * \param arg      passed to the handler
+ * \return ESP_OK, or ESP_ERR_NO_MEM
+ */
+esp_err_t isotp_init(isotp_pdu_handler_t handler, void *arg);
+
+/**
+ * \brief Set the flow control we send for multi-frame requests
+ *
+ * \param bs     block size, 0 lets the tester send all Consecutive Frames at once
+ * \param stmin  minimum separation time, encoded as in ISO 15765-2
+ */
+void isotp_set_rx_flow_control(uint8_t bs, uint8_t stmin);
+
+/**
+ * \brief Send a payload to a tester
+ *
+ * Payloads of up to 7 bytes go out immediately as a Single Frame. Longer
+ * payloads are copied into the tester's session: the First Frame is sent
+ * now and the Consecutive Frames follow as flow control permits. A transfer
+ * still in progress for the same tester is aborted.
+ *
+ * \param addr     addressing, see #isotp_addr_t
+ * \param payload  data to send, may be a temporary
+ * \param len      payload length, 1..ISOTP_MAX_PAYLOAD
+ * \return ESP_OK, ESP_ERR_INVALID_SIZE, ESP_ERR_NO_MEM if no session is free,
+ *         or ESP_FAIL if the first frame could not be written
+ */
+esp_err_t isotp_send(const isotp_addr_t *addr, const uint8_t *payload, size_t len);
+
+/**
+ * \brief Pass a received frame to the transport layer
+ *
+ * Flow control frames advance the matching transmit session. Single, First
+ * and Consecutive Frames are reassembled; our own flow control is sent on
+ * addr->tx_id, and complete PDUs go to the handler given to isotp_init().
+ *
+ * \param addr   addressing of the frame, addr->rx_id is the frame's CAN ID
+ * \param frame  received frame
+ * \return true if the frame was consumed by the transport layer
+ */
+bool isotp_on_frame(const isotp_addr_t *addr, const CAN_frame_t *frame);
+
+/**
+ * \brief Copy the transmit statistics
+ */
+void isotp_get_stats(isotp_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ISOTP_H__ */
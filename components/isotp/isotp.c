@@ -0,0 +1,568 @@
+/**
+ * @file isotp.c
+ * @brief ISO 15765-2 (ISO-TP) transport layer, see isotp.h
+ */
+
+#include "isotp.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "ISOTP";
+
+typedef enum {
+    ISOTP_TX_IDLE,     // Session free
+    ISOTP_TX_WAIT_FC,  // First Frame or block sent, waiting for flow control (N_Bs)
+    ISOTP_TX_SENDING,  // Sending Consecutive Frames, paced by STmin and TX completion
+} isotp_tx_state_t;
+
+// Retry interval while the CAN TX ring is full
+#define ISOTP_TX_RETRY_US 1000
+
+typedef struct {
+    isotp_addr_t addr;
+    isotp_tx_state_t state;
+    esp_timer_handle_t timer;
+    int64_t deadline;       // time the armed timer is due, stale callbacks are ignored
+    int64_t as_deadline;    // the pending Consecutive Frame must be sent by then (N_As)
+    uint32_t gen;           // bumped per transfer, completions of older transfers are ignored
+    bool cf_queued;         // a Consecutive Frame is queued, the next waits for its completion
+    size_t len;
+    size_t offset;          // next payload byte to send
+    uint8_t sn;             // next sequence number
+    uint8_t bs;             // block size granted by the last flow control, 0 = no limit
+    uint8_t block_sent;     // Consecutive Frames sent in the current block
+    uint8_t wft;            // FS=WAIT frames received in a row
+    uint32_t st_us;         // STmin granted by the last flow control
+    uint8_t buf[ISOTP_MAX_PAYLOAD];
+} isotp_tx_session_t;
+
+typedef enum {
+    ISOTP_RX_IDLE,        // Session free
+    ISOTP_RX_RECEIVING,   // First Frame received, waiting for Consecutive Frames (N_Cr)
+    ISOTP_RX_DELIVERING,  // Buffer lent to the PDU handler
+} isotp_rx_state_t;
+
+typedef struct {
+    isotp_addr_t addr;
+    isotp_rx_state_t state;
+    esp_timer_handle_t timer;
+    int64_t deadline;       // time the armed timer is due, stale callbacks are ignored
+    size_t len;
+    size_t offset;          // next payload byte expected
+    uint8_t sn;             // next sequence number expected
+    uint8_t block_recv;     // Consecutive Frames received in the current block
+    uint8_t buf[ISOTP_MAX_PAYLOAD];
+} isotp_rx_session_t;
+
+static isotp_tx_session_t tx_sessions[CONFIG_ISOTP_TX_SESSIONS];
+static isotp_rx_session_t rx_sessions[CONFIG_ISOTP_RX_SESSIONS];
+static isotp_stats_t isotp_stats;
+
+static isotp_pdu_handler_t pdu_handler = NULL;
+static void *pdu_handler_arg = NULL;
+static uint8_t rx_bs = CONFIG_ISOTP_RX_BS;
+static uint8_t rx_stmin = CONFIG_ISOTP_RX_STMIN;
+
+// Serializes the CAN task (isotp_send, received frames) and the esp_timer task (STmin, N_Bs, N_Cr)
+static SemaphoreHandle_t isotp_lock = NULL;
+
+static void isotp_frame(CAN_frame_t *frame, const isotp_addr_t *addr, const uint8_t data[8])
+{
+    memset(frame, 0, sizeof(*frame));
+    frame->MsgID = addr->tx_id;
+    frame->FIR.B.DLC = 8;
+    frame->FIR.B.FF = addr->extended ? CAN_frame_ext : CAN_frame_std;
+    frame->FIR.B.RTR = CAN_no_RTR;
+    memcpy(frame->data.u8, data, 8);
+}
+
+// Single Frames and flow control, dropped by the CAN driver once stale
+static int isotp_write(const isotp_addr_t *addr, const uint8_t data[8])
+{
+    CAN_frame_t frame;
+    isotp_frame(&frame, addr, data);
+    return CAN_write_frame(&frame);
+}
+
+// Frames of a segmented transfer expire at N_As and are cancelled with the
+// transfer, both by the completion tag; either ends the transfer
+static int isotp_queue(const isotp_addr_t *addr, const uint8_t data[8], uint32_t deadline_us,
+                       CAN_tx_callback_t callback, void *arg)
+{
+    const CAN_tx_options_t options = {
+        .tx_class = CAN_TX_RESPONSE,
+        .deadline_us = deadline_us,
+        .callback = callback,
+        .arg = arg,
+    };
+    CAN_frame_t frame;
+    isotp_frame(&frame, addr, data);
+    return CAN_queue_frame(&frame, &options);
+}
+
+// Separation time in microseconds, see ISO 15765-2 table "STmin parameter values"
+static uint32_t isotp_stmin_us(uint8_t st)
+{
+    if (st <= 0x7F) {
+        return st * 1000;
+    }
+    if (st >= 0xF1 && st <= 0xF9) {
+        return (st - 0xF0) * 100;
+    }
+    // Reserved values shall be treated as the longest STmin
+    return 127000;
+}
+
+static void isotp_arm(isotp_tx_session_t *s, uint32_t us)
+{
+    esp_timer_stop(s->timer);
+    s->deadline = esp_timer_get_time() + us;
+    esp_timer_start_once(s->timer, us);
+}
+
+// Completion tag of the session's current transfer: session index in the
+// low bits, generation above (CONFIG_ISOTP_TX_SESSIONS is at most 8)
+static void *isotp_tag(const isotp_tx_session_t *s)
+{
+    return (void *)(uintptr_t)((s->gen << 3) | (uint32_t)(s - tx_sessions));
+}
+
+static void isotp_tx_done(const CAN_frame_t *frame, CAN_tx_status_t status, uint32_t latency_us, void *arg);
+
+// Frames of the transfer still in the CAN ring are dropped, so none of them
+// goes out after it ended, e.g. ahead of the next transfer's First Frame
+static void isotp_end(isotp_tx_session_t *s)
+{
+    esp_timer_stop(s->timer);
+    CAN_cancel(isotp_tx_done, isotp_tag(s));
+    s->state = ISOTP_TX_IDLE;
+    s->cf_queued = false;
+    s->gen++;
+}
+
+// Queue the next Consecutive Frame; the following one is sent from its TX
+// completion, so a transfer never holds more than one frame of the CAN ring
+static void isotp_send_consecutive(isotp_tx_session_t *s)
+{
+    uint8_t data[8] = { 0 };
+    size_t chunk = s->len - s->offset < 7 ? s->len - s->offset : 7;
+    data[0] = ISOTP_PCI_CF | s->sn;
+    memcpy(&data[1], &s->buf[s->offset], chunk);
+
+    int64_t now = esp_timer_get_time();
+    uint32_t left = s->as_deadline > now ? (uint32_t)(s->as_deadline - now) : 1;
+    if (isotp_queue(&s->addr, data, left, isotp_tx_done, isotp_tag(s)) != 0) {
+        // CAN TX ring full: try again shortly, unless the frame is overdue
+        if (now >= s->as_deadline) {
+            ESP_LOGW(TAG, "N_As timeout queueing CF to 0x%03lx", (unsigned long)s->addr.tx_id);
+            isotp_stats.timeouts++;
+            isotp_end(s);
+        } else {
+            isotp_arm(s, ISOTP_TX_RETRY_US);
+        }
+        return;
+    }
+    s->offset += chunk;
+    s->sn = (s->sn + 1) & 0x0F;
+    s->cf_queued = true;
+    isotp_arm(s, left);
+}
+
+// The queued Consecutive Frame left the controller; called with isotp_lock held
+static void isotp_on_cf_sent(isotp_tx_session_t *s)
+{
+    s->cf_queued = false;
+    s->as_deadline = esp_timer_get_time() + s->st_us + CONFIG_ISOTP_N_AS_MS * 1000;
+
+    if (s->offset >= s->len) {
+        isotp_stats.completed++;
+        isotp_end(s);
+    } else if (s->bs != 0 && ++s->block_sent >= s->bs) {
+        s->state = ISOTP_TX_WAIT_FC;
+        isotp_arm(s, CONFIG_ISOTP_N_BS_MS * 1000);
+    } else if (s->st_us != 0) {
+        isotp_arm(s, s->st_us);
+    } else {
+        isotp_send_consecutive(s);
+    }
+}
+
+// TX completion of a First or Consecutive Frame, called from the CAN driver's
+// task; only a Consecutive Frame moves the transfer on, N_Bs covers the First Frame
+static void isotp_tx_done(const CAN_frame_t *frame, CAN_tx_status_t status, uint32_t latency_us, void *arg)
+{
+    uint32_t tag = (uint32_t)(uintptr_t)arg;
+    isotp_tx_session_t *s = &tx_sessions[tag & 0x07];
+
+    xSemaphoreTake(isotp_lock, portMAX_DELAY);
+    // Completions of an aborted or timed out transfer are ignored
+    if ((frame->data.u8[0] & 0xF0) == ISOTP_PCI_CF && s->state == ISOTP_TX_SENDING && s->cf_queued && isotp_tag(s) == arg) {
+        if (status == CAN_TX_DONE) {
+            isotp_on_cf_sent(s);
+        } else {
+            ESP_LOGW(TAG, "CF to 0x%03lx expired", (unsigned long)s->addr.tx_id);
+            isotp_stats.timeouts++;
+            isotp_end(s);
+        }
+    }
+    xSemaphoreGive(isotp_lock);
+}
+
+static void isotp_timer_cb(void *arg)
+{
+    isotp_tx_session_t *s = (isotp_tx_session_t *)arg;
+
+    xSemaphoreTake(isotp_lock, portMAX_DELAY);
+    // The timer may have been re-armed while this callback waited for the lock
+    if (esp_timer_get_time() >= s->deadline) {
+        if (s->state == ISOTP_TX_WAIT_FC) {
+            ESP_LOGW(TAG, "N_Bs timeout waiting for flow control on 0x%03lx", (unsigned long)s->addr.rx_id);
+            isotp_stats.timeouts++;
+            isotp_end(s);
+        } else if (s->state == ISOTP_TX_SENDING && s->cf_queued) {
+            ESP_LOGW(TAG, "N_As timeout sending CF to 0x%03lx", (unsigned long)s->addr.tx_id);
+            isotp_stats.timeouts++;
+            isotp_end(s);
+        } else if (s->state == ISOTP_TX_SENDING) {
+            isotp_send_consecutive(s);
+        }
+    }
+    xSemaphoreGive(isotp_lock);
+}
+
+static void isotp_rx_timer_cb(void *arg)
+{
+    isotp_rx_session_t *s = (isotp_rx_session_t *)arg;
+
+    xSemaphoreTake(isotp_lock, portMAX_DELAY);
+    if (s->state == ISOTP_RX_RECEIVING && esp_timer_get_time() >= s->deadline) {
+        ESP_LOGW(TAG, "N_Cr timeout after %d of %d bytes from 0x%03lx",
+                 (int)s->offset, (int)s->len, (unsigned long)s->addr.rx_id);
+        isotp_stats.rx_timeouts++;
+        s->state = ISOTP_RX_IDLE;
+    }
+    xSemaphoreGive(isotp_lock);
+}
+
+esp_err_t isotp_init(isotp_pdu_handler_t handler, void *arg)
+{
+    if (isotp_lock != NULL) {
+        return ESP_OK;
+    }
+
+    pdu_handler = handler;
+    pdu_handler_arg = arg;
+
+    isotp_lock = xSemaphoreCreateMutex();
+    if (isotp_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < CONFIG_ISOTP_RX_SESSIONS; i++) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = &isotp_rx_timer_cb,
+            .arg = &rx_sessions[i],
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "isotp_rx",
+        };
+        rx_sessions[i].state = ISOTP_RX_IDLE;
+        if (esp_timer_create(&timer_args, &rx_sessions[i].timer) != ESP_OK) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    for (int i = 0; i < CONFIG_ISOTP_TX_SESSIONS; i++) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = &isotp_timer_cb,
+            .arg = &tx_sessions[i],
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "isotp_tx",
+        };
+        tx_sessions[i].state = ISOTP_TX_IDLE;
+        if (esp_timer_create(&timer_args, &tx_sessions[i].timer) != ESP_OK) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t isotp_send(const isotp_addr_t *addr, const uint8_t *payload, size_t len)
+{
+    uint8_t data[8] = { 0 };
+
+    if (len == 0 || len > ISOTP_MAX_PAYLOAD) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (len <= 7) {
+        data[0] = ISOTP_PCI_SF | len;
+        memcpy(&data[1], payload, len);
+        return isotp_write(addr, data) == 0 ? ESP_OK : ESP_FAIL;
+    }
+
+    xSemaphoreTake(isotp_lock, portMAX_DELAY);
+
+    // One session per tester: reuse the tester's session, otherwise take a free one
+    isotp_tx_session_t *s = NULL;
+    for (int i = 0; i < CONFIG_ISOTP_TX_SESSIONS; i++) {
+        isotp_tx_session_t *it = &tx_sessions[i];
+        if (it->state != ISOTP_TX_IDLE && it->addr.rx_id == addr->rx_id && it->addr.extended == addr->extended) {
+            ESP_LOGD(TAG, "New transfer to 0x%03lx aborts the previous one", (unsigned long)addr->tx_id);
+            isotp_stats.aborted++;
+            s = it;
+            break;
+        }
+        if (s == NULL && it->state == ISOTP_TX_IDLE) {
+            s = it;
+        }
+    }
+    if (s == NULL) {
+        isotp_stats.no_session++;
+        xSemaphoreGive(isotp_lock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    isotp_end(s);
+    s->addr = *addr;
+    memcpy(s->buf, payload, len);
+    s->len = len;
+    s->offset = 6;
+    s->sn = 1;
+    s->wft = 0;
+    s->state = ISOTP_TX_WAIT_FC;
+
+    data[0] = ISOTP_PCI_FF | (len >> 8);
+    data[1] = len & 0xFF;
+    memcpy(&data[2], payload, 6);
+
+    esp_err_t err = ESP_OK;
+    if (isotp_queue(addr, data, CONFIG_ISOTP_N_AS_MS * 1000, isotp_tx_done, isotp_tag(s)) != 0) {
+        isotp_end(s);
+        err = ESP_FAIL;
+    } else {
+        isotp_arm(s, CONFIG_ISOTP_N_BS_MS * 1000);
+    }
+
+    xSemaphoreGive(isotp_lock);
+    return err;
+}
+
+// Called with isotp_lock held
+static void isotp_on_flow_control(const CAN_frame_t *frame, bool extended)
+{
+    isotp_tx_session_t *s = NULL;
+    for (int i = 0; i < CONFIG_ISOTP_TX_SESSIONS; i++) {
+        isotp_tx_session_t *it = &tx_sessions[i];
+        if (it->state != ISOTP_TX_IDLE && it->addr.rx_id == frame->MsgID && it->addr.extended == extended) {
+            s = it;
+            break;
+        }
+    }
+
+    // Flow control is only expected after a First Frame or a complete block
+    if (s == NULL || s->state != ISOTP_TX_WAIT_FC) {
+        return;
+    }
+
+    switch (frame->data.u8[0] & 0x0F) {
+        case ISOTP_FS_CTS:
+            esp_timer_stop(s->timer);
+            s->bs = frame->data.u8[1];
+            s->st_us = isotp_stmin_us(frame->data.u8[2]);
+            s->block_sent = 0;
+            s->wft = 0;
+            s->as_deadline = esp_timer_get_time() + CONFIG_ISOTP_N_AS_MS * 1000;
+            s->state = ISOTP_TX_SENDING;
+            isotp_send_consecutive(s);
+            break;
+        case ISOTP_FS_WAIT:
+            if (++s->wft > CONFIG_ISOTP_N_WFT_MAX) {
+                ESP_LOGW(TAG, "N_WFTmax exceeded on 0x%03lx", (unsigned long)s->addr.rx_id);
+                isotp_stats.wait_exceeded++;
+                isotp_end(s);
+            } else {
+                isotp_arm(s, CONFIG_ISOTP_N_BS_MS * 1000);
+            }
+            break;
+        case ISOTP_FS_OVERFLOW:
+            ESP_LOGW(TAG, "Tester 0x%03lx reported overflow for %d bytes", (unsigned long)s->addr.rx_id, (int)s->len);
+            isotp_stats.overflows++;
+            isotp_end(s);
+            break;
+        default:
+            ESP_LOGW(TAG, "Invalid flow status 0x%02x", frame->data.u8[0]);
+            isotp_end(s);
+            break;
+    }
+}
+
+static void isotp_send_flow_control(const isotp_addr_t *addr, isotp_flow_status_t fs)
+{
+    uint8_t data[8] = { 0 };
+    data[0] = ISOTP_PCI_FC | fs;
+    data[1] = rx_bs;
+    data[2] = rx_stmin;
+    isotp_write(addr, data);
+}
+
+static void isotp_rx_arm(isotp_rx_session_t *s)
+{
+    esp_timer_stop(s->timer);
+    s->deadline = esp_timer_get_time() + CONFIG_ISOTP_N_CR_MS * 1000;
+    esp_timer_start_once(s->timer, CONFIG_ISOTP_N_CR_MS * 1000);
+}
+
+// Called with isotp_lock held, returns the session holding a complete PDU or NULL
+static isotp_rx_session_t *isotp_on_first_frame(const isotp_addr_t *addr, const CAN_frame_t *frame)
+{
+    size_t len = ((frame->data.u8[0] & 0x0F) << 8) | frame->data.u8[1];
+
+    isotp_rx_session_t *s = NULL;
+    for (int i = 0; i < CONFIG_ISOTP_RX_SESSIONS; i++) {
+        isotp_rx_session_t *it = &rx_sessions[i];
+        // A new First Frame from the same tester restarts its reception
+        if (it->state == ISOTP_RX_RECEIVING && it->addr.rx_id == addr->rx_id && it->addr.extended == addr->extended) {
+            s = it;
+            break;
+        }
+        if (s == NULL && it->state == ISOTP_RX_IDLE) {
+            s = it;
+        }
+    }
+
+    // FF_DL of 0 announces a 32-bit length, which is larger than our buffer
+    if (s == NULL || len == 0) {
+        isotp_stats.rx_overflows++;
+        isotp_send_flow_control(addr, ISOTP_FS_OVERFLOW);
+        return NULL;
+    }
+    if (len < 8) {
+        // Would have fit a Single Frame, ignore as required by ISO 15765-2
+        return NULL;
+    }
+
+    s->addr = *addr;
+    s->len = len;
+    memcpy(s->buf, &frame->data.u8[2], 6);
+    s->offset = 6;
+    s->sn = 1;
+    s->block_recv = 0;
+    s->state = ISOTP_RX_RECEIVING;
+
+    isotp_send_flow_control(addr, ISOTP_FS_CTS);
+    isotp_rx_arm(s);
+    return NULL;
+}
+
+// Called with isotp_lock held, returns the session holding a complete PDU or NULL
+static isotp_rx_session_t *isotp_on_consecutive_frame(const isotp_addr_t *addr, const CAN_frame_t *frame)
+{
+    isotp_rx_session_t *s = NULL;
+    for (int i = 0; i < CONFIG_ISOTP_RX_SESSIONS; i++) {
+        isotp_rx_session_t *it = &rx_sessions[i];
+        if (it->state == ISOTP_RX_RECEIVING && it->addr.rx_id == addr->rx_id && it->addr.extended == addr->extended) {
+            s = it;
+            break;
+        }
+    }
+    if (s == NULL) {
+        return NULL;
+    }
+
+    if ((frame->data.u8[0] & 0x0F) != s->sn) {
+        ESP_LOGW(TAG, "Wrong SN %d (expected %d) from 0x%03lx",
+                 frame->data.u8[0] & 0x0F, s->sn, (unsigned long)addr->rx_id);
+        isotp_stats.rx_sn_errors++;
+        esp_timer_stop(s->timer);
+        s->state = ISOTP_RX_IDLE;
+        return NULL;
+    }
+
+    size_t chunk = s->len - s->offset < 7 ? s->len - s->offset : 7;
+    memcpy(&s->buf[s->offset], &frame->data.u8[1], chunk);
+    s->offset += chunk;
+    s->sn = (s->sn + 1) & 0x0F;
+
+    if (s->offset >= s->len) {
+        esp_timer_stop(s->timer);
+        s->state = ISOTP_RX_DELIVERING;
+        return s;
+    }
+
+    if (rx_bs != 0 && ++s->block_recv >= rx_bs) {
+        s->block_recv = 0;
+        isotp_send_flow_control(addr, ISOTP_FS_CTS);
+    }
+    isotp_rx_arm(s);
+    return NULL;
+}
+
+bool isotp_on_frame(const isotp_addr_t *addr, const CAN_frame_t *frame)
+{
+    uint8_t pci = frame->data.u8[0] & 0xF0;
+    isotp_rx_session_t *complete = NULL;
+
+    switch (pci) {
+        case ISOTP_PCI_SF: {
+            // Single Frames are delivered straight from the frame
+            size_t len = frame->data.u8[0] & 0x0F;
+            if (len == 0 || len > 7 || len + 1 > frame->FIR.B.DLC) {
+                return false;
+            }
+            if (pdu_handler != NULL) {
+                pdu_handler(addr, &frame->data.u8[1], len, pdu_handler_arg);
+            }
+            return true;
+        }
+        case ISOTP_PCI_FF:
+        case ISOTP_PCI_CF:
+        case ISOTP_PCI_FC:
+            break;
+        default:
+            return false;
+    }
+
+    xSemaphoreTake(isotp_lock, portMAX_DELAY);
+    if (pci == ISOTP_PCI_FC) {
+        isotp_on_flow_control(frame, addr->extended);
+    } else if (pci == ISOTP_PCI_FF) {
+        complete = isotp_on_first_frame(addr, frame);
+    } else {
+        complete = isotp_on_consecutive_frame(addr, frame);
+    }
+    xSemaphoreGive(isotp_lock);
+
+    // The handler runs without the lock so it can respond through isotp_send();
+    // the DELIVERING state keeps the buffer away from the timers meanwhile
+    if (complete != NULL) {
+        if (pdu_handler != NULL) {
+            pdu_handler(&complete->addr, complete->buf, complete->len, pdu_handler_arg);
+        }
+        xSemaphoreTake(isotp_lock, portMAX_DELAY);
+        isotp_stats.rx_completed++;
+        complete->state = ISOTP_RX_IDLE;
+        xSemaphoreGive(isotp_lock);
+    }
+    return true;
+}
+
+void isotp_set_rx_flow_control(uint8_t bs, uint8_t stmin)
+{
+    xSemaphoreTake(isotp_lock, portMAX_DELAY);
+    rx_bs = bs;
+    rx_stmin = stmin;
+    xSemaphoreGive(isotp_lock);
+}
+
+void isotp_get_stats(isotp_stats_t *stats)
+{
+    xSemaphoreTake(isotp_lock, portMAX_DELAY);
+    *stats = isotp_stats;
+    xSemaphoreGive(isotp_lock);
+}
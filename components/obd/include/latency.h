@@ -0,0 +1,98 @@
+/** \file
+  \brief Request latency histograms
+  Every answered request is timed in four stages:
+
+      RX task receipt -> dispatch -> response queued (submit) -> on the wire
+
+  dispatch is when the request handler got the frame (the same task as
+   the receipt unless OBD_RX_QUEUED), submit when the response was handed
+   to the CAN TX ring, and the last stamp comes from the TX completion.
+   Each stage, and the whole of it, goes into a fixed-bin histogram per
+   (service, first PID) of the request and into one over all requests.
+
+  Responses sent through ISO-TP (several PIDs, VIN) are timed up to submit;
+   their frames are paced by the tester and have no single end.
+*/
+
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "CAN.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+typedef enum {
+	LATENCY_RX_TO_DISPATCH = 0,
+	LATENCY_DISPATCH_TO_SUBMIT = 1,
+	LATENCY_SUBMIT_TO_TX = 2,
+	LATENCY_RX_TO_TX = 3,
+} latency_stage_t;
+
+#define LATENCY_STAGES 4
+
+/// Histogram bins, the last one collects everything above the last bound
+#define LATENCY_BINS 20
+
+/// Upper bounds of the bins, in us
+extern const uint32_t latency_bounds_us[LATENCY_BINS - 1];
+
+/// (service, PID) pairs with their own histograms; further pairs only count towards all requests
+#define LATENCY_KEYS 16
+
+typedef struct {
+	uint32_t count;
+	uint32_t max_us;
+	uint64_t total_us;
+	uint32_t bins[LATENCY_BINS];
+} latency_histogram_t;
+
+typedef struct {
+	bool all;        ///< over all requests, service and pid are not set
+	uint8_t service;
+	uint8_t pid;
+	latency_histogram_t stages[LATENCY_STAGES];
+} latency_entry_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t avg_us;
+	uint32_t p50_us; ///< percentiles are the upper bound of their bin, at most max_us
+	uint32_t p95_us;
+	uint32_t p99_us;
+	uint32_t max_us;
+} latency_summary_t;
+
+/// Start timing a request received at `rx_time_us`; called by the task handling requests
+void latency_begin(int64_t rx_time_us);
+
+/// Key the request being timed by its service and first PID
+void latency_set_key(uint8_t service, uint8_t pid);
+
+/// A response to the request being timed is queued; fills `options` to time its transmission
+void latency_submit(CAN_tx_options_t *options);
+
+/// A response went out through ISO-TP
+void latency_submit_untimed(void);
+
+/// The request has been handled
+void latency_end(void);
+
+/// Copy entry `index` (0 is all requests), false past the last one in use
+bool latency_get(size_t index, latency_entry_t *entry);
+
+void latency_summarize(const latency_histogram_t *histogram, latency_summary_t *summary);
+
+/// Clear all histograms
+void latency_reset(void);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __LATENCY_H
@@ -0,0 +1,47 @@
+/** \file
+  \brief Pre-encoded Mode 01 response frames
+  One ready-to-send frame is kept per ECU and supported Mode 01 PID.
+   Frames are re-encoded when the vehicle signal they depend on or the
+   ECU configuration changes, so answering a request is a table lookup
+   and a copy.
+*/
+
+#ifndef __OBD_CACHE_H
+#define __OBD_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "CAN.h"
+#include "vehicle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+/// Encode every supported PID, must be called after obd_ecu_init and before the CAN task starts
+void obd_cache_init(void);
+
+/// Re-encode the frames of all PIDs whose signal changed in the latest vehicle state
+void obd_cache_refresh(void);
+
+/// Re-encode all frames of ECU `ecu` after its configuration changed
+void obd_cache_update_ecu(uint8_t ecu);
+
+/// Copy the cached response of ECU `ecu` for `pid` into `frame`
+/// return false if the ECU does not serve the PID
+bool obd_cache_get(uint8_t ecu, uint8_t pid, CAN_frame_t *frame);
+
+/// Copy the cached responses of ECU `ecu` for up to `count` PIDs into `frames`,
+/// all encoded from the same vehicle state. Unsupported PIDs are skipped.
+/// return number of frames written
+int obd_cache_get_many(uint8_t ecu, const uint8_t *pids, int count, CAN_frame_t *frames);
+
+/// Measure request-to-frame time of the uncached and cached paths and print it
+void obd_cache_benchmark(unsigned int iterations);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __OBD_CACHE_H
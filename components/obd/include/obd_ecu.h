@@ -0,0 +1,106 @@
+/** \file
+  \brief Virtual ECUs
+  Up to OBD_ECU_MAX ECUs share the controller. ECU n answers physical
+   requests on 0x7E0 + n with response ID 0x7E8 + n (or 0x18DA<ecu>F1 /
+   0x18DAF1<ecu> with 29-bit addressing) and serves its own subset of the
+   Mode 01 PID registry. Received CAN IDs are routed through a table
+   indexed by CAN ID; functional requests reach every enabled ECU.
+   The CAN receive filter follows the request IDs of the enabled ECUs.
+*/
+
+#ifndef __OBD_ECU_H
+#define __OBD_ECU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "isotp.h"
+#include "obd_pids.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+#define OBD_ECU_MAX 8
+
+/// Functional (broadcast) request ID
+#define OBD_FUNCTIONAL_ID 0x7DF
+
+/// Physical request ID of ECU `n`
+#define OBD_ECU_REQUEST_ID(n) (0x7E0 + (n))
+
+/// Response ID of ECU `n`
+#define OBD_ECU_RESPONSE_ID(n) (0x7E8 + (n))
+
+/// 29-bit functional request ID (normal fixed addressing, target 0x33)
+#define OBD_FUNCTIONAL_ID_29 0x18DB33F1
+
+/// External test equipment address
+#define OBD_TESTER_ADDRESS 0xF1
+
+/// 29-bit node address of ECU `n`
+#define OBD_ECU_ADDRESS(n) (0x10 + (n))
+
+/// 29-bit physical request ID of ECU `n`: 0x18DA<ecu>F1
+#define OBD_ECU_REQUEST_ID_29(n) (0x18DA0000 | (OBD_ECU_ADDRESS(n) << 8) | OBD_TESTER_ADDRESS)
+
+/// 29-bit response ID of ECU `n`: 0x18DAF1<ecu>
+#define OBD_ECU_RESPONSE_ID_29(n) (0x18DA0000 | (OBD_TESTER_ADDRESS << 8) | OBD_ECU_ADDRESS(n))
+
+/// Route of a CAN ID that is not addressed to any ECU
+#define OBD_ECU_NONE 0xFF
+
+/// Route of a functional request
+#define OBD_ECU_FUNCTIONAL 0xFE
+
+/// CAN identifier length used by all ECUs
+typedef enum {
+	OBD_ADDRESSING_11BIT = 0,
+	OBD_ADDRESSING_29BIT,
+} obd_addressing_t;
+
+/// Virtual ECU
+typedef struct {
+	bool enabled;
+	isotp_addr_t addr;                    ///< tx_id: response ID, rx_id: physical request ID
+	uint32_t supported[OBD_MODE1_RANGES]; ///< Answers to range PIDs 0x00, 0x20, ... 0xE0
+} obd_ecu_t;
+
+/// Set up the default vehicle, must be called before obd_cache_init
+void obd_ecu_init(void);
+
+/// Copy ECU number `ecu`, 0 <= ecu < OBD_ECU_MAX, consistent with a concurrent reconfiguration
+void obd_ecu_get(uint8_t ecu, obd_ecu_t *copy);
+
+/// Addresses of ECU number `ecu`, 0 <= ecu < OBD_ECU_MAX
+isotp_addr_t obd_ecu_addr(uint8_t ecu);
+
+/// Route a received CAN ID, `extended` is true for 29-bit frames.
+/// For an ECU number `addr` (if not NULL) receives its addresses, from the same table
+/// return the ECU number, OBD_ECU_FUNCTIONAL or OBD_ECU_NONE
+uint8_t obd_ecu_route(uint32_t can_id, bool extended, isotp_addr_t *addr);
+
+/// Fill `order` with the enabled ECUs in bus arbitration order (ascending response ID)
+/// return number of ECUs written, at most OBD_ECU_MAX
+uint8_t obd_ecu_arbitration_order(uint8_t order[OBD_ECU_MAX]);
+
+/// Check whether ECU `ecu` answers Mode 01 `pid` (including range PIDs)
+bool obd_ecu_supports(uint8_t ecu, uint8_t pid);
+
+/// Switch all ECUs to 11-bit or 29-bit identifiers
+void obd_ecu_set_addressing(obd_addressing_t addressing);
+
+/// Current addressing mode
+obd_addressing_t obd_ecu_get_addressing(void);
+
+/// Enable or disable ECU `ecu` and select the PIDs it serves.
+/// PIDs not in the registry are ignored, range PIDs are derived.
+esp_err_t obd_ecu_configure(uint8_t ecu, bool enabled, const uint8_t *pids, size_t pid_count);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __OBD_ECU_H
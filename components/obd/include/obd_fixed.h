@@ -0,0 +1,69 @@
+/** \file
+  \brief Fixed-point counterparts of the obdRevConvert_* functions
+  Values are passed in milli-units of the physical quantity (e.g. 1500 rpm
+   is 1500000, 90.5 °C is 90500). The encoders use integer arithmetic only;
+   divisions by constants are done as a multiply and shift, so the result is
+   exact and independent of float rounding. Inputs outside a PID's range
+   saturate at the range limits.
+*/
+
+#ifndef __OBD_FIXED_H
+#define __OBD_FIXED_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+/// Scale of the fixed-point values: physical value * OBD_FIXED_SCALE
+#define OBD_FIXED_SCALE 1000
+
+/// All fixed-point reverse conversion functions adhere to this
+/// return value is number of values [A,B,C,D] filled.
+typedef int (*OBDConvFixedFunc)(int32_t val, unsigned int *A, unsigned int *B,
+	unsigned int *C, unsigned int *D);
+
+int obdRevConvertFixed_04    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_05    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_06_09 (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_0A    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_0B    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_0C    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_0D    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_0E    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_0F    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_10    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_11    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_14_1B (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_1F    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_21    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_22    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_23    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_24_2B (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_2C    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_2D    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_2E    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_2F    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_30    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_31    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_32    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_33    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_34_3B (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_3C_3F (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_42    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_43    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_44    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_45    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_46    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_47_4B (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_4C    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_4D    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_4E    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+int obdRevConvertFixed_52    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __OBD_FIXED_H
@@ -0,0 +1,71 @@
+/** \file
+  \brief Mode 01 PID registry
+  Every Mode 01 PID the emulator answers is listed once in OBD_MODE1_PIDS.
+   The lookup table and the supported-PID bitmaps (PIDs 0x00, 0x20, ... 0xE0)
+   are both generated from that list at compile time, so they cannot drift.
+*/
+
+#ifndef __OBD_PIDS_H
+#define __OBD_PIDS_H
+
+#include <stdint.h>
+
+#include "obd_fixed.h"
+#include "vehicle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+/// Served Mode 01 PIDs: X(ctx, pid, fixed-point reverse conversion function, vehicle signal)
+#define OBD_MODE1_PIDS(X, ctx) \
+	X(ctx, 0x05, obdRevConvertFixed_05, VEHICLE_COOLANT) \
+	X(ctx, 0x0C, obdRevConvertFixed_0C, VEHICLE_RPM) \
+	X(ctx, 0x0D, obdRevConvertFixed_0D, VEHICLE_SPEED) \
+	X(ctx, 0x11, obdRevConvertFixed_11, VEHICLE_THROTTLE) \
+	X(ctx, 0x2F, obdRevConvertFixed_2F, VEHICLE_FUEL_LEVEL)
+
+/// Bit of PID `pid` in the bitmap returned for the range PID `base`.
+/// PID base+1 is the MSB of byte A, PID base+0x20 the LSB of byte D.
+#define OBD_PID_BIT(base, pid) \
+	(((pid) > (base) && (pid) <= (base) + 0x20) ? (UINT32_C(1) << ((base) + 0x20 - (pid))) : 0)
+
+/// Range PID base+0x20 is supported as soon as any PID above it is served
+#define OBD_NEXT_RANGE_BIT(base, pid) (((pid) > (base) + 0x20) ? UINT32_C(1) : 0)
+
+#define OBD_BITMAP_TERM(base, pid, conv, sig) | OBD_PID_BIT(base, pid) | OBD_NEXT_RANGE_BIT(base, pid)
+
+/// Supported PID bitmap for range PID `base`, as a constant expression
+#define OBD_MODE1_BITMAP(base) ((uint32_t)(0 OBD_MODE1_PIDS(OBD_BITMAP_TERM, base)))
+
+#define OBD_MODE1_RANGES 8
+
+#define OBD_COUNT_TERM(ctx, pid, conv, sig) + 1
+
+/// Number of served Mode 01 PIDs, excluding range PIDs
+#define OBD_MODE1_PID_COUNT (0 OBD_MODE1_PIDS(OBD_COUNT_TERM, 0))
+
+/// Mode 01 PID descriptor
+typedef struct {
+	OBDConvFixedFunc convert; ///< NULL if the PID is not served
+	vehicle_signal_t signal;  ///< signal passed to convert
+} obd_pid_desc_t;
+
+/// Descriptor for every possible PID, indexed by PID
+extern const obd_pid_desc_t obd_mode1_pids[256];
+
+/// Supported PID bitmaps for range PIDs 0x00, 0x20, ... 0xE0
+extern const uint32_t obd_mode1_supported[OBD_MODE1_RANGES];
+
+/// Check whether a Mode 01 PID (including range PIDs) is answered
+int obd_mode1_is_supported(uint8_t pid);
+
+/// Encode the data bytes of a Mode 01 response for `pid` from `state` into data[0..3]
+/// return number of data bytes written, 0 if the PID is not supported
+int obd_mode1_encode(uint8_t pid, const vehicle_state_t *state, uint8_t *data);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __OBD_PIDS_H
@@ -0,0 +1,29 @@
+/** \file
+  \brief OBD-II request handling
+  Frames received by the CAN driver are routed to the virtual ECU they are
+   addressed to (see obd_ecu.h) and reassembled by the ISO-TP layer; Mode 01
+   requests are answered from the pre-encoded frames of obd_cache.h, Mode 09
+   (VIN) through ISO-TP. Nothing here depends on Wi-Fi, HTTP or the file
+   system, so the responder also runs on the linux target.
+*/
+
+#ifndef __OBD_RESPONDER_H
+#define __OBD_RESPONDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+/// Requests are handled in the CAN RX task. Set to 1 to pass frames through a
+/// queue to the CAN task instead, to compare the RX -> TX latency of both paths
+#define OBD_RX_QUEUED 0
+
+/// Start the CAN driver and answer requests from then on.
+/// obd_ecu_init and obd_cache_init must have been called.
+void obd_responder_start(void);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __OBD_RESPONDER_H
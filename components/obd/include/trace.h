@@ -0,0 +1,101 @@
+/** \file
+  \brief CAN frame trace
+  Received and transmitted frames are recorded in binary into a lock-free
+   ring by the CAN tasks (a copy and a compare-and-swap per frame); a
+   low-priority drain task formats them off the CAN path. Output lines are
+   candump log lines, so a trace written to the FAT partition can be
+   replayed as is:
+
+      (81.234567) can0 7DF#0201050000000000 R
+      (81.234810) can0 7E8#03410583AAAAAAAA T
+
+  The latest frames are kept for GET /api/trace. A frame that finds the
+   ring full is dropped and counted.
+
+  The verbosity level is set at run time: at TRACE_OFF no hook is
+   installed and the CAN tasks pay nothing, TRACE_DEBUG also enables the
+   request handling messages.
+*/
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+typedef enum {
+	TRACE_OFF = 0,    ///< nothing is recorded
+	TRACE_FRAMES = 1, ///< every frame is recorded
+	TRACE_DEBUG = 2,  ///< frames and request handling messages
+} trace_level_t;
+
+/// Output to the serial console
+#define TRACE_SINK_SERIAL (1u << 0)
+/// Output appended to TRACE_FILE_PATH
+#define TRACE_SINK_FILE   (1u << 1)
+
+#define TRACE_FILE_PATH "/spiflash/trace.log"
+
+/// Frames kept for trace_get_recent
+#define TRACE_RECENT 32
+
+/// Length of a line written by trace_format, including the NUL
+#define TRACE_LINE_MAX 64
+
+#define TRACE_FLAG_TX  (1u << 0) ///< transmitted, received otherwise
+#define TRACE_FLAG_EXT (1u << 1) ///< 29-bit identifier
+#define TRACE_FLAG_RTR (1u << 2) ///< remote frame
+
+typedef struct {
+	int64_t time_us; ///< esp_timer time of reception or end of transmission
+	uint32_t id;
+	uint8_t dlc;
+	uint8_t flags;   ///< TRACE_FLAG_*
+	uint8_t data[8];
+} trace_record_t;
+
+typedef struct {
+	trace_level_t level;
+	uint32_t sinks;       ///< TRACE_SINK_*
+	uint32_t recorded;    ///< frames written into the ring
+	uint32_t dropped;     ///< frames lost on a full ring
+	uint32_t drained;     ///< frames taken out by the drain task
+	uint32_t file_errors; ///< failed writes to TRACE_FILE_PATH
+} trace_stats_t;
+
+/// Current level, read through trace_get_level
+extern volatile uint8_t trace_level;
+
+/// Create the drain task, must be called once before trace_set_level
+void trace_init(void);
+
+void trace_set_level(trace_level_t level);
+
+static inline trace_level_t trace_get_level(void)
+{
+	return (trace_level_t)trace_level;
+}
+
+/// Select the outputs (TRACE_SINK_*); fails when the trace file cannot be opened
+esp_err_t trace_set_sinks(uint32_t sinks);
+
+void trace_get_stats(trace_stats_t *stats);
+
+/// Copy up to `max` of the latest frames, oldest first; returns the number copied
+size_t trace_get_recent(trace_record_t *records, size_t max);
+
+/// Format `record` as a candump log line without newline; returns its length
+int trace_format(const trace_record_t *record, char *line, size_t size);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __TRACE_H
@@ -0,0 +1,62 @@
+#ifndef __VEHICLE_H
+#define __VEHICLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "obd_fixed.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+/// Emulated vehicle signals; values are stored in milli-units of the listed physical unit
+/// (VEHICLE_SCALE), as expected by the obdRevConvertFixed_* functions
+typedef enum {
+	VEHICLE_SPEED,      ///< km/h
+	VEHICLE_RPM,        ///< rpm
+	VEHICLE_THROTTLE,   ///< %
+	VEHICLE_COOLANT,    ///< °C
+	VEHICLE_FUEL_LEVEL, ///< %
+	VEHICLE_SIGNAL_COUNT
+} vehicle_signal_t;
+
+#define VEHICLE_SCALE OBD_FIXED_SCALE
+
+#define VEHICLE_VIN_LEN 17
+
+/// Complete vehicle state. Published through a sequence lock: writers
+/// (httpd, simulation tasks) replace fields atomically, readers (CAN task)
+/// copy a consistent snapshot without blocking.
+typedef struct {
+	int32_t signals[VEHICLE_SIGNAL_COUNT];
+	char vin[VEHICLE_VIN_LEN]; ///< not NUL terminated
+} vehicle_state_t;
+
+/// Copy a consistent snapshot of the whole state
+void vehicle_read(vehicle_state_t *state);
+
+/// Latest value of a single signal
+int32_t vehicle_get_signal(vehicle_signal_t signal);
+
+void vehicle_set_signal(vehicle_signal_t signal, int32_t value);
+
+/// Publish `count` signals at once; readers see either none or all of them
+void vehicle_set_signals(const vehicle_signal_t *signals, const int32_t *values, size_t count);
+
+/// Set the VIN from a string, shorter VINs are padded with NULs
+void vehicle_set_vin(const char *vin);
+
+/// Parse a decimal string ("-12.5") into milli-units without going through float,
+/// saturating at +/-INT32_MAX
+int32_t vehicle_parse_value(const char *str);
+
+/// Look up a signal by its API name ("speed", "rpm", ...)
+/// return VEHICLE_SIGNAL_COUNT if the name is unknown
+vehicle_signal_t vehicle_signal_from_name(const char *name);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __VEHICLE_H
@@ -0,0 +1,204 @@
+/** \file
+  \brief Request latency histograms, see latency.h
+*/
+
+#include "latency.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+// No key: the request is only counted towards all requests
+#define LATENCY_NO_KEY 0
+
+// RX -> submit travels with the frame as the TX callback argument, below the key
+#define LATENCY_ARG_KEY_BITS 8
+#define LATENCY_ARG_MAX_US ((UINT32_MAX >> LATENCY_ARG_KEY_BITS))
+
+const uint32_t latency_bounds_us[LATENCY_BINS - 1] = {
+	25, 50, 75, 100, 150, 200, 300, 400, 500, 750,
+	1000, 1500, 2000, 3000, 5000, 7500, 10000, 20000, 50000
+};
+
+// Entry 0 is all requests, the keys follow in the order they were seen
+static latency_entry_t latency_entries[1 + LATENCY_KEYS] = { [0] = { .all = true } };
+static size_t latency_entry_count = 1;
+// Guards latency_entries; written by the request handler and the CAN alert task, read by httpd and the console
+static portMUX_TYPE latency_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Request being timed, only touched by the task handling requests
+static bool latency_active;
+static bool latency_dispatch_recorded;
+static int64_t latency_rx_us;
+static int64_t latency_dispatch_us;
+static uint8_t latency_key;
+
+static uint8_t latency_bin(uint32_t us)
+{
+	uint8_t bin = 0;
+	while (bin < LATENCY_BINS - 1 && us > latency_bounds_us[bin]) {
+		bin++;
+	}
+	return bin;
+}
+
+static void latency_add(latency_histogram_t *histogram, uint8_t bin, uint32_t us)
+{
+	histogram->count++;
+	histogram->total_us += us;
+	histogram->bins[bin]++;
+	if (us > histogram->max_us) {
+		histogram->max_us = us;
+	}
+}
+
+static void latency_record(uint8_t key, latency_stage_t stage, uint32_t us)
+{
+	uint8_t bin = latency_bin(us);
+
+	portENTER_CRITICAL(&latency_mux);
+	latency_add(&latency_entries[0].stages[stage], bin, us);
+	if (key != LATENCY_NO_KEY) {
+		latency_add(&latency_entries[key].stages[stage], bin, us);
+	}
+	portEXIT_CRITICAL(&latency_mux);
+}
+
+// TX completion of a timed response, runs in the CAN alert task
+static void latency_tx_done(const CAN_frame_t *frame, CAN_tx_status_t status, uint32_t latency_us, void *arg)
+{
+	if (status != CAN_TX_DONE) {
+		return;
+	}
+	uintptr_t packed = (uintptr_t)arg;
+	uint8_t key = packed & ((1u << LATENCY_ARG_KEY_BITS) - 1);
+	uint32_t rx_to_submit = packed >> LATENCY_ARG_KEY_BITS;
+
+	latency_record(key, LATENCY_SUBMIT_TO_TX, latency_us);
+	latency_record(key, LATENCY_RX_TO_TX, rx_to_submit + latency_us);
+}
+
+void latency_begin(int64_t rx_time_us)
+{
+	latency_active = true;
+	latency_dispatch_recorded = false;
+	latency_rx_us = rx_time_us;
+	latency_dispatch_us = esp_timer_get_time();
+	latency_key = LATENCY_NO_KEY;
+}
+
+void latency_set_key(uint8_t service, uint8_t pid)
+{
+	if (!latency_active) {
+		return;
+	}
+
+	portENTER_CRITICAL(&latency_mux);
+	size_t i = 1;
+	while (i < latency_entry_count && (latency_entries[i].service != service || latency_entries[i].pid != pid)) {
+		i++;
+	}
+	if (i == latency_entry_count && i < 1 + LATENCY_KEYS) {
+		memset(&latency_entries[i], 0, sizeof(latency_entries[i]));
+		latency_entries[i].service = service;
+		latency_entries[i].pid = pid;
+		latency_entry_count++;
+	}
+	portEXIT_CRITICAL(&latency_mux);
+
+	latency_key = (i < latency_entry_count) ? (uint8_t)i : LATENCY_NO_KEY;
+}
+
+// Account the stages up to a response being queued; returns RX -> submit
+static uint32_t latency_submitted(void)
+{
+	int64_t now = esp_timer_get_time();
+
+	// Functional requests are answered by several ECUs, the request reached the handler once
+	if (!latency_dispatch_recorded) {
+		latency_record(latency_key, LATENCY_RX_TO_DISPATCH, (uint32_t)(latency_dispatch_us - latency_rx_us));
+		latency_dispatch_recorded = true;
+	}
+	latency_record(latency_key, LATENCY_DISPATCH_TO_SUBMIT, (uint32_t)(now - latency_dispatch_us));
+	return (uint32_t)(now - latency_rx_us);
+}
+
+void latency_submit(CAN_tx_options_t *options)
+{
+	if (!latency_active) {
+		return;
+	}
+	uint32_t rx_to_submit = latency_submitted();
+	if (rx_to_submit > LATENCY_ARG_MAX_US) {
+		rx_to_submit = LATENCY_ARG_MAX_US;
+	}
+
+	options->callback = &latency_tx_done;
+	options->arg = (void *)(((uintptr_t)rx_to_submit << LATENCY_ARG_KEY_BITS) | latency_key);
+}
+
+void latency_submit_untimed(void)
+{
+	if (latency_active) {
+		latency_submitted();
+	}
+}
+
+void latency_end(void)
+{
+	latency_active = false;
+}
+
+bool latency_get(size_t index, latency_entry_t *entry)
+{
+	bool found = false;
+
+	portENTER_CRITICAL(&latency_mux);
+	if (index < latency_entry_count) {
+		*entry = latency_entries[index];
+		found = true;
+	}
+	portEXIT_CRITICAL(&latency_mux);
+
+	return found;
+}
+
+// Upper bound of the bin holding the `percent` percentile
+static uint32_t latency_percentile(const latency_histogram_t *histogram, uint32_t percent)
+{
+	uint32_t rank = (uint32_t)(((uint64_t)histogram->count * percent + 99) / 100);
+	uint32_t seen = 0;
+
+	for (uint8_t bin = 0; bin < LATENCY_BINS - 1; bin++) {
+		seen += histogram->bins[bin];
+		if (seen >= rank) {
+			return latency_bounds_us[bin] < histogram->max_us ? latency_bounds_us[bin] : histogram->max_us;
+		}
+	}
+	return histogram->max_us;
+}
+
+void latency_summarize(const latency_histogram_t *histogram, latency_summary_t *summary)
+{
+	memset(summary, 0, sizeof(*summary));
+	if (histogram->count == 0) {
+		return;
+	}
+	summary->count = histogram->count;
+	summary->avg_us = (uint32_t)(histogram->total_us / histogram->count);
+	summary->p50_us = latency_percentile(histogram, 50);
+	summary->p95_us = latency_percentile(histogram, 95);
+	summary->p99_us = latency_percentile(histogram, 99);
+	summary->max_us = histogram->max_us;
+}
+
+void latency_reset(void)
+{
+	// Keys stay in place, a request being timed may hold one
+	portENTER_CRITICAL(&latency_mux);
+	for (size_t i = 0; i < latency_entry_count; i++) {
+		memset(latency_entries[i].stages, 0, sizeof(latency_entries[i].stages));
+	}
+	portEXIT_CRITICAL(&latency_mux);
+}
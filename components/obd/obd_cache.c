@@ -0,0 +1,211 @@
+/** \file
+  \brief Pre-encoded Mode 01 response frames, see obd_cache.h
+*/
+
+#include "obd_cache.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+#include "obd_ecu.h"
+#include "obd_pids.h"
+
+#define OBD_CACHE_SLOTS (OBD_MODE1_PID_COUNT + OBD_MODE1_RANGES)
+#define OBD_CACHE_NONE 0xFF
+
+_Static_assert(OBD_CACHE_SLOTS < OBD_CACHE_NONE, "too many PIDs for the cache slot index");
+
+static CAN_frame_t obd_cache_frames[OBD_ECU_MAX][OBD_CACHE_SLOTS];
+static uint8_t obd_cache_pid[OBD_CACHE_SLOTS];
+static uint8_t obd_cache_slot[256];
+static vehicle_state_t obd_cache_state; // snapshot the frames were encoded from
+static uint8_t obd_cache_used;
+
+// Guards obd_cache_frames; writers run in the httpd workers, readers in the CAN task
+static portMUX_TYPE obd_cache_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Serializes writers while they encode, never taken by the CAN task
+static SemaphoreHandle_t obd_cache_lock;
+
+static void obd_cache_encode(const obd_ecu_t *e, uint8_t pid, const vehicle_state_t *state, CAN_frame_t *frame)
+{
+	frame->MsgID = e->addr.tx_id;
+	frame->FIR.U = 0;
+	frame->FIR.B.DLC = 8;
+	frame->FIR.B.FF = e->addr.extended ? CAN_frame_ext : CAN_frame_std;
+	frame->FIR.B.RTR = CAN_no_RTR;
+	frame->data.u32[0] = 0;
+	frame->data.u32[1] = 0; // 0x00 is standard padding
+	frame->data.u8[1] = 0x41; // Mode 1 (+ 0x40)
+	frame->data.u8[2] = pid;
+
+	if ((pid & 0x1F) == 0) {
+		// Range PIDs announce what this ECU serves, not the whole registry
+		uint32_t bitmap = e->supported[pid >> 5];
+		frame->data.u8[3] = (uint8_t)(bitmap >> 24);
+		frame->data.u8[4] = (uint8_t)(bitmap >> 16);
+		frame->data.u8[5] = (uint8_t)(bitmap >> 8);
+		frame->data.u8[6] = (uint8_t)bitmap;
+		frame->data.u8[0] = 6;
+	} else {
+		frame->data.u8[0] = 2 + obd_mode1_encode(pid, state, &frame->data.u8[3]);
+	}
+}
+
+void obd_cache_init(void)
+{
+	obd_cache_lock = xSemaphoreCreateMutex();
+	memset(obd_cache_slot, OBD_CACHE_NONE, sizeof(obd_cache_slot));
+	obd_cache_used = 0;
+
+	for (int pid = 0; pid < 256; pid++) {
+		if (obd_mode1_is_supported(pid)) {
+			obd_cache_pid[obd_cache_used] = pid;
+			obd_cache_slot[pid] = obd_cache_used;
+			obd_cache_used++;
+		}
+	}
+
+	vehicle_read(&obd_cache_state);
+
+	for (uint8_t ecu = 0; ecu < OBD_ECU_MAX; ecu++) {
+		obd_cache_update_ecu(ecu);
+	}
+}
+
+void obd_cache_update_ecu(uint8_t ecu)
+{
+	obd_ecu_t e;
+	CAN_frame_t frame;
+
+	xSemaphoreTake(obd_cache_lock, portMAX_DELAY);
+	obd_ecu_get(ecu, &e);
+
+	// Every slot is kept valid, so a PID enabled later never exposes a stale frame
+	for (uint8_t slot = 0; slot < obd_cache_used; slot++) {
+		obd_cache_encode(&e, obd_cache_pid[slot], &obd_cache_state, &frame);
+
+		portENTER_CRITICAL(&obd_cache_mux);
+		obd_cache_frames[ecu][slot] = frame;
+		portEXIT_CRITICAL(&obd_cache_mux);
+	}
+
+	xSemaphoreGive(obd_cache_lock);
+}
+
+void obd_cache_refresh(void)
+{
+	vehicle_state_t state;
+	CAN_frame_t staged[OBD_CACHE_SLOTS];
+	uint8_t staged_slot[OBD_CACHE_SLOTS];
+	uint8_t staged_count = 0;
+	obd_ecu_t engine;
+	isotp_addr_t addrs[OBD_ECU_MAX];
+
+	xSemaphoreTake(obd_cache_lock, portMAX_DELAY);
+	obd_ecu_get(0, &engine);
+	for (uint8_t ecu = 0; ecu < OBD_ECU_MAX; ecu++) {
+		addrs[ecu] = obd_ecu_addr(ecu);
+	}
+
+	// Always encode the latest snapshot, so the last of several concurrent writers wins
+	vehicle_read(&state);
+
+	for (uint8_t slot = 0; slot < obd_cache_used; slot++) {
+		const obd_pid_desc_t *desc = &obd_mode1_pids[obd_cache_pid[slot]];
+		if (desc->convert == NULL || state.signals[desc->signal] == obd_cache_state.signals[desc->signal]) {
+			continue;
+		}
+		// Data bytes do not depend on the ECU, only the ID is patched per ECU below
+		obd_cache_encode(&engine, obd_cache_pid[slot], &state, &staged[staged_count]);
+		staged_slot[staged_count++] = slot;
+	}
+
+	// Swap all changed frames at once, so a multi-PID response never mixes two states
+	portENTER_CRITICAL(&obd_cache_mux);
+	for (uint8_t ecu = 0; ecu < OBD_ECU_MAX; ecu++) {
+		for (uint8_t i = 0; i < staged_count; i++) {
+			CAN_frame_t *frame = &obd_cache_frames[ecu][staged_slot[i]];
+			*frame = staged[i];
+			frame->MsgID = addrs[ecu].tx_id;
+			frame->FIR.B.FF = addrs[ecu].extended ? CAN_frame_ext : CAN_frame_std;
+		}
+	}
+	portEXIT_CRITICAL(&obd_cache_mux);
+
+	obd_cache_state = state;
+	xSemaphoreGive(obd_cache_lock);
+}
+
+bool obd_cache_get(uint8_t ecu, uint8_t pid, CAN_frame_t *frame)
+{
+	uint8_t slot = obd_cache_slot[pid];
+	if (slot == OBD_CACHE_NONE || !obd_ecu_supports(ecu, pid)) {
+		return false;
+	}
+
+	portENTER_CRITICAL(&obd_cache_mux);
+	*frame = obd_cache_frames[ecu][slot];
+	portEXIT_CRITICAL(&obd_cache_mux);
+	return true;
+}
+
+int obd_cache_get_many(uint8_t ecu, const uint8_t *pids, int count, CAN_frame_t *frames)
+{
+	uint8_t slots[OBD_CACHE_SLOTS];
+	int found = 0;
+
+	for (int i = 0; i < count && found < OBD_CACHE_SLOTS; i++) {
+		uint8_t slot = obd_cache_slot[pids[i]];
+		if (slot != OBD_CACHE_NONE && obd_ecu_supports(ecu, pids[i])) {
+			slots[found++] = slot;
+		}
+	}
+
+	portENTER_CRITICAL(&obd_cache_mux);
+	for (int i = 0; i < found; i++) {
+		frames[i] = obd_cache_frames[ecu][slots[i]];
+	}
+	portEXIT_CRITICAL(&obd_cache_mux);
+	return found;
+}
+
+void obd_cache_benchmark(unsigned int iterations)
+{
+	static const uint8_t pids[] = { 0x00, 0x05, 0x0C, 0x0D, 0x11, 0x2F };
+	const unsigned int count = iterations * sizeof(pids);
+	volatile uint8_t sink = 0;
+	vehicle_state_t state;
+	CAN_frame_t frame;
+	obd_ecu_t engine;
+
+	obd_ecu_get(0, &engine);
+	int64_t start = esp_timer_get_time();
+	for (unsigned int i = 0; i < iterations; i++) {
+		for (unsigned int j = 0; j < sizeof(pids); j++) {
+			vehicle_read(&state);
+			obd_cache_encode(&engine, pids[j], &state, &frame);
+			sink += frame.data.u8[3];
+		}
+	}
+	int64_t encoded_us = esp_timer_get_time() - start;
+
+	start = esp_timer_get_time();
+	for (unsigned int i = 0; i < iterations; i++) {
+		for (unsigned int j = 0; j < sizeof(pids); j++) {
+			obd_cache_get(0, pids[j], &frame);
+			sink += frame.data.u8[3];
+		}
+	}
+	int64_t cached_us = esp_timer_get_time() - start;
+	(void)sink;
+
+	printf("OBD response benchmark (%u requests):\n", count);
+	printf("  encode on request: %" PRId64 " us total, %" PRId64 " ns/request\n", encoded_us, encoded_us * 1000 / count);
+	printf("  cached frame     : %" PRId64 " us total, %" PRId64 " ns/request\n", cached_us, cached_us * 1000 / count);
+}
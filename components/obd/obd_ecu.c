@@ -0,0 +1,234 @@
+/** \file
+  \brief Virtual ECUs, see obd_ecu.h
+*/
+
+#include "obd_ecu.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "CAN.h"
+
+#include "obd_cache.h"
+
+// Routes are indexed by the low byte of 11-bit IDs 0x700 - 0x7FF, or by the
+// target address of 29-bit physical IDs 0x18DA<target>F1
+#define OBD_ECU_DISPATCH_BASE 0x700
+#define OBD_ECU_DISPATCH_SIZE 256
+#define OBD_ECU_PHYSICAL_29_MASK 0xFFFF00FF
+#define OBD_ECU_PHYSICAL_29 (0x18DA0000 | OBD_TESTER_ADDRESS)
+
+static obd_ecu_t obd_ecus[OBD_ECU_MAX];
+static obd_addressing_t obd_ecu_addressing = OBD_ADDRESSING_11BIT;
+static uint8_t obd_ecu_dispatch[OBD_ECU_DISPATCH_SIZE];
+static uint8_t obd_ecu_order[OBD_ECU_MAX];
+static uint8_t obd_ecu_order_count;
+
+// Guards the tables above; written by the httpd workers, read by the CAN task,
+// which only ever gets copies taken under it (both cores run either side)
+static portMUX_TYPE obd_ecu_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Default vehicle: an engine ECU serving every registered PID and a transmission ECU
+#define OBD_ECU_PID_ENTRY(ctx, pid, conv, sig) pid,
+static const uint8_t obd_ecu_engine_pids[] = { OBD_MODE1_PIDS(OBD_ECU_PID_ENTRY, 0) };
+static const uint8_t obd_ecu_transmission_pids[] = { 0x0C, 0x0D };
+
+// Dispatch table index of a physical request ID in the current addressing mode
+static inline uint32_t obd_ecu_dispatch_index(uint32_t can_id)
+{
+	if (obd_ecu_addressing == OBD_ADDRESSING_29BIT) {
+		return (can_id >> 8) & 0xFF;
+	}
+	return can_id - OBD_ECU_DISPATCH_BASE;
+}
+
+// Rebuild the dispatch table and arbitration order, obd_ecu_mux held
+static void obd_ecu_rebuild(void)
+{
+	memset(obd_ecu_dispatch, OBD_ECU_NONE, sizeof(obd_ecu_dispatch));
+	if (obd_ecu_addressing == OBD_ADDRESSING_11BIT) {
+		obd_ecu_dispatch[OBD_FUNCTIONAL_ID - OBD_ECU_DISPATCH_BASE] = OBD_ECU_FUNCTIONAL;
+	}
+	obd_ecu_order_count = 0;
+
+	for (uint8_t ecu = 0; ecu < OBD_ECU_MAX; ecu++) {
+		if (!obd_ecus[ecu].enabled) {
+			continue;
+		}
+		obd_ecu_dispatch[obd_ecu_dispatch_index(obd_ecus[ecu].addr.rx_id)] = ecu;
+
+		// Lowest response ID wins arbitration when all ECUs answer at once
+		uint8_t i = obd_ecu_order_count++;
+		while (i > 0 && obd_ecus[obd_ecu_order[i - 1]].addr.tx_id > obd_ecus[ecu].addr.tx_id) {
+			obd_ecu_order[i] = obd_ecu_order[i - 1];
+			i--;
+		}
+		obd_ecu_order[i] = ecu;
+	}
+}
+
+// Receive only the functional ID and the request IDs of enabled ECUs
+static void obd_ecu_update_filter(void)
+{
+	uint32_t ids[OBD_ECU_MAX + 1];
+	size_t count = 0;
+
+	portENTER_CRITICAL(&obd_ecu_mux);
+	bool extended = obd_ecu_addressing == OBD_ADDRESSING_29BIT;
+	ids[count++] = extended ? OBD_FUNCTIONAL_ID_29 : OBD_FUNCTIONAL_ID;
+	for (uint8_t i = 0; i < obd_ecu_order_count; i++) {
+		ids[count++] = obd_ecus[obd_ecu_order[i]].addr.rx_id;
+	}
+	portEXIT_CRITICAL(&obd_ecu_mux);
+
+	CAN_set_filter(ids, count, extended);
+}
+
+static void obd_ecu_apply(uint8_t ecu, bool enabled, const uint8_t *pids, size_t pid_count)
+{
+	uint32_t supported[OBD_MODE1_RANGES] = { 0 };
+
+	for (size_t i = 0; i < pid_count; i++) {
+		uint8_t pid = pids[i];
+		if ((pid & 0x1F) != 0 && obd_mode1_pids[pid].convert != NULL) {
+			supported[pid >> 5] |= OBD_PID_BIT(pid & 0xE0, pid);
+		}
+	}
+
+	// Range PID base+0x20 is announced when anything above it is served
+	for (int range = OBD_MODE1_RANGES - 2; range >= 0; range--) {
+		if (supported[range + 1] != 0) {
+			supported[range] |= 1;
+		}
+	}
+
+	portENTER_CRITICAL(&obd_ecu_mux);
+	obd_ecus[ecu].enabled = enabled;
+	memcpy(obd_ecus[ecu].supported, supported, sizeof(supported));
+	obd_ecu_rebuild();
+	portEXIT_CRITICAL(&obd_ecu_mux);
+
+	obd_ecu_update_filter();
+}
+
+void obd_ecu_init(void)
+{
+	for (uint8_t ecu = 0; ecu < OBD_ECU_MAX; ecu++) {
+		obd_ecus[ecu].enabled = false;
+		obd_ecus[ecu].addr.tx_id = OBD_ECU_RESPONSE_ID(ecu);
+		obd_ecus[ecu].addr.rx_id = OBD_ECU_REQUEST_ID(ecu);
+		obd_ecus[ecu].addr.extended = false;
+		memset(obd_ecus[ecu].supported, 0, sizeof(obd_ecus[ecu].supported));
+	}
+
+	obd_ecu_apply(0, true, obd_ecu_engine_pids, sizeof(obd_ecu_engine_pids));
+	obd_ecu_apply(1, true, obd_ecu_transmission_pids, sizeof(obd_ecu_transmission_pids));
+}
+
+void obd_ecu_get(uint8_t ecu, obd_ecu_t *copy)
+{
+	portENTER_CRITICAL(&obd_ecu_mux);
+	*copy = obd_ecus[ecu];
+	portEXIT_CRITICAL(&obd_ecu_mux);
+}
+
+isotp_addr_t obd_ecu_addr(uint8_t ecu)
+{
+	portENTER_CRITICAL(&obd_ecu_mux);
+	isotp_addr_t addr = obd_ecus[ecu].addr;
+	portEXIT_CRITICAL(&obd_ecu_mux);
+	return addr;
+}
+
+// Route of `can_id` in the current tables, obd_ecu_mux held
+static uint8_t obd_ecu_route_locked(uint32_t can_id, bool extended)
+{
+	if (extended != (obd_ecu_addressing == OBD_ADDRESSING_29BIT)) {
+		return OBD_ECU_NONE;
+	}
+
+	if (extended) {
+		if ((can_id & OBD_ECU_PHYSICAL_29_MASK) != OBD_ECU_PHYSICAL_29) {
+			return can_id == OBD_FUNCTIONAL_ID_29 ? OBD_ECU_FUNCTIONAL : OBD_ECU_NONE;
+		}
+	} else if (can_id - OBD_ECU_DISPATCH_BASE >= OBD_ECU_DISPATCH_SIZE) {
+		return OBD_ECU_NONE;
+	}
+	return obd_ecu_dispatch[obd_ecu_dispatch_index(can_id)];
+}
+
+uint8_t obd_ecu_route(uint32_t can_id, bool extended, isotp_addr_t *addr)
+{
+	portENTER_CRITICAL(&obd_ecu_mux);
+	uint8_t route = obd_ecu_route_locked(can_id, extended);
+	if (addr != NULL && route < OBD_ECU_MAX) {
+		*addr = obd_ecus[route].addr;
+	}
+	portEXIT_CRITICAL(&obd_ecu_mux);
+	return route;
+}
+
+uint8_t obd_ecu_arbitration_order(uint8_t order[OBD_ECU_MAX])
+{
+	portENTER_CRITICAL(&obd_ecu_mux);
+	uint8_t count = obd_ecu_order_count;
+	memcpy(order, obd_ecu_order, count);
+	portEXIT_CRITICAL(&obd_ecu_mux);
+	return count;
+}
+
+bool obd_ecu_supports(uint8_t ecu, uint8_t pid)
+{
+	const obd_ecu_t *e = &obd_ecus[ecu];
+	bool supported;
+
+	portENTER_CRITICAL(&obd_ecu_mux);
+	if (!e->enabled) {
+		supported = false;
+	} else if ((pid & 0x1F) == 0) {
+		// Range PID 0x00 is mandatory, the others are announced by the previous range
+		supported = pid == 0 || (e->supported[(pid >> 5) - 1] & 1);
+	} else {
+		supported = (e->supported[pid >> 5] & OBD_PID_BIT(pid & 0xE0, pid)) != 0;
+	}
+	portEXIT_CRITICAL(&obd_ecu_mux);
+	return supported;
+}
+
+void obd_ecu_set_addressing(obd_addressing_t addressing)
+{
+	bool extended = addressing == OBD_ADDRESSING_29BIT;
+
+	portENTER_CRITICAL(&obd_ecu_mux);
+	obd_ecu_addressing = addressing;
+	for (uint8_t ecu = 0; ecu < OBD_ECU_MAX; ecu++) {
+		obd_ecus[ecu].addr.tx_id = extended ? OBD_ECU_RESPONSE_ID_29(ecu) : OBD_ECU_RESPONSE_ID(ecu);
+		obd_ecus[ecu].addr.rx_id = extended ? OBD_ECU_REQUEST_ID_29(ecu) : OBD_ECU_REQUEST_ID(ecu);
+		obd_ecus[ecu].addr.extended = extended;
+	}
+	obd_ecu_rebuild();
+	portEXIT_CRITICAL(&obd_ecu_mux);
+	obd_ecu_update_filter();
+
+	// Cached frames carry the response ID
+	for (uint8_t ecu = 0; ecu < OBD_ECU_MAX; ecu++) {
+		obd_cache_update_ecu(ecu);
+	}
+}
+
+obd_addressing_t obd_ecu_get_addressing(void)
+{
+	return obd_ecu_addressing;
+}
+
+esp_err_t obd_ecu_configure(uint8_t ecu, bool enabled, const uint8_t *pids, size_t pid_count)
+{
+	if (ecu >= OBD_ECU_MAX || (pids == NULL && pid_count > 0)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	obd_ecu_apply(ecu, enabled, pids, pid_count);
+	obd_cache_update_ecu(ecu);
+	return ESP_OK;
+}
@@ -0,0 +1,239 @@
+/** \file
+  \brief Fixed-point functions to convert from values back to OBDII output, see obd_fixed.h
+*/
+
+#include "obd_fixed.h"
+
+// floor(x / d) for a constant d > 0 as a 32x32->64 bit multiply and shift.
+// With s = 32 + floor(log2(d)) the reciprocal ceil(2^s / d) fits in 32 bits
+// and the result is exact for every x < 2^31. All operands are constants, so
+// the compiler folds the reciprocal; no division is left in the generated code.
+#define OBD_FX_SHIFT(d) (63 - __builtin_clz(d))
+#define OBD_FX_RECIP(d) ((((uint64_t)1 << OBD_FX_SHIFT(d)) + (d) - 1) / (d))
+#define OBD_FX_DIV(x, d) ((uint32_t)(((uint64_t)(uint32_t)(x) * OBD_FX_RECIP(d)) >> OBD_FX_SHIFT(d)))
+
+static inline uint32_t obd_fx_range(int32_t val, int32_t lo, int32_t hi)
+{
+	if (val < lo) {
+		val = lo;
+	} else if (val > hi) {
+		val = hi;
+	}
+	return (uint32_t)(val - lo);
+}
+
+static inline int obd_fx_1(uint32_t raw, unsigned int *A)
+{
+	*A = raw > 0xFF ? 0xFF : raw;
+	return 1;
+}
+
+static inline int obd_fx_2(uint32_t raw, unsigned int *A, unsigned int *B)
+{
+	if (raw > 0xFFFF) {
+		raw = 0xFFFF;
+	}
+	*A = raw >> 8;
+	*B = raw & 0xFF;
+	return 2;
+}
+
+
+int obdRevConvertFixed_04    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// 255 * val / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 100000) * 255, 100000), A);
+}
+
+
+int obdRevConvertFixed_05    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, -40000, 215000), 1000), A);
+}
+
+
+int obdRevConvertFixed_06_09 (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// (val + 100) * 128 / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, -100000, 99219) * 128, 100000), A);
+}
+
+
+int obdRevConvertFixed_0A    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 765000), 3000), A);
+}
+
+
+int obdRevConvertFixed_0B    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 255000), 1000), A);
+}
+
+
+int obdRevConvertFixed_0C    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 16383750), 250), A, B);
+}
+
+
+int obdRevConvertFixed_0D    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 255000), 1000), A);
+}
+
+
+int obdRevConvertFixed_0E    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, -64000, 63500), 500), A);
+}
+
+
+int obdRevConvertFixed_0F    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, -40000, 215000), 1000), A);
+}
+
+
+int obdRevConvertFixed_10    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 655350), 10), A, B);
+}
+
+
+int obdRevConvertFixed_11    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// 255 * val / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 100000) * 255, 100000), A);
+}
+
+
+int obdRevConvertFixed_14_1B (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 1275), 5), A);
+}
+
+
+int obdRevConvertFixed_1F    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 65535000), 1000), A, B);
+}
+
+
+int obdRevConvertFixed_21    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 65535000), 1000), A, B);
+}
+
+
+int obdRevConvertFixed_22    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 5177265), 79), A, B);
+}
+
+
+int obdRevConvertFixed_23    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 655350000), 10000), A, B);
+}
+
+
+int obdRevConvertFixed_24_2B (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// val / 0.0000305 = val * 2000 / 61 in milli-units
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 1999) * 2000, 61), A, B);
+}
+
+
+int obdRevConvertFixed_2C    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// 255 * val / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 100000) * 255, 100000), A);
+}
+
+
+int obdRevConvertFixed_2D    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// (val + 100) * 128 / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, -100000, 99219) * 128, 100000), A);
+}
+
+
+int obdRevConvertFixed_2E    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// 255 * val / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 100000) * 255, 100000), A);
+}
+
+
+int obdRevConvertFixed_2F    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// 255 * val / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 100000) * 255, 100000), A);
+}
+
+
+int obdRevConvertFixed_30    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 255000), 1000), A);
+}
+
+
+int obdRevConvertFixed_31    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 65535000), 1000), A, B);
+}
+
+
+int obdRevConvertFixed_32    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, -8192000, 8191750), 250), A, B);
+}
+
+
+int obdRevConvertFixed_33    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 255000), 1000), A);
+}
+
+
+int obdRevConvertFixed_34_3B (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// val / 0.0000305 = val * 2000 / 61 in milli-units
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 1999) * 2000, 61), A, B);
+}
+
+
+int obdRevConvertFixed_3C_3F (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, -40000, 6513500), 100), A, B);
+}
+
+
+int obdRevConvertFixed_42    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(obd_fx_range(val, 0, 65535), A, B);
+}
+
+
+int obdRevConvertFixed_43    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// 255 * val / 100 = 51 * val / 20 in milli-units
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 25700000) * 51, 20000), A, B);
+}
+
+
+int obdRevConvertFixed_44    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// val / 0.0000305 = val * 2000 / 61 in milli-units
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 1999) * 2000, 61), A, B);
+}
+
+
+int obdRevConvertFixed_45    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// 255 * val / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 100000) * 255, 100000), A);
+}
+
+
+int obdRevConvertFixed_46    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, -40000, 215000), 1000), A);
+}
+
+
+int obdRevConvertFixed_47_4B (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// 255 * val / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 100000) * 255, 100000), A);
+}
+
+
+int obdRevConvertFixed_4C    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// 255 * val / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 100000) * 255, 100000), A);
+}
+
+
+int obdRevConvertFixed_4D    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 65535000), 1000), A, B);
+}
+
+
+int obdRevConvertFixed_4E    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	return obd_fx_2(OBD_FX_DIV(obd_fx_range(val, 0, 65535000), 1000), A, B);
+}
+
+
+int obdRevConvertFixed_52    (int32_t val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	// 255 * val / 100
+	return obd_fx_1(OBD_FX_DIV(obd_fx_range(val, 0, 100000) * 255, 100000), A);
+}
@@ -0,0 +1,63 @@
+/** \file
+  \brief Mode 01 PID registry, see obd_pids.h
+*/
+
+#include "obd_pids.h"
+
+#include <stddef.h>
+
+#define OBD_PID_ENTRY(ctx, pid, conv, sig) [pid] = { .convert = conv, .signal = sig },
+
+const obd_pid_desc_t obd_mode1_pids[256] = {
+	OBD_MODE1_PIDS(OBD_PID_ENTRY, 0)
+};
+
+const uint32_t obd_mode1_supported[OBD_MODE1_RANGES] = {
+	OBD_MODE1_BITMAP(0x00),
+	OBD_MODE1_BITMAP(0x20),
+	OBD_MODE1_BITMAP(0x40),
+	OBD_MODE1_BITMAP(0x60),
+	OBD_MODE1_BITMAP(0x80),
+	OBD_MODE1_BITMAP(0xA0),
+	OBD_MODE1_BITMAP(0xC0),
+	OBD_MODE1_BITMAP(0xE0),
+};
+
+_Static_assert((OBD_MODE1_BITMAP(0x00) & OBD_PID_BIT(0x00, 0x0C)) != 0, "PID bitmap generation is broken");
+
+int obd_mode1_is_supported(uint8_t pid)
+{
+	if ((pid & 0x1F) == 0) {
+		// Range PID 0x00 is mandatory, the others are announced by the previous range
+		return pid == 0 || (obd_mode1_supported[(pid >> 5) - 1] & 1);
+	}
+	return obd_mode1_pids[pid].convert != NULL;
+}
+
+int obd_mode1_encode(uint8_t pid, const vehicle_state_t *state, uint8_t *data)
+{
+	if ((pid & 0x1F) == 0) {
+		if (!obd_mode1_is_supported(pid)) {
+			return 0;
+		}
+		uint32_t bitmap = obd_mode1_supported[pid >> 5];
+		data[0] = (uint8_t)(bitmap >> 24);
+		data[1] = (uint8_t)(bitmap >> 16);
+		data[2] = (uint8_t)(bitmap >> 8);
+		data[3] = (uint8_t)bitmap;
+		return 4;
+	}
+
+	const obd_pid_desc_t *desc = &obd_mode1_pids[pid];
+	if (desc->convert == NULL) {
+		return 0;
+	}
+
+	unsigned int A = 0, B = 0, C = 0, D = 0;
+	int data_len = desc->convert(state->signals[desc->signal], &A, &B, &C, &D);
+	data[0] = (uint8_t)A;
+	data[1] = (uint8_t)B;
+	data[2] = (uint8_t)C;
+	data[3] = (uint8_t)D;
+	return data_len;
+}
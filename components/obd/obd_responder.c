@@ -0,0 +1,295 @@
+/** \file
+  \brief OBD-II request handling, see obd_responder.h
+*/
+
+#include "obd_responder.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "CAN.h"
+#include "CAN_config.h"
+#include "isotp.h"
+
+#include "latency.h"
+#include "obd_cache.h"
+#include "obd_ecu.h"
+#include "trace.h"
+#include "vehicle.h"
+
+// SAE J1979: a Mode 01 request may ask for up to 6 PIDs at once
+#define OBD_MAX_PIDS_PER_REQUEST 6
+
+// Request handling messages, shown at trace level debug (`trace debug` on the console)
+#define DEBUG_PRINT(fmt, ...) do { \
+		if (trace_get_level() >= TRACE_DEBUG) { \
+			printf("[DEBUG] " fmt, ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+CAN_frame_t createOBDResponse(uint8_t ecu, unsigned int mode, unsigned int pid)
+{
+	CAN_frame_t response;
+
+	const isotp_addr_t addr = obd_ecu_addr(ecu);
+
+	response.MsgID = addr.tx_id; // Response ID of the answering ECU
+	response.FIR.B.DLC = 8;
+	response.FIR.B.FF = addr.extended ? CAN_frame_ext : CAN_frame_std;
+	response.FIR.B.RTR = CAN_no_RTR;
+	// Length will be set by the caller based on data size
+	response.data.u8[0] = 2; // Default length (Mode + PID)
+	response.data.u8[1] = 0x40 + mode; // Mode (+ 0x40)
+	response.data.u8[2] = pid; // PID
+	// Initialize rest to padding
+	memset(&response.data.u8[3], 0x00, 5); // 0x00 is standard padding
+
+	return response;
+}
+
+int sendOBDResponse(CAN_frame_t *response)
+{
+	CAN_tx_options_t options = {
+		.tx_class = CAN_TX_RESPONSE,
+		.deadline_us = CONFIG_ESP_CAN_TX_DEADLINE_MS * 1000,
+	};
+	latency_submit(&options);
+	int success = CAN_queue_frame(response, &options);
+
+	// The frame itself shows up in the trace once transmitted
+	if (success != 0) {
+		DEBUG_PRINT("TX queue full, response 0x%03" PRIx32 " dropped\n", response->MsgID);
+	}
+
+	return success;
+}
+
+// Send an ISO-TP (ISO 15765-2) payload from `ecu`; multi-frame payloads are
+// paced by the tester's flow control in the ISO-TP layer
+void sendOBDPayload(uint8_t ecu, const uint8_t *payload, size_t len)
+{
+	const isotp_addr_t addr = obd_ecu_addr(ecu);
+	esp_err_t err = isotp_send(&addr, payload, len);
+	latency_submit_untimed();
+	if (err != ESP_OK) {
+		DEBUG_PRINT("ISO-TP send of %d bytes failed: %s\n", (int)len, esp_err_to_name(err));
+	}
+}
+
+void respondToOBD1(uint8_t ecu, const uint8_t *pids, int count)
+{
+	CAN_frame_t cached;
+
+	DEBUG_PRINT("Building Mode 1 response of ECU %d for %d PID(s)\n", ecu, count);
+
+	// Single PID: the cached frame is the complete response
+	if (count == 1) {
+		if (obd_cache_get(ecu, pids[0], &cached)) {
+			sendOBDResponse(&cached);
+		} else {
+			DEBUG_PRINT("Unsupported PID 0x%02x\n", pids[0]);
+		}
+		return;
+	}
+
+	// Multiple PIDs: Mode byte followed by PID + data bytes of every supported PID,
+	// all taken from the same vehicle state
+	CAN_frame_t frames[OBD_MAX_PIDS_PER_REQUEST];
+	int found = obd_cache_get_many(ecu, pids, count, frames);
+
+	uint8_t payload[1 + OBD_MAX_PIDS_PER_REQUEST * 5];
+	size_t len = 0;
+	payload[len++] = 0x41; // Mode 1 (+ 0x40)
+
+	for (int i = 0; i < found; i++) {
+		// Cached frame is [length] [0x41] [PID] [data...]
+		size_t pid_len = frames[i].data.u8[0] - 1;
+		memcpy(&payload[len], &frames[i].data.u8[2], pid_len);
+		len += pid_len;
+	}
+
+	if (len > 1) {
+		sendOBDPayload(ecu, payload, len);
+	}
+}
+
+void respondToOBD9(uint8_t ecu, uint8_t pid)
+{
+	// Vehicle information is reported by the engine ECU only
+	if (ecu != 0) {
+		return;
+	}
+
+	DEBUG_PRINT("Building Mode 9 response for PID 0x%02x\n", pid);
+
+	CAN_frame_t response = createOBDResponse(ecu, 9, pid);
+
+	switch (pid)
+	{
+		case 0x00: // Supported PIDs
+			response.data.u8[0] = 6; // Mode + PID + 4 bytes
+			response.data.u8[3] = 0x40; // Data byte 1
+			response.data.u8[4] = 0x00; // Data byte 2
+			response.data.u8[5] = 0x00; // Data byte 3
+			response.data.u8[6] = 0x00; // Data byte 4
+			sendOBDResponse(&response);
+			break;
+		case 0x02: // Vehicle Identification Number (VIN)
+		{
+			vehicle_state_t state;
+			vehicle_read(&state);
+
+			uint8_t payload[3 + VEHICLE_VIN_LEN];
+			payload[0] = 0x49; // Mode (+ 0x40)
+			payload[1] = 0x02; // PID
+			payload[2] = 0x01; // Number of data items
+			memcpy(&payload[3], state.vin, VEHICLE_VIN_LEN);
+			sendOBDPayload(ecu, payload, sizeof(payload));
+			break;
+		}
+	}
+}
+
+// Answer a request as ECU `ecu`
+void respondToOBD(uint8_t ecu, const uint8_t *pdu, size_t len)
+{
+	latency_set_key(pdu[0], len >= 2 ? pdu[1] : 0);
+
+	switch (pdu[0]) { // Mode
+		case 1: // Show current data
+		{
+			// Mode byte followed by up to 6 PIDs
+			int pid_count = len - 1;
+			if (pid_count > OBD_MAX_PIDS_PER_REQUEST) {
+				pid_count = OBD_MAX_PIDS_PER_REQUEST;
+			}
+			if (pid_count > 0) {
+				respondToOBD1(ecu, &pdu[1], pid_count);
+			}
+			break;
+		}
+		case 9: // Vehicle information
+			if (len >= 2) {
+				respondToOBD9(ecu, pdu[1]);
+			}
+			break;
+		default:
+			DEBUG_PRINT("  Unsupported mode: 0x%02x\n\n", pdu[0]);
+	}
+}
+
+// Service dispatcher, called by the ISO-TP layer with every complete request
+void handleOBDRequest(const isotp_addr_t *addr, const uint8_t *pdu, size_t len, void *arg)
+{
+	DEBUG_PRINT("  Request on 0x%03" PRIx32 ": Mode 0x%02x, %d byte(s)\n\n", addr->rx_id, pdu[0], (int)len);
+
+	uint8_t route = obd_ecu_route(addr->rx_id, addr->extended, NULL);
+	if (route != OBD_ECU_FUNCTIONAL) {
+		respondToOBD(route, pdu, len);
+		return;
+	}
+
+	// Functional request: every ECU answers, queued in the order the ECUs
+	// would win arbitration on a real bus. ECUs without a supported PID stay silent.
+	uint8_t order[OBD_ECU_MAX];
+	uint8_t count = obd_ecu_arbitration_order(order);
+	for (uint8_t i = 0; i < count; i++) {
+		respondToOBD(order[i], pdu, len);
+	}
+}
+
+// Frame being handled by the CAN task, its latency is timed from its reception
+static void handleCANFrame(const CAN_frame_t *frame, int64_t rx_time_us)
+{
+	// The frame has already been traced by the CAN RX task (see trace.h)
+	latency_begin(rx_time_us);
+
+	// Look up which ECU (if any) the frame is addressed to
+	bool extended = frame->FIR.B.FF == CAN_frame_ext;
+	isotp_addr_t ecu_addr;
+	uint8_t route = obd_ecu_route(frame->MsgID, extended, &ecu_addr);
+	if (route == OBD_ECU_FUNCTIONAL) {
+		// Functional requests are single frames only (ISO 15765-4)
+		if ((frame->data.u8[0] & 0xF0) == ISOTP_PCI_SF) {
+			const isotp_addr_t addr = {
+				.tx_id = frame->MsgID,
+				.rx_id = frame->MsgID,
+				.extended = extended,
+			};
+			isotp_on_frame(&addr, frame);
+		}
+	} else if (route != OBD_ECU_NONE) {
+		isotp_on_frame(&ecu_addr, frame);
+	}
+
+	latency_end();
+}
+
+#if OBD_RX_QUEUED
+typedef struct {
+	CAN_frame_t frame;
+	int64_t rx_time_us;
+} queued_frame_t;
+
+static QueueHandle_t obd_rx_queue;
+
+static void onCANFrame(const CAN_frame_t *frame, int64_t rx_time_us, void *arg)
+{
+	queued_frame_t item = { .frame = *frame, .rx_time_us = rx_time_us };
+	CAN_rx_enqueue(obd_rx_queue, &item);
+}
+#else
+// Runs in the CAN RX task: requests are answered in the task that received them
+static void onCANFrame(const CAN_frame_t *frame, int64_t rx_time_us, void *arg)
+{
+	handleCANFrame(frame, rx_time_us);
+}
+#endif
+
+void task_CAN(void *pvParameters)
+{
+	(void)pvParameters;
+
+#if OBD_RX_QUEUED
+	obd_rx_queue = xQueueCreate(CONFIG_ESP_CAN_RX_APP_QUEUE_LEN, sizeof(queued_frame_t));
+#endif
+
+	//start CAN Module, received frames are handed to onCANFrame
+	ESP_ERROR_CHECK(isotp_init(&handleOBDRequest, NULL));
+	CAN_set_rx_callback(&onCANFrame, NULL);
+	CAN_init();
+	printf("CAN initialized...\n");
+
+	// DEBUG: Send test speed frame at startup
+	vehicle_set_signal(VEHICLE_SPEED, 85 * VEHICLE_SCALE); // Set test speed to 85 km/h
+	CAN_frame_t test_frame = createOBDResponse(0, 1, 0x0D); // Speed PID
+	test_frame.data.u8[0] = 3; // Data length (Mode + PID + 1 byte value)
+	test_frame.data.u8[3] = 85; // Speed value
+	CAN_write_frame(&test_frame);
+	DEBUG_PRINT("Sent test speed frame: 85 km/h\n");
+
+#if OBD_RX_QUEUED
+	queued_frame_t item;
+	while (1)
+	{
+		//receive next CAN frame from queue
+		if (xQueueReceive(obd_rx_queue, &item, portMAX_DELAY) == pdTRUE)
+		{
+			handleCANFrame(&item.frame, item.rx_time_us);
+		}
+	}
+#else
+	vTaskDelete(NULL);
+#endif
+}
+
+void obd_responder_start(void)
+{
+	// Increased stack size to 4096 bytes for debug logging
+	xTaskCreate(&task_CAN, "CAN", 4096, NULL, 5, NULL);
+}
@@ -0,0 +1,227 @@
+/** \file
+  \brief CAN frame trace, see trace.h
+*/
+
+#include "trace.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "CAN.h"
+
+// Slots of the frame ring, a power of two
+#define TRACE_RING_LEN 256
+
+// The drain task wakes up this often and takes out at most a batch per pass
+#define TRACE_DRAIN_MS 50
+#define TRACE_DRAIN_BATCH 32
+
+// A slot's sequence number tells who owns it: `pos` free for the writer at
+// position pos, `pos + 1` filled for the reader at pos (bounded MPMC queue
+// after D. Vyukov, with a single reader)
+typedef struct {
+	uint32_t seq;
+	trace_record_t record;
+} trace_slot_t;
+
+static trace_slot_t trace_ring[TRACE_RING_LEN];
+static uint32_t trace_head; // next write position, claimed by compare-and-swap
+static uint32_t trace_tail; // next read position, drain task only
+
+volatile uint8_t trace_level = TRACE_OFF;
+
+static uint32_t trace_recorded;
+static uint32_t trace_dropped;
+static uint32_t trace_drained;
+
+// Guards the sinks, the trace file and the recent frames; taken by the drain task per batch
+static SemaphoreHandle_t trace_lock;
+static uint32_t trace_sinks = TRACE_SINK_SERIAL;
+static FILE *trace_file;
+static uint32_t trace_file_errors;
+static trace_record_t trace_recent[TRACE_RECENT];
+static uint32_t trace_recent_count;
+
+// CAN trace hook, runs in the CAN RX and alert tasks
+static void trace_frame(const CAN_frame_t *frame, int64_t time_us, CAN_trace_dir_t dir)
+{
+	uint32_t pos = __atomic_load_n(&trace_head, __ATOMIC_RELAXED);
+	trace_slot_t *slot;
+
+	while (1) {
+		slot = &trace_ring[pos % TRACE_RING_LEN];
+		int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff < 0) {
+			// Not yet drained since the last round
+			__atomic_add_fetch(&trace_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		if (diff == 0 && __atomic_compare_exchange_n(&trace_head, &pos, pos + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			break;
+		}
+		if (diff > 0) {
+			pos = __atomic_load_n(&trace_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	trace_record_t *record = &slot->record;
+	record->time_us = time_us;
+	record->id = frame->MsgID;
+	record->dlc = frame->FIR.B.DLC;
+	record->flags = (dir == CAN_TRACE_TX ? TRACE_FLAG_TX : 0) |
+		(frame->FIR.B.FF == CAN_frame_ext ? TRACE_FLAG_EXT : 0) |
+		(frame->FIR.B.RTR == CAN_RTR ? TRACE_FLAG_RTR : 0);
+	memcpy(record->data, frame->data.u8, sizeof(record->data));
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&trace_recorded, 1, __ATOMIC_RELAXED);
+}
+
+static bool trace_take(trace_record_t *record)
+{
+	trace_slot_t *slot = &trace_ring[trace_tail % TRACE_RING_LEN];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != trace_tail + 1) {
+		return false;
+	}
+	*record = slot->record;
+	__atomic_store_n(&slot->seq, trace_tail + TRACE_RING_LEN, __ATOMIC_RELEASE);
+	trace_tail++;
+	return true;
+}
+
+int trace_format(const trace_record_t *record, char *line, size_t size)
+{
+	uint8_t dlc = record->dlc > 8 ? 8 : record->dlc;
+	int len = snprintf(line, size, "(%" PRId64 ".%06" PRId64 ") can0 %0*" PRIX32 "#",
+		record->time_us / 1000000, record->time_us % 1000000,
+		(record->flags & TRACE_FLAG_EXT) ? 8 : 3, record->id);
+
+	if (record->flags & TRACE_FLAG_RTR) {
+		len += snprintf(line + len, size - len, "R%u", dlc);
+	} else {
+		for (uint8_t i = 0; i < dlc; i++) {
+			len += snprintf(line + len, size - len, "%02X", record->data[i]);
+		}
+	}
+	len += snprintf(line + len, size - len, " %c", (record->flags & TRACE_FLAG_TX) ? 'T' : 'R');
+	return len;
+}
+
+// Format and write out a batch, lowest priority: the CAN tasks only ever wait on the ring
+static void task_trace_drain(void *pvParameters)
+{
+	trace_record_t batch[TRACE_DRAIN_BATCH];
+	char line[TRACE_LINE_MAX];
+	uint32_t reported_drops = 0;
+
+	while (1) {
+		vTaskDelay(pdMS_TO_TICKS(TRACE_DRAIN_MS));
+
+		size_t count;
+		do {
+			count = 0;
+			while (count < TRACE_DRAIN_BATCH && trace_take(&batch[count])) {
+				count++;
+			}
+			if (count == 0) {
+				break;
+			}
+			__atomic_add_fetch(&trace_drained, count, __ATOMIC_RELAXED);
+
+			xSemaphoreTake(trace_lock, portMAX_DELAY);
+			for (size_t i = 0; i < count; i++) {
+				trace_recent[trace_recent_count++ % TRACE_RECENT] = batch[i];
+				if ((trace_sinks & (TRACE_SINK_SERIAL | TRACE_SINK_FILE)) == 0) {
+					continue;
+				}
+				trace_format(&batch[i], line, sizeof(line));
+				if (trace_sinks & TRACE_SINK_SERIAL) {
+					printf("%s\n", line);
+				}
+				if (trace_file != NULL && fprintf(trace_file, "%s\n", line) < 0) {
+					trace_file_errors++;
+				}
+			}
+			if (trace_file != NULL) {
+				fflush(trace_file);
+			}
+			xSemaphoreGive(trace_lock);
+		} while (count == TRACE_DRAIN_BATCH);
+
+		uint32_t dropped = __atomic_load_n(&trace_dropped, __ATOMIC_RELAXED);
+		if (dropped != reported_drops && (trace_sinks & TRACE_SINK_SERIAL)) {
+			printf("trace: %" PRIu32 " frame(s) dropped\n", dropped - reported_drops);
+		}
+		reported_drops = dropped;
+	}
+}
+
+void trace_init(void)
+{
+	for (uint32_t i = 0; i < TRACE_RING_LEN; i++) {
+		trace_ring[i].seq = i;
+	}
+	trace_lock = xSemaphoreCreateMutex();
+
+	xTaskCreate(&task_trace_drain, "trace", 3072, NULL, 1, NULL);
+}
+
+void trace_set_level(trace_level_t level)
+{
+	trace_level = level;
+	CAN_set_trace_hook(level >= TRACE_FRAMES ? &trace_frame : NULL);
+}
+
+esp_err_t trace_set_sinks(uint32_t sinks)
+{
+	esp_err_t err = ESP_OK;
+
+	xSemaphoreTake(trace_lock, portMAX_DELAY);
+	if ((sinks & TRACE_SINK_FILE) && trace_file == NULL) {
+		trace_file = fopen(TRACE_FILE_PATH, "a");
+		if (trace_file == NULL) {
+			sinks &= ~TRACE_SINK_FILE;
+			err = ESP_FAIL;
+		}
+	} else if (!(sinks & TRACE_SINK_FILE) && trace_file != NULL) {
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+	trace_sinks = sinks;
+	xSemaphoreGive(trace_lock);
+
+	return err;
+}
+
+void trace_get_stats(trace_stats_t *stats)
+{
+	stats->level = trace_get_level();
+	stats->recorded = __atomic_load_n(&trace_recorded, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&trace_dropped, __ATOMIC_RELAXED);
+	stats->drained = __atomic_load_n(&trace_drained, __ATOMIC_RELAXED);
+
+	xSemaphoreTake(trace_lock, portMAX_DELAY);
+	stats->sinks = trace_sinks;
+	stats->file_errors = trace_file_errors;
+	xSemaphoreGive(trace_lock);
+}
+
+size_t trace_get_recent(trace_record_t *records, size_t max)
+{
+	xSemaphoreTake(trace_lock, portMAX_DELAY);
+	size_t count = trace_recent_count < TRACE_RECENT ? trace_recent_count : TRACE_RECENT;
+	if (count > max) {
+		count = max;
+	}
+	for (size_t i = 0; i < count; i++) {
+		records[i] = trace_recent[(trace_recent_count - count + i) % TRACE_RECENT];
+	}
+	xSemaphoreGive(trace_lock);
+
+	return count;
+}
@@ -0,0 +1,129 @@
+#include "vehicle.h"
+#include "obd_cache.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+static const char *vehicle_signal_names[VEHICLE_SIGNAL_COUNT] = {
+	[VEHICLE_SPEED] = "speed",
+	[VEHICLE_RPM] = "rpm",
+	[VEHICLE_THROTTLE] = "throttle",
+	[VEHICLE_COOLANT] = "coolant",
+	[VEHICLE_FUEL_LEVEL] = "fuel",
+};
+
+static vehicle_state_t vehicle_state = {
+	.signals = {
+		[VEHICLE_COOLANT] = 90 * VEHICLE_SCALE,
+		[VEHICLE_FUEL_LEVEL] = 100 * VEHICLE_SCALE,
+	},
+	.vin = "ESP32OBD2EMULATOR",
+};
+
+// Sequence lock: odd while a writer is publishing, bumped twice per publish
+static uint32_t vehicle_seq;
+
+// Serializes writers. Holding it in a critical section also keeps the writer
+// from being preempted mid-publish, so a reader never waits on a sleeping writer.
+static portMUX_TYPE vehicle_write_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void vehicle_write_begin(void)
+{
+	portENTER_CRITICAL(&vehicle_write_mux);
+	__atomic_store_n(&vehicle_seq, vehicle_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE); // sequence before data
+}
+
+static void vehicle_write_end(void)
+{
+	__atomic_store_n(&vehicle_seq, vehicle_seq + 1, __ATOMIC_RELEASE); // data before sequence
+	portEXIT_CRITICAL(&vehicle_write_mux);
+}
+
+void vehicle_read(vehicle_state_t *state)
+{
+	uint32_t seq;
+
+	do {
+		// Only a writer running on the other core can be mid-publish, it is done within a few hundred cycles
+		while ((seq = __atomic_load_n(&vehicle_seq, __ATOMIC_ACQUIRE)) & 1) {
+		}
+		memcpy(state, &vehicle_state, sizeof(*state));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE); // data before re-check
+	} while (__atomic_load_n(&vehicle_seq, __ATOMIC_RELAXED) != seq);
+}
+
+int32_t vehicle_get_signal(vehicle_signal_t signal)
+{
+	// A single aligned word is never torn
+	return __atomic_load_n(&vehicle_state.signals[signal], __ATOMIC_RELAXED);
+}
+
+void vehicle_set_signal(vehicle_signal_t signal, int32_t value)
+{
+	vehicle_set_signals(&signal, &value, 1);
+}
+
+void vehicle_set_signals(const vehicle_signal_t *signals, const int32_t *values, size_t count)
+{
+	vehicle_write_begin();
+	for (size_t i = 0; i < count; i++) {
+		vehicle_state.signals[signals[i]] = values[i];
+	}
+	vehicle_write_end();
+
+	obd_cache_refresh();
+}
+
+void vehicle_set_vin(const char *vin)
+{
+	size_t len = strnlen(vin, VEHICLE_VIN_LEN);
+
+	vehicle_write_begin();
+	memcpy(vehicle_state.vin, vin, len);
+	memset(&vehicle_state.vin[len], 0, VEHICLE_VIN_LEN - len);
+	vehicle_write_end();
+}
+
+vehicle_signal_t vehicle_signal_from_name(const char *name)
+{
+	for (int i = 0; i < VEHICLE_SIGNAL_COUNT; i++) {
+		if (strcmp(name, vehicle_signal_names[i]) == 0) {
+			return (vehicle_signal_t)i;
+		}
+	}
+	return VEHICLE_SIGNAL_COUNT;
+}
+
+int32_t vehicle_parse_value(const char *str)
+{
+	int32_t sign = 1;
+	int64_t integer = 0;
+	int32_t fraction = 0;
+	int32_t fraction_scale = VEHICLE_SCALE;
+
+	if (*str == '-') {
+		sign = -1;
+		str++;
+	} else if (*str == '+') {
+		str++;
+	}
+	// Values beyond the int32_t range saturate, the remaining digits only count
+	for (; *str >= '0' && *str <= '9'; str++) {
+		if (integer <= INT32_MAX / VEHICLE_SCALE) {
+			integer = integer * 10 + (*str - '0');
+		}
+	}
+	if (*str == '.') {
+		for (str++; *str >= '0' && *str <= '9' && fraction_scale > 1; str++) {
+			fraction_scale /= 10;
+			fraction += (*str - '0') * fraction_scale;
+		}
+	}
+	int64_t value = integer * VEHICLE_SCALE + fraction;
+	if (value > INT32_MAX) {
+		value = INT32_MAX;
+	}
+	return sign * (int32_t)value;
+}
@@ -7,11 +7,27 @@
 #include "nvs_flash.h"
 #include "esp_vfs_fat.h"
 #include <inttypes.h>
+#include <stdlib.h>
+
+#include "esp_timer.h"
 
 #include "CAN.h"
 #include "CAN_config.h"
 
+#include "console.h"
+
 #include "obd.h"
+#include "obd_pids.h"
+#include "obd_cache.h"
+#include "obd_ecu.h"
+#include "obd_responder.h"
+#include "generator.h"
+#include "latency.h"
+#include "physics.h"
+#include "playback.h"
+#include "replay.h"
+#include "trace.h"
+#include "vehicle.h"
 
 #include <string.h>
 #include "http_server.h"
@@ -58,244 +74,13 @@ CAN_device_t CAN_cfg = {
 	.rx_queue = NULL,						 // FreeRTOS queue for RX frames
 };
 
-// Queue for CAN multi-frame packets
-uint8_t can_flow_queue[5][8];
-
-unsigned int vehicle_speed = 0;
-float vehicle_rpm = 0;
-float vehicle_throttle = 0;
-float vehicle_coolant = 90;
-float vehicle_fuel_level = 100;
-char vehicle_vin[17] = "ESP32OBD2EMULATOR";
-
 static EventGroupHandle_t wifi_event_group;
 
 #define WIFI_SSID "ESP32-OBD2"
 #define WIFI_PASS "88888888"
 
-// Debug mode - set to 1 to enable detailed CAN frame logging
-// To enable: change to 1, rebuild (idf.py build), flash, and monitor serial output
-#define DEBUG_MODE 0
-
-#if DEBUG_MODE
-#define DEBUG_PRINT(fmt, ...) printf("[DEBUG] " fmt, ##__VA_ARGS__)
-#else
-#define DEBUG_PRINT(fmt, ...)
-#endif
-
-CAN_frame_t createOBDResponse(unsigned int mode, unsigned int pid)
-{
-	CAN_frame_t response;
-
-	response.MsgID = 0x7E8; // Standard OBD2 ECU Response ID
-	response.FIR.B.DLC = 8;
-	response.FIR.B.FF = CAN_frame_std;
-	response.FIR.B.RTR = CAN_no_RTR;
-	// Length will be set by the caller based on data size
-	response.data.u8[0] = 2; // Default length (Mode + PID)
-	response.data.u8[1] = 0x40 + mode; // Mode (+ 0x40)
-	response.data.u8[2] = pid; // PID
-	// Initialize rest to padding
-	memset(&response.data.u8[3], 0x00, 5); // 0x00 is standard padding
-
-	return response;
-}
-
-int sendOBDResponse(CAN_frame_t *response)
-{
-	int success = CAN_write_frame(response);
-
-	DEBUG_PRINT("TX CAN Frame:\n");
-	DEBUG_PRINT("  MsgID: 0x%03" PRIx32 "\n", response->MsgID);
-	DEBUG_PRINT("  DLC: %d, RTR: %d, FF: %d\n", response->FIR.B.DLC, response->FIR.B.RTR, response->FIR.B.FF);
-	DEBUG_PRINT("  Data: %02x %02x %02x %02x %02x %02x %02x %02x\n",
-			   response->data.u8[0], response->data.u8[1], response->data.u8[2], response->data.u8[3],
-			   response->data.u8[4], response->data.u8[5], response->data.u8[6], response->data.u8[7]);
-	DEBUG_PRINT("  Status: %s\n\n", (success == 0) ? "OK" : "FAIL");
-	
-	return success;
-}
-
-void respondToOBD1(uint8_t pid)
-{
-	DEBUG_PRINT("Building Mode 1 response for PID 0x%02x\n", pid);
-
-	CAN_frame_t response = createOBDResponse(1, pid);
-	unsigned int A=0, B=0, C=0, D=0;
-	int data_len = 0;
-
-	switch (pid)
-	{
-		case 0x00: // Supported PIDs
-			data_len = 4;
-			response.data.u8[3] = 0x00; // Data byte 1
-			response.data.u8[4] = 0x18; // Data byte 2
-			response.data.u8[5] = 0x80; // Data byte 3
-			response.data.u8[6] = 0x00; // Data byte 4
-			break;
-		case 0x0C: // RPM
-			data_len = obdRevConvert_0C(vehicle_rpm, &A, &B, &C, &D);
-			response.data.u8[3] = (uint8_t)A;
-			response.data.u8[4] = (uint8_t)B;
-			break;
-		case 0x0D: // Speed
-			data_len = obdRevConvert_0D(vehicle_speed, &A, &B, &C, &D);
-			response.data.u8[3] = (uint8_t)A;
-			break;
-		case 0x11: // Throttle position
-			data_len = obdRevConvert_11(vehicle_throttle, &A, &B, &C, &D);
-			response.data.u8[3] = (uint8_t)A;
-			break;
-		case 0x05: // Coolant temperature
-			data_len = obdRevConvert_05(vehicle_coolant, &A, &B, &C, &D);
-			response.data.u8[3] = (uint8_t)A;
-			break;
-		case 0x2F: // Fuel level
-			data_len = obdRevConvert_2F(vehicle_fuel_level, &A, &B, &C, &D);
-			response.data.u8[3] = (uint8_t)A;
-			break;
-	}
-
-	if (data_len > 0) {
-		response.data.u8[0] = 2 + data_len; // Mode + PID + Data bytes
-		sendOBDResponse(&response);
-	} else {
-		DEBUG_PRINT("Unsupported PID 0x%02x or conversion failed\n", pid);
-	}
-}
-
-void respondToOBD9(uint8_t pid)
-{
-	DEBUG_PRINT("Building Mode 9 response for PID 0x%02x\n", pid);
-
-	CAN_frame_t response = createOBDResponse(9, pid);
-
-	switch (pid)
-	{
-		case 0x00: // Supported PIDs
-			response.data.u8[0] = 6; // Mode + PID + 4 bytes
-			response.data.u8[3] = 0x40; // Data byte 1
-			response.data.u8[4] = 0x00; // Data byte 2
-			response.data.u8[5] = 0x00; // Data byte 3
-			response.data.u8[6] = 0x00; // Data byte 4
-			sendOBDResponse(&response);
-			break;
-		case 0x02: // Vehicle Identification Number (VIN)
-			// Initiate multi-frame message packet
-			response.data.u8[0] = 0x10; // FF (First Frame, ISO_15765-2)
-			response.data.u8[1] = 0x14; // Length (20 bytes)
-			response.data.u8[2] = 0x49; // Mode (+ 0x40)
-			response.data.u8[3] = 0x02; // PID
-			response.data.u8[4] = 0x01; // Data byte 1
-			response.data.u8[5] = vehicle_vin[0]; // Data byte 2
-			response.data.u8[6] = vehicle_vin[1]; // Data byte 3
-			response.data.u8[7] = vehicle_vin[2]; // Data byte 4
-			sendOBDResponse(&response);
-
-			// Clear flow control queue
-			// memset(can_flow_queue, 0, 40);
-
-			// Fill flow control queue
-			// Part 1
-			can_flow_queue[0][0] = 0x21; // CF (Consecutive Frame, ISO_15765-2), sequence number
-			can_flow_queue[0][1] = vehicle_vin[3]; // Data byte 1
-			can_flow_queue[0][2] = vehicle_vin[4]; // Data byte 2
-			can_flow_queue[0][3] = vehicle_vin[5]; // Data byte 3
-			can_flow_queue[0][4] = vehicle_vin[6]; // Data byte 4
-			can_flow_queue[0][5] = vehicle_vin[7]; // Data byte 5
-			can_flow_queue[0][6] = vehicle_vin[8]; // Data byte 6
-			can_flow_queue[0][7] = vehicle_vin[9]; // Data byte 7
-			// Part 2
-			can_flow_queue[1][0] = 0x22; // CF
-			can_flow_queue[1][1] = vehicle_vin[10]; // Data byte 1
-			can_flow_queue[1][2] = vehicle_vin[11]; // Data byte 2
-			can_flow_queue[1][3] = vehicle_vin[12]; // Data byte 3
-			can_flow_queue[1][4] = vehicle_vin[13]; // Data byte 4
-			can_flow_queue[1][5] = vehicle_vin[14]; // Data byte 5
-			can_flow_queue[1][6] = vehicle_vin[15]; // Data byte 6
-			can_flow_queue[1][7] = vehicle_vin[16]; // Data byte 7
-
-			break;
-	}
-}
-
-void task_CAN(void *pvParameters)
-{
-	(void)pvParameters;
-
-	//frame buffer
-	CAN_frame_t __RX_frame;
-
-	//create CAN RX Queue BEFORE CAN_init
-	CAN_cfg.rx_queue = xQueueCreate(10, sizeof(CAN_frame_t));
-
-	//start CAN Module
-	CAN_init();
-	printf("CAN initialized...\n");
-
-	// DEBUG: Send test speed frame at startup
-	vehicle_speed = 85; // Set test speed to 85 km/h
-	CAN_frame_t test_frame = createOBDResponse(1, 0x0D); // Speed PID
-	test_frame.data.u8[0] = 3; // Data length (Mode + PID + 1 byte value)
-	test_frame.data.u8[3] = 85; // Speed value
-	CAN_write_frame(&test_frame);
-	DEBUG_PRINT("Sent test speed frame: 85 km/h\n");
-
-	// Track time for periodic diagnostics
-	TickType_t last_diagnostic_time = xTaskGetTickCount();
-
-	while (1)
-	{
-		//receive next CAN frame from queue
-		if (xQueueReceive(CAN_cfg.rx_queue, &__RX_frame, 3 * portTICK_PERIOD_MS) == pdTRUE)
-		{
-			printf("RX ID: 0x%03" PRIx32 " Data: %02x %02x %02x %02x %02x %02x %02x %02x\n",
-				   __RX_frame.MsgID,
-				   __RX_frame.data.u8[0], __RX_frame.data.u8[1], __RX_frame.data.u8[2], __RX_frame.data.u8[3],
-				   __RX_frame.data.u8[4], __RX_frame.data.u8[5], __RX_frame.data.u8[6], __RX_frame.data.u8[7]);
-
-			DEBUG_PRINT("\nRX CAN Frame:\n");
-			DEBUG_PRINT("  MsgID: 0x%08" PRIx32 "\n", __RX_frame.MsgID);
-			DEBUG_PRINT("  DLC: %d, RTR: %d, FF: %d\n", __RX_frame.FIR.B.DLC, __RX_frame.FIR.B.RTR, __RX_frame.FIR.B.FF);
-			DEBUG_PRINT("  Data: %02x %02x %02x %02x %02x %02x %02x %02x\n",
-					   __RX_frame.data.u8[0], __RX_frame.data.u8[1], __RX_frame.data.u8[2], __RX_frame.data.u8[3],
-					   __RX_frame.data.u8[4], __RX_frame.data.u8[5], __RX_frame.data.u8[6], __RX_frame.data.u8[7]);
-
-			// Check if frame is OBD query
-			if (__RX_frame.MsgID == 0x7df) {
-				DEBUG_PRINT("  Type: OBD QUERY\n");
-				DEBUG_PRINT("  Mode: 0x%02x, PID: 0x%02x\n\n", __RX_frame.data.u8[1], __RX_frame.data.u8[2]);
-
-				switch (__RX_frame.data.u8[1]) { // Mode
-					case 1: // Show current data
-						respondToOBD1(__RX_frame.data.u8[2]);
-						break;
-					case 9: // Vehicle information
-						respondToOBD9(__RX_frame.data.u8[2]);
-					break;
-				default:
-					DEBUG_PRINT("  Unsupported mode: 0x%02x\n\n", __RX_frame.data.u8[1]);
-				}
-			} else if (__RX_frame.MsgID == 0x7e0) { // Check if frame is addressed to the ECU (us)
-				DEBUG_PRINT("  Type: ECU MSG\n\n");				if (__RX_frame.data.u8[0] == 0x30) { // Flow control frame (continue)
-					CAN_frame_t response = createOBDResponse(0, 0);
-
-					for (int i = 0; i < 5; i++) {
-						if (can_flow_queue[i][0] == 0) { continue; }
-
-						for (int j = 0; j < 8; j++) {
-							response.data.u8[j] = can_flow_queue[i][j];
-						}
-						sendOBDResponse(&response);
-					}
-
-					// Clear flow control queue
-					memset(can_flow_queue, 0, 40);
-				}
-			}
-		}
-	}
-}
+// Started in app_main before any handler or console command can run
+static http_server_t server;
 
 const char *get_filename_ext(const char *filename)
 {
@@ -366,18 +151,40 @@ static void cb_GET_root(http_context_t http_ctx, void *ctx)
 	http_response_end(http_ctx);
 }
 
+// Files are streamed through a buffer of this size taken from the request's arena
+#define FILE_CHUNK_SIZE 1024
+
 static void cb_GET_file(http_context_t http_ctx, void *ctx)
 {
-	char *file = malloc(FILE_MAX_SIZE + 1);
-	size_t response_size;
-	ESP_ERROR_CHECK(readFile((char*)ctx, file, &response_size));
+	char *chunk = http_request_alloc(http_ctx, FILE_CHUNK_SIZE);
+	FILE *fp = fopen((char*)ctx, "r");
+	if (chunk == NULL || fp == NULL) {
+		if (fp != NULL) {
+			fclose(fp);
+		}
+		http_response_begin(http_ctx, chunk == NULL ? 500 : 404, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+		http_buffer_t http_response = { .data = "", .data_is_persistent = true };
+		http_response_write(http_ctx, &http_response);
+		http_response_end(http_ctx);
+		return;
+	}
+	// Chunks are buffered in the arena, no need for a stdio buffer on the heap
+	setvbuf(fp, NULL, _IONBF, 0);
+	fseek(fp, 0, SEEK_END);
+	long response_size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
 
 	char *content_type = get_type_for_filename_ext(ctx);
 
-	http_response_begin(http_ctx, 200, content_type, response_size);
-	http_buffer_t http_file = {.data = file};
-	http_response_write(http_ctx, &http_file);
-	free(file);
+	http_response_begin(http_ctx, 200, content_type, response_size < 0 ? HTTP_RESPONSE_SIZE_UNKNOWN : (size_t)response_size);
+	size_t len;
+	while ((len = fread(chunk, 1, FILE_CHUNK_SIZE, fp)) > 0) {
+		http_buffer_t http_file = { .data = chunk, .size = len };
+		if (http_response_write(http_ctx, &http_file) != ESP_OK) {
+			break;
+		}
+	}
+	fclose(fp);
 	http_response_end(http_ctx);
 }
 
@@ -390,18 +197,11 @@ static void cb_PATCH_vehicle(http_context_t http_ctx, void* ctx)
 	if (name != NULL && value != NULL) {
 		printf("Received %s = %s\n", name, value);
 
-		if (strcmp(name, "speed") == 0) {
-			vehicle_speed = strtol(value, NULL, 10);
-		} else if (strcmp(name, "rpm") == 0) {
-			vehicle_rpm = strtol(value, NULL, 10);
-		} else if (strcmp(name, "throttle") == 0) {
-			vehicle_throttle = strtof(value, NULL);
-		} else if (strcmp(name, "coolant") == 0) {
-			vehicle_coolant = strtof(value, NULL);
-		} else if (strcmp(name, "fuel") == 0) {
-			vehicle_fuel_level = strtof(value, NULL);
+		vehicle_signal_t signal = vehicle_signal_from_name(name);
+		if (signal != VEHICLE_SIGNAL_COUNT) {
+			vehicle_set_signal(signal, vehicle_parse_value(value));
 		} else if (strcmp(name, "vin") == 0) {
-			strncpy(vehicle_vin, value, 17);
+			vehicle_set_vin(value);
 		}
 	} else {
 		printf("Invalid data received !\n");
@@ -414,6 +214,611 @@ static void cb_PATCH_vehicle(http_context_t http_ctx, void* ctx)
 	http_response_end(http_ctx);
 }
 
+// Drive a signal from a generator: signal=<name>&type=<off|constant|ramp|sine|square|steps|random>
+// with min, max, value (constant), period (s), noise and seed (random), steps=<s:value,...>
+static void cb_PATCH_generator(http_context_t http_ctx, void* ctx)
+{
+	const char *name = http_request_get_arg_value(http_ctx, "signal");
+	const char *type = http_request_get_arg_value(http_ctx, "type");
+	const char *min = http_request_get_arg_value(http_ctx, "min");
+	const char *max = http_request_get_arg_value(http_ctx, "max");
+	const char *value = http_request_get_arg_value(http_ctx, "value");
+	const char *period = http_request_get_arg_value(http_ctx, "period");
+	const char *noise = http_request_get_arg_value(http_ctx, "noise");
+	const char *seed = http_request_get_arg_value(http_ctx, "seed");
+	const char *steps = http_request_get_arg_value(http_ctx, "steps");
+	unsigned int code = 400;
+
+	vehicle_signal_t signal = (name != NULL) ? vehicle_signal_from_name(name) : VEHICLE_SIGNAL_COUNT;
+	generator_type_t generator_type = (type != NULL) ? generator_type_from_name(type) : GENERATOR_TYPE_COUNT;
+
+	if (signal != VEHICLE_SIGNAL_COUNT && generator_type != GENERATOR_TYPE_COUNT) {
+		generator_config_t config = {
+			.type = generator_type,
+			.min = (min != NULL) ? vehicle_parse_value(min) : 0,
+			.max = (max != NULL) ? vehicle_parse_value(max) : 0,
+			.period_ms = (period != NULL) ? (uint32_t)vehicle_parse_value(period) : 0, // seconds parse into ms
+			.noise = (noise != NULL) ? vehicle_parse_value(noise) : 0,
+			.seed = (seed != NULL) ? (uint32_t)strtoul(seed, NULL, 10) : 0,
+		};
+		if (value != NULL) {
+			config.min = config.max = vehicle_parse_value(value);
+		}
+
+		const char *p = steps;
+		while (p != NULL && *p != '\0' && config.step_count < GENERATOR_MAX_STEPS) {
+			const char *colon = strchr(p, ':');
+			if (colon == NULL) {
+				break;
+			}
+			config.steps[config.step_count].time_ms = (uint32_t)vehicle_parse_value(p);
+			config.steps[config.step_count++].value = vehicle_parse_value(colon + 1);
+			p = strchr(colon, ',');
+			if (p != NULL) {
+				p++;
+			}
+		}
+
+		printf("Received generator %s for %s\n", type, name);
+		code = (generator_configure(signal, &config) == ESP_OK) ? 200 : 400;
+	} else {
+		printf("Invalid data received !\n");
+	}
+
+	http_response_begin(http_ctx, code, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = "", .data_is_persistent = true };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+// Generator tick cost
+static void cb_GET_generator(http_context_t http_ctx, void* ctx)
+{
+	generator_stats_t stats;
+	generator_get_stats(&stats);
+
+	char body[128];
+	snprintf(body, sizeof(body),
+		"{\"active\":%" PRIu32 ",\"tick_ms\":%d,\"ticks\":%" PRIu32 ",\"last_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}",
+		stats.active, GENERATOR_TICK_MS, stats.ticks, stats.last_us, stats.max_us);
+
+	http_response_begin(http_ctx, 200, "application/json", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = body };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+// Configure a virtual ECU: id=<0-7>&enabled=<0|1>&pids=<hex PID list, e.g. 0C,0D>
+// and/or the addressing of all ECUs: addressing=<11|29>
+static void cb_PATCH_ecu(http_context_t http_ctx, void* ctx)
+{
+	const char *id = http_request_get_arg_value(http_ctx, "id");
+	const char *enabled = http_request_get_arg_value(http_ctx, "enabled");
+	const char *pid_list = http_request_get_arg_value(http_ctx, "pids");
+	const char *addressing = http_request_get_arg_value(http_ctx, "addressing");
+	unsigned int code = 400;
+
+	if (addressing != NULL) {
+		int bits = atoi(addressing);
+		if (bits == 11 || bits == 29) {
+			printf("Received addressing = %d bit\n", bits);
+			obd_ecu_set_addressing(bits == 29 ? OBD_ADDRESSING_29BIT : OBD_ADDRESSING_11BIT);
+			code = 200;
+		}
+	}
+
+	if (id != NULL && enabled != NULL) {
+		uint8_t pids[256];
+		size_t pid_count = 0;
+		const char *p = pid_list;
+
+		while (p != NULL && *p != '\0' && pid_count < sizeof(pids)) {
+			char *end;
+			unsigned long pid = strtoul(p, &end, 16);
+			if (end == p || pid > 0xFF) {
+				break;
+			}
+			pids[pid_count++] = pid;
+			p = (*end == ',') ? end + 1 : end;
+		}
+
+		printf("Received ECU %s enabled=%s with %d PID(s)\n", id, enabled, (int)pid_count);
+
+		// The whole id must be a valid ECU number, atoi would wrap 258 to ECU 2
+		char *end;
+		unsigned long ecu = strtoul(id, &end, 10);
+		if (end == id || *end != '\0' || ecu >= OBD_ECU_MAX) {
+			printf("Invalid ECU %s\n", id);
+			code = 400;
+		} else {
+			code = (obd_ecu_configure(ecu, atoi(enabled) != 0, pids, pid_count) == ESP_OK) ? 200 : 400;
+		}
+	} else if (addressing == NULL) {
+		printf("Invalid data received !\n");
+	}
+
+	http_response_begin(http_ctx, code, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = "", .data_is_persistent = true };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+// Play a drive cycle from the FAT partition: file=<name>&speed=<multiplier, default 1>&loop=<0|1>
+// Without `file` the current playback is stopped
+static void cb_PATCH_playback(http_context_t http_ctx, void* ctx)
+{
+	const char *file = http_request_get_arg_value(http_ctx, "file");
+	const char *speed = http_request_get_arg_value(http_ctx, "speed");
+	const char *loop = http_request_get_arg_value(http_ctx, "loop");
+	unsigned int code = 200;
+
+	if (file == NULL) {
+		printf("Stopping playback\n");
+		playback_stop();
+	} else if (strchr(file, '/') != NULL) {
+		printf("Invalid data received !\n");
+		code = 400;
+	} else {
+		char path[64];
+		snprintf(path, sizeof(path), "/spiflash/%s", file);
+		int32_t multiplier = (speed != NULL) ? vehicle_parse_value(speed) : PLAYBACK_SPEED_REALTIME;
+
+		esp_err_t err = playback_start(path, multiplier, loop != NULL && atoi(loop) != 0);
+		printf("Starting playback of %s: %s\n", path, esp_err_to_name(err));
+		if (err == ESP_ERR_NOT_FOUND) {
+			code = 404;
+		} else if (err != ESP_OK) {
+			code = 400;
+		}
+	}
+
+	http_response_begin(http_ctx, code, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = "", .data_is_persistent = true };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+// Run the physics model: enabled=<0|1>&rate=<steps per second, default 50>
+static void cb_PATCH_physics(http_context_t http_ctx, void* ctx)
+{
+	const char *enabled = http_request_get_arg_value(http_ctx, "enabled");
+	const char *rate = http_request_get_arg_value(http_ctx, "rate");
+	unsigned int code = 200;
+
+	if (enabled != NULL && atoi(enabled) == 0) {
+		printf("Stopping physics model\n");
+		physics_stop();
+	} else {
+		uint32_t rate_hz = (rate != NULL) ? (uint32_t)atoi(rate) : 50;
+		printf("Starting physics model at %" PRIu32 " Hz\n", rate_hz);
+		if (physics_start(rate_hz) != ESP_OK) {
+			code = 400;
+		}
+	}
+
+	http_response_begin(http_ctx, code, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = "", .data_is_persistent = true };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+// Physics step cost, to keep it within budget next to the CAN task
+static void cb_GET_physics(http_context_t http_ctx, void* ctx)
+{
+	physics_stats_t stats;
+	physics_get_stats(&stats);
+
+	char body[160];
+	snprintf(body, sizeof(body),
+		"{\"running\":%d,\"rate_hz\":%" PRIu32 ",\"steps\":%" PRIu32 ",\"last_us\":%" PRIu32 ",\"avg_us\":%" PRIu64 ",\"max_us\":%" PRIu32 "}",
+		physics_is_running(), stats.rate_hz, stats.steps, stats.last_us,
+		stats.steps ? stats.total_us / stats.steps : 0, stats.max_us);
+
+	http_response_begin(http_ctx, 200, "application/json", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = body };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+// Replay a candump/ASC trace from the FAT partition: file=<name>&speed=<multiplier, default 1>
+// Without `file` the current replay is stopped
+static void cb_PATCH_replay(http_context_t http_ctx, void* ctx)
+{
+	const char *file = http_request_get_arg_value(http_ctx, "file");
+	const char *speed = http_request_get_arg_value(http_ctx, "speed");
+	unsigned int code = 200;
+
+	if (file == NULL) {
+		printf("Stopping replay\n");
+		replay_stop();
+	} else if (strchr(file, '/') != NULL) {
+		printf("Invalid data received !\n");
+		code = 400;
+	} else {
+		char path[64];
+		snprintf(path, sizeof(path), "/spiflash/%s", file);
+		int32_t multiplier = (speed != NULL) ? vehicle_parse_value(speed) : REPLAY_SPEED_REALTIME;
+
+		esp_err_t err = replay_start(path, multiplier);
+		printf("Starting replay of %s: %s\n", path, esp_err_to_name(err));
+		if (err == ESP_ERR_NOT_FOUND) {
+			code = 404;
+		} else if (err != ESP_OK) {
+			code = 400;
+		}
+	}
+
+	http_response_begin(http_ctx, code, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = "", .data_is_persistent = true };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+// Replay fidelity: frame counts and how late frames left against the trace timing
+static void cb_GET_replay(http_context_t http_ctx, void* ctx)
+{
+	replay_stats_t stats;
+	replay_get_stats(&stats);
+
+	// Every counter at 10 digits takes 444 bytes and the NUL
+	char body[448];
+	int len = snprintf(body, sizeof(body),
+		"{\"running\":%d,\"sent\":%" PRIu32 ",\"dropped\":%" PRIu32 ",\"skipped_lines\":%" PRIu32 ",\"underruns\":%" PRIu32 ",\"max_error_us\":%" PRIu32 ",\"histogram\":[",
+		replay_is_running(), stats.sent, stats.dropped, stats.skipped_lines, stats.underruns, stats.max_error_us);
+	for (int i = 0; i < REPLAY_HISTOGRAM_BINS; i++) {
+		if (i < REPLAY_HISTOGRAM_BINS - 1) {
+			len += snprintf(body + len, sizeof(body) - len, "%s{\"le_us\":%" PRIu32 ",\"count\":%" PRIu32 "}",
+				i ? "," : "", replay_histogram_bounds_us[i], stats.histogram[i]);
+		} else {
+			len += snprintf(body + len, sizeof(body) - len, ",{\"le_us\":null,\"count\":%" PRIu32 "}]}", stats.histogram[i]);
+		}
+	}
+
+	http_response_begin(http_ctx, 200, "application/json", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = body };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+static const char *const latency_stage_names[LATENCY_STAGES] = { "rx_to_dispatch", "dispatch_to_submit", "submit_to_tx", "rx_to_tx" };
+
+// Request latency per stage, over all requests and per service and first PID
+static void cb_GET_latency(http_context_t http_ctx, void* ctx)
+{
+	latency_entry_t entry;
+	latency_summary_t summary;
+	char body[640];
+	int len = snprintf(body, sizeof(body), "{\"entries\":[");
+
+	http_response_begin(http_ctx, 200, "application/json", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = body };
+
+	// One entry per write, the largest one fits the buffer
+	for (size_t i = 0; latency_get(i, &entry); i++) {
+		if (entry.all) {
+			len += snprintf(body + len, sizeof(body) - len, "{\"service\":null,\"pid\":null");
+		} else {
+			len += snprintf(body + len, sizeof(body) - len, "%s{\"service\":%u,\"pid\":\"0x%02x\"", i ? "," : "", entry.service, entry.pid);
+		}
+		for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+			latency_summarize(&entry.stages[stage], &summary);
+			len += snprintf(body + len, sizeof(body) - len,
+				",\"%s\":{\"count\":%" PRIu32 ",\"avg_us\":%" PRIu32 ",\"p50_us\":%" PRIu32 ",\"p95_us\":%" PRIu32 ",\"p99_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}",
+				latency_stage_names[stage], summary.count, summary.avg_us, summary.p50_us, summary.p95_us, summary.p99_us, summary.max_us);
+		}
+		len += snprintf(body + len, sizeof(body) - len, "}");
+		http_response_write(http_ctx, &http_response);
+		len = 0;
+	}
+	snprintf(body + len, sizeof(body) - len, "]}");
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+// Requests answered and per-connection arena use of the HTTP server
+static void cb_GET_http(http_context_t http_ctx, void* ctx)
+{
+	http_server_stats_t stats;
+	http_server_get_stats(server, &stats);
+
+	char body[128];
+	snprintf(body, sizeof(body),
+		"{\"requests\":%" PRIu32 ",\"arena\":{\"size\":%u,\"high_water\":%u,\"failures\":%" PRIu32 "}}",
+		stats.requests, (unsigned)stats.arena_size, (unsigned)stats.arena_high_water, stats.arena_failures);
+
+	http_response_begin(http_ctx, 200, "application/json", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = body };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+static void cb_DELETE_latency(http_context_t http_ctx, void* ctx)
+{
+	printf("Resetting latency histograms\n");
+	latency_reset();
+
+	http_response_begin(http_ctx, 200, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = "", .data_is_persistent = true };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+static const char *const trace_level_names[] = { "off", "frames", "debug" };
+
+// Trace verbosity and outputs: level=<off|frames|debug>&serial=<0|1>&file=<0|1>
+static void cb_PATCH_trace(http_context_t http_ctx, void* ctx)
+{
+	const char *level = http_request_get_arg_value(http_ctx, "level");
+	const char *serial = http_request_get_arg_value(http_ctx, "serial");
+	const char *file = http_request_get_arg_value(http_ctx, "file");
+	unsigned int code = 200;
+
+	if (level != NULL) {
+		int i = 0;
+		while (i <= TRACE_DEBUG && strcmp(level, trace_level_names[i]) != 0) {
+			i++;
+		}
+		if (i > TRACE_DEBUG) {
+			printf("Invalid data received !\n");
+			code = 400;
+		} else {
+			trace_set_level((trace_level_t)i);
+		}
+	}
+
+	if (code == 200 && (serial != NULL || file != NULL)) {
+		trace_stats_t stats;
+		trace_get_stats(&stats);
+		uint32_t sinks = stats.sinks;
+		if (serial != NULL) {
+			sinks = atoi(serial) ? (sinks | TRACE_SINK_SERIAL) : (sinks & ~TRACE_SINK_SERIAL);
+		}
+		if (file != NULL) {
+			sinks = atoi(file) ? (sinks | TRACE_SINK_FILE) : (sinks & ~TRACE_SINK_FILE);
+		}
+		if (trace_set_sinks(sinks) != ESP_OK) {
+			printf("Cannot open %s\n", TRACE_FILE_PATH);
+			code = 500;
+		}
+	}
+
+	http_response_begin(http_ctx, code, "text/plain", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = "", .data_is_persistent = true };
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+// Trace counters and the latest frames as candump lines
+static void cb_GET_trace(http_context_t http_ctx, void* ctx)
+{
+	trace_stats_t stats;
+	trace_get_stats(&stats);
+	trace_record_t records[TRACE_RECENT];
+	size_t count = trace_get_recent(records, TRACE_RECENT);
+
+	char body[512];
+	int len = snprintf(body, sizeof(body),
+		"{\"level\":\"%s\",\"serial\":%d,\"file\":%d,\"recorded\":%" PRIu32 ",\"dropped\":%" PRIu32 ",\"drained\":%" PRIu32 ",\"file_errors\":%" PRIu32 ",\"frames\":[",
+		trace_level_names[stats.level], (stats.sinks & TRACE_SINK_SERIAL) != 0, (stats.sinks & TRACE_SINK_FILE) != 0,
+		stats.recorded, stats.dropped, stats.drained, stats.file_errors);
+
+	http_response_begin(http_ctx, 200, "application/json", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = body };
+	for (size_t i = 0; i < count; i++) {
+		if (len > (int)sizeof(body) - TRACE_LINE_MAX - 4) {
+			http_response_write(http_ctx, &http_response);
+			len = 0;
+		}
+		len += snprintf(body + len, sizeof(body) - len, "%s\"", i ? "," : "");
+		len += trace_format(&records[i], body + len, sizeof(body) - len);
+		len += snprintf(body + len, sizeof(body) - len, "\"");
+	}
+	snprintf(body + len, sizeof(body) - len, "]}");
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+static const char *const can_bus_state_names[] = { "active", "warning", "passive", "off", "recovering" };
+
+// CAN receive filter (what the hardware lets through and the software drops), RX losses, RX -> TX latency, TX queue and bus state
+static void cb_GET_can(http_context_t http_ctx, void* ctx)
+{
+	CAN_filter_stats_t stats;
+	CAN_get_filter_stats(&stats);
+	CAN_rx_stats_t rx;
+	CAN_get_rx_stats(&rx);
+	CAN_tx_stats_t tx;
+	CAN_get_tx_stats(&tx);
+	CAN_bus_stats_t bus;
+	CAN_get_bus_stats(&bus);
+	CAN_bus_event_t events[CAN_BUS_EVENT_LOG];
+	size_t event_count = CAN_get_bus_events(events, CAN_BUS_EVENT_LOG);
+
+	// Entry 0 covers all requests
+	latency_entry_t entry;
+	latency_summary_t latency;
+	latency_get(0, &entry);
+	latency_summarize(&entry.stages[LATENCY_RX_TO_TX], &latency);
+
+	char body[896];
+	int len = snprintf(body, sizeof(body),
+		"{\"filter\":{\"mode\":\"%s\",\"code\":\"0x%08" PRIx32 "\",\"mask\":\"0x%08" PRIx32 "\",\"width\":%" PRIu32 "},"
+		"\"hw_accepted\":%" PRIu32 ",\"sw_rejected\":%" PRIu32 ","
+		"\"rx_to_tx\":{\"path\":\"%s\",\"count\":%" PRIu32 ",\"avg_us\":%" PRIu32 ",\"p50_us\":%" PRIu32 ",\"p99_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "},"
+		"\"tx\":{\"queued\":%" PRIu32 ",\"sent\":%" PRIu32 ",\"retries\":%" PRIu32 ",\"expired\":%" PRIu32 ",\"cancelled\":%" PRIu32 ",\"full\":%" PRIu32 ","
+		"\"last_us\":%" PRIu32 ",\"avg_us\":%" PRIu64 ",\"max_us\":%" PRIu32 "},",
+		stats.hw_dual ? "dual" : "single", stats.hw_code, stats.hw_mask, stats.hw_width,
+		stats.hw_accepted, stats.sw_rejected,
+		OBD_RX_QUEUED ? "queued" : "direct", latency.count, latency.avg_us, latency.p50_us, latency.p99_us, latency.max_us,
+		tx.queued, tx.sent, tx.retries, tx.expired, tx.cancelled, tx.full,
+		tx.last_us, tx.sent ? tx.total_us / tx.sent : 0, tx.max_us);
+	len += snprintf(body + len, sizeof(body) - len,
+		"\"rx\":{\"received\":%" PRIu32 ",\"hw_overruns\":%" PRIu32 ",\"driver_missed\":%" PRIu32 ",\"driver_hwm\":%" PRIu32 ",\"driver_depth\":%" PRIu32 ","
+		"\"queue_drops\":%" PRIu32 ",\"queue_hwm\":%" PRIu32 ",\"queue_depth\":%" PRIu32 ",\"bursts\":[",
+		rx.received, rx.hw_overruns, rx.driver_missed, rx.driver_hwm, rx.driver_depth,
+		rx.queue_drops, rx.queue_hwm, rx.queue_depth);
+	for (int i = 0; i < CAN_RX_BURST_BINS; i++) {
+		len += snprintf(body + len, sizeof(body) - len, "%s%" PRIu32, i ? "," : "", rx.bursts[i]);
+	}
+	snprintf(body + len, sizeof(body) - len, "]},");
+
+	http_response_begin(http_ctx, 200, "application/json", HTTP_RESPONSE_SIZE_UNKNOWN);
+	http_buffer_t http_response = { .data = body };
+	http_response_write(http_ctx, &http_response);
+
+	// Bus state and its latest transitions, in a second part to keep the buffer small
+	len = snprintf(body, sizeof(body),
+		"\"bus\":{\"state\":\"%s\",\"error_passive\":%" PRIu32 ",\"bus_off\":%" PRIu32 ",\"recoveries\":%" PRIu32 ",\"backoff_ms\":%" PRIu32 ","
+		"\"recover\":{\"last_us\":%" PRIu32 ",\"avg_us\":%" PRIu64 ",\"max_us\":%" PRIu32 "},\"events\":[",
+		can_bus_state_names[bus.state], bus.error_passive, bus.bus_off, bus.recoveries, bus.backoff_ms,
+		bus.recover_last_us, bus.recoveries ? bus.recover_total_us / bus.recoveries : 0, bus.recover_max_us);
+	for (size_t i = 0; i < event_count; i++) {
+		if (len > (int)sizeof(body) - 64) {
+			http_response_write(http_ctx, &http_response);
+			len = 0;
+		}
+		len += snprintf(body + len, sizeof(body) - len, "%s{\"time_us\":%" PRId64 ",\"state\":\"%s\"}",
+			i ? "," : "", events[i].time_us, can_bus_state_names[events[i].state]);
+	}
+	snprintf(body + len, sizeof(body) - len, "]}}");
+	http_response_write(http_ctx, &http_response);
+	http_response_end(http_ctx);
+}
+
+// Serial console: where received frames got lost, bus state transitions, then the driver state
+static int cmd_can(int argc, char **argv)
+{
+	static const char *const burst_labels[CAN_RX_BURST_BINS] = { "1", "2", "3-4", "5-8", "9-16", "17-32", ">32" };
+	CAN_rx_stats_t rx;
+	CAN_get_rx_stats(&rx);
+
+	printf("RX received     : %" PRIu32 "\n", rx.received);
+	printf("   hw overruns  : %" PRIu32 "\n", rx.hw_overruns);
+	printf("   driver missed: %" PRIu32 " (high water %" PRIu32 "/%" PRIu32 ")\n", rx.driver_missed, rx.driver_hwm, rx.driver_depth);
+	printf("   queue drops  : %" PRIu32 " (high water %" PRIu32 "/%" PRIu32 ")\n", rx.queue_drops, rx.queue_hwm, rx.queue_depth);
+	printf("   bursts       :");
+	for (int i = 0; i < CAN_RX_BURST_BINS; i++) {
+		printf(" %s:%" PRIu32, burst_labels[i], rx.bursts[i]);
+	}
+	printf("\n");
+
+	latency_entry_t entry;
+	latency_summary_t latency;
+	latency_get(0, &entry);
+	latency_summarize(&entry.stages[LATENCY_RX_TO_TX], &latency);
+	printf("RX -> TX (%s): %" PRIu32 " responses, avg %" PRIu32 " us, p99 %" PRIu32 " us, max %" PRIu32 " us\n",
+		OBD_RX_QUEUED ? "queued" : "direct", latency.count, latency.avg_us, latency.p99_us, latency.max_us);
+
+	CAN_bus_stats_t bus;
+	CAN_get_bus_stats(&bus);
+	CAN_bus_event_t events[CAN_BUS_EVENT_LOG];
+	size_t event_count = CAN_get_bus_events(events, CAN_BUS_EVENT_LOG);
+
+	printf("Bus state       : %s\n", can_bus_state_names[bus.state]);
+	printf("   error passive: %" PRIu32 ", bus off: %" PRIu32 ", recovered: %" PRIu32 "\n", bus.error_passive, bus.bus_off, bus.recoveries);
+	printf("   recovery     : last %" PRIu32 " us, max %" PRIu32 " us, backoff %" PRIu32 " ms\n", bus.recover_last_us, bus.recover_max_us, bus.backoff_ms);
+	for (size_t i = 0; i < event_count; i++) {
+		printf("   %12" PRId64 " us %s\n", events[i].time_us, can_bus_state_names[events[i].state]);
+	}
+
+	CAN_print_diagnostics();
+	return 0;
+}
+
+// Serial console: trace [off|frames|debug] [serial|noserial] [file|nofile]
+static int cmd_trace(int argc, char **argv)
+{
+	trace_stats_t stats;
+	trace_get_stats(&stats);
+	uint32_t sinks = stats.sinks;
+
+	for (int i = 1; i < argc; i++) {
+		int level = 0;
+		while (level <= TRACE_DEBUG && strcmp(argv[i], trace_level_names[level]) != 0) {
+			level++;
+		}
+		if (level <= TRACE_DEBUG) {
+			trace_set_level((trace_level_t)level);
+		} else if (strcmp(argv[i], "serial") == 0) {
+			sinks |= TRACE_SINK_SERIAL;
+		} else if (strcmp(argv[i], "noserial") == 0) {
+			sinks &= ~TRACE_SINK_SERIAL;
+		} else if (strcmp(argv[i], "file") == 0) {
+			sinks |= TRACE_SINK_FILE;
+		} else if (strcmp(argv[i], "nofile") == 0) {
+			sinks &= ~TRACE_SINK_FILE;
+		} else {
+			printf("Unknown argument %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (sinks != stats.sinks && trace_set_sinks(sinks) != ESP_OK) {
+		printf("Cannot open %s\n", TRACE_FILE_PATH);
+	}
+
+	trace_get_stats(&stats);
+	printf("Trace level     : %s\n", trace_level_names[stats.level]);
+	printf("   outputs      :%s%s\n", (stats.sinks & TRACE_SINK_SERIAL) ? " serial" : "", (stats.sinks & TRACE_SINK_FILE) ? " " TRACE_FILE_PATH : "");
+	printf("   frames       : %" PRIu32 " recorded, %" PRIu32 " dropped, %" PRIu32 " drained\n", stats.recorded, stats.dropped, stats.drained);
+	printf("   file errors  : %" PRIu32 "\n", stats.file_errors);
+	return 0;
+}
+
+// Serial console: latency [reset]
+static int cmd_latency(int argc, char **argv)
+{
+	if (argc > 1) {
+		if (strcmp(argv[1], "reset") != 0) {
+			printf("Unknown argument %s\n", argv[1]);
+			return 1;
+		}
+		latency_reset();
+		return 0;
+	}
+
+	latency_entry_t entry;
+	latency_summary_t summary;
+	printf("%-9s %-18s %8s %8s %8s %8s %8s %8s\n", "request", "stage", "count", "avg", "p50", "p95", "p99", "max");
+	for (size_t i = 0; latency_get(i, &entry); i++) {
+		char name[16];
+		if (entry.all) {
+			snprintf(name, sizeof(name), "all");
+		} else {
+			snprintf(name, sizeof(name), "%02x/%02x", entry.service, entry.pid);
+		}
+		for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+			latency_summarize(&entry.stages[stage], &summary);
+			if (summary.count == 0) {
+				continue;
+			}
+			printf("%-9s %-18s %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 "\n",
+				name, latency_stage_names[stage], summary.count, summary.avg_us, summary.p50_us, summary.p95_us, summary.p99_us, summary.max_us);
+		}
+	}
+	printf("(us, percentiles are bin upper bounds)\n");
+	return 0;
+}
+
+// Serial console: http
+static int cmd_http(int argc, char **argv)
+{
+	http_server_stats_t stats;
+	http_server_get_stats(server, &stats);
+
+	printf("requests %" PRIu32 "\n", stats.requests);
+	printf("arena    %u of %u bytes at most per request, %" PRIu32 " allocation(s) failed\n",
+		(unsigned)stats.arena_high_water, (unsigned)stats.arena_size, stats.arena_failures);
+	return 0;
+}
+
+// Serial console: cost of the PID cache and of a generator tick
+static int cmd_bench(int argc, char **argv)
+{
+	obd_cache_benchmark(1000);
+	generator_benchmark(500);
+	return 0;
+}
+
 void wifi_init_softap()
 {
 	wifi_event_group = xEventGroupCreate();
@@ -470,6 +875,16 @@ void app_main()
 	}
 	ESP_ERROR_CHECK(ret);
 
+	///////////////// OBD
+
+	obd_ecu_init();
+	obd_cache_init();
+	playback_init();
+	physics_init();
+	replay_init();
+	generator_init();
+	trace_init();
+
 	///////////////// WIFI	
 
 	printf("Initializing WIFI...\n");
@@ -479,7 +894,6 @@ void app_main()
 
 	printf("Initializing HTTP server...\n");
 
-	http_server_t server;
 	http_server_options_t http_options = HTTP_SERVER_OPTIONS_DEFAULT();
 
 	ESP_ERROR_CHECK(http_server_start(&http_options, &server));
@@ -489,6 +903,37 @@ void app_main()
 	// ESP_ERROR_CHECK(http_register_handler(server, "/main.css", HTTP_GET, HTTP_HANDLE_RESPONSE, &cb_GET_file, "/spiflash/main.css"));
 	// ESP_ERROR_CHECK(http_register_handler(server, "/main.js", HTTP_GET, HTTP_HANDLE_RESPONSE, &cb_GET_file, "/spiflash/main.js"));
 	ESP_ERROR_CHECK(http_register_form_handler(server, "/api/vehicle", HTTP_PATCH, HTTP_HANDLE_RESPONSE, &cb_PATCH_vehicle, NULL));
+	ESP_ERROR_CHECK(http_register_form_handler(server, "/api/ecu", HTTP_PATCH, HTTP_HANDLE_RESPONSE, &cb_PATCH_ecu, NULL));
+	ESP_ERROR_CHECK(http_register_handler(server, "/api/can", HTTP_GET, HTTP_HANDLE_RESPONSE, &cb_GET_can, NULL));
+	ESP_ERROR_CHECK(http_register_form_handler(server, "/api/generator", HTTP_PATCH, HTTP_HANDLE_RESPONSE, &cb_PATCH_generator, NULL));
+	ESP_ERROR_CHECK(http_register_handler(server, "/api/generator", HTTP_GET, HTTP_HANDLE_RESPONSE, &cb_GET_generator, NULL));
+	ESP_ERROR_CHECK(http_register_form_handler(server, "/api/playback", HTTP_PATCH, HTTP_HANDLE_RESPONSE, &cb_PATCH_playback, NULL));
+	ESP_ERROR_CHECK(http_register_form_handler(server, "/api/physics", HTTP_PATCH, HTTP_HANDLE_RESPONSE, &cb_PATCH_physics, NULL));
+	ESP_ERROR_CHECK(http_register_handler(server, "/api/physics", HTTP_GET, HTTP_HANDLE_RESPONSE, &cb_GET_physics, NULL));
+	ESP_ERROR_CHECK(http_register_form_handler(server, "/api/replay", HTTP_PATCH, HTTP_HANDLE_RESPONSE, &cb_PATCH_replay, NULL));
+	ESP_ERROR_CHECK(http_register_handler(server, "/api/replay", HTTP_GET, HTTP_HANDLE_RESPONSE, &cb_GET_replay, NULL));
+	ESP_ERROR_CHECK(http_register_handler(server, "/api/latency", HTTP_GET, HTTP_HANDLE_RESPONSE, &cb_GET_latency, NULL));
+	ESP_ERROR_CHECK(http_register_handler(server, "/api/latency", HTTP_DELETE, HTTP_HANDLE_RESPONSE, &cb_DELETE_latency, NULL));
+	ESP_ERROR_CHECK(http_register_form_handler(server, "/api/trace", HTTP_PATCH, HTTP_HANDLE_RESPONSE, &cb_PATCH_trace, NULL));
+	ESP_ERROR_CHECK(http_register_handler(server, "/api/trace", HTTP_GET, HTTP_HANDLE_RESPONSE, &cb_GET_trace, NULL));
+	ESP_ERROR_CHECK(http_register_handler(server, "/api/http", HTTP_GET, HTTP_HANDLE_RESPONSE, &cb_GET_http, NULL));
+
+	///////////////// Console
+
+	ret = console_init();
+	if (ret == ESP_OK)
+	{
+		ESP_ERROR_CHECK(console_register("can", "CAN receive losses, queue high-water marks, bus state transitions and error counters", NULL, &cmd_can));
+		ESP_ERROR_CHECK(console_register("trace", "Show or set the CAN frame trace level and outputs", "[off|frames|debug] [serial|noserial] [file|nofile]", &cmd_trace));
+		ESP_ERROR_CHECK(console_register("latency", "Request latency per stage, service and PID (p50/p95/p99/max)", "[reset]", &cmd_latency));
+		ESP_ERROR_CHECK(console_register("http", "HTTP requests answered and request arena high-water mark", NULL, &cmd_http));
+		ESP_ERROR_CHECK(console_register("bench", "Benchmark the PID cache and the signal generators", NULL, &cmd_bench));
+		ESP_ERROR_CHECK(console_start());
+	}
+	else
+	{
+		printf("Serial console unavailable: %s\n", esp_err_to_name(ret));
+	}
 
 	////////////////// FAT - Disabled (requires partition table reflash)
 	// Close monitor first, then run: idf.py -p /dev/ttyACM0 flash
@@ -511,6 +956,5 @@ void app_main()
 	printf("========================================\n\n");
 
 	//Create CAN receive task - START LAST after all initialization
-	// Increased stack size to 4096 bytes for debug logging
-	xTaskCreate(&task_CAN, "CAN", 4096, NULL, 5, NULL);
+	obd_responder_start();
 }
@@ -3,3 +3,6 @@
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
 
+
+# Entry point of the linux target only (CMake build)
+COMPONENT_OBJEXCLUDE := linux_main.o
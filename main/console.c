@@ -0,0 +1,52 @@
+/** \file
+  \brief Serial console, see console.h
+*/
+
+#include "console.h"
+
+#include <stddef.h>
+
+#include "esp_console.h"
+
+static esp_console_repl_t *console_repl;
+
+esp_err_t console_init(void)
+{
+	esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+	repl_config.prompt = "obd>";
+	esp_err_t err;
+
+#if defined(CONFIG_ESP_CONSOLE_UART_DEFAULT) || defined(CONFIG_ESP_CONSOLE_UART_CUSTOM)
+	esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+	err = esp_console_new_repl_uart(&uart_config, &repl_config, &console_repl);
+#elif defined(CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG)
+	esp_console_dev_usb_serial_jtag_config_t jtag_config = ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT();
+	err = esp_console_new_repl_usb_serial_jtag(&jtag_config, &repl_config, &console_repl);
+#else
+	err = ESP_ERR_NOT_SUPPORTED;
+#endif
+	if (err != ESP_OK) {
+		return err;
+	}
+
+	return esp_console_register_help_command();
+}
+
+esp_err_t console_register(const char *name, const char *help, const char *hint, console_command_t func)
+{
+	const esp_console_cmd_t command = {
+		.command = name,
+		.help = help,
+		.hint = hint,
+		.func = func,
+	};
+	return esp_console_cmd_register(&command);
+}
+
+esp_err_t console_start(void)
+{
+	if (console_repl == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	return esp_console_start_repl(console_repl);
+}
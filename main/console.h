@@ -0,0 +1,33 @@
+/** \file
+  \brief Serial console
+  A line-editing REPL on the primary console (UART or USB Serial/JTAG) for
+   inspecting the emulator at run time. Modules register their commands
+   with console_register; `help` lists them.
+*/
+
+#ifndef __CONSOLE_H
+#define __CONSOLE_H
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+/// Command handler, argv[0] is the command name
+typedef int (*console_command_t)(int argc, char **argv);
+
+/// Set up the console, must be called once before console_register
+esp_err_t console_init(void);
+
+/// Add a command; `hint` describes the arguments, may be NULL
+esp_err_t console_register(const char *name, const char *help, const char *hint, console_command_t func);
+
+/// Start reading commands
+esp_err_t console_start(void);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __CONSOLE_H
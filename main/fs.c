@@ -25,7 +25,7 @@ esp_err_t dumpDir(char *path)
 				strcpy(type, "Directory");
 				break;
 		}
-		printf("| %s (%d, %s)\n", pDirent->d_name, pDirent->d_ino, type);
+		printf("| %s (%lu, %s)\n", pDirent->d_name, (unsigned long)pDirent->d_ino, type);
 	}
 	
 	printf("\n");
@@ -41,7 +41,7 @@ esp_err_t readFile(char *path, char *buffer, size_t *length)
 	if (fp != NULL) {
 		printf("Reading file\n");
 		size_t newLen = fread(buffer, sizeof(char), FILE_MAX_SIZE, fp);
-		printf("read %d\n", newLen);
+		printf("read %u\n", (unsigned int)newLen);
 		if (length) {
 			*length = newLen;
 		}
@@ -59,4 +59,77 @@ esp_err_t readFile(char *path, char *buffer, size_t *length)
 	}
 
 	return ESP_FAIL;
-}
\ No newline at end of file
+}
+
+esp_err_t lineReaderOpen(line_reader_t *reader, const char *path)
+{
+	reader->fp = fopen(path, "r");
+	if (reader->fp == NULL) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	// Chunks are buffered in the reader, no need for a second stdio buffer
+	setvbuf(reader->fp, NULL, _IONBF, 0);
+	reader->offset = 0;
+	reader->len = 0;
+	reader->pos = 0;
+	return ESP_OK;
+}
+
+char *lineReaderNext(line_reader_t *reader)
+{
+	for (;;) {
+		char *start = &reader->buf[reader->pos];
+		char *end = memchr(start, '\n', reader->len - reader->pos);
+		if (end != NULL) {
+			*end = '\0';
+			reader->pos = end - reader->buf + 1;
+			return start;
+		}
+
+		// Move the partial line to the front and append the next chunk.
+		// A line filling the whole buffer is too long and dropped.
+		size_t partial = reader->len - reader->pos;
+		if (partial == LINE_READER_CHUNK_SIZE) {
+			partial = 0;
+		}
+		memmove(reader->buf, &reader->buf[reader->len - partial], partial);
+		reader->offset += reader->len - partial;
+		reader->pos = 0;
+
+		size_t read = fread(&reader->buf[partial], 1, LINE_READER_CHUNK_SIZE - partial, reader->fp);
+		reader->len = partial + read;
+		if (read == 0) {
+			if (partial == 0) {
+				return NULL;
+			}
+			// Last line without a newline
+			reader->buf[reader->len] = '\0';
+			reader->pos = reader->len;
+			return reader->buf;
+		}
+	}
+}
+
+long lineReaderTell(const line_reader_t *reader)
+{
+	return reader->offset + reader->pos;
+}
+
+esp_err_t lineReaderSeek(line_reader_t *reader, long offset)
+{
+	if (fseek(reader->fp, offset, SEEK_SET) != 0) {
+		return ESP_FAIL;
+	}
+	reader->offset = offset;
+	reader->len = 0;
+	reader->pos = 0;
+	return ESP_OK;
+}
+
+void lineReaderClose(line_reader_t *reader)
+{
+	if (reader->fp != NULL) {
+		fclose(reader->fp);
+		reader->fp = NULL;
+	}
+}
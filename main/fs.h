@@ -1,6 +1,28 @@
 #include "esp_system.h"
 
+#include <stdio.h>
+
 #define FILE_MAX_SIZE 4096
 
+// Lines read by a line_reader_t must fit into one chunk
+#define LINE_READER_CHUNK_SIZE 512
+
+// Streams a text file line by line through a fixed buffer, for files larger than FILE_MAX_SIZE
+typedef struct {
+	FILE *fp;
+	long offset; // file offset of buf[0]
+	size_t len;
+	size_t pos;
+	char buf[LINE_READER_CHUNK_SIZE + 1];
+} line_reader_t;
+
 esp_err_t dumpDir(char *path);
-esp_err_t readFile(char *path, char *buffer, size_t *length);
\ No newline at end of file
+esp_err_t readFile(char *path, char *buffer, size_t *length);
+
+esp_err_t lineReaderOpen(line_reader_t *reader, const char *path);
+// Next line, NUL terminated in place (without the newline); NULL at end of file
+char *lineReaderNext(line_reader_t *reader);
+// File offset of the next line
+long lineReaderTell(const line_reader_t *reader);
+esp_err_t lineReaderSeek(line_reader_t *reader, long offset);
+void lineReaderClose(line_reader_t *reader);
@@ -0,0 +1,246 @@
+/** \file
+  \brief Parametric signal generators, see generator.h
+*/
+
+#include "generator.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+// One sine period in 256 segments, linearly interpolated; Q15
+#define GENERATOR_SINE_SEGMENTS 256
+#define GENERATOR_BENCHMARK_TICKS 100
+
+typedef struct {
+	generator_config_t config;
+	uint32_t phase;      // position in the period, 2^32 = one period
+	uint32_t phase_step; // phase advance per tick
+	uint32_t elapsed_ms; // step schedule time
+	uint8_t next_step;
+	uint32_t prng;       // xorshift32 state, never 0
+	int32_t value;
+} generator_t;
+
+static const char *const generator_type_names[GENERATOR_TYPE_COUNT] = {
+	"off", "constant", "ramp", "sine", "square", "steps", "random",
+};
+
+static int16_t generator_sine_table[GENERATOR_SINE_SEGMENTS + 1];
+
+static generator_t generators[VEHICLE_SIGNAL_COUNT];
+static uint32_t generator_active;
+
+// Guards generators; taken by the generator task each tick and by the httpd workers
+static SemaphoreHandle_t generator_lock;
+static TaskHandle_t generator_task;
+
+static generator_stats_t generator_stats;
+// Guards generator_stats; written by the generator task, read by the httpd workers
+static portMUX_TYPE generator_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static int32_t generator_sine(uint32_t phase)
+{
+	uint32_t index = phase >> 24;
+	int32_t fraction = (phase >> 8) & 0xFFFF;
+	int32_t a = generator_sine_table[index];
+	int32_t b = generator_sine_table[index + 1];
+	return a + (((b - a) * fraction) >> 16);
+}
+
+static uint32_t generator_random(generator_t *g)
+{
+	uint32_t x = g->prng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	g->prng = x;
+	return x;
+}
+
+static void generator_reset(generator_t *g, const generator_config_t *config)
+{
+	g->config = *config;
+	g->phase = 0;
+	g->phase_step = config->period_ms ? (uint32_t)((((uint64_t)GENERATOR_TICK_MS << 32) + config->period_ms / 2) / config->period_ms) : 0;
+	g->elapsed_ms = 0;
+	g->next_step = 0;
+	g->prng = config->seed ? config->seed : 1;
+	g->value = config->type == GENERATOR_RANDOM ? (int32_t)(((int64_t)config->min + config->max) / 2) : config->min;
+}
+
+// Value for the current tick, then advance by one tick
+static int32_t generator_step(generator_t *g)
+{
+	const generator_config_t *c = &g->config;
+	int64_t range = (int64_t)c->max - c->min;
+
+	switch (c->type) {
+	case GENERATOR_RAMP:
+		g->value = c->min + (int32_t)((range * (g->phase >> 16)) >> 16);
+		break;
+	case GENERATOR_SINE:
+		g->value = c->min + (int32_t)(range / 2 + ((range / 2 * generator_sine(g->phase)) >> 15));
+		break;
+	case GENERATOR_SQUARE:
+		g->value = g->phase < 0x80000000u ? c->max : c->min;
+		break;
+	case GENERATOR_STEPS:
+		while (g->next_step < c->step_count && g->elapsed_ms >= c->steps[g->next_step].time_ms) {
+			g->value = c->steps[g->next_step++].value;
+		}
+		g->elapsed_ms += GENERATOR_TICK_MS;
+		if (c->period_ms > 0 && g->elapsed_ms >= c->period_ms) {
+			g->elapsed_ms -= c->period_ms;
+			g->next_step = 0;
+		}
+		break;
+	case GENERATOR_RANDOM: {
+		// Uniform in [-noise, noise] by multiply-shift, clamped into [min, max]
+		int64_t delta = (int64_t)(((uint64_t)generator_random(g) * (2 * (uint64_t)c->noise + 1)) >> 32) - c->noise;
+		int64_t value = g->value + delta;
+		g->value = (int32_t)(value < c->min ? c->min : (value > c->max ? c->max : value));
+		break;
+	}
+	default:
+		break;
+	}
+
+	g->phase += g->phase_step;
+	return g->value;
+}
+
+static void task_generator(void *pvParameters)
+{
+	(void)pvParameters;
+	TickType_t last_wake = xTaskGetTickCount();
+
+	while (1) {
+		if (generator_active == 0) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			last_wake = xTaskGetTickCount();
+		}
+		vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(GENERATOR_TICK_MS));
+
+		vehicle_signal_t signals[VEHICLE_SIGNAL_COUNT];
+		int32_t values[VEHICLE_SIGNAL_COUNT];
+		size_t count = 0;
+
+		int64_t start = esp_timer_get_time();
+		xSemaphoreTake(generator_lock, portMAX_DELAY);
+		for (int signal = 0; signal < VEHICLE_SIGNAL_COUNT; signal++) {
+			if (generators[signal].config.type != GENERATOR_OFF) {
+				signals[count] = (vehicle_signal_t)signal;
+				values[count++] = generator_step(&generators[signal]);
+			}
+		}
+		xSemaphoreGive(generator_lock);
+		if (count > 0) {
+			vehicle_set_signals(signals, values, count);
+		}
+		uint32_t cost = (uint32_t)(esp_timer_get_time() - start);
+
+		portENTER_CRITICAL(&generator_stats_mux);
+		generator_stats.active = count;
+		generator_stats.ticks++;
+		generator_stats.last_us = cost;
+		if (cost > generator_stats.max_us) {
+			generator_stats.max_us = cost;
+		}
+		portEXIT_CRITICAL(&generator_stats_mux);
+	}
+}
+
+void generator_init(void)
+{
+	for (int i = 0; i <= GENERATOR_SINE_SEGMENTS; i++) {
+		generator_sine_table[i] = (int16_t)lrintf(32767.0f * sinf(2.0f * 3.14159265f * i / GENERATOR_SINE_SEGMENTS));
+	}
+
+	generator_lock = xSemaphoreCreateMutex();
+	xTaskCreate(&task_generator, "generator", 2048, NULL, 4, &generator_task);
+}
+
+esp_err_t generator_configure(vehicle_signal_t signal, const generator_config_t *config)
+{
+	if (signal >= VEHICLE_SIGNAL_COUNT || config->type >= GENERATOR_TYPE_COUNT
+		|| config->min > config->max || config->noise < 0 || config->step_count > GENERATOR_MAX_STEPS) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	if ((config->type == GENERATOR_RAMP || config->type == GENERATOR_SINE || config->type == GENERATOR_SQUARE)
+		&& config->period_ms < 2 * GENERATOR_TICK_MS) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	for (uint8_t i = 1; i < config->step_count; i++) {
+		if (config->steps[i].time_ms < config->steps[i - 1].time_ms) {
+			return ESP_ERR_INVALID_ARG;
+		}
+	}
+
+	xSemaphoreTake(generator_lock, portMAX_DELAY);
+	bool was_off = generators[signal].config.type == GENERATOR_OFF;
+	bool is_off = config->type == GENERATOR_OFF;
+	generator_reset(&generators[signal], config);
+	generator_active += (was_off && !is_off) - (!was_off && is_off);
+	xSemaphoreGive(generator_lock);
+
+	xTaskNotifyGive(generator_task);
+	return ESP_OK;
+}
+
+generator_type_t generator_type_from_name(const char *name)
+{
+	int type = 0;
+	while (type < GENERATOR_TYPE_COUNT && strcmp(name, generator_type_names[type]) != 0) {
+		type++;
+	}
+	return (generator_type_t)type;
+}
+
+void generator_get_stats(generator_stats_t *stats)
+{
+	portENTER_CRITICAL(&generator_stats_mux);
+	*stats = generator_stats;
+	portEXIT_CRITICAL(&generator_stats_mux);
+}
+
+void generator_benchmark(unsigned int count)
+{
+	generator_t *bench = malloc(count * sizeof(generator_t));
+	if (bench == NULL || count == 0) {
+		free(bench);
+		return;
+	}
+
+	generator_config_t config = {
+		.min = 0, .max = 100 * VEHICLE_SCALE, .period_ms = 10000, .noise = VEHICLE_SCALE,
+		.step_count = 2, .steps = { { 0, 0 }, { 5000, 50 * VEHICLE_SCALE } },
+	};
+	for (unsigned int i = 0; i < count; i++) {
+		config.type = (generator_type_t)(GENERATOR_CONSTANT + i % (GENERATOR_TYPE_COUNT - GENERATOR_CONSTANT));
+		config.seed = i;
+		generator_reset(&bench[i], &config);
+	}
+
+	volatile int32_t sink = 0;
+	int64_t start = esp_timer_get_time();
+	for (unsigned int tick = 0; tick < GENERATOR_BENCHMARK_TICKS; tick++) {
+		for (unsigned int i = 0; i < count; i++) {
+			sink += generator_step(&bench[i]);
+		}
+	}
+	int64_t elapsed_us = esp_timer_get_time() - start;
+	(void)sink;
+	free(bench);
+
+	printf("Generator benchmark (%u generators, %d ticks):\n", count, GENERATOR_BENCHMARK_TICKS);
+	printf("  %" PRId64 " us/tick, %" PRId64 " ns/generator\n",
+		elapsed_us / GENERATOR_BENCHMARK_TICKS, elapsed_us * 1000 / ((int64_t)count * GENERATOR_BENCHMARK_TICKS));
+}
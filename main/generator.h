@@ -0,0 +1,88 @@
+/** \file
+  \brief Parametric signal generators
+  Each vehicle signal can be driven by a generator: a constant, a ramp
+   (sawtooth), a sine, a square wave, a step schedule or a seeded random
+   walk. All generators are evaluated on one shared tick and published into
+   the vehicle state together. Evaluation is incremental and integer only:
+   periodic shapes advance a 32-bit phase accumulator, the sine comes from a
+   table, and the random walk uses a xorshift PRNG, so the same seed always
+   produces the same sequence.
+
+  Generators, playback and the physics model all write the vehicle state;
+   drive a signal from one source at a time.
+*/
+
+#ifndef __GENERATOR_H
+#define __GENERATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "vehicle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+/// Interval at which all generators are evaluated
+#define GENERATOR_TICK_MS 20
+
+#define GENERATOR_MAX_STEPS 8
+
+typedef enum {
+	GENERATOR_OFF,      ///< signal is left alone
+	GENERATOR_CONSTANT, ///< min
+	GENERATOR_RAMP,     ///< min to max over period, then starts over
+	GENERATOR_SINE,     ///< between min and max with period
+	GENERATOR_SQUARE,   ///< max for the first half of period, min for the second
+	GENERATOR_STEPS,    ///< step schedule starting at min, repeats after period if non-zero
+	GENERATOR_RANDOM,   ///< random walk from the middle of min and max, at most noise per tick
+	GENERATOR_TYPE_COUNT
+} generator_type_t;
+
+typedef struct {
+	uint32_t time_ms; ///< since the start of the schedule
+	int32_t value;
+} generator_step_t;
+
+typedef struct {
+	generator_type_t type;
+	int32_t min;        ///< milli-units
+	int32_t max;        ///< milli-units
+	uint32_t period_ms;
+	int32_t noise;      ///< random walk: largest step per tick, milli-units
+	uint32_t seed;      ///< random walk: PRNG seed, 0 is replaced by 1
+	uint8_t step_count;
+	generator_step_t steps[GENERATOR_MAX_STEPS]; ///< sorted by time
+} generator_config_t;
+
+/// Evaluation cost statistics
+typedef struct {
+	uint32_t active;   ///< generators running
+	uint32_t ticks;    ///< ticks since start
+	uint32_t last_us;  ///< cost of the last tick, including publishing
+	uint32_t max_us;   ///< most expensive tick
+} generator_stats_t;
+
+/// Create the generator task, must be called once before generator_configure
+void generator_init(void);
+
+/// Attach (or with GENERATOR_OFF detach) a generator to `signal`, restarting it from its initial state
+esp_err_t generator_configure(vehicle_signal_t signal, const generator_config_t *config);
+
+/// Look up a generator type by its API name ("off", "constant", "ramp", ...)
+/// return GENERATOR_TYPE_COUNT if the name is unknown
+generator_type_t generator_type_from_name(const char *name);
+
+void generator_get_stats(generator_stats_t *stats);
+
+/// Evaluate `count` generators of every type for a number of ticks and print the cost per generator
+void generator_benchmark(unsigned int count);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __GENERATOR_H
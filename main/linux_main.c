@@ -0,0 +1,42 @@
+/** \file
+  \brief Entry point on the linux target
+  Only the OBD responder runs, without Wi-Fi, HTTP, console or file system;
+   every received and transmitted frame is printed in candump log format.
+   With the SocketCAN backend (the default on linux) it answers on
+   CONFIG_ESP_CAN_SOCKETCAN_IFNAME:
+
+      sudo ip link add dev vcan0 type vcan && sudo ip link set up vcan0
+      idf.py --preview set-target linux && idf.py build && ./build/can-demo.elf
+      cansend vcan0 7DF#02010C0000000000
+*/
+
+#include <stdio.h>
+
+#include "CAN.h"
+#include "CAN_config.h"
+
+#include "obd_cache.h"
+#include "obd_ecu.h"
+#include "obd_responder.h"
+#include "trace.h"
+
+// The bitrate of a SocketCAN interface is set with `ip link`, not here
+CAN_device_t CAN_cfg = {
+	.speed = CAN_SPEED_500KBPS,
+	.rx_queue = NULL,
+};
+
+void app_main(void)
+{
+	obd_ecu_init();
+	obd_cache_init();
+	trace_init();
+	trace_set_level(TRACE_FRAMES);
+
+#if CONFIG_ESP_CAN_BACKEND_SOCKETCAN
+	printf("OBD-II emulator on %s\n", CONFIG_ESP_CAN_SOCKETCAN_IFNAME);
+#else
+	printf("OBD-II emulator\n");
+#endif
+	obd_responder_start();
+}
@@ -0,0 +1,239 @@
+/** \file
+  \brief Engine and vehicle physics model, see physics.h
+*/
+
+#include "physics.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "vehicle.h"
+
+// Engine
+#define PHYSICS_IDLE_RPM 800.0f
+#define PHYSICS_LAUNCH_RPM 2200.0f   // engine speed while the clutch slips at full throttle
+#define PHYSICS_REDLINE_RPM 6500.0f
+#define PHYSICS_PEAK_TORQUE 250.0f   // Nm
+#define PHYSICS_PEAK_TORQUE_RPM 4000.0f
+#define PHYSICS_FRICTION_TORQUE 15.0f // Nm
+#define PHYSICS_FRICTION_PER_RPM 0.004f
+
+// Driveline and body
+#define PHYSICS_GEAR_COUNT 5
+#define PHYSICS_FINAL_DRIVE 3.9f
+#define PHYSICS_EFFICIENCY 0.9f
+#define PHYSICS_WHEEL_RADIUS 0.31f // m
+#define PHYSICS_MASS 1400.0f       // kg
+#define PHYSICS_DRAG_AREA 0.7f     // Cd * A, m^2
+#define PHYSICS_AIR_DENSITY 1.2f
+#define PHYSICS_ROLLING 0.012f
+#define PHYSICS_GRAVITY 9.81f
+#define PHYSICS_UPSHIFT_RPM 2000.0f  // at zero throttle, rises with throttle
+#define PHYSICS_UPSHIFT_THROTTLE_RPM 3500.0f
+#define PHYSICS_DOWNSHIFT_RPM 1200.0f
+
+// Cooling, in degC/s
+#define PHYSICS_AMBIENT 20.0f
+#define PHYSICS_THERMOSTAT 90.0f
+#define PHYSICS_HEAT_IDLE 0.1f
+#define PHYSICS_HEAT_PER_KW 0.004f
+#define PHYSICS_RADIATOR 0.001f     // per degC above ambient
+#define PHYSICS_THERMOSTAT_GAIN 0.2f // per degC above the thermostat
+
+// Fuel
+#define PHYSICS_TANK 50.0f          // l
+#define PHYSICS_IDLE_FUEL 0.8f      // l/h
+#define PHYSICS_FUEL_PER_KWH 0.3f   // l/kWh
+
+#define PHYSICS_RPM_TO_RAD_S (2.0f * 3.14159265f / 60.0f)
+
+static const float physics_gears[PHYSICS_GEAR_COUNT] = { 3.6f, 2.1f, 1.4f, 1.0f, 0.8f };
+
+typedef struct {
+	float speed;   // m/s
+	float rpm;
+	int gear;      // 1 .. PHYSICS_GEAR_COUNT
+	float coolant; // degC
+	float fuel;    // l
+} physics_model_t;
+
+static physics_model_t physics_model;
+static uint32_t physics_rate_hz;
+static volatile bool physics_running;
+static volatile bool physics_restart;
+static TaskHandle_t physics_task;
+
+static physics_stats_t physics_stats;
+// Guards physics_stats; written by the physics task, read by the httpd workers
+static portMUX_TYPE physics_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const vehicle_signal_t physics_outputs[] = { VEHICLE_SPEED, VEHICLE_RPM, VEHICLE_COOLANT, VEHICLE_FUEL_LEVEL };
+
+// Advance the model by `dt` seconds with `throttle` in 0..1; no allocation, no I/O
+static void physics_step(physics_model_t *m, float dt, float throttle)
+{
+	float ratio = physics_gears[m->gear - 1] * PHYSICS_FINAL_DRIVE;
+
+	// Engine speed follows the wheels once the clutch is engaged; below idle the clutch slips
+	float wheel_rpm = m->speed / PHYSICS_WHEEL_RADIUS / PHYSICS_RPM_TO_RAD_S * ratio;
+	bool slipping = wheel_rpm < PHYSICS_IDLE_RPM;
+	float rpm = slipping ? PHYSICS_IDLE_RPM + throttle * (PHYSICS_LAUNCH_RPM - PHYSICS_IDLE_RPM) : wheel_rpm;
+
+	// Torque curve peaks at PHYSICS_PEAK_TORQUE_RPM, the limiter cuts fuel at the redline
+	float x = (rpm - PHYSICS_PEAK_TORQUE_RPM) / PHYSICS_PEAK_TORQUE_RPM;
+	float engine_torque = throttle * PHYSICS_PEAK_TORQUE * (1.0f - 0.5f * x * x);
+	if (rpm >= PHYSICS_REDLINE_RPM) {
+		engine_torque = 0.0f;
+		rpm = PHYSICS_REDLINE_RPM;
+	}
+	float torque = engine_torque - (PHYSICS_FRICTION_TORQUE + rpm * PHYSICS_FRICTION_PER_RPM);
+	if (slipping && torque < 0.0f) {
+		torque = 0.0f; // no engine braking through a slipping clutch
+	}
+
+	// Longitudinal dynamics
+	float drive = torque * ratio * PHYSICS_EFFICIENCY / PHYSICS_WHEEL_RADIUS;
+	float resistance = 0.5f * PHYSICS_AIR_DENSITY * PHYSICS_DRAG_AREA * m->speed * m->speed
+		+ PHYSICS_ROLLING * PHYSICS_MASS * PHYSICS_GRAVITY;
+	m->speed += (drive - resistance) / PHYSICS_MASS * dt;
+	if (m->speed < 0.0f) {
+		m->speed = 0.0f;
+	}
+
+	// Automatic gearbox: later upshifts under load
+	if (m->gear < PHYSICS_GEAR_COUNT && wheel_rpm > PHYSICS_UPSHIFT_RPM + throttle * PHYSICS_UPSHIFT_THROTTLE_RPM) {
+		m->gear++;
+	} else if (m->gear > 1 && wheel_rpm < PHYSICS_DOWNSHIFT_RPM) {
+		m->gear--;
+	}
+
+	// Coolant warms with engine power, the radiator and thermostat pull it back
+	float power_kw = engine_torque * rpm * PHYSICS_RPM_TO_RAD_S / 1000.0f;
+	float heating = PHYSICS_HEAT_IDLE + power_kw * PHYSICS_HEAT_PER_KW;
+	float cooling = PHYSICS_RADIATOR * (m->coolant - PHYSICS_AMBIENT);
+	if (m->coolant > PHYSICS_THERMOSTAT) {
+		cooling += PHYSICS_THERMOSTAT_GAIN * (m->coolant - PHYSICS_THERMOSTAT);
+	}
+	m->coolant += (heating - cooling) * dt;
+
+	// Fuel burnt at idle plus in proportion to the work done
+	m->fuel -= (PHYSICS_IDLE_FUEL + power_kw * PHYSICS_FUEL_PER_KWH) / 3600.0f * dt;
+	if (m->fuel < 0.0f) {
+		m->fuel = 0.0f;
+	}
+
+	m->rpm = rpm;
+}
+
+static void physics_publish(const physics_model_t *m)
+{
+	const int32_t values[] = {
+		(int32_t)(m->speed * 3.6f * VEHICLE_SCALE),
+		(int32_t)(m->rpm * VEHICLE_SCALE),
+		(int32_t)(m->coolant * VEHICLE_SCALE),
+		(int32_t)(m->fuel * (100.0f / PHYSICS_TANK) * VEHICLE_SCALE),
+	};
+	vehicle_set_signals(physics_outputs, values, sizeof(physics_outputs) / sizeof(physics_outputs[0]));
+}
+
+// Continue from whatever the sliders or a playback left behind
+static void physics_seed(physics_model_t *m)
+{
+	vehicle_state_t state;
+	vehicle_read(&state);
+
+	m->speed = (float)state.signals[VEHICLE_SPEED] / (3.6f * VEHICLE_SCALE);
+	m->rpm = (float)state.signals[VEHICLE_RPM] / VEHICLE_SCALE;
+	m->gear = 1;
+	m->coolant = (float)state.signals[VEHICLE_COOLANT] / VEHICLE_SCALE;
+	m->fuel = (float)state.signals[VEHICLE_FUEL_LEVEL] * (PHYSICS_TANK / 100.0f) / VEHICLE_SCALE;
+}
+
+static void task_physics(void *pvParameters)
+{
+	(void)pvParameters;
+	TickType_t last_wake = xTaskGetTickCount();
+
+	while (1) {
+		if (!physics_running) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+		if (physics_restart) {
+			physics_restart = false;
+			physics_seed(&physics_model);
+			portENTER_CRITICAL(&physics_stats_mux);
+			memset(&physics_stats, 0, sizeof(physics_stats));
+			portEXIT_CRITICAL(&physics_stats_mux);
+			last_wake = xTaskGetTickCount();
+		}
+		// The period is whole ticks, so step by what it really is: with a 100 Hz tick
+		// 60 Hz sleeps 10 ms, and stepping 1/60 s would run 1.67x real time
+		TickType_t period = MAX(1, pdMS_TO_TICKS(1000 / physics_rate_hz));
+		uint32_t period_ms = period * portTICK_PERIOD_MS;
+		vTaskDelayUntil(&last_wake, period);
+		if (!physics_running) {
+			continue;
+		}
+
+		int64_t start = esp_timer_get_time();
+		float throttle = (float)vehicle_get_signal(VEHICLE_THROTTLE) / (100 * VEHICLE_SCALE);
+		physics_step(&physics_model, period_ms / 1000.0f, throttle < 0.0f ? 0.0f : (throttle > 1.0f ? 1.0f : throttle));
+		physics_publish(&physics_model);
+		uint32_t cost = (uint32_t)(esp_timer_get_time() - start);
+
+		portENTER_CRITICAL(&physics_stats_mux);
+		physics_stats.rate_hz = 1000 / period_ms;
+		physics_stats.steps++;
+		physics_stats.last_us = cost;
+		physics_stats.total_us += cost;
+		if (cost > physics_stats.max_us) {
+			physics_stats.max_us = cost;
+		}
+		portEXIT_CRITICAL(&physics_stats_mux);
+	}
+}
+
+void physics_init(void)
+{
+	xTaskCreate(&task_physics, "physics", 2048, NULL, 4, &physics_task);
+}
+
+esp_err_t physics_start(uint32_t rate_hz)
+{
+	if (rate_hz < PHYSICS_RATE_MIN_HZ || rate_hz > PHYSICS_RATE_MAX_HZ) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	physics_rate_hz = rate_hz;
+	if (physics_running) {
+		return ESP_OK;
+	}
+
+	// The task re-seeds the model itself, so it never races with a step in flight
+	physics_restart = true;
+	physics_running = true;
+	xTaskNotifyGive(physics_task);
+	return ESP_OK;
+}
+
+void physics_stop(void)
+{
+	physics_running = false;
+}
+
+bool physics_is_running(void)
+{
+	return physics_running;
+}
+
+void physics_get_stats(physics_stats_t *stats)
+{
+	portENTER_CRITICAL(&physics_stats_mux);
+	*stats = physics_stats;
+	portEXIT_CRITICAL(&physics_stats_mux);
+}
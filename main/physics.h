@@ -0,0 +1,50 @@
+/** \file
+  \brief Engine and vehicle physics model
+  A fixed-step simulation that turns the throttle signal into engine
+   torque, RPM, gear and road speed, warms up the coolant and burns fuel.
+   Speed, RPM, coolant and fuel level are published into the vehicle state
+   every step, so all signals stay physically consistent.
+*/
+
+#ifndef __PHYSICS_H
+#define __PHYSICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+#define PHYSICS_RATE_MIN_HZ 1
+#define PHYSICS_RATE_MAX_HZ 100 ///< one step per RTOS tick
+
+/// Step cost statistics, times include publishing into the vehicle state
+typedef struct {
+	uint32_t rate_hz;  ///< step rate achieved, the period is rounded down to whole ticks
+	uint32_t steps;    ///< steps since start
+	uint32_t last_us;  ///< cost of the last step
+	uint32_t max_us;   ///< most expensive step
+	uint64_t total_us; ///< sum over all steps
+} physics_stats_t;
+
+/// Create the simulation task, must be called once before physics_start
+void physics_init(void);
+
+/// Start (or change the rate of) the simulation, seeding it from the current vehicle state
+esp_err_t physics_start(uint32_t rate_hz);
+
+/// Stop the simulation, signals keep their last value
+void physics_stop(void);
+
+bool physics_is_running(void);
+
+void physics_get_stats(physics_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __PHYSICS_H
@@ -0,0 +1,228 @@
+/** \file
+  \brief Drive-cycle playback, see playback.h
+*/
+
+#include "playback.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "fs.h"
+#include "vehicle.h"
+
+#define PLAYBACK_MAX_COLUMNS 16
+#define PLAYBACK_COLUMN_SKIP -1
+
+typedef struct {
+	int32_t time;                         ///< ms
+	int32_t values[VEHICLE_SIGNAL_COUNT]; ///< indexed like playback_signals
+} playback_row_t;
+
+static line_reader_t playback_reader;
+static long playback_data_offset; // file offset of the first row
+
+// CSV column -> index into playback_signals, column 0 is the time
+static int8_t playback_columns[PLAYBACK_MAX_COLUMNS];
+static uint8_t playback_column_count;
+static vehicle_signal_t playback_signals[VEHICLE_SIGNAL_COUNT];
+static uint8_t playback_signal_count;
+
+static playback_row_t playback_prev;
+static playback_row_t playback_next;
+static int64_t playback_position; // us of cycle time
+static int32_t playback_speed;
+static bool playback_loop;
+
+// Guards the state above; taken by the playback task each tick and by the httpd workers
+static SemaphoreHandle_t playback_lock;
+static TaskHandle_t playback_task;
+
+static bool playback_read_header(void)
+{
+	char *line = lineReaderNext(&playback_reader);
+	if (line == NULL) {
+		return false;
+	}
+
+	playback_column_count = 0;
+	playback_signal_count = 0;
+
+	for (char *name = line; name != NULL && playback_column_count < PLAYBACK_MAX_COLUMNS; ) {
+		char *next = strchr(name, ',');
+		if (next != NULL) {
+			*next++ = '\0';
+		}
+		name[strcspn(name, " \r")] = '\0';
+
+		int8_t column = PLAYBACK_COLUMN_SKIP;
+		vehicle_signal_t signal = vehicle_signal_from_name(name);
+		if (playback_column_count > 0 && signal != VEHICLE_SIGNAL_COUNT) {
+			column = playback_signal_count;
+			playback_signals[playback_signal_count++] = signal;
+		}
+		playback_columns[playback_column_count++] = column;
+		name = next;
+	}
+
+	playback_data_offset = lineReaderTell(&playback_reader);
+	return playback_signal_count > 0;
+}
+
+static bool playback_read_row(playback_row_t *row)
+{
+	char *line;
+
+	while ((line = lineReaderNext(&playback_reader)) != NULL) {
+		if (line[0] == '\0' || line[0] == '\r') {
+			continue;
+		}
+
+		memset(row, 0, sizeof(*row));
+		char *field = line;
+		for (uint8_t col = 0; field != NULL && col < playback_column_count; col++) {
+			int32_t value = vehicle_parse_value(field);
+			if (col == 0) {
+				row->time = value; // seconds parse into ms
+			} else if (playback_columns[col] != PLAYBACK_COLUMN_SKIP) {
+				row->values[playback_columns[col]] = value;
+			}
+			field = strchr(field, ',');
+			if (field != NULL) {
+				field++;
+			}
+		}
+		return true;
+	}
+	return false;
+}
+
+// Position on the first two rows of the cycle
+static bool playback_rewind(void)
+{
+	if (lineReaderSeek(&playback_reader, playback_data_offset) != ESP_OK) {
+		return false;
+	}
+
+	if (!playback_read_row(&playback_prev)) {
+		return false;
+	}
+	if (!playback_read_row(&playback_next)) {
+		playback_next = playback_prev;
+	}
+	playback_position = (int64_t)playback_prev.time * 1000;
+	return true;
+}
+
+static void playback_close(void)
+{
+	lineReaderClose(&playback_reader);
+}
+
+static void playback_publish(const int32_t *values)
+{
+	vehicle_set_signals(playback_signals, values, playback_signal_count);
+}
+
+// Advance by one tick and publish the interpolated sample, playback_lock held
+static void playback_step(void)
+{
+	playback_position += (int64_t)PLAYBACK_TICK_MS * playback_speed; // ms * milli-units = us
+
+	while (playback_position >= (int64_t)playback_next.time * 1000) {
+		playback_prev = playback_next;
+		if (playback_read_row(&playback_next)) {
+			continue;
+		}
+
+		// End of the cycle: hold the last sample, or start over keeping the overshoot
+		int32_t last_time = playback_prev.time;
+		int64_t overshoot = playback_position - (int64_t)last_time * 1000;
+		if (!playback_loop || !playback_rewind() || last_time <= playback_prev.time) {
+			playback_publish(playback_prev.values);
+			playback_close();
+			return;
+		}
+		playback_position += overshoot;
+	}
+
+	int32_t values[VEHICLE_SIGNAL_COUNT];
+	int64_t span = (int64_t)(playback_next.time - playback_prev.time) * 1000;
+	int64_t elapsed = playback_position - (int64_t)playback_prev.time * 1000;
+
+	for (uint8_t i = 0; i < playback_signal_count; i++) {
+		int64_t delta = (int64_t)playback_next.values[i] - playback_prev.values[i];
+		values[i] = playback_prev.values[i] + (int32_t)(delta * elapsed / span);
+	}
+	playback_publish(values);
+}
+
+static void task_playback(void *pvParameters)
+{
+	(void)pvParameters;
+	TickType_t last_wake = xTaskGetTickCount();
+
+	while (1) {
+		if (!playback_is_running()) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			last_wake = xTaskGetTickCount();
+		}
+		vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(PLAYBACK_TICK_MS));
+
+		xSemaphoreTake(playback_lock, portMAX_DELAY);
+		if (playback_reader.fp != NULL) {
+			playback_step();
+		}
+		xSemaphoreGive(playback_lock);
+	}
+}
+
+void playback_init(void)
+{
+	playback_lock = xSemaphoreCreateMutex();
+	xTaskCreate(&task_playback, "playback", 3072, NULL, 4, &playback_task);
+}
+
+esp_err_t playback_start(const char *path, int32_t speed, bool loop)
+{
+	if (speed <= 0) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	xSemaphoreTake(playback_lock, portMAX_DELAY);
+	playback_close();
+
+	esp_err_t err = lineReaderOpen(&playback_reader, path);
+	if (err != ESP_OK) {
+		xSemaphoreGive(playback_lock);
+		return err;
+	}
+
+	if (!playback_read_header() || !playback_rewind()) {
+		playback_close();
+		xSemaphoreGive(playback_lock);
+		return ESP_ERR_INVALID_SIZE;
+	}
+	playback_speed = speed;
+	playback_loop = loop;
+	playback_publish(playback_prev.values);
+	xSemaphoreGive(playback_lock);
+
+	xTaskNotifyGive(playback_task);
+	return ESP_OK;
+}
+
+void playback_stop(void)
+{
+	xSemaphoreTake(playback_lock, portMAX_DELAY);
+	playback_close();
+	xSemaphoreGive(playback_lock);
+}
+
+bool playback_is_running(void)
+{
+	return playback_reader.fp != NULL;
+}
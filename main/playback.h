@@ -0,0 +1,52 @@
+/** \file
+  \brief Drive-cycle playback
+  Streams a drive-cycle CSV file in small chunks and publishes linearly
+   interpolated signals into the vehicle state at a fixed tick.
+
+  File format: a header line naming the columns, then one row per sample.
+   The first column is the time in seconds, the other columns are vehicle
+   signals by API name (speed, rpm, throttle, coolant, fuel); unknown
+   columns are ignored.
+
+      time,speed,rpm,throttle
+      0,0,800,0
+      2.5,12,1900,35.5
+*/
+
+#ifndef __PLAYBACK_H
+#define __PLAYBACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+/// Interval at which interpolated signals are published
+#define PLAYBACK_TICK_MS 50
+
+/// Playback speed of real time, in VEHICLE_SCALE milli-units
+#define PLAYBACK_SPEED_REALTIME 1000
+
+/// Create the playback task, must be called once before playback_start
+void playback_init(void);
+
+/// Start playing `path`, replacing the current playback.
+/// `speed` is the speed multiplier in milli-units (PLAYBACK_SPEED_REALTIME = 1x),
+/// `loop` restarts the cycle at its end instead of holding the last sample.
+esp_err_t playback_start(const char *path, int32_t speed, bool loop);
+
+/// Stop playback, signals keep their last value
+void playback_stop(void);
+
+/// Check whether a cycle is being played
+bool playback_is_running(void);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __PLAYBACK_H
@@ -0,0 +1,510 @@
+/** \file
+  \brief CAN trace replay, see replay.h
+*/
+
+#include "replay.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "CAN.h"
+#include "fs.h"
+
+// Frames per batch; one batch is transmitted while the other one is read
+#define REPLAY_BATCH 64
+#define REPLAY_BATCH_COUNT 2
+
+// RTOS ticks are 10 ms, so the player sleeps on an esp_timer and spins the last stretch
+#define REPLAY_SPIN_US 200
+
+typedef struct {
+	int64_t time_us; // timestamp in the trace
+	CAN_frame_t frame;
+} replay_record_t;
+
+typedef struct {
+	uint32_t generation; // replay the batch was read for
+	uint16_t count;
+	bool last;           // end of the trace
+	replay_record_t records[REPLAY_BATCH];
+} replay_batch_t;
+
+// Schedule of the frames in the TX ring, for their completions. Bulk frames
+// leave the ring in the order they were queued, and fewer than
+// CONFIG_ESP_CAN_TX_RING_SIZE fit, so a slot is free again when it comes round
+#define REPLAY_PENDING CONFIG_ESP_CAN_TX_RING_SIZE
+
+typedef struct {
+	int64_t due;         // esp_timer time the frame was scheduled for
+	uint32_t generation; // replay the frame belongs to
+} replay_pending_t;
+
+const uint32_t replay_histogram_bounds_us[REPLAY_HISTOGRAM_BINS - 1] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+
+static replay_batch_t replay_batches[REPLAY_BATCH_COUNT];
+// Batch indices handed between the reader (fills free ones) and the player (sends filled ones)
+static QueueHandle_t replay_free;
+static QueueHandle_t replay_filled;
+
+static line_reader_t replay_reader;
+static int32_t replay_speed;
+// Bumped by every start and stop, batches and waits of an older replay are abandoned
+static volatile uint32_t replay_generation;
+static volatile bool replay_active;
+
+// Guards replay_reader and replay_speed; taken by the reader task per batch and by the httpd workers
+static SemaphoreHandle_t replay_lock;
+static TaskHandle_t replay_reader_task;
+static TaskHandle_t replay_player_task;
+static esp_timer_handle_t replay_timer;
+
+static replay_pending_t replay_pending[REPLAY_PENDING];
+static uint32_t replay_pending_next; // only touched by the player task
+
+static replay_stats_t replay_stats;
+// Guards replay_stats; written by both tasks, read by the httpd workers
+static portMUX_TYPE replay_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *replay_skip_spaces(const char *s)
+{
+	while (*s == ' ' || *s == '\t') {
+		s++;
+	}
+	return s;
+}
+
+// Seconds with up to 6 decimals into us, without going through float
+static const char *replay_parse_time(const char *s, int64_t *time_us)
+{
+	const char *start = s;
+	int64_t us = 0;
+
+	while (isdigit((unsigned char)*s)) {
+		us = us * 10 + (*s++ - '0');
+	}
+	if (s == start) {
+		return NULL;
+	}
+	us *= 1000000;
+	if (*s == '.') {
+		s++;
+		for (int32_t scale = 100000; isdigit((unsigned char)*s); scale /= 10) {
+			us += (*s++ - '0') * scale;
+		}
+	}
+	*time_us = us;
+	return s;
+}
+
+static int replay_hex_digit(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	c = (char)tolower((unsigned char)c);
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+// Returns the number of digits consumed, 0 when `*s` is not a hex number
+static int replay_parse_hex(const char **s, uint32_t *value)
+{
+	int digits = 0;
+	int digit;
+
+	*value = 0;
+	while (digits < 8 && (digit = replay_hex_digit((*s)[digits])) >= 0) {
+		*value = (*value << 4) | (uint32_t)digit;
+		digits++;
+	}
+	*s += digits;
+	return digits;
+}
+
+static bool replay_parse_byte(const char **s, uint8_t *byte)
+{
+	int high = replay_hex_digit((*s)[0]);
+	int low = high < 0 ? -1 : replay_hex_digit((*s)[1]);
+	if (low < 0) {
+		return false;
+	}
+	*byte = (uint8_t)(high << 4 | low);
+	*s += 2;
+	return true;
+}
+
+static bool replay_set_id(CAN_frame_t *frame, uint32_t id, bool extended)
+{
+	if (id > (extended ? 0x1FFFFFFF : 0x7FF)) {
+		return false;
+	}
+	frame->MsgID = id;
+	frame->FIR.B.FF = extended ? CAN_frame_ext : CAN_frame_std;
+	return true;
+}
+
+// candump log line: (1436509052.249713) can0 7E8#0641000000000000, 123#R or 123#R4 for remote frames
+static bool replay_parse_candump(const char *s, replay_record_t *record)
+{
+	CAN_frame_t *frame = &record->frame;
+	uint32_t id;
+
+	s = replay_parse_time(s + 1, &record->time_us);
+	if (s == NULL || *s != ')') {
+		return false;
+	}
+	s = replay_skip_spaces(s + 1);
+	s = strpbrk(s, " \t"); // interface name
+	if (s == NULL) {
+		return false;
+	}
+	s = replay_skip_spaces(s);
+
+	int digits = replay_parse_hex(&s, &id);
+	if (digits == 0 || *s++ != '#' || !replay_set_id(frame, id, digits > 3)) {
+		return false;
+	}
+
+	if (*s == 'R') {
+		frame->FIR.B.RTR = CAN_RTR;
+		frame->FIR.B.DLC = isdigit((unsigned char)s[1]) ? s[1] - '0' : 0;
+		return frame->FIR.B.DLC <= 8;
+	}
+
+	// `##` marks CAN FD frames, which do not parse as a data byte
+	uint8_t dlc = 0;
+	while (dlc < 8 && replay_parse_byte(&s, &frame->data.u8[dlc])) {
+		dlc++;
+		if (*s == '.') {
+			s++;
+		}
+	}
+	frame->FIR.B.DLC = dlc;
+	return *s == '\0' || *s == ' ' || *s == '\t' || *s == '\r';
+}
+
+// ASC line: 0.012345 1  7E8  Rx   d 8 06 41 00 BE 3F A8 13 00, the ID is followed by `x` when extended
+static bool replay_parse_asc(const char *s, replay_record_t *record)
+{
+	CAN_frame_t *frame = &record->frame;
+	uint32_t id;
+
+	s = replay_parse_time(replay_skip_spaces(s), &record->time_us);
+	if (s == NULL || (*s != ' ' && *s != '\t')) {
+		return false;
+	}
+	s = replay_skip_spaces(s);
+	if (!isdigit((unsigned char)*s)) { // channel
+		return false;
+	}
+	while (isdigit((unsigned char)*s)) {
+		s++;
+	}
+	s = replay_skip_spaces(s);
+
+	if (replay_parse_hex(&s, &id) == 0) {
+		return false;
+	}
+	bool extended = *s == 'x';
+	if (extended) {
+		s++;
+	}
+	if ((*s != ' ' && *s != '\t') || !replay_set_id(frame, id, extended)) {
+		return false;
+	}
+	s = replay_skip_spaces(s);
+	if ((strncmp(s, "Rx", 2) != 0 && strncmp(s, "Tx", 2) != 0) || (s[2] != ' ' && s[2] != '\t')) {
+		return false;
+	}
+	s = replay_skip_spaces(s + 2);
+
+	char type = *s++;
+	if (type != 'd' && type != 'r') {
+		return false;
+	}
+	s = replay_skip_spaces(s);
+	uint8_t dlc = isdigit((unsigned char)*s) ? *s - '0' : 0;
+	if (dlc > 8) {
+		return false;
+	}
+	frame->FIR.B.DLC = dlc;
+	if (type == 'r') {
+		frame->FIR.B.RTR = CAN_RTR;
+		return true;
+	}
+
+	s++;
+	for (uint8_t i = 0; i < dlc; i++) {
+		s = replay_skip_spaces(s);
+		if (!replay_parse_byte(&s, &frame->data.u8[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool replay_parse_line(const char *line, replay_record_t *record)
+{
+	memset(&record->frame, 0, sizeof(record->frame));
+	if (line[0] == '(') {
+		return replay_parse_candump(line, record);
+	}
+	return replay_parse_asc(line, record);
+}
+
+// Read the next batch of the trace, replay_lock held
+static void replay_fill(replay_batch_t *batch)
+{
+	uint32_t skipped = 0;
+
+	batch->generation = replay_generation;
+	batch->count = 0;
+	batch->last = false;
+
+	while (batch->count < REPLAY_BATCH) {
+		char *line = lineReaderNext(&replay_reader);
+		if (line == NULL) {
+			batch->last = true;
+			lineReaderClose(&replay_reader);
+			break;
+		}
+		if (replay_parse_line(line, &batch->records[batch->count])) {
+			batch->count++;
+		} else if (line[strspn(line, " \t\r")] != '\0') {
+			skipped++;
+		}
+	}
+
+	if (skipped > 0) {
+		portENTER_CRITICAL(&replay_stats_mux);
+		replay_stats.skipped_lines += skipped;
+		portEXIT_CRITICAL(&replay_stats_mux);
+	}
+}
+
+static void task_replay_reader(void *pvParameters)
+{
+	(void)pvParameters;
+	uint8_t index;
+
+	while (1) {
+		xQueueReceive(replay_free, &index, portMAX_DELAY);
+
+		xSemaphoreTake(replay_lock, portMAX_DELAY);
+		while (replay_reader.fp == NULL) {
+			xSemaphoreGive(replay_lock);
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			xSemaphoreTake(replay_lock, portMAX_DELAY);
+		}
+		replay_fill(&replay_batches[index]);
+		xSemaphoreGive(replay_lock);
+
+		xQueueSendToBack(replay_filled, &index, portMAX_DELAY);
+	}
+}
+
+static void replay_timer_expired(void *arg)
+{
+	(void)arg;
+	xTaskNotifyGive(replay_player_task);
+}
+
+// Sleep until `due` in esp_timer time; false when the replay was stopped or replaced meanwhile
+static bool replay_wait_until(int64_t due, uint32_t generation)
+{
+	int64_t remaining;
+
+	while ((remaining = due - esp_timer_get_time()) > REPLAY_SPIN_US) {
+		esp_timer_stop(replay_timer);
+		esp_timer_start_once(replay_timer, remaining - REPLAY_SPIN_US);
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		if (replay_generation != generation) {
+			return false;
+		}
+	}
+	while (esp_timer_get_time() < due) {
+	}
+	return true;
+}
+
+static void replay_record_dropped(void)
+{
+	portENTER_CRITICAL(&replay_stats_mux);
+	replay_stats.dropped++;
+	portEXIT_CRITICAL(&replay_stats_mux);
+}
+
+// TX completion in the CAN alert task: the timing error is taken when the
+// frame is on the wire, so waiting behind responses counts as well
+static void replay_tx_done(const CAN_frame_t *frame, CAN_tx_status_t status, uint32_t latency_us, void *arg)
+{
+	const replay_pending_t *pending = arg;
+	int64_t error_us = esp_timer_get_time() - pending->due;
+	uint32_t error = error_us > 0 ? (uint32_t)error_us : 0;
+	uint8_t bin = 0;
+
+	// Frames of an earlier replay count for none
+	if (pending->generation != replay_generation) {
+		return;
+	}
+	if (status != CAN_TX_DONE) {
+		replay_record_dropped();
+		return;
+	}
+	while (bin < REPLAY_HISTOGRAM_BINS - 1 && error > replay_histogram_bounds_us[bin]) {
+		bin++;
+	}
+
+	portENTER_CRITICAL(&replay_stats_mux);
+	replay_stats.sent++;
+	replay_stats.histogram[bin]++;
+	if (error > replay_stats.max_error_us) {
+		replay_stats.max_error_us = error;
+	}
+	portEXIT_CRITICAL(&replay_stats_mux);
+}
+
+static bool replay_queue(const CAN_frame_t *frame, int64_t due, uint32_t generation)
+{
+	replay_pending_t *pending = &replay_pending[replay_pending_next % REPLAY_PENDING];
+	const CAN_tx_options_t options = {
+		.tx_class = CAN_TX_BULK,
+		.deadline_us = CONFIG_ESP_CAN_TX_BULK_DEADLINE_MS * 1000,
+		.callback = replay_tx_done,
+		.arg = pending,
+	};
+
+	pending->due = due;
+	pending->generation = generation;
+	if (CAN_queue_frame(frame, &options) != 0) {
+		return false;
+	}
+	replay_pending_next++;
+	return true;
+}
+
+static void task_replay_player(void *pvParameters)
+{
+	(void)pvParameters;
+	uint32_t generation = 0;
+	int64_t start_us = 0; // wall clock of the first frame
+	int64_t first_us = 0; // trace time of the first frame
+	int32_t speed = REPLAY_SPEED_REALTIME;
+	uint8_t index;
+
+	while (1) {
+		if (xQueueReceive(replay_filled, &index, 0) != pdTRUE) {
+			if (replay_active) {
+				portENTER_CRITICAL(&replay_stats_mux);
+				replay_stats.underruns++;
+				portEXIT_CRITICAL(&replay_stats_mux);
+			}
+			xQueueReceive(replay_filled, &index, portMAX_DELAY);
+		}
+		replay_batch_t *batch = &replay_batches[index];
+
+		if (batch->generation == replay_generation) {
+			// The first batch of a replay sets the time base
+			if (batch->generation != generation && batch->count > 0) {
+				generation = batch->generation;
+				start_us = esp_timer_get_time();
+				first_us = batch->records[0].time_us;
+				speed = replay_speed;
+			}
+
+			for (uint16_t i = 0; i < batch->count; i++) {
+				const replay_record_t *record = &batch->records[i];
+				int64_t due = start_us + (record->time_us - first_us) * REPLAY_SPEED_REALTIME / speed;
+				if (!replay_wait_until(due, batch->generation)) {
+					break;
+				}
+				if (!replay_queue(&record->frame, due, batch->generation)) {
+					replay_record_dropped();
+				}
+			}
+
+			if (batch->last && batch->generation == replay_generation) {
+				replay_active = false;
+			}
+		}
+
+		xQueueSendToBack(replay_free, &index, portMAX_DELAY);
+	}
+}
+
+void replay_init(void)
+{
+	replay_lock = xSemaphoreCreateMutex();
+	replay_free = xQueueCreate(REPLAY_BATCH_COUNT, sizeof(uint8_t));
+	replay_filled = xQueueCreate(REPLAY_BATCH_COUNT, sizeof(uint8_t));
+	for (uint8_t i = 0; i < REPLAY_BATCH_COUNT; i++) {
+		xQueueSendToBack(replay_free, &i, 0);
+	}
+
+	const esp_timer_create_args_t timer_args = {
+		.callback = &replay_timer_expired,
+		.name = "replay",
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&timer_args, &replay_timer));
+
+	// The player preempts the CAN task so frames leave on time; the reader runs below both
+	xTaskCreate(&task_replay_reader, "replay_rd", 3072, NULL, 3, &replay_reader_task);
+	xTaskCreate(&task_replay_player, "replay_tx", 2048, NULL, 6, &replay_player_task);
+}
+
+esp_err_t replay_start(const char *path, int32_t speed)
+{
+	if (speed <= 0) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	xSemaphoreTake(replay_lock, portMAX_DELAY);
+	lineReaderClose(&replay_reader);
+	replay_speed = speed;
+	replay_generation++;
+
+	esp_err_t err = lineReaderOpen(&replay_reader, path);
+	replay_active = err == ESP_OK;
+	if (err == ESP_OK) {
+		portENTER_CRITICAL(&replay_stats_mux);
+		memset(&replay_stats, 0, sizeof(replay_stats));
+		portEXIT_CRITICAL(&replay_stats_mux);
+	}
+	xSemaphoreGive(replay_lock);
+
+	// Wake the reader for the new file and the player out of a wait for the old one
+	xTaskNotifyGive(replay_reader_task);
+	xTaskNotifyGive(replay_player_task);
+	return err;
+}
+
+void replay_stop(void)
+{
+	xSemaphoreTake(replay_lock, portMAX_DELAY);
+	lineReaderClose(&replay_reader);
+	replay_generation++;
+	replay_active = false;
+	xSemaphoreGive(replay_lock);
+
+	xTaskNotifyGive(replay_player_task);
+}
+
+bool replay_is_running(void)
+{
+	return replay_active;
+}
+
+void replay_get_stats(replay_stats_t *stats)
+{
+	portENTER_CRITICAL(&replay_stats_mux);
+	*stats = replay_stats;
+	portEXIT_CRITICAL(&replay_stats_mux);
+}
@@ -0,0 +1,73 @@
+/** \file
+  \brief CAN trace replay
+  Streams a recorded CAN log from the FAT partition onto the bus with the
+   original inter-frame timing, scaled by a speed factor. A reader task
+   parses the file into one batch while the player task transmits the
+   other, so file access never delays a frame that is due.
+
+  Both candump log files (`candump -l`) and Vector ASC files are accepted,
+   the format is detected per line; other lines are counted and skipped.
+
+      (1436509052.249713) can0 7E8#0641000000000000
+      (1436509052.251002) can0 18DAF110#02010C
+      0.012345 1  7E8             Rx   d 8 06 41 00 BE 3F A8 13 00
+      0.013000 1  18DAF110x       Rx   d 3 02 01 0C
+
+  Frames are queued without blocking, as bulk traffic that keeps the order
+   of the trace; a frame that finds the TX queue full, or is not sent
+   within CONFIG_ESP_CAN_TX_BULK_DEADLINE_MS, is dropped and counted. The
+   lateness of every frame on the wire against its scheduled time is
+   collected into a histogram.
+*/
+
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+/// Replay speed of real time, in VEHICLE_SCALE milli-units
+#define REPLAY_SPEED_REALTIME 1000
+
+/// Timing error bins, the last one collects everything above the last bound
+#define REPLAY_HISTOGRAM_BINS 9
+
+/// Upper bounds of the timing error bins, in us
+extern const uint32_t replay_histogram_bounds_us[REPLAY_HISTOGRAM_BINS - 1];
+
+/// Replay statistics since the last replay_start
+typedef struct {
+	uint32_t sent;            ///< frames transmitted
+	uint32_t dropped;         ///< frames dropped on a full TX queue or at their deadline
+	uint32_t skipped_lines;   ///< lines that are not a classic CAN frame
+	uint32_t underruns;       ///< times the player waited for the reader
+	uint32_t max_error_us;    ///< latest frame against its schedule
+	uint32_t histogram[REPLAY_HISTOGRAM_BINS]; ///< frames per timing error bin
+} replay_stats_t;
+
+/// Create the reader and player tasks, must be called once before replay_start
+void replay_init(void);
+
+/// Start replaying `path`, replacing the current replay.
+/// `speed` is the speed multiplier in milli-units (REPLAY_SPEED_REALTIME = 1x).
+esp_err_t replay_start(const char *path, int32_t speed);
+
+/// Stop the replay, frames already queued are still sent
+void replay_stop(void);
+
+/// Check whether a trace is being replayed
+bool replay_is_running(void);
+
+void replay_get_stats(replay_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif // __REPLAY_H
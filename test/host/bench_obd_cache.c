@@ -0,0 +1,92 @@
+/** \file
+  \brief Cached against on-request Mode 01 responses on the host
+  Before timing, every cached frame is checked against a fresh encoding of
+   the current vehicle state, over a series of pseudo-random states; then
+   obd_cache_benchmark prints the time per request of both paths.
+
+   bench_obd_cache [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CAN_config.h"
+
+#include "obd_cache.h"
+#include "obd_ecu.h"
+#include "obd_pids.h"
+#include "vehicle.h"
+
+#define STATES 200
+
+// Required by the CAN component, no frame is sent here
+CAN_device_t CAN_cfg = {
+	.speed = CAN_SPEED_500KBPS,
+	.rx_queue = NULL,
+};
+
+static int check_cache(void)
+{
+	vehicle_state_t state;
+	CAN_frame_t frame;
+	uint8_t data[5];
+	int failures = 0;
+
+	vehicle_read(&state);
+	for (uint8_t ecu = 0; ecu < OBD_ECU_MAX; ecu++) {
+		for (int pid = 0; pid < 256; pid++) {
+			bool cached = obd_cache_get(ecu, pid, &frame);
+
+			if (cached != obd_ecu_supports(ecu, pid)) {
+				printf("FAIL ECU %d PID 0x%02x: cached %d\n", ecu, pid, cached);
+				failures++;
+				continue;
+			}
+			// Range PIDs hold the ECU's bitmap, checked by the responder test
+			if (!cached || (pid & 0x1F) == 0)
+				continue;
+
+			int len = obd_mode1_encode(pid, &state, data);
+			if (frame.MsgID != obd_ecu_addr(ecu).tx_id || frame.data.u8[0] != 2 + len ||
+			    frame.data.u8[1] != 0x41 || frame.data.u8[2] != pid ||
+			    memcmp(&frame.data.u8[3], data, len) != 0) {
+				printf("FAIL ECU %d PID 0x%02x: stale or wrong frame\n", ecu, pid);
+				failures++;
+			}
+		}
+	}
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = argc > 1 ? (unsigned int)strtoul(argv[1], NULL, 10) : 100000;
+	static const vehicle_signal_t signals[] = {
+		VEHICLE_SPEED, VEHICLE_RPM, VEHICLE_THROTTLE, VEHICLE_COOLANT, VEHICLE_FUEL_LEVEL,
+	};
+	int32_t values[VEHICLE_SIGNAL_COUNT];
+	int failures = 0;
+
+	obd_ecu_init();
+	obd_cache_init();
+	failures += check_cache();
+
+	srand(1);
+	for (int i = 0; i < STATES && failures == 0; i++) {
+		// Every signal moves, including out of range values that must saturate
+		values[0] = rand() % 300000 - 10000;
+		values[1] = rand() % 20000000 - 100000;
+		values[2] = rand() % 120000 - 10000;
+		values[3] = rand() % 300000 - 60000;
+		values[4] = rand() % 120000 - 10000;
+		size_t count = 1 + rand() % VEHICLE_SIGNAL_COUNT;
+		vehicle_set_signals(signals, values, count);
+		failures += check_cache();
+	}
+
+	obd_cache_benchmark(iterations);
+
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
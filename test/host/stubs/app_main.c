@@ -0,0 +1,13 @@
+/** \file
+  \brief Process entry point for app_main on the host, as on the linux target
+*/
+#include <unistd.h>
+
+void app_main(void);
+
+int main(void)
+{
+	app_main();
+	for (;;)
+		pause();
+}
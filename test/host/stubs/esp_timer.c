@@ -0,0 +1,214 @@
+/**
+ * \file esp_timer.c
+ * \brief Host stand-in for esp_timer
+ *
+ * Timers fire from one dispatcher thread, like the esp_timer task, or from
+ * host_timer_advance once the clock has been made manual.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "esp_timer.h"
+#include "host_timer.h"
+
+struct host_timer {
+	esp_timer_cb_t callback;
+	void *arg;
+	int64_t due;
+	uint64_t period;
+	bool armed;
+	struct host_timer *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed;
+static struct host_timer *timers;
+static bool dispatcher;
+static bool manual;
+static int64_t manual_now;
+
+static int64_t monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t esp_timer_get_time(void)
+{
+	int64_t now;
+
+	pthread_mutex_lock(&lock);
+	now = manual ? manual_now : monotonic_us();
+	pthread_mutex_unlock(&lock);
+	return now;
+}
+
+/// Earliest armed timer; caller holds the lock
+static struct host_timer *next_due(void)
+{
+	struct host_timer *first = NULL;
+
+	for (struct host_timer *t = timers; t != NULL; t = t->next) {
+		if (t->armed && (first == NULL || t->due < first->due))
+			first = t;
+	}
+	return first;
+}
+
+/// Take `t` off the schedule before its callback runs; caller holds the lock
+static void expire(struct host_timer *t)
+{
+	if (t->period != 0)
+		t->due += (int64_t)t->period;
+	else
+		t->armed = false;
+}
+
+static void *dispatch(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		struct host_timer *t = manual ? NULL : next_due();
+
+		if (t == NULL) {
+			pthread_cond_wait(&changed, &lock);
+			continue;
+		}
+		int64_t wait_us = t->due - monotonic_us();
+		if (wait_us > 0) {
+			struct timespec until;
+
+			clock_gettime(CLOCK_MONOTONIC, &until);
+			until.tv_sec += wait_us / 1000000;
+			until.tv_nsec += (long)(wait_us % 1000000) * 1000;
+			if (until.tv_nsec >= 1000000000L) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&changed, &lock, &until);
+			continue;
+		}
+		expire(t);
+		pthread_mutex_unlock(&lock);
+		t->callback(t->arg);
+		pthread_mutex_lock(&lock);
+	}
+	return NULL;
+}
+
+static void start_dispatcher(void)
+{
+	pthread_condattr_t attr;
+	pthread_t thread;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&changed, &attr);
+	dispatcher = true;
+	pthread_create(&thread, NULL, dispatch, NULL);
+	pthread_detach(thread);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+	struct host_timer *t = calloc(1, sizeof(*t));
+
+	if (t == NULL)
+		return ESP_ERR_NO_MEM;
+	t->callback = args->callback;
+	t->arg = args->arg;
+	pthread_mutex_lock(&lock);
+	if (!dispatcher)
+		start_dispatcher();
+	t->next = timers;
+	timers = t;
+	pthread_mutex_unlock(&lock);
+	*handle = t;
+	return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t t, uint64_t timeout_us, uint64_t period_us)
+{
+	esp_err_t err = ESP_OK;
+
+	pthread_mutex_lock(&lock);
+	if (t->armed) {
+		err = ESP_ERR_INVALID_STATE;
+	} else {
+		t->due = (manual ? manual_now : monotonic_us()) + (int64_t)timeout_us;
+		t->period = period_us;
+		t->armed = true;
+		pthread_cond_signal(&changed);
+	}
+	pthread_mutex_unlock(&lock);
+	return err;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+	return start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+	return start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+	esp_err_t err = ESP_OK;
+
+	pthread_mutex_lock(&lock);
+	if (!timer->armed)
+		err = ESP_ERR_INVALID_STATE;
+	timer->armed = false;
+	pthread_mutex_unlock(&lock);
+	return err;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+	pthread_mutex_lock(&lock);
+	for (struct host_timer **p = &timers; *p != NULL; p = &(*p)->next) {
+		if (*p == timer) {
+			*p = timer->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	free(timer);
+	return ESP_OK;
+}
+
+void host_timer_manual(int64_t now_us)
+{
+	pthread_mutex_lock(&lock);
+	manual = true;
+	manual_now = now_us;
+	pthread_mutex_unlock(&lock);
+}
+
+void host_timer_advance(int64_t us)
+{
+	pthread_mutex_lock(&lock);
+	int64_t target = manual_now + us;
+
+	for (;;) {
+		struct host_timer *t = next_due();
+
+		if (t == NULL || t->due > target)
+			break;
+		if (t->due > manual_now)
+			manual_now = t->due;
+		expire(t);
+		pthread_mutex_unlock(&lock);
+		t->callback(t->arg);
+		pthread_mutex_lock(&lock);
+	}
+	manual_now = target;
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,418 @@
+/**
+ * \file freertos.c
+ * \brief Host stand-in for the FreeRTOS kernel on POSIX threads
+ *
+ * Good enough to run the components unmodified in a test: there is no
+ * scheduler and no priorities, every task is a thread and all critical
+ * sections share one recursive spinlock, cheap when uncontended like the
+ * portMUX on the device. Waits use CLOCK_MONOTONIC.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct host_task {
+	pthread_t thread;
+	TaskFunction_t fn;
+	void *arg;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t notify;
+};
+
+struct host_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	uint8_t *items;
+	UBaseType_t length;
+	UBaseType_t item_size;
+	UBaseType_t head;
+	UBaseType_t count;
+};
+
+struct host_event_group {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	EventBits_t bits;
+};
+
+static atomic_uintptr_t critical_owner;
+static __thread unsigned int critical_depth;
+static pthread_condattr_t monotonic;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static struct timespec epoch;
+static __thread struct host_task *current;
+
+static void init(void)
+{
+	pthread_condattr_init(&monotonic);
+	pthread_condattr_setclock(&monotonic, CLOCK_MONOTONIC);
+	clock_gettime(CLOCK_MONOTONIC, &epoch);
+}
+
+static void sync_init(pthread_mutex_t *lock, pthread_cond_t *cond)
+{
+	pthread_once(&once, init);
+	pthread_mutex_init(lock, NULL);
+	pthread_cond_init(cond, &monotonic);
+}
+
+static void add_ms(struct timespec *ts, uint64_t ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/// Absolute deadline for a timeout in ticks; NULL for portMAX_DELAY
+static const struct timespec *deadline(TickType_t timeout, struct timespec *ts)
+{
+	if (timeout == portMAX_DELAY)
+		return NULL;
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	add_ms(ts, (uint64_t)timeout * portTICK_PERIOD_MS);
+	return ts;
+}
+
+/// Wait on `cond`; false once the deadline has passed
+static bool wait(pthread_cond_t *cond, pthread_mutex_t *lock, const struct timespec *until)
+{
+	if (until == NULL)
+		return pthread_cond_wait(cond, lock) == 0;
+	return pthread_cond_timedwait(cond, lock, until) != ETIMEDOUT;
+}
+
+// The address of a thread-local identifies the owner
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+	uintptr_t self = (uintptr_t)&critical_depth;
+	uintptr_t expected = 0;
+
+	(void)mux;
+	if (atomic_load_explicit(&critical_owner, memory_order_relaxed) != self) {
+		while (!atomic_compare_exchange_weak_explicit(&critical_owner, &expected, self,
+		                                              memory_order_acquire, memory_order_relaxed)) {
+			expected = 0;
+			sched_yield();
+		}
+	}
+	critical_depth++;
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+	(void)mux;
+	if (--critical_depth == 0)
+		atomic_store_explicit(&critical_owner, 0, memory_order_release);
+}
+
+// ---- Tasks ----
+
+static struct host_task *task_new(void)
+{
+	struct host_task *task = calloc(1, sizeof(*task));
+
+	if (task != NULL)
+		sync_init(&task->lock, &task->cond);
+	return task;
+}
+
+static void *task_main(void *arg)
+{
+	current = arg;
+	current->fn(current->arg);
+	return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+	struct host_task *task = task_new();
+
+	(void)name;
+	(void)stack;
+	(void)priority;
+	if (task == NULL)
+		return pdFAIL;
+	task->fn = fn;
+	task->arg = arg;
+	if (handle != NULL)
+		*handle = task;
+	if (pthread_create(&task->thread, NULL, task_main, task) != 0) {
+		free(task);
+		return pdFAIL;
+	}
+	pthread_detach(task->thread);
+	return pdPASS;
+}
+
+/// Deleting another task cancels its thread; only safe while it sleeps
+void vTaskDelete(TaskHandle_t task)
+{
+	if (task == NULL || task == current)
+		pthread_exit(NULL);
+	pthread_cancel(task->thread);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	struct timespec now;
+
+	pthread_once(&once, init);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t ms = (int64_t)(now.tv_sec - epoch.tv_sec) * 1000 + (now.tv_nsec - epoch.tv_nsec) / 1000000;
+	return (TickType_t)(ms / portTICK_PERIOD_MS);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	struct timespec ts = {0};
+
+	add_ms(&ts, (uint64_t)ticks * portTICK_PERIOD_MS);
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+		;
+}
+
+void vTaskDelayUntil(TickType_t *previous, TickType_t increment)
+{
+	TickType_t wake = *previous + increment;
+	TickType_t now = xTaskGetTickCount();
+
+	if ((int32_t)(wake - now) > 0)
+		vTaskDelay(wake - now);
+	*previous = wake;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	// The main thread gets a handle on first use
+	if (current == NULL)
+		current = task_new();
+	return current;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	pthread_mutex_lock(&task->lock);
+	task->notify++;
+	pthread_cond_broadcast(&task->cond);
+	pthread_mutex_unlock(&task->lock);
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout)
+{
+	struct host_task *task = xTaskGetCurrentTaskHandle();
+	struct timespec ts;
+	const struct timespec *until = deadline(timeout, &ts);
+	uint32_t value;
+
+	pthread_mutex_lock(&task->lock);
+	while (task->notify == 0 && wait(&task->cond, &task->lock, until))
+		;
+	value = task->notify;
+	if (value != 0)
+		task->notify = clear ? 0 : value - 1;
+	pthread_mutex_unlock(&task->lock);
+	return value;
+}
+
+// ---- Queues and semaphores ----
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+	struct host_queue *queue = calloc(1, sizeof(*queue));
+
+	if (queue == NULL)
+		return NULL;
+	queue->items = calloc(length, item_size ? item_size : 1);
+	if (queue->items == NULL) {
+		free(queue);
+		return NULL;
+	}
+	queue->length = length;
+	queue->item_size = item_size;
+	sync_init(&queue->lock, &queue->changed);
+	return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->changed);
+	free(queue->items);
+	free(queue);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t timeout)
+{
+	struct timespec ts;
+	const struct timespec *until = deadline(timeout, &ts);
+	BaseType_t sent = pdFALSE;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == queue->length && timeout != 0 && wait(&queue->changed, &queue->lock, until))
+		;
+	if (queue->count < queue->length) {
+		UBaseType_t tail = (queue->head + queue->count) % queue->length;
+		memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+		queue->count++;
+		pthread_cond_broadcast(&queue->changed);
+		sent = pdTRUE;
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return sent;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t timeout)
+{
+	struct timespec ts;
+	const struct timespec *until = deadline(timeout, &ts);
+	BaseType_t received = pdFALSE;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == 0 && timeout != 0 && wait(&queue->changed, &queue->lock, until))
+		;
+	if (queue->count > 0) {
+		memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+		queue->head = (queue->head + 1) % queue->length;
+		queue->count--;
+		pthread_cond_broadcast(&queue->changed);
+		received = pdTRUE;
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return received;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	UBaseType_t count;
+
+	pthread_mutex_lock(&queue->lock);
+	count = queue->count;
+	pthread_mutex_unlock(&queue->lock);
+	return count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->head = 0;
+	queue->count = 0;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+	return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	SemaphoreHandle_t sem = xSemaphoreCreateBinary();
+
+	if (sem != NULL)
+		xSemaphoreGive(sem);
+	return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+	SemaphoreHandle_t sem = xQueueCreate(max, 0);
+
+	for (UBaseType_t i = 0; sem != NULL && i < initial; i++)
+		xSemaphoreGive(sem);
+	return sem;
+}
+
+// Semaphores are queues of empty items, nothing is copied
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout)
+{
+	uint8_t token;
+
+	return xQueueReceive(sem, &token, timeout);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	static const uint8_t token;
+
+	return xQueueSendToBack(sem, &token, 0);
+}
+
+// ---- Event groups ----
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+	struct host_event_group *group = calloc(1, sizeof(*group));
+
+	if (group != NULL)
+		sync_init(&group->lock, &group->changed);
+	return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+	pthread_mutex_destroy(&group->lock);
+	pthread_cond_destroy(&group->changed);
+	free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+	EventBits_t value;
+
+	pthread_mutex_lock(&group->lock);
+	group->bits |= bits;
+	value = group->bits;
+	pthread_cond_broadcast(&group->changed);
+	pthread_mutex_unlock(&group->lock);
+	return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+	EventBits_t value;
+
+	pthread_mutex_lock(&group->lock);
+	value = group->bits;
+	group->bits &= ~bits;
+	pthread_mutex_unlock(&group->lock);
+	return value;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear,
+                                BaseType_t all, TickType_t timeout)
+{
+	struct timespec ts;
+	const struct timespec *until = deadline(timeout, &ts);
+	EventBits_t value;
+	bool met;
+
+	pthread_mutex_lock(&group->lock);
+	for (;;) {
+		value = group->bits;
+		met = all ? (value & bits) == bits : (value & bits) != 0;
+		if (met || timeout == 0 || !wait(&group->changed, &group->lock, until))
+			break;
+	}
+	if (met && clear)
+		group->bits &= ~bits;
+	pthread_mutex_unlock(&group->lock);
+	return value;
+}
@@ -0,0 +1,20 @@
+/**
+ * \file host_timer.h
+ * \brief Manual clock for the host esp_timer, see esp_timer.c
+ *
+ * After host_timer_manual the clock stands still: esp_timer_get_time
+ * returns the manual time and timers fire only from host_timer_advance,
+ * in deadline order and in the calling thread.
+ */
+#ifndef HOST_TIMER_H
+#define HOST_TIMER_H
+
+#include <stdint.h>
+
+/** \brief Stop the clock at `now_us`; call before any timer is started */
+void host_timer_manual(int64_t now_us);
+
+/** \brief Move the manual clock forward, firing the timers that fall due */
+void host_timer_advance(int64_t us);
+
+#endif /* HOST_TIMER_H */
@@ -0,0 +1,85 @@
+/**
+ * \file http_parser.h
+ * \brief Host stand-in for the http_parser component
+ *
+ * The types and method numbers of the real parser, which is not built on
+ * the host: it never parses anything and fails every input.
+ */
+#ifndef HOST_HTTP_PARSER_H
+#define HOST_HTTP_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum http_method {
+	HTTP_DELETE = 0,
+	HTTP_GET = 1,
+	HTTP_HEAD = 2,
+	HTTP_POST = 3,
+	HTTP_PUT = 4,
+	HTTP_CONNECT = 5,
+	HTTP_OPTIONS = 6,
+	HTTP_TRACE = 7,
+	HTTP_PATCH = 28,
+};
+
+enum http_parser_type {
+	HTTP_REQUEST,
+	HTTP_RESPONSE,
+	HTTP_BOTH,
+};
+
+enum http_errno {
+	HPE_OK = 0,
+	HPE_PAUSED = 31,
+	HPE_UNKNOWN = 32,
+};
+
+typedef struct http_parser {
+	unsigned short http_major;
+	unsigned short http_minor;
+	unsigned int method : 8;
+	unsigned int http_errno : 7;
+	void *data;
+} http_parser;
+
+typedef int (*http_data_cb)(http_parser *parser, const char *at, size_t length);
+typedef int (*http_cb)(http_parser *parser);
+
+typedef struct {
+	http_cb on_message_begin;
+	http_data_cb on_url;
+	http_data_cb on_status;
+	http_data_cb on_header_field;
+	http_data_cb on_header_value;
+	http_cb on_headers_complete;
+	http_data_cb on_body;
+	http_cb on_message_complete;
+	http_cb on_chunk_header;
+	http_cb on_chunk_complete;
+} http_parser_settings;
+
+#define HTTP_PARSER_ERRNO(p) ((enum http_errno)(p)->http_errno)
+
+static inline void http_parser_init(http_parser *parser, enum http_parser_type type)
+{
+	*parser = (http_parser){ 0 };
+}
+
+static inline size_t http_parser_execute(http_parser *parser, const http_parser_settings *settings,
+                                         const char *data, size_t len)
+{
+	parser->http_errno = HPE_UNKNOWN;
+	return 0;
+}
+
+static inline void http_parser_pause(http_parser *parser, int paused)
+{
+	parser->http_errno = paused ? HPE_PAUSED : HPE_OK;
+}
+
+static inline int http_should_keep_alive(const http_parser *parser) { return 0; }
+static inline const char *http_method_str(enum http_method m) { return "<method>"; }
+static inline const char *http_errno_name(enum http_errno err) { return "HPE_UNKNOWN"; }
+
+#endif /* HOST_HTTP_PARSER_H */
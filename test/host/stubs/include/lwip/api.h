@@ -0,0 +1,43 @@
+/**
+ * \file api.h
+ * \brief Host stand-in for the lwIP netconn API
+ *
+ * There is no network on the host: a connection cannot be created and every
+ * call on one fails, so code using it compiles and tests drive it some
+ * other way.
+ */
+#ifndef HOST_LWIP_API_H
+#define HOST_LWIP_API_H
+
+#include <stddef.h>
+
+#include "lwip/sys.h"
+
+struct netconn;
+struct netbuf;
+
+enum netconn_type {
+	NETCONN_TCP = 0x10,
+};
+
+#define NETCONN_NOCOPY 0x00
+#define NETCONN_COPY 0x01
+#define NETCONN_MORE 0x02
+
+#define IP_ADDR_ANY NULL
+
+static inline struct netconn *netconn_new(enum netconn_type type) { return NULL; }
+static inline err_t netconn_bind(struct netconn *conn, const void *addr, u16_t port) { return ERR_CONN; }
+static inline err_t netconn_listen(struct netconn *conn) { return ERR_CONN; }
+static inline err_t netconn_accept(struct netconn *conn, struct netconn **new_conn) { return ERR_CLSD; }
+static inline err_t netconn_recv(struct netconn *conn, struct netbuf **buf) { return ERR_CLSD; }
+static inline err_t netconn_write(struct netconn *conn, const void *data, size_t size, u8_t flags) { return ERR_CLSD; }
+static inline err_t netconn_close(struct netconn *conn) { return ERR_OK; }
+static inline err_t netconn_delete(struct netconn *conn) { return ERR_OK; }
+static inline void netconn_set_recvtimeout(struct netconn *conn, int timeout_ms) {}
+static inline void netconn_set_sendtimeout(struct netconn *conn, int timeout_ms) {}
+static inline err_t netbuf_data(struct netbuf *buf, void **data, u16_t *len) { return ERR_VAL; }
+static inline s8_t netbuf_next(struct netbuf *buf) { return -1; }
+static inline void netbuf_delete(struct netbuf *buf) {}
+
+#endif /* HOST_LWIP_API_H */
@@ -0,0 +1,19 @@
+/**
+ * \file lock.h
+ * \brief Host stand-in for the newlib locks of ESP-IDF
+ *
+ * A zeroed _lock_t is an unlocked lock, as with newlib.
+ */
+#ifndef HOST_SYS_LOCK_H
+#define HOST_SYS_LOCK_H
+
+#include <pthread.h>
+
+typedef pthread_mutex_t _lock_t;
+
+static inline void _lock_init(_lock_t *lock) { pthread_mutex_init(lock, NULL); }
+static inline void _lock_close(_lock_t *lock) { pthread_mutex_destroy(lock); }
+static inline void _lock_acquire(_lock_t *lock) { pthread_mutex_lock(lock); }
+static inline void _lock_release(_lock_t *lock) { pthread_mutex_unlock(lock); }
+
+#endif /* HOST_SYS_LOCK_H */
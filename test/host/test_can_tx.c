@@ -0,0 +1,262 @@
+/** \file
+  \brief The CAN.c transmit ring against a scripted controller
+  The backend hands every transmitted frame to the test, which then reports
+  it sent or failed as a controller would, e.g. one on a bus where nobody
+  acknowledges. esp_timer runs on the manual clock of host_timer.h, so
+  deadlines are exact; the alert task of CAN.c runs as usual.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "CAN.h"
+#include "CAN_backend.h"
+#include "CAN_config.h"
+#include "host_timer.h"
+#include "sdkconfig.h"
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+CAN_device_t CAN_cfg = {
+	.speed = CAN_SPEED_500KBPS,
+	.rx_queue = NULL,
+};
+
+static int failures;
+
+// ---- Scripted controller ----
+
+static QueueHandle_t wire;          // frames handed to the controller
+static EventGroupHandle_t events;   // outcome reported by the test
+
+static int script_open(void *ctx, const uint32_t *ids, size_t count, bool extended, CAN_filter_stats_t *hw)
+{
+	memset(hw, 0, sizeof(*hw));
+	return 0;
+}
+
+static void script_close(void *ctx)
+{
+}
+
+static int script_transmit(void *ctx, const CAN_frame_t *frame)
+{
+	return xQueueSendToBack(wire, frame, 0) == pdTRUE ? 0 : -1;
+}
+
+static int script_receive(void *ctx, CAN_frame_t *frame, uint32_t timeout_ms)
+{
+	vTaskDelay(pdMS_TO_TICKS(timeout_ms));
+	return -1;
+}
+
+static int script_wait_events(void *ctx, uint32_t *bits, uint32_t timeout_ms)
+{
+	*bits = xEventGroupWaitBits(events, CAN_EVENT_ALL, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeout_ms)) & CAN_EVENT_ALL;
+	return 0;
+}
+
+static int script_get_status(void *ctx, CAN_backend_status_t *status)
+{
+	memset(status, 0, sizeof(*status));
+	return 0;
+}
+
+static const CAN_backend_ops_t script_ops = {
+	.name = "script",
+	.open = script_open,
+	.close = script_close,
+	.transmit = script_transmit,
+	.receive = script_receive,
+	.wait_events = script_wait_events,
+	.get_status = script_get_status,
+};
+
+/// The frame the controller was given next; false if none within 200 ms
+static bool on_wire(uint32_t id)
+{
+	CAN_frame_t frame;
+
+	if (xQueueReceive(wire, &frame, pdMS_TO_TICKS(200)) != pdTRUE) {
+		printf("FAIL: 0x%03x not transmitted\n", (unsigned)id);
+		failures++;
+		return false;
+	}
+	if (frame.MsgID != id) {
+		printf("FAIL: 0x%03x transmitted, expected 0x%03x\n", (unsigned)frame.MsgID, (unsigned)id);
+		failures++;
+		return false;
+	}
+	return true;
+}
+
+/// Nothing more is given to the controller
+static bool wire_idle(void)
+{
+	CAN_frame_t frame;
+
+	if (xQueueReceive(wire, &frame, pdMS_TO_TICKS(50)) == pdTRUE) {
+		printf("FAIL: 0x%03x transmitted\n", (unsigned)frame.MsgID);
+		failures++;
+		return false;
+	}
+	return true;
+}
+
+/// Report the frame in flight as sent or failed
+static void outcome(bool acked)
+{
+	xEventGroupSetBits(events, acked ? CAN_EVENT_TX_DONE : CAN_EVENT_TX_FAILED);
+}
+
+// ---- Senders ----
+
+static int completions[2];
+static int expirations[2];
+
+static void tx_callback(const CAN_frame_t *frame, CAN_tx_status_t status, uint32_t latency_us, void *arg)
+{
+	int sender = (int)(intptr_t)arg;
+
+	__atomic_add_fetch(status == CAN_TX_DONE ? &completions[sender] : &expirations[sender], 1, __ATOMIC_SEQ_CST);
+}
+
+static void queue(uint32_t id, CAN_tx_class_t tx_class, CAN_tx_callback_t callback, int sender)
+{
+	CAN_frame_t frame = { .MsgID = id };
+	const CAN_tx_options_t options = {
+		.tx_class = tx_class,
+		.callback = callback,
+		.arg = (void *)(intptr_t)sender,
+	};
+
+	frame.FIR.B.DLC = 8;
+	CHECK(CAN_queue_frame(&frame, &options) == 0);
+}
+
+static CAN_tx_stats_t tx_stats(void)
+{
+	CAN_tx_stats_t stats;
+
+	CAN_get_tx_stats(&stats);
+	return stats;
+}
+
+// ---- Tests ----
+
+static void test_order(void)
+{
+	// Responses first and by arbitration, bulk traffic in queue order
+	queue(0x7E8, CAN_TX_RESPONSE, NULL, 0);
+	on_wire(0x7E8);
+	queue(0x300, CAN_TX_BULK, NULL, 0);
+	queue(0x7E9, CAN_TX_RESPONSE, NULL, 0);
+	queue(0x100, CAN_TX_BULK, NULL, 0);
+	queue(0x7E0, CAN_TX_RESPONSE, NULL, 0);
+	outcome(true);
+	on_wire(0x7E0);
+	outcome(true);
+	on_wire(0x7E9);
+	outcome(true);
+	on_wire(0x300);
+	outcome(true);
+	on_wire(0x100);
+	outcome(true);
+	wire_idle();
+}
+
+static void test_no_ack(void)
+{
+	CAN_tx_stats_t before = tx_stats();
+	CAN_frame_t frame = { .MsgID = 0x300 };
+
+	// Nobody acknowledges: a bulk frame is repeated until its deadline, then dropped
+	frame.FIR.B.DLC = 8;
+	CHECK(CAN_try_write_frame(&frame) == 0);
+	int attempts = 0;
+	for (int64_t t = 0; t < CONFIG_ESP_CAN_TX_BULK_DEADLINE_MS * 1000LL; t += 100000) {
+		if (!on_wire(0x300))
+			break;
+		attempts++;
+		host_timer_advance(100000);
+		outcome(false);
+	}
+	wire_idle();
+	CHECK(attempts == CONFIG_ESP_CAN_TX_BULK_DEADLINE_MS / 100);
+	CHECK(tx_stats().expired == before.expired + 1);
+	CHECK(tx_stats().retries == before.retries + attempts);
+
+	// So is a response, at the default deadline
+	queue(0x7E8, CAN_TX_RESPONSE, tx_callback, 0);
+	on_wire(0x7E8);
+	host_timer_advance(CONFIG_ESP_CAN_TX_DEADLINE_MS * 1000);
+	outcome(false);
+	wire_idle();
+	CHECK(expirations[0] == 1 && completions[0] == 0);
+	CHECK(tx_stats().expired == before.expired + 2);
+	expirations[0] = 0;
+}
+
+static void test_cancel(void)
+{
+	CAN_tx_stats_t before = tx_stats();
+
+	// Frames of sender 0 behind one in flight are withdrawn, sender 1's stay
+	queue(0x7E0, CAN_TX_RESPONSE, NULL, 0);
+	on_wire(0x7E0);
+	queue(0x7E8, CAN_TX_RESPONSE, tx_callback, 0);
+	queue(0x7E8, CAN_TX_RESPONSE, tx_callback, 0);
+	queue(0x7E9, CAN_TX_RESPONSE, tx_callback, 1);
+	queue(0x300, CAN_TX_BULK, tx_callback, 0);
+	CHECK(CAN_cancel(tx_callback, (void *)0) == 3);
+	outcome(true);
+	on_wire(0x7E9);
+	outcome(true);
+	wire_idle();
+	CHECK(completions[0] == 0 && expirations[0] == 0 && completions[1] == 1);
+	CHECK(tx_stats().cancelled == before.cancelled + 3);
+
+	// The frame in flight cannot be recalled: it is not repeated once it
+	// fails, and completes without the callback
+	queue(0x7E8, CAN_TX_RESPONSE, tx_callback, 0);
+	on_wire(0x7E8);
+	CHECK(CAN_cancel(tx_callback, (void *)0) == 0);
+	outcome(false);
+	wire_idle();
+	queue(0x7E8, CAN_TX_RESPONSE, tx_callback, 0);
+	on_wire(0x7E8);
+	CHECK(CAN_cancel(tx_callback, (void *)0) == 0);
+	outcome(true);
+	wire_idle();
+	CHECK(completions[0] == 0 && expirations[0] == 0);
+	CHECK(tx_stats().sent == before.sent + 3);
+}
+
+int main(void)
+{
+	CAN_backend_t backend = { .ops = &script_ops };
+
+	host_timer_manual(0);
+	wire = xQueueCreate(CONFIG_ESP_CAN_TX_RING_SIZE, sizeof(CAN_frame_t));
+	events = xEventGroupCreate();
+	CHECK(CAN_set_backend(&backend) == 0);
+	CHECK(CAN_init() == 0);
+
+	test_order();
+	test_no_ack();
+	test_cancel();
+
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
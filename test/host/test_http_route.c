@@ -0,0 +1,173 @@
+/** \file
+  \brief Request routing of the HTTP server
+  The route trie and its lookup are static, so the test includes
+  http_server.c; lwIP and http_parser are stubs that are never reached.
+  Handlers are registered on a bare server context and looked up for a
+  request context the way uri_done does, and the outcome is read as
+  http_handle_connection does: a handler, a 405 when only the method did
+  not match, or a 404.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+
+// newlib has it, the server formats Content-Length with it
+static char *itoa(int value, char *str, int base)
+{
+	sprintf(str, "%d", value);
+	return str;
+}
+
+#include "http_server.c"
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static int failures;
+static struct http_server_context_ server;
+static struct http_context_ ctx;
+
+static void handler(http_context_t http_ctx, void *arg)
+{
+}
+
+static void route(const char *pattern, int method)
+{
+	// The pattern itself tells which handler was found
+	CHECK(http_register_handler(&server, pattern, method, HTTP_HANDLE_RESPONSE, handler, (void *)pattern) == ESP_OK);
+}
+
+/// Look up `uri`: the pattern of the handler, "405" or "404"
+static const char *request(int method, const char *uri)
+{
+	static char arena[512];
+	static char path[128];
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.server = &server;
+	ctx.arena.base = arena;
+	ctx.arena.size = sizeof(arena);
+	ctx.parser.method = method;
+	snprintf(path, sizeof(path), "%s", uri);
+	ctx.uri = path;
+	http_find_handler(&ctx);
+	if (ctx.handler != NULL)
+		return ctx.handler->ctx;
+	return ctx.route != NULL ? "405" : "404";
+}
+
+static bool routed(int method, const char *uri, const char *pattern)
+{
+	const char *found = request(method, uri);
+
+	if (strcmp(found, pattern) != 0) {
+		printf("FAIL: %s went to %s, expected %s\n", uri, found, pattern);
+		failures++;
+		return false;
+	}
+	return true;
+}
+
+static bool param(const char *name, const char *value)
+{
+	const char *got = http_request_get_param(&ctx, name);
+
+	if (got == NULL || strcmp(got, value) != 0) {
+		printf("FAIL: %s of %s is %s, expected %s\n", name, ctx.uri, got ? got : "missing", value);
+		failures++;
+		return false;
+	}
+	return true;
+}
+
+static void test_precedence(void)
+{
+	// Literal before ":name" before "*", whatever the order of registration
+	routed(HTTP_GET, "/api/ecu/all", "/api/ecu/all");
+	routed(HTTP_GET, "/API/Ecu/ALL", "/api/ecu/all");
+	routed(HTTP_GET, "/api/ecu/3", "/api/ecu/:id");
+	param("id", "3");
+	routed(HTTP_GET, "/api/ecu/3/dtc/p0301", "/api/ecu/*");
+	param("*", "3/dtc/p0301");
+	routed(HTTP_GET, "/api/ecu/3/pids", "/api/ecu/:id/pids");
+	param("id", "3");
+	routed(HTTP_GET, "/api/can", "/api/can");
+	routed(HTTP_GET, "/api/can/", "/api/can");
+	routed(HTTP_GET, "/", "/");
+}
+
+static void test_fallback(void)
+{
+	// "all" has no "pids" below it, ":id" has
+	routed(HTTP_GET, "/api/ecu/all/pids", "/api/ecu/:id/pids");
+	param("id", "all");
+	// ":id" has no "x" below it, "*" takes the rest
+	routed(HTTP_GET, "/api/ecu/3/x", "/api/ecu/*");
+	param("*", "3/x");
+	// No ECU route at all for "pids" under "can", the second level parameter has one
+	routed(HTTP_GET, "/api/can/7/pids", "/api/:group/:id/pids");
+	param("group", "can");
+	param("id", "7");
+	routed(HTTP_GET, "/api/ecu/3/pids/more", "/api/ecu/*");
+	param("*", "3/pids/more");
+}
+
+static void test_params(void)
+{
+	// Captured in path order, decoded
+	routed(HTTP_GET, "/api/trace/a%20b/pids", "/api/:group/:id/pids");
+	param("group", "trace");
+	param("id", "a b");
+	routed(HTTP_GET, "/files/www/css/main.css", "/files/:dir/*");
+	param("dir", "www");
+	param("*", "css/main.css");
+	CHECK(http_request_get_param(&ctx, "id") == NULL);
+
+	// "*" only at the end
+	CHECK(http_register_handler(&server, "/files/*/x", HTTP_GET, HTTP_HANDLE_RESPONSE, handler, NULL) == ESP_ERR_INVALID_ARG);
+	routed(HTTP_GET, "/files/www/x", "/files/:dir/*");
+}
+
+static void test_not_found(void)
+{
+	// A path with handlers for other methods is a 405, one without any a 404
+	routed(HTTP_PATCH, "/api/ecu/all", "405");
+	routed(HTTP_DELETE, "/api/can", "405");
+	routed(HTTP_PATCH, "/api/ecu", "/api/ecu");
+	// The path itself has a route, "*" below it is not tried
+	routed(HTTP_GET, "/api/ecu", "405");
+	routed(HTTP_GET, "/api/vehicle", "404");
+	routed(HTTP_GET, "/api/can/x", "404");
+	routed(HTTP_GET, "/files", "404");
+	routed(HTTP_POST, "/nothing/here", "404");
+	// "*" also matches nothing
+	routed(HTTP_GET, "/files/www", "/files/:dir/*");
+	param("*", "");
+}
+
+int main(void)
+{
+	route("/", HTTP_GET);
+	route("/api/ecu/*", HTTP_GET);
+	route("/api/ecu/:id", HTTP_GET);
+	route("/api/ecu/all", HTTP_GET);
+	route("/api/ecu/:id/pids", HTTP_GET);
+	route("/api/ecu", HTTP_PATCH);
+	route("/api/:group/:id/pids", HTTP_GET);
+	route("/api/can", HTTP_GET);
+	route("/files/:dir/*", HTTP_GET);
+
+	test_precedence();
+	test_fallback();
+	test_params();
+	test_not_found();
+
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
@@ -0,0 +1,598 @@
+/** \file
+  \brief ISO-TP transport layer against a scripted tester
+  isotp.c runs on a fake CAN driver: a FIFO of CONFIG_ESP_CAN_TX_RING_SIZE
+   frames that the test transmits one at a time, calling the completion
+   callbacks as the alert task would. esp_timer runs on the manual clock of
+   host_timer.h, so STmin, N_Bs, N_As and N_Cr are exact and the whole test
+   runs in one thread.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "CAN.h"
+#include "esp_timer.h"
+#include "host_timer.h"
+#include "isotp.h"
+#include "sdkconfig.h"
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+#define RING_SIZE CONFIG_ESP_CAN_TX_RING_SIZE
+#define ECU_TX_ID 0x7E8
+#define ECU_RX_ID 0x7E0
+#define OTHER_ID 0x100
+
+// Retry interval of a CF while the ring is full, ISOTP_TX_RETRY_US in isotp.c
+#define TX_RETRY_US 1000
+
+static int failures;
+
+static const isotp_addr_t ecu = { .tx_id = ECU_TX_ID, .rx_id = ECU_RX_ID, .extended = false };
+
+// ---- Fake CAN driver ----
+
+typedef struct {
+	CAN_frame_t frame;
+	CAN_tx_options_t options;
+	int64_t deadline_us;
+} queued_t;
+
+static queued_t ring[RING_SIZE];
+static int ring_head, ring_count;
+static int cancelled;
+
+int CAN_queue_frame(const CAN_frame_t *frame, const CAN_tx_options_t *options)
+{
+	if (ring_count == RING_SIZE)
+		return -1;
+	queued_t *q = &ring[(ring_head + ring_count++) % RING_SIZE];
+	q->frame = *frame;
+	q->options = *options;
+	q->deadline_us = esp_timer_get_time() +
+		(options->deadline_us ? options->deadline_us : CONFIG_ESP_CAN_TX_DEADLINE_MS * 1000);
+	return 0;
+}
+
+int CAN_cancel(CAN_tx_callback_t callback, void *arg)
+{
+	int kept = 0, n = 0;
+
+	for (int i = 0; i < ring_count; i++) {
+		queued_t q = ring[(ring_head + i) % RING_SIZE];
+		if (q.options.callback == callback && q.options.arg == arg)
+			n++;
+		else
+			ring[(ring_head + kept++) % RING_SIZE] = q;
+	}
+	ring_count = kept;
+	cancelled += n;
+	return n;
+}
+
+int CAN_write_frame(const CAN_frame_t *frame)
+{
+	const CAN_tx_options_t options = {
+		.tx_class = CAN_TX_RESPONSE,
+		.deadline_us = CONFIG_ESP_CAN_TX_DEADLINE_MS * 1000,
+	};
+	return CAN_queue_frame(frame, &options);
+}
+
+/// Frames of the transport layer in the ring
+static int ring_isotp(void)
+{
+	int n = 0;
+
+	for (int i = 0; i < ring_count; i++)
+		n += ring[(ring_head + i) % RING_SIZE].frame.MsgID == ECU_TX_ID;
+	return n;
+}
+
+/// Put the oldest frame on the bus, dropping expired ones first as the
+/// driver would; false if the ring is empty
+static bool bus_transmit(CAN_frame_t *frame)
+{
+	while (ring_count > 0) {
+		queued_t q = ring[ring_head];
+		ring_head = (ring_head + 1) % RING_SIZE;
+		ring_count--;
+		bool expired = esp_timer_get_time() >= q.deadline_us;
+		if (!expired && frame != NULL)
+			*frame = q.frame;
+		if (q.options.callback != NULL)
+			q.options.callback(&q.frame, expired ? CAN_TX_EXPIRED : CAN_TX_DONE, 0, q.options.arg);
+		if (!expired)
+			return true;
+	}
+	return false;
+}
+
+/// Traffic of another sender filling the ring
+static void bus_fill(int n)
+{
+	CAN_frame_t frame = { .MsgID = OTHER_ID };
+	const CAN_tx_options_t options = { .tx_class = CAN_TX_BULK, .deadline_us = 60000000 };
+
+	frame.FIR.B.DLC = 8;
+	while (n-- > 0)
+		CAN_queue_frame(&frame, &options);
+}
+
+static void bus_flush(void)
+{
+	while (bus_transmit(NULL))
+		;
+}
+
+// ---- Tester ----
+
+static uint8_t pdu[ISOTP_MAX_PAYLOAD];
+static size_t pdu_len;
+static int pdus;
+static bool echo;
+
+static void handler(const isotp_addr_t *addr, const uint8_t *data, size_t len, void *arg)
+{
+	memcpy(pdu, data, len);
+	pdu_len = len;
+	pdus++;
+	if (echo)
+		CHECK(isotp_send(addr, data, len) == ESP_OK);
+}
+
+static void tester_frame(const uint8_t data[8])
+{
+	CAN_frame_t frame = { .MsgID = ECU_RX_ID };
+	const isotp_addr_t from = { .tx_id = ECU_TX_ID, .rx_id = ECU_RX_ID, .extended = false };
+
+	frame.FIR.B.DLC = 8;
+	memcpy(frame.data.u8, data, 8);
+	isotp_on_frame(&from, &frame);
+}
+
+static void tester_fc(uint8_t fs, uint8_t bs, uint8_t st)
+{
+	tester_frame((const uint8_t[8]){ ISOTP_PCI_FC | fs, bs, st });
+}
+
+static isotp_stats_t stats(void)
+{
+	isotp_stats_t s;
+
+	isotp_get_stats(&s);
+	return s;
+}
+
+static void pattern(uint8_t *buf, size_t len, uint8_t seed)
+{
+	for (size_t i = 0; i < len; i++)
+		buf[i] = (uint8_t)(i * 7 + seed);
+}
+
+/**
+ * Receive a transfer whose First Frame is next in the ring, granting `bs`
+ * and `st` in every flow control. Checks the sequence numbers, that no CF
+ * comes before STmin has passed or beyond a block, that the transfer never
+ * holds more than one CF in the ring and that CFs expire within N_As.
+ * Returns the payload length, 0 on a protocol error.
+ */
+static size_t tester_receive(uint8_t *out, uint8_t bs, uint8_t st, int64_t st_us)
+{
+	CAN_frame_t frame;
+	size_t len, offset;
+	uint8_t sn = 1;
+	int in_block = 0;
+	bool gap = false; // the previous CF was in the same block
+	int64_t last_cf = 0, now = 0;
+
+	if (!bus_transmit(&frame) || (frame.data.u8[0] & 0xF0) != ISOTP_PCI_FF) {
+		printf("FAIL: no First Frame\n");
+		failures++;
+		return 0;
+	}
+	len = ((frame.data.u8[0] & 0x0F) << 8) | frame.data.u8[1];
+	memcpy(out, &frame.data.u8[2], 6);
+	offset = 6;
+	tester_fc(ISOTP_FS_CTS, bs, st);
+
+	while (offset < len) {
+		if (ring_isotp() > 1) {
+			printf("FAIL: %d frames of one transfer in the ring\n", ring_isotp());
+			failures++;
+			return 0;
+		}
+		if (ring_count == 0) {
+			// Nothing queued: let STmin run, but never as far as N_As
+			if (now - last_cf > CONFIG_ISOTP_N_AS_MS * 1000) {
+				printf("FAIL: stalled at %d of %d bytes\n", (int)offset, (int)len);
+				failures++;
+				return 0;
+			}
+			host_timer_advance(50);
+			now += 50;
+			continue;
+		}
+
+		const CAN_tx_options_t options = ring[ring_head].options;
+		bus_transmit(&frame);
+		if (frame.data.u8[0] != (ISOTP_PCI_CF | sn) || options.deadline_us == 0 ||
+		    options.deadline_us > CONFIG_ISOTP_N_AS_MS * 1000 || options.callback == NULL) {
+			printf("FAIL: CF %02x (SN %d expected), deadline %d us\n",
+			       frame.data.u8[0], sn, (int)options.deadline_us);
+			failures++;
+			return 0;
+		}
+		if (gap && now - last_cf < st_us) {
+			printf("FAIL: CF after %d us, STmin is %d us\n", (int)(now - last_cf), (int)st_us);
+			failures++;
+		}
+		last_cf = now;
+		gap = true;
+		size_t chunk = len - offset < 7 ? len - offset : 7;
+		memcpy(&out[offset], &frame.data.u8[1], chunk);
+		offset += chunk;
+		sn = (sn + 1) & 0x0F;
+
+		if (bs != 0 && ++in_block == bs && offset < len) {
+			// End of block: the sender waits for the next flow control
+			host_timer_advance(st_us + 1000);
+			now += st_us + 1000;
+			CHECK(ring_count == 0);
+			in_block = 0;
+			gap = false;
+			tester_fc(ISOTP_FS_CTS, bs, st);
+		}
+	}
+	return len;
+}
+
+/// Send `len` bytes to the ECU as FF and CFs, honouring its flow control;
+/// returns the number of flow control frames received
+static int tester_send(const uint8_t *data, size_t len)
+{
+	CAN_frame_t frame;
+	uint8_t buf[8] = { ISOTP_PCI_FF | (len >> 8), len & 0xFF };
+	size_t offset = 6;
+	uint8_t sn = 1;
+	int block = 0;
+	int fcs = 0;
+
+	memcpy(&buf[2], data, 6);
+	tester_frame(buf);
+	while (offset < len) {
+		if (block == 0) {
+			if (!bus_transmit(&frame) || frame.data.u8[0] != (ISOTP_PCI_FC | ISOTP_FS_CTS)) {
+				printf("FAIL: no flow control at %d of %d bytes\n", (int)offset, (int)len);
+				failures++;
+				return fcs;
+			}
+			fcs++;
+			block = frame.data.u8[1] ? frame.data.u8[1] : -1;
+		}
+		size_t chunk = len - offset < 7 ? len - offset : 7;
+		memset(buf, 0, sizeof(buf));
+		buf[0] = ISOTP_PCI_CF | sn;
+		memcpy(&buf[1], &data[offset], chunk);
+		tester_frame(buf);
+		offset += chunk;
+		sn = (sn + 1) & 0x0F;
+		if (block > 0)
+			block--;
+	}
+	return fcs;
+}
+
+// ---- Tests ----
+
+static void test_single_frame(void)
+{
+	CAN_frame_t frame;
+
+	CHECK(isotp_send(&ecu, (const uint8_t[]){ 0x41, 0x0D, 0x55 }, 3) == ESP_OK);
+	CHECK(bus_transmit(&frame));
+	CHECK(frame.MsgID == ECU_TX_ID && frame.data.u8[0] == 0x03 && frame.data.u8[3] == 0x55);
+	CHECK(ring_count == 0);
+	CHECK(isotp_send(&ecu, pdu, 0) == ESP_ERR_INVALID_SIZE);
+	CHECK(isotp_send(&ecu, pdu, ISOTP_MAX_PAYLOAD + 1) == ESP_ERR_INVALID_SIZE);
+}
+
+static void test_segmented(uint8_t bs, uint8_t st, int64_t st_us, size_t len)
+{
+	uint8_t data[ISOTP_MAX_PAYLOAD], got[ISOTP_MAX_PAYLOAD];
+	isotp_stats_t before = stats();
+
+	pattern(data, len, bs + st);
+	CHECK(isotp_send(&ecu, data, len) == ESP_OK);
+	CHECK(tester_receive(got, bs, st, st_us) == len);
+	CHECK(memcmp(got, data, len) == 0);
+	CHECK(stats().completed == before.completed + 1);
+	CHECK(ring_count == 0);
+}
+
+static void test_stmin(void)
+{
+	uint8_t data[20] = { 0 };
+
+	// STmin 0xF5 is 500 us, 10 is 10 ms: nothing before, the next CF right after
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	bus_flush();
+	tester_fc(ISOTP_FS_CTS, 0, 10);
+	CHECK(bus_transmit(NULL));
+	host_timer_advance(9999);
+	CHECK(ring_count == 0);
+	host_timer_advance(1);
+	CHECK(ring_isotp() == 1);
+	bus_flush();
+	host_timer_advance(10000);
+	CHECK(stats().completed > 0 && ring_count == 0);
+
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	bus_flush();
+	tester_fc(ISOTP_FS_CTS, 0, 0xF5);
+	CHECK(bus_transmit(NULL));
+	host_timer_advance(499);
+	CHECK(ring_count == 0);
+	host_timer_advance(1);
+	CHECK(ring_isotp() == 1);
+	bus_flush();
+}
+
+static void test_wait(void)
+{
+	uint8_t data[20] = { 0 };
+	isotp_stats_t before = stats();
+
+	// N_WFTmax WAITs, each within N_Bs, keep the transfer alive
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	bus_flush();
+	for (int i = 0; i < CONFIG_ISOTP_N_WFT_MAX; i++) {
+		host_timer_advance(CONFIG_ISOTP_N_BS_MS * 1000 - 1);
+		tester_fc(ISOTP_FS_WAIT, 0, 0);
+	}
+	CHECK(stats().timeouts == before.timeouts);
+	tester_fc(ISOTP_FS_CTS, 0, 0);
+	CHECK(ring_isotp() == 1);
+	bus_flush();
+	bus_flush();
+	CHECK(stats().completed == before.completed + 1);
+
+	// One WAIT more ends it
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	bus_flush();
+	for (int i = 0; i <= CONFIG_ISOTP_N_WFT_MAX; i++)
+		tester_fc(ISOTP_FS_WAIT, 0, 0);
+	CHECK(stats().wait_exceeded == before.wait_exceeded + 1);
+	tester_fc(ISOTP_FS_CTS, 0, 0);
+	CHECK(ring_count == 0);
+
+	// So does an overflow
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	bus_flush();
+	tester_fc(ISOTP_FS_OVERFLOW, 0, 0);
+	CHECK(stats().overflows == before.overflows + 1);
+	tester_fc(ISOTP_FS_CTS, 0, 0);
+	CHECK(ring_count == 0);
+}
+
+static void test_n_bs(void)
+{
+	uint8_t data[100] = { 0 };
+	isotp_stats_t before = stats();
+
+	// No flow control after the First Frame
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	bus_flush();
+	host_timer_advance(CONFIG_ISOTP_N_BS_MS * 1000 - 1);
+	CHECK(stats().timeouts == before.timeouts);
+	host_timer_advance(1);
+	CHECK(stats().timeouts == before.timeouts + 1);
+	tester_fc(ISOTP_FS_CTS, 0, 0);
+	CHECK(ring_count == 0);
+
+	// No flow control after a block
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	bus_flush();
+	tester_fc(ISOTP_FS_CTS, 2, 0);
+	bus_flush();
+	bus_flush();
+	CHECK(ring_count == 0);
+	host_timer_advance(CONFIG_ISOTP_N_BS_MS * 1000);
+	CHECK(stats().timeouts == before.timeouts + 2);
+	tester_fc(ISOTP_FS_CTS, 0, 0);
+	CHECK(ring_count == 0);
+}
+
+static void test_n_cr(void)
+{
+	uint8_t data[20];
+	isotp_stats_t before = stats();
+	int delivered = pdus;
+	CAN_frame_t fc;
+
+	pattern(data, sizeof(data), 3);
+	tester_frame((const uint8_t[8]){ ISOTP_PCI_FF, sizeof(data), data[0], data[1], data[2], data[3], data[4], data[5] });
+	CHECK(bus_transmit(&fc) && fc.data.u8[0] == (ISOTP_PCI_FC | ISOTP_FS_CTS));
+	tester_frame((const uint8_t[8]){ ISOTP_PCI_CF | 1, data[6], data[7], data[8], data[9], data[10], data[11], data[12] });
+	host_timer_advance(CONFIG_ISOTP_N_CR_MS * 1000 - 1);
+	CHECK(stats().rx_timeouts == before.rx_timeouts);
+	host_timer_advance(1);
+	CHECK(stats().rx_timeouts == before.rx_timeouts + 1);
+
+	// The rest of the PDU arrives too late
+	tester_frame((const uint8_t[8]){ ISOTP_PCI_CF | 2, data[13], data[14], data[15], data[16], data[17], data[18], data[19] });
+	CHECK(pdus == delivered);
+
+	// A wrong sequence number drops the PDU as well
+	tester_frame((const uint8_t[8]){ ISOTP_PCI_FF, sizeof(data), data[0], data[1], data[2], data[3], data[4], data[5] });
+	bus_flush();
+	tester_frame((const uint8_t[8]){ ISOTP_PCI_CF | 2 });
+	CHECK(stats().rx_sn_errors == before.rx_sn_errors + 1);
+	CHECK(pdus == delivered);
+}
+
+static void test_rx_block_size(void)
+{
+	uint8_t data[100];
+
+	// 14 CFs in blocks of 3: a flow control after the FF and after every
+	// complete block but the last
+	pattern(data, sizeof(data), 9);
+	isotp_set_rx_flow_control(3, 0);
+	CHECK(tester_send(data, sizeof(data)) == 5);
+	isotp_set_rx_flow_control(CONFIG_ISOTP_RX_BS, CONFIG_ISOTP_RX_STMIN);
+	CHECK(ring_count == 0);
+	CHECK(pdu_len == sizeof(data) && memcmp(pdu, data, sizeof(data)) == 0);
+}
+
+static void test_round_trip(void)
+{
+	static uint8_t data[ISOTP_MAX_PAYLOAD], got[ISOTP_MAX_PAYLOAD];
+	isotp_stats_t before = stats();
+
+	// 4095 bytes in, the handler sends them back, 585 CFs with SN wrapping
+	pattern(data, sizeof(data), 42);
+	echo = true;
+	tester_send(data, sizeof(data));
+	echo = false;
+	CHECK(stats().rx_completed == before.rx_completed + 1);
+	CHECK(pdu_len == sizeof(data) && memcmp(pdu, data, sizeof(data)) == 0);
+	CHECK(tester_receive(got, 0, 0, 0) == sizeof(data));
+	CHECK(memcmp(got, data, sizeof(data)) == 0);
+	CHECK(stats().completed == before.completed + 1);
+}
+
+static void test_ring_full(void)
+{
+	uint8_t data[ISOTP_MAX_PAYLOAD];
+	uint8_t got[ISOTP_MAX_PAYLOAD];
+	isotp_stats_t before = stats();
+
+	// BS 0 and STmin 0 used to queue every CF at once: 585 CFs in a
+	// 32-frame ring, the rest lost or expired at the 100 ms deadline
+	pattern(data, sizeof(data), 1);
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	CHECK(tester_receive(got, 0, 0, 0) == sizeof(data));
+	CHECK(memcmp(got, data, sizeof(data)) == 0);
+
+	// Ring full of other traffic: the CF waits, well past 100 ms, and goes
+	// out once there is room
+	CHECK(isotp_send(&ecu, data, 100) == ESP_OK);
+	CHECK(bus_transmit(NULL));
+	bus_fill(RING_SIZE);
+	tester_fc(ISOTP_FS_CTS, 0, 0);
+	host_timer_advance(500000);
+	CHECK(ring_isotp() == 0);
+	CHECK(bus_transmit(NULL));
+	host_timer_advance(TX_RETRY_US);
+	CHECK(ring_isotp() == 1);
+	while (ring_count > 0) {
+		bus_transmit(NULL);
+		host_timer_advance(100);
+	}
+	CHECK(stats().completed == before.completed + 2);
+	CHECK(stats().timeouts == before.timeouts);
+
+	// Still full after N_As: the transfer is given up
+	CHECK(isotp_send(&ecu, data, 100) == ESP_OK);
+	CHECK(bus_transmit(NULL));
+	bus_fill(RING_SIZE);
+	tester_fc(ISOTP_FS_CTS, 0, 0);
+	host_timer_advance(CONFIG_ISOTP_N_AS_MS * 1000 + TX_RETRY_US);
+	CHECK(stats().timeouts == before.timeouts + 1);
+	bus_flush();
+	host_timer_advance(TX_RETRY_US);
+	CHECK(ring_count == 0);
+}
+
+static void test_abort(void)
+{
+	uint8_t data[100];
+	uint8_t got[100];
+	isotp_stats_t before = stats();
+
+	// A new transfer replaces the old one; the old CF still in the ring is
+	// withdrawn, so it never goes out ahead of the new First Frame
+	pattern(data, sizeof(data), 5);
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	bus_flush();
+	tester_fc(ISOTP_FS_CTS, 0, 0);
+	CHECK(ring_isotp() == 1);
+	int withdrawn = cancelled;
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	CHECK(stats().aborted == before.aborted + 1);
+	CHECK(cancelled == withdrawn + 1);
+	CHECK(ring_isotp() == 1 && (ring[ring_head].frame.data.u8[0] & 0xF0) == ISOTP_PCI_FF);
+	CHECK(tester_receive(got, 0, 0, 0) == sizeof(data));
+	CHECK(memcmp(got, data, sizeof(data)) == 0);
+
+	// A CF not sent within N_As is withdrawn with its transfer
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	bus_flush();
+	tester_fc(ISOTP_FS_CTS, 0, 0);
+	CHECK(ring_isotp() == 1);
+	host_timer_advance(CONFIG_ISOTP_N_AS_MS * 1000);
+	CHECK(stats().timeouts == before.timeouts + 1);
+	CHECK(ring_count == 0);
+
+	// An N_Bs timeout withdraws a First Frame still in the ring
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	host_timer_advance(CONFIG_ISOTP_N_BS_MS * 1000);
+	CHECK(stats().timeouts == before.timeouts + 2);
+	CHECK(ring_count == 0);
+}
+
+static void test_late_ff_completion(void)
+{
+	uint8_t data[30];
+	uint8_t got[30];
+	CAN_frame_t frame;
+
+	// The flow control overtakes the completion of the First Frame: that
+	// completion must not count as the CF's and queue the next one early
+	pattern(data, sizeof(data), 8);
+	CHECK(isotp_send(&ecu, data, sizeof(data)) == ESP_OK);
+	tester_fc(ISOTP_FS_CTS, 0, 0);
+	CHECK(ring_isotp() == 2);
+	CHECK(bus_transmit(&frame) && (frame.data.u8[0] & 0xF0) == ISOTP_PCI_FF);
+	CHECK(ring_isotp() == 1);
+	memcpy(got, &frame.data.u8[2], 6);
+	for (int i = 0; i < 4; i++) {
+		CHECK(bus_transmit(&frame) && frame.data.u8[0] == (ISOTP_PCI_CF | (i + 1)));
+		memcpy(&got[6 + i * 7], &frame.data.u8[1], i < 3 ? 7 : 3);
+		CHECK(ring_count == (i < 3));
+	}
+	CHECK(memcmp(got, data, sizeof(data)) == 0);
+}
+
+int main(void)
+{
+	host_timer_manual(0);
+	CHECK(isotp_init(handler, NULL) == ESP_OK);
+
+	test_single_frame();
+	test_segmented(0, 0, 0, 20);
+	test_segmented(4, 0, 0, 100);
+	test_segmented(1, 0, 0, 50);
+	test_segmented(3, 5, 5000, 200);
+	test_segmented(0, 0xF1, 100, 300);
+	test_segmented(8, 0x7F, 127000, 100);
+	test_stmin();
+	test_wait();
+	test_n_bs();
+	test_n_cr();
+	test_rx_block_size();
+	test_round_trip();
+	test_ring_full();
+	test_abort();
+	test_late_ff_completion();
+
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
@@ -0,0 +1,269 @@
+/** \file
+  \brief Latency histograms and their percentiles
+  latency.c runs on its own on the manual esp_timer clock; the test
+   completes the timed responses itself, as the CAN alert task would.
+   Percentiles are checked on histograms with a known distribution: the
+   upper bound of the bin holding the rank, rounded up, at most the
+   maximum. Then requests are timed stage by stage, functional ones
+   answered twice, and keyed by (service, PID) up to LATENCY_KEYS.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "CAN.h"
+#include "esp_timer.h"
+#include "host_timer.h"
+#include "latency.h"
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static int failures;
+
+// ---- Percentiles ----
+
+/// Bin of `us` by latency_bounds_us, as latency.c sorts it
+static int bin_of(uint32_t us)
+{
+	int bin = 0;
+
+	while (bin < LATENCY_BINS - 1 && us > latency_bounds_us[bin])
+		bin++;
+	return bin;
+}
+
+static void add(latency_histogram_t *h, uint32_t us, uint32_t times)
+{
+	h->count += times;
+	h->total_us += (uint64_t)us * times;
+	h->bins[bin_of(us)] += times;
+	if (us > h->max_us)
+		h->max_us = us;
+}
+
+static bool summary_is(const latency_histogram_t *h, uint32_t avg, uint32_t p50, uint32_t p95, uint32_t p99)
+{
+	latency_summary_t s;
+
+	latency_summarize(h, &s);
+	if (s.count != h->count || s.avg_us != avg || s.p50_us != p50 || s.p95_us != p95 || s.p99_us != p99 ||
+	    s.max_us != h->max_us) {
+		printf("FAIL: count %u avg %u p50 %u p95 %u p99 %u max %u, expected %u %u %u %u %u %u\n",
+		       (unsigned)s.count, (unsigned)s.avg_us, (unsigned)s.p50_us, (unsigned)s.p95_us, (unsigned)s.p99_us,
+		       (unsigned)s.max_us, (unsigned)h->count, (unsigned)avg, (unsigned)p50, (unsigned)p95, (unsigned)p99,
+		       (unsigned)h->max_us);
+		failures++;
+		return false;
+	}
+	return true;
+}
+
+static void test_percentiles(void)
+{
+	latency_histogram_t h;
+
+	// The bounds rise, the last bin is open
+	for (int i = 1; i < LATENCY_BINS - 1; i++)
+		CHECK(latency_bounds_us[i] > latency_bounds_us[i - 1]);
+
+	memset(&h, 0, sizeof(h));
+	summary_is(&h, 0, 0, 0, 0);
+
+	// 100 samples: 50 at 20, 45 at 120, 4 at 900 and one beyond the last bound
+	add(&h, 20, 50);
+	add(&h, 120, 45);
+	add(&h, 900, 4);
+	add(&h, 60000, 1);
+	summary_is(&h, 700, 25, 150, 1000);
+	// One more in the open bin: every rank moves up a sample, p99 into the
+	// open bin, which has no bound but the maximum
+	add(&h, 70000, 1);
+	summary_is(&h, 1386, 150, 1000, 70000);
+
+	// The rank rounds up: the 2nd of 3 samples is the median
+	memset(&h, 0, sizeof(h));
+	add(&h, 10, 1);
+	add(&h, 400, 2);
+	summary_is(&h, 270, 400, 400, 400);
+
+	// A bound belongs to its bin; a percentile never exceeds the maximum
+	memset(&h, 0, sizeof(h));
+	add(&h, 25, 1);
+	summary_is(&h, 25, 25, 25, 25);
+	add(&h, 26, 1);
+	summary_is(&h, 25, 25, 26, 26);
+	memset(&h, 0, sizeof(h));
+	add(&h, 60, 200);
+	summary_is(&h, 60, 60, 60, 60);
+
+	// p99 of 1000 samples is the 990th, p95 the 950th
+	memset(&h, 0, sizeof(h));
+	add(&h, 100, 950);
+	add(&h, 200, 40);
+	add(&h, 5000, 10);
+	summary_is(&h, 153, 100, 100, 200);
+	add(&h, 5000, 1);
+	summary_is(&h, 157, 100, 200, 5000);
+}
+
+// ---- Timed requests ----
+
+static latency_entry_t entry(size_t index)
+{
+	latency_entry_t e;
+
+	memset(&e, 0, sizeof(e));
+	CHECK(latency_get(index, &e));
+	return e;
+}
+
+/// The stage sums of `e`, in stage order
+static bool totals_are(const latency_entry_t *e, uint64_t rx_dispatch, uint64_t dispatch_submit,
+                       uint64_t submit_tx, uint64_t rx_tx)
+{
+	const uint64_t want[LATENCY_STAGES] = { rx_dispatch, dispatch_submit, submit_tx, rx_tx };
+
+	for (int s = 0; s < LATENCY_STAGES; s++) {
+		if (e->stages[s].total_us != want[s]) {
+			printf("FAIL: stage %d of %02X/%02X totals %llu us, expected %llu\n", s, e->service, e->pid,
+			       (unsigned long long)e->stages[s].total_us, (unsigned long long)want[s]);
+			failures++;
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Complete a timed response as the CAN alert task would
+static void transmitted(const CAN_tx_options_t *options, CAN_tx_status_t status, uint32_t latency_us)
+{
+	CAN_frame_t frame = { .MsgID = 0x7E8 };
+
+	CHECK(options->callback != NULL);
+	options->callback(&frame, status, latency_us, options->arg);
+}
+
+static void test_request(void)
+{
+	CAN_tx_options_t options = { 0 };
+
+	// Received 40 us ago, dispatched now, queued 60 us later, on the wire 300 us after that
+	latency_begin(esp_timer_get_time() - 40);
+	latency_set_key(0x01, 0x0C);
+	host_timer_advance(60);
+	latency_submit(&options);
+	latency_end();
+	transmitted(&options, CAN_TX_DONE, 300);
+
+	latency_entry_t all = entry(0), rpm = entry(1);
+	CHECK(all.all && !rpm.all && rpm.service == 0x01 && rpm.pid == 0x0C);
+	totals_are(&all, 40, 60, 300, 400);
+	totals_are(&rpm, 40, 60, 300, 400);
+	CHECK(rpm.stages[LATENCY_RX_TO_TX].bins[bin_of(400)] == 1 && rpm.stages[LATENCY_RX_TO_TX].max_us == 400);
+	CHECK(!latency_get(2, &all));
+}
+
+static void test_functional(void)
+{
+	CAN_tx_options_t first = { 0 }, second = { 0 };
+
+	// Two ECUs answer: the request reached the handler once, two responses were queued
+	latency_begin(esp_timer_get_time() - 10);
+	latency_set_key(0x01, 0x0D);
+	host_timer_advance(20);
+	latency_submit(&first);
+	host_timer_advance(30);
+	latency_submit(&second);
+	latency_end();
+	transmitted(&first, CAN_TX_DONE, 100);
+	// A response that never made it is not timed
+	transmitted(&second, CAN_TX_EXPIRED, 5000);
+
+	latency_entry_t speed = entry(2);
+	CHECK(speed.service == 0x01 && speed.pid == 0x0D);
+	CHECK(speed.stages[LATENCY_RX_TO_DISPATCH].count == 1);
+	CHECK(speed.stages[LATENCY_DISPATCH_TO_SUBMIT].count == 2);
+	CHECK(speed.stages[LATENCY_SUBMIT_TO_TX].count == 1 && speed.stages[LATENCY_RX_TO_TX].count == 1);
+	totals_are(&speed, 10, 20 + 50, 100, 30 + 100);
+}
+
+static void test_untimed(void)
+{
+	latency_entry_t before = entry(0);
+
+	// ISO-TP: timed up to submit
+	latency_begin(esp_timer_get_time());
+	latency_set_key(0x09, 0x02);
+	host_timer_advance(200);
+	latency_submit_untimed();
+	latency_end();
+
+	latency_entry_t vin = entry(3), all = entry(0);
+	totals_are(&vin, 0, 200, 0, 0);
+	CHECK(vin.stages[LATENCY_RX_TO_DISPATCH].count == 1 && vin.stages[LATENCY_SUBMIT_TO_TX].count == 0);
+	CHECK(all.stages[LATENCY_RX_TO_TX].count == before.stages[LATENCY_RX_TO_TX].count);
+
+	// Outside a request nothing is recorded
+	latency_set_key(0x01, 0x05);
+	latency_submit_untimed();
+	CHECK(!latency_get(4, &vin));
+	CHECK(entry(0).stages[LATENCY_DISPATCH_TO_SUBMIT].count == all.stages[LATENCY_DISPATCH_TO_SUBMIT].count);
+}
+
+static void test_keys(void)
+{
+	CAN_tx_options_t options = { 0 };
+	latency_entry_t e;
+
+	// The table fills up; further pairs count towards all requests only
+	for (int pid = 0x20; pid < 0x20 + LATENCY_KEYS; pid++) {
+		latency_begin(esp_timer_get_time());
+		latency_set_key(0x01, pid);
+		latency_submit_untimed();
+		latency_end();
+	}
+	CHECK(latency_get(LATENCY_KEYS, &e) && !latency_get(LATENCY_KEYS + 1, &e));
+	uint32_t count = entry(0).stages[LATENCY_RX_TO_DISPATCH].count;
+	latency_begin(esp_timer_get_time());
+	latency_set_key(0x01, 0x7F);
+	latency_submit(&options);
+	latency_end();
+	transmitted(&options, CAN_TX_DONE, 100);
+	CHECK(entry(0).stages[LATENCY_RX_TO_DISPATCH].count == count + 1);
+	CHECK(!latency_get(LATENCY_KEYS + 1, &e));
+
+	// A known pair still gets its own
+	latency_begin(esp_timer_get_time());
+	latency_set_key(0x01, 0x0C);
+	latency_submit_untimed();
+	latency_end();
+	CHECK(entry(1).stages[LATENCY_RX_TO_DISPATCH].count == 2);
+
+	// Reset clears the histograms and keeps the keys
+	latency_reset();
+	for (size_t i = 0; i <= LATENCY_KEYS; i++) {
+		e = entry(i);
+		for (int s = 0; s < LATENCY_STAGES; s++)
+			CHECK(e.stages[s].count == 0 && e.stages[s].max_us == 0);
+	}
+	CHECK(entry(1).pid == 0x0C);
+}
+
+int main(void)
+{
+	host_timer_manual(1000000);
+
+	test_percentiles();
+	test_request();
+	test_functional();
+	test_untimed();
+	test_keys();
+
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
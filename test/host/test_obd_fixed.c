@@ -0,0 +1,164 @@
+/** \file
+  \brief Every input of every obdRevConvertFixed_* encoder
+  Each encoder is checked for every milli-unit from 1000 below to 1000 above
+   its range, and at the int32 limits, against an exact integer reference:
+   raw = floor((clamp(val, lo, hi) - lo) * num / den), saturated to the
+   width of the PID. Inside the range the float encoder of obd.c is run on
+   the same value and may differ by 1 LSB at most, and only on the PIDs
+   whose table entry says why.
+*/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "obd.h"
+#include "obd_fixed.h"
+
+typedef struct {
+	const char *name;
+	OBDConvFixedFunc fixed;
+	OBDConvRevFunc conv;
+	int32_t lo, hi;         ///< Range in milli-units, lo is also the offset
+	int64_t num, den;       ///< raw = (val - lo) * num / den
+	int bytes;
+	int32_t conv_lo;        ///< Float path compared from here
+	const char *conv_drift; ///< Why the float path may be 1 LSB off, NULL if it may not
+} pid_case_t;
+
+#define PID(id, lo, hi, num, den, bytes, conv_lo, drift) \
+	{ #id, obdRevConvertFixed_##id, obdRevConvert_##id, lo, hi, num, den, bytes, conv_lo, drift }
+
+// Float inputs above 2^24 milli-units are no longer exact
+#define BEYOND_2_24 "val in float loses milli-units above 16777.216"
+
+static const pid_case_t pids[] = {
+	PID(04,    0,        100000,    255, 100000, 1, 0, NULL),
+	PID(05,    -40000,   215000,    1, 1000,     1, -40000, NULL),
+	// (unsigned int) of a negative float is undefined, only val >= 0 is compared
+	PID(06_09, -100000,  99219,     128, 100000, 1, 0, NULL),
+	PID(0A,    0,        765000,    1, 3000,     1, 0, NULL),
+	PID(0B,    0,        255000,    1, 1000,     1, 0, NULL),
+	PID(0C,    0,        16383750,  1, 250,      2, 0, NULL),
+	PID(0D,    0,        255000,    1, 1000,     1, 0, NULL),
+	PID(0E,    -64000,   63500,     1, 500,      1, -64000, NULL),
+	PID(0F,    -40000,   215000,    1, 1000,     1, -40000, NULL),
+	PID(10,    0,        655350,    1, 10,       2, 0, "val * 100 rounds"),
+	PID(11,    0,        100000,    255, 100000, 1, 0, NULL),
+	PID(14_1B, 0,        1275,      1, 5,        1, 0, NULL),
+	PID(1F,    0,        65535000,  1, 1000,     2, 0, BEYOND_2_24),
+	PID(21,    0,        65535000,  1, 1000,     2, 0, BEYOND_2_24),
+	PID(22,    0,        5177265,   1, 79,       2, 0, "0.079 is inexact in float"),
+	PID(23,    0,        655350000, 1, 10000,    2, 0, BEYOND_2_24),
+	PID(24_2B, 0,        1999,      2000, 61,    2, 0, NULL),
+	PID(2C,    0,        100000,    255, 100000, 1, 0, NULL),
+	PID(2D,    -100000,  99219,     128, 100000, 1, -100000, NULL),
+	PID(2E,    0,        100000,    255, 100000, 1, 0, NULL),
+	PID(2F,    0,        100000,    255, 100000, 1, 0, NULL),
+	PID(30,    0,        255000,    1, 1000,     1, 0, NULL),
+	PID(31,    0,        65535000,  1, 1000,     2, 0, BEYOND_2_24),
+	PID(32,    -8192000, 8191750,   1, 250,      2, -8192000, NULL),
+	PID(33,    0,        255000,    1, 1000,     1, 0, NULL),
+	PID(34_3B, 0,        1999,      2000, 61,    2, 0, NULL),
+	PID(3C_3F, -40000,   6513500,   1, 100,      2, -40000, "(val + 40) * 10 rounds"),
+	PID(42,    0,        65535,     1, 1,        2, 0, "val * 1000 rounds"),
+	PID(43,    0,        25700000,  51, 20000,   2, 0, "val * 255 / 100 rounds"),
+	PID(44,    0,        1999,      2000, 61,    2, 0, NULL),
+	PID(45,    0,        100000,    255, 100000, 1, 0, NULL),
+	PID(46,    -40000,   215000,    1, 1000,     1, -40000, NULL),
+	PID(47_4B, 0,        100000,    255, 100000, 1, 0, NULL),
+	PID(4C,    0,        100000,    255, 100000, 1, 0, NULL),
+	PID(4D,    0,        65535000,  1, 1000,     2, 0, BEYOND_2_24),
+	PID(4E,    0,        65535000,  1, 1000,     2, 0, BEYOND_2_24),
+	PID(52,    0,        100000,    255, 100000, 1, 0, NULL),
+};
+
+static int64_t reference(const pid_case_t *p, int32_t val)
+{
+	int64_t v = val < p->lo ? p->lo : val > p->hi ? p->hi : val;
+	return (v - p->lo) * p->num / p->den;
+}
+
+static int64_t saturate(const pid_case_t *p, int64_t raw)
+{
+	int64_t max = p->bytes == 1 ? 0xFF : 0xFFFF;
+	return raw > max ? max : raw;
+}
+
+static int64_t raw_of(int n, unsigned int A, unsigned int B)
+{
+	return n == 2 ? ((int64_t)A << 8 | B) : A;
+}
+
+/// Fixed encoder of `val` against the reference; false on a mismatch
+static bool check_fixed(const pid_case_t *p, int32_t val)
+{
+	unsigned int A = 0, B = 0, C = 0, D = 0;
+	int n = p->fixed(val, &A, &B, &C, &D);
+	int64_t want = saturate(p, reference(p, val));
+
+	if (n != p->bytes || A > 0xFF || B > 0xFF || raw_of(n, A, B) != want) {
+		printf("FAIL %s(%" PRId32 "): %d byte(s) %02x %02x, expected %" PRId64 "\n",
+		       p->name, val, n, A, B, want);
+		return false;
+	}
+	return true;
+}
+
+static int check_pid(const pid_case_t *p)
+{
+	int failures = 0;
+	long drift = 0;
+	int32_t first = 0;
+
+	for (int64_t v = (int64_t)p->lo - 1000; v <= (int64_t)p->hi + 1000; v++) {
+		int32_t val = (int32_t)v;
+
+		if (!check_fixed(p, val) && ++failures > 10)
+			return failures;
+
+		// Above the width of the PID the float encoder wraps, the fixed one saturates
+		if (val < p->conv_lo || val > p->hi || reference(p, val) != saturate(p, reference(p, val)))
+			continue;
+
+		unsigned int a = 0, b = 0, c = 0, d = 0;
+		unsigned int A = 0, B = 0, C = 0, D = 0;
+		int conv_n = p->conv((float)val / 1000.0f, &a, &b, &c, &d);
+		int fixed_n = p->fixed(val, &A, &B, &C, &D);
+		int64_t conv = raw_of(conv_n, a, b);
+		int64_t fixed = raw_of(fixed_n, A, B);
+		int64_t diff = conv > fixed ? conv - fixed : fixed - conv;
+
+		if (diff == 0)
+			continue;
+		if (drift++ == 0)
+			first = val;
+		if (diff > 1 || p->conv_drift == NULL) {
+			printf("FAIL %s(%" PRId32 "): float %" PRId64 ", fixed %" PRId64 "\n", p->name, val, conv, fixed);
+			if (++failures > 10)
+				return failures;
+		}
+	}
+
+	const int32_t limits[] = { INT32_MIN, INT32_MIN + 1, -1, 0, INT32_MAX - 1, INT32_MAX };
+	for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+		failures += !check_fixed(p, limits[i]);
+	}
+
+	if (drift != 0) {
+		printf("%-6s float differs by 1 LSB on %ld value(s) from %" PRId32 ": %s\n",
+		       p->name, drift, first, p->conv_drift);
+	}
+	return failures;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	for (size_t i = 0; i < sizeof(pids) / sizeof(pids[0]); i++) {
+		failures += check_pid(&pids[i]);
+	}
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
@@ -0,0 +1,204 @@
+/** \file
+  \brief Drive-cycle playback at 100x real time
+  Plays fixtures/drive_cycle.csv (about 10 KB, irregular row spacing, an
+   unknown column and a blank line) through playback.c and fs.c. The test
+   stands in for the PID cache: vehicle.c calls obd_cache_refresh with every
+   published state, which is recorded here and compared with the fixture
+   interpolated at each tick, once to the end of the cycle and once looping
+   across its end.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "playback.h"
+#include "vehicle.h"
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+#define SPEED (100 * PLAYBACK_SPEED_REALTIME)
+#define TICK_US ((int64_t)PLAYBACK_TICK_MS * SPEED) // cycle time per tick
+#define MAX_ROWS 512
+#define MAX_SAMPLES 512
+
+typedef struct {
+	int64_t time_us;
+	int64_t values[VEHICLE_SIGNAL_COUNT];
+} row_t;
+
+static int failures;
+static row_t rows[MAX_ROWS];
+static int row_count;
+static QueueHandle_t published;
+
+// Called by vehicle_set_signals, in the playback task or in playback_start
+void obd_cache_refresh(void)
+{
+	vehicle_state_t state;
+
+	vehicle_read(&state);
+	if (xQueueSendToBack(published, &state, 0) != pdTRUE) {
+		printf("FAIL: more than %d samples\n", MAX_SAMPLES);
+		failures++;
+	}
+}
+
+// Independent of playback.c: strtod on the whole file, signals by column name
+static void load_fixture(void)
+{
+	static const char *names[VEHICLE_SIGNAL_COUNT] = { "speed", "rpm", "throttle", "coolant", "fuel" };
+	int column_signal[16];
+	int columns = 0;
+	char line[256];
+	FILE *fp = fopen(FIXTURE, "r");
+
+	if (fp == NULL || fgets(line, sizeof(line), fp) == NULL) {
+		printf("FAIL: cannot read %s\n", FIXTURE);
+		exit(1);
+	}
+	for (char *name = strtok(line, ",\r\n"); name != NULL; name = strtok(NULL, ",\r\n")) {
+		column_signal[columns] = -1;
+		for (int s = 0; s < VEHICLE_SIGNAL_COUNT; s++) {
+			if (strcmp(name, names[s]) == 0)
+				column_signal[columns] = s;
+		}
+		columns++;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL && row_count < MAX_ROWS) {
+		char *p = line;
+		if (line[0] == '\n')
+			continue;
+		row_t *row = &rows[row_count++];
+		for (int c = 0; c < columns; c++) {
+			double v = strtod(p, &p);
+			int64_t milli = (int64_t)(v * 1000 + (v < 0 ? -0.5 : 0.5));
+			if (c == 0)
+				row->time_us = milli * 1000;
+			else if (column_signal[c] >= 0)
+				row->values[column_signal[c]] = milli;
+			p += *p == ',';
+		}
+	}
+	fclose(fp);
+}
+
+/// The fixture at `t` us into the cycle, linearly interpolated
+static void expected_at(int64_t t, int64_t *values)
+{
+	int i = 0;
+
+	while (i + 1 < row_count && rows[i + 1].time_us <= t)
+		i++;
+	for (int s = 0; s < VEHICLE_SIGNAL_COUNT; s++) {
+		if (i + 1 == row_count) {
+			values[s] = rows[i].values[s];
+			continue;
+		}
+		int64_t span = rows[i + 1].time_us - rows[i].time_us;
+		values[s] = rows[i].values[s] + (rows[i + 1].values[s] - rows[i].values[s]) * (t - rows[i].time_us) / span;
+	}
+}
+
+static bool check_sample(int n, int64_t t)
+{
+	vehicle_state_t state;
+	int64_t want[VEHICLE_SIGNAL_COUNT];
+
+	if (xQueueReceive(published, &state, 0) != pdTRUE) {
+		printf("FAIL: sample %d at %.2f s missing\n", n, t / 1e6);
+		failures++;
+		return false;
+	}
+	expected_at(t, want);
+	for (int s = 0; s < VEHICLE_SIGNAL_COUNT; s++) {
+		if (state.signals[s] != want[s]) {
+			printf("FAIL: sample %d at %.2f s, signal %d is %d, expected %lld\n",
+			       n, t / 1e6, s, (int)state.signals[s], (long long)want[s]);
+			failures++;
+			return false;
+		}
+	}
+	return true;
+}
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void test_to_the_end(void)
+{
+	int64_t length = rows[row_count - 1].time_us;
+	int ticks = (int)((length + TICK_US - 1) / TICK_US);
+	int64_t start = now_ms();
+
+	CHECK(playback_start(FIXTURE, SPEED, false) == ESP_OK);
+	while (playback_is_running() && now_ms() - start < 10000)
+		vTaskDelay(pdMS_TO_TICKS(10));
+	int64_t elapsed = now_ms() - start;
+	CHECK(!playback_is_running());
+
+	// The first row at start, then one interpolated sample per tick; the
+	// tick reaching the end publishes the last row and stops
+	CHECK((int)uxQueueMessagesWaiting(published) == 1 + ticks);
+	check_sample(0, 0);
+	for (int k = 1; k <= ticks; k++) {
+		if (!check_sample(k, k * TICK_US < length ? k * TICK_US : length))
+			break;
+	}
+
+	// Ticks are never early; 293.5 s at 100x is 59 ticks, just under 3 s
+	printf("%d ticks in %lld ms\n", ticks, (long long)elapsed);
+	CHECK(elapsed >= (int64_t)(ticks - 1) * PLAYBACK_TICK_MS);
+}
+
+static void test_loop(void)
+{
+	int64_t length = rows[row_count - 1].time_us;
+	int ticks = (int)(length / TICK_US) + 12;
+
+	// The cycle is not a multiple of a tick: each lap starts with the overshoot
+	CHECK(length % TICK_US != 0);
+	CHECK(playback_start(FIXTURE, SPEED, true) == ESP_OK);
+	while ((int)uxQueueMessagesWaiting(published) < 1 + ticks)
+		vTaskDelay(pdMS_TO_TICKS(10));
+	playback_stop();
+	CHECK(!playback_is_running());
+
+	check_sample(0, 0);
+	for (int k = 1; k <= ticks; k++) {
+		if (!check_sample(k, k * TICK_US % length))
+			break;
+	}
+	xQueueReset(published);
+}
+
+int main(void)
+{
+	published = xQueueCreate(MAX_SAMPLES, sizeof(vehicle_state_t));
+	load_fixture();
+	playback_init();
+
+	CHECK(playback_start("/nonexistent.csv", SPEED, false) == ESP_ERR_NOT_FOUND);
+	CHECK(playback_start(FIXTURE, 0, false) == ESP_ERR_INVALID_ARG);
+
+	test_to_the_end();
+	test_loop();
+
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
@@ -0,0 +1,162 @@
+/** \file
+  \brief Trace replay over the loopback backend
+  Replays fixtures/trace.log, bursts of frames sharing a timestamp with
+   their IDs falling within each burst, so arbitration order is not trace
+   order. The tap must see every frame in trace order, none before its
+   time, and the statistics must count each frame once it is on the wire.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "CAN.h"
+#include "CAN_backend.h"
+#include "CAN_config.h"
+
+#include "replay.h"
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+#define MAX_FRAMES 128
+// The first frame sets the time base, a later one may be that much ahead of it
+#define EARLY_US 1000
+
+typedef struct {
+	int64_t time_us;
+	CAN_frame_t frame;
+} sent_t;
+
+CAN_device_t CAN_cfg = {
+	.speed = CAN_SPEED_500KBPS,
+	.rx_queue = NULL,
+};
+
+static int failures;
+static QueueHandle_t sent;
+static sent_t expected[MAX_FRAMES];
+static int expected_count;
+static int skipped_lines;
+
+static void tap(const CAN_frame_t *frame, void *arg)
+{
+	sent_t s = { .time_us = esp_timer_get_time(), .frame = *frame };
+
+	xQueueSendToBack(sent, &s, 0);
+}
+
+// Independent of replay.c: sscanf on the candump lines of the fixture
+static void load_fixture(void)
+{
+	char line[128];
+	FILE *fp = fopen(FIXTURE, "r");
+
+	if (fp == NULL) {
+		printf("FAIL: cannot read %s\n", FIXTURE);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), fp) != NULL && expected_count < MAX_FRAMES) {
+		unsigned long sec, usec;
+		char id[16], data[32];
+
+		if (sscanf(line, "(%lu.%lu) %*s %15[0-9A-Fa-f]#%31s", &sec, &usec, id, data) != 4) {
+			skipped_lines++;
+			continue;
+		}
+		sent_t *e = &expected[expected_count++];
+		e->time_us = (int64_t)sec * 1000000 + usec;
+		e->frame.MsgID = strtoul(id, NULL, 16);
+		e->frame.FIR.B.FF = strlen(id) > 3 ? CAN_frame_ext : CAN_frame_std;
+		if (data[0] == 'R') {
+			e->frame.FIR.B.RTR = CAN_RTR;
+			continue;
+		}
+		for (size_t i = 0; i + 1 < strlen(data) && i < 16; i += 2) {
+			char byte[3] = { data[i], data[i + 1], 0 };
+			e->frame.data.u8[e->frame.FIR.B.DLC++] = (uint8_t)strtoul(byte, NULL, 16);
+		}
+	}
+	fclose(fp);
+}
+
+static bool same_frame(const CAN_frame_t *a, const CAN_frame_t *b)
+{
+	return a->MsgID == b->MsgID && a->FIR.B.FF == b->FIR.B.FF && a->FIR.B.RTR == b->FIR.B.RTR &&
+	       a->FIR.B.DLC == b->FIR.B.DLC && memcmp(a->data.u8, b->data.u8, a->FIR.B.DLC) == 0;
+}
+
+static void test_replay(void)
+{
+	replay_stats_t stats;
+	sent_t first, got;
+
+	CHECK(replay_start(FIXTURE, 1000) == ESP_OK);
+	for (int i = 0; i < expected_count; i++) {
+		if (xQueueReceive(sent, &got, pdMS_TO_TICKS(1000)) != pdTRUE) {
+			printf("FAIL: frame %d of %d not sent\n", i, expected_count);
+			failures++;
+			return;
+		}
+		if (i == 0)
+			first = got;
+		if (!same_frame(&got.frame, &expected[i].frame)) {
+			printf("FAIL: frame %d is 0x%03x, expected 0x%03x\n",
+			       i, (unsigned)got.frame.MsgID, (unsigned)expected[i].frame.MsgID);
+			failures++;
+			return;
+		}
+		int64_t offset = got.time_us - first.time_us;
+		int64_t scheduled = expected[i].time_us - expected[0].time_us;
+		if (offset < scheduled - EARLY_US) {
+			printf("FAIL: frame %d sent at %lld us, scheduled at %lld us\n", i, (long long)offset, (long long)scheduled);
+			failures++;
+		}
+	}
+
+	// The last completions may still be on their way from the alert task
+	for (int i = 0; i < 100; i++) {
+		replay_get_stats(&stats);
+		if (!replay_is_running() && stats.sent == (uint32_t)expected_count)
+			break;
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	uint32_t binned = 0;
+	for (int i = 0; i < REPLAY_HISTOGRAM_BINS; i++)
+		binned += stats.histogram[i];
+	printf("%d frames, max error %u us\n", expected_count, (unsigned)stats.max_error_us);
+	CHECK(!replay_is_running());
+	CHECK(stats.sent == (uint32_t)expected_count && stats.dropped == 0);
+	CHECK(stats.skipped_lines == (uint32_t)skipped_lines);
+	CHECK(binned == stats.sent);
+	CHECK(uxQueueMessagesWaiting(sent) == 0);
+}
+
+int main(void)
+{
+	CAN_backend_t bus;
+
+	sent = xQueueCreate(MAX_FRAMES, sizeof(sent_t));
+	load_fixture();
+	CAN_backend_loopback(false, &bus);
+	CAN_loopback_set_tap(&bus, tap, NULL);
+	CAN_set_backend(&bus);
+	CHECK(CAN_init() == 0);
+	replay_init();
+
+	CHECK(replay_start("/nonexistent.log", 1000) == ESP_ERR_NOT_FOUND);
+	CHECK(replay_start(FIXTURE, 0) == ESP_ERR_INVALID_ARG);
+	test_replay();
+
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
@@ -0,0 +1,131 @@
+/** \file
+  \brief The OBD responder as a host process, over the loopback backend
+  Requests are injected as if received, answers are taken from the tap.
+  Covers a functional single-frame request answered by two ECUs and the
+  segmented VIN answer paced by the tester's flow control.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "CAN.h"
+#include "CAN_backend.h"
+#include "CAN_config.h"
+
+#include "obd_cache.h"
+#include "obd_ecu.h"
+#include "obd_responder.h"
+#include "vehicle.h"
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+CAN_device_t CAN_cfg = {
+	.speed = CAN_SPEED_500KBPS,
+	.rx_queue = NULL,
+};
+
+static int failures;
+static CAN_backend_t bus;
+static QueueHandle_t sent;
+
+static void tap(const CAN_frame_t *frame, void *arg)
+{
+	xQueueSendToBack(sent, frame, 0);
+}
+
+static void inject(uint32_t id, const uint8_t data[8])
+{
+	CAN_frame_t frame = {0};
+
+	frame.MsgID = id;
+	frame.FIR.B.DLC = 8;
+	frame.FIR.B.FF = CAN_frame_std;
+	memcpy(frame.data.u8, data, 8);
+	CHECK(CAN_loopback_inject(&bus, &frame) == 0);
+}
+
+/// Next transmitted frame; false if none follows within a second
+static bool expect(uint32_t id, const uint8_t *data, size_t len, CAN_frame_t *frame)
+{
+	CAN_frame_t local;
+
+	if (frame == NULL)
+		frame = &local;
+	if (xQueueReceive(sent, frame, pdMS_TO_TICKS(1000)) != pdTRUE) {
+		printf("FAIL: no frame for 0x%03x\n", (unsigned)id);
+		failures++;
+		return false;
+	}
+	if (frame->MsgID != id || memcmp(frame->data.u8, data, len) != 0) {
+		printf("FAIL: got 0x%03x", (unsigned)frame->MsgID);
+		for (int i = 0; i < frame->FIR.B.DLC; i++)
+			printf(" %02x", frame->data.u8[i]);
+		printf(", expected 0x%03x\n", (unsigned)id);
+		failures++;
+		return false;
+	}
+	return true;
+}
+
+static void test_functional_request(void)
+{
+	// Both ECUs serve RPM, the engine ECU wins arbitration
+	vehicle_set_signal(VEHICLE_RPM, 1500 * VEHICLE_SCALE);
+	inject(OBD_FUNCTIONAL_ID, (const uint8_t[8]){0x02, 0x01, 0x0C});
+	expect(OBD_ECU_RESPONSE_ID(0), (const uint8_t[]){0x04, 0x41, 0x0C, 0x17, 0x70}, 5, NULL);
+	expect(OBD_ECU_RESPONSE_ID(1), (const uint8_t[]){0x04, 0x41, 0x0C, 0x17, 0x70}, 5, NULL);
+}
+
+static void test_vin(void)
+{
+	static const char vin[] = "1HGCM82633A004352";
+	uint8_t payload[20];
+	CAN_frame_t frame;
+
+	vehicle_set_vin(vin);
+	inject(OBD_ECU_REQUEST_ID(0), (const uint8_t[8]){0x02, 0x09, 0x02});
+	if (!expect(OBD_ECU_RESPONSE_ID(0), (const uint8_t[]){0x10, 20, 0x49, 0x02, 0x01}, 5, &frame))
+		return;
+	memcpy(payload, &frame.data.u8[2], 6);
+
+	// Clear to send, no block limit and no separation time
+	inject(OBD_ECU_REQUEST_ID(0), (const uint8_t[8]){0x30, 0x00, 0x00});
+	if (!expect(OBD_ECU_RESPONSE_ID(0), (const uint8_t[]){0x21}, 1, &frame))
+		return;
+	memcpy(&payload[6], &frame.data.u8[1], 7);
+	if (!expect(OBD_ECU_RESPONSE_ID(0), (const uint8_t[]){0x22}, 1, &frame))
+		return;
+	memcpy(&payload[13], &frame.data.u8[1], 7);
+
+	CHECK(memcmp(&payload[3], vin, 17) == 0);
+}
+
+int main(void)
+{
+	sent = xQueueCreate(64, sizeof(CAN_frame_t));
+	CAN_backend_loopback(false, &bus);
+	CAN_loopback_set_tap(&bus, tap, NULL);
+	CAN_set_backend(&bus);
+
+	obd_ecu_init();
+	obd_cache_init();
+	obd_responder_start();
+
+	// The responder announces itself with a speed frame once CAN is up
+	expect(OBD_ECU_RESPONSE_ID(0), (const uint8_t[]){0x03, 0x41, 0x0D, 85}, 4, NULL);
+
+	test_functional_request();
+	test_vin();
+
+	CHECK(uxQueueMessagesWaiting(sent) == 0);
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
@@ -0,0 +1,187 @@
+/** \file
+  \brief The frame ring of trace.c and its drop accounting
+  trace.c runs on its own with a fake CAN_set_trace_hook; the test calls
+   the hook as the CAN tasks would. A burst larger than the ring, offered
+   before the drain task first wakes up, fills it: the frames that find it
+   full are dropped and counted, the ones already in it are all drained.
+   Then two tasks trace concurrently with the drain task running, and every
+   frame offered must be either recorded or dropped, every one recorded
+   drained, in order.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "CAN.h"
+#include "trace.h"
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+// TRACE_RING_LEN and TRACE_DRAIN_MS in trace.c
+#define RING_LEN 256
+#define DRAIN_MS 50
+
+#define BURST_EXTRA 44
+#define PRODUCER_FRAMES 20000
+
+static int failures;
+static CAN_trace_hook_t hook;
+static uint32_t produced[2];
+
+// ---- Fake CAN driver ----
+
+void CAN_set_trace_hook(CAN_trace_hook_t trace_hook)
+{
+	hook = trace_hook;
+}
+
+static void offer(uint32_t id, uint32_t n, CAN_trace_dir_t dir)
+{
+	CAN_frame_t frame = { .MsgID = id };
+
+	frame.FIR.B.DLC = 4;
+	memcpy(frame.data.u8, &n, sizeof(n));
+	hook(&frame, n, dir);
+}
+
+static trace_stats_t stats(void)
+{
+	trace_stats_t s;
+
+	trace_get_stats(&s);
+	return s;
+}
+
+/// Wait until the drain task has taken out everything recorded
+static bool drained(void)
+{
+	for (int i = 0; i < 100; i++) {
+		trace_stats_t s = stats();
+		if (s.drained == s.recorded)
+			return true;
+		vTaskDelay(pdMS_TO_TICKS(DRAIN_MS / 2));
+	}
+	printf("FAIL: %u of %u frames drained\n", (unsigned)stats().drained, (unsigned)stats().recorded);
+	failures++;
+	return false;
+}
+
+// ---- Tests ----
+
+static void test_format(void)
+{
+	char line[TRACE_LINE_MAX];
+	trace_record_t rx = { .time_us = 81234567, .id = 0x7DF, .dlc = 8, .data = { 0x02, 0x01, 0x05 } };
+	trace_record_t tx = { .time_us = 81234810, .id = 0x18DAF110, .dlc = 3, .flags = TRACE_FLAG_TX | TRACE_FLAG_EXT,
+	                      .data = { 0x02, 0x41, 0x05 } };
+	trace_record_t rtr = { .time_us = 5, .id = 0x123, .dlc = 2, .flags = TRACE_FLAG_RTR };
+
+	CHECK(trace_format(&rx, line, sizeof(line)) == (int)strlen(line));
+	CHECK(strcmp(line, "(81.234567) can0 7DF#0201050000000000 R") == 0);
+	trace_format(&tx, line, sizeof(line));
+	CHECK(strcmp(line, "(81.234810) can0 18DAF110#024105 T") == 0);
+	trace_format(&rtr, line, sizeof(line));
+	CHECK(strcmp(line, "(0.000005) can0 123#R2 R") == 0);
+}
+
+static void test_full_ring(void)
+{
+	trace_record_t recent[TRACE_RECENT];
+
+	// The drain task sleeps its first period: the ring takes RING_LEN frames,
+	// the rest find it full
+	for (uint32_t n = 0; n < RING_LEN + BURST_EXTRA; n++)
+		offer(0x100, n, CAN_TRACE_RX);
+	trace_stats_t s = stats();
+	CHECK(s.recorded == RING_LEN);
+	CHECK(s.dropped == BURST_EXTRA);
+	CHECK(s.drained == 0);
+
+	// What was recorded all comes out, the newest recorded frames are the recent ones
+	drained();
+	s = stats();
+	CHECK(s.drained == RING_LEN && s.dropped == BURST_EXTRA);
+	CHECK(trace_get_recent(recent, TRACE_RECENT) == TRACE_RECENT);
+	CHECK(recent[0].time_us == RING_LEN - TRACE_RECENT);
+	CHECK(recent[TRACE_RECENT - 1].time_us == RING_LEN - 1);
+
+	// Drained, the ring has room for a whole ring again
+	for (uint32_t n = 0; n < RING_LEN; n++)
+		offer(0x200, n, CAN_TRACE_TX);
+	s = stats();
+	CHECK(s.recorded == 2 * RING_LEN && s.dropped == BURST_EXTRA);
+	drained();
+	CHECK(trace_get_recent(recent, 1) == 1);
+	CHECK(recent[0].id == 0x200 && recent[0].time_us == RING_LEN - 1 && (recent[0].flags & TRACE_FLAG_TX));
+}
+
+static void task_producer(void *arg)
+{
+	int p = (int)(intptr_t)arg;
+
+	for (uint32_t n = 0; n < PRODUCER_FRAMES; n++) {
+		offer(0x300 + p, n, p ? CAN_TRACE_TX : CAN_TRACE_RX);
+		// Spread over a few drain periods
+		if (n % 64 == 63)
+			vTaskDelay(1);
+	}
+	__atomic_store_n(&produced[p], PRODUCER_FRAMES, __ATOMIC_RELEASE);
+	vTaskDelete(NULL);
+}
+
+static void test_concurrent(void)
+{
+	trace_stats_t before = stats();
+	trace_record_t recent[TRACE_RECENT];
+	int64_t last[2] = { -1, -1 };
+
+	xTaskCreate(task_producer, "producer0", 4096, (void *)0, 5, NULL);
+	xTaskCreate(task_producer, "producer1", 4096, (void *)1, 5, NULL);
+	while (__atomic_load_n(&produced[0], __ATOMIC_ACQUIRE) + __atomic_load_n(&produced[1], __ATOMIC_ACQUIRE)
+	       < 2 * PRODUCER_FRAMES)
+		vTaskDelay(pdMS_TO_TICKS(10));
+	drained();
+
+	trace_stats_t s = stats();
+	uint32_t recorded = s.recorded - before.recorded;
+	uint32_t dropped = s.dropped - before.dropped;
+	printf("%u frames offered, %u recorded, %u dropped\n", 2 * PRODUCER_FRAMES, (unsigned)recorded, (unsigned)dropped);
+	CHECK(recorded + dropped == 2 * PRODUCER_FRAMES);
+	CHECK(s.drained == s.recorded);
+
+	// Each producer's frames come out in the order they were recorded
+	size_t count = trace_get_recent(recent, TRACE_RECENT);
+	for (size_t i = 0; i < count; i++) {
+		int p = recent[i].id - 0x300;
+		CHECK(p == 0 || p == 1);
+		CHECK(recent[i].time_us > last[p & 1]);
+		CHECK((recent[i].flags & TRACE_FLAG_TX) == (p ? TRACE_FLAG_TX : 0));
+		last[p & 1] = recent[i].time_us;
+	}
+}
+
+int main(void)
+{
+	test_format();
+
+	trace_init();
+	CHECK(trace_set_sinks(0) == ESP_OK);
+	trace_set_level(TRACE_FRAMES);
+	CHECK(hook != NULL);
+	test_full_ring();
+	test_concurrent();
+
+	trace_set_level(TRACE_OFF);
+	CHECK(hook == NULL);
+
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
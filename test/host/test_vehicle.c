@@ -0,0 +1,200 @@
+/** \file
+  \brief The sequence lock of vehicle.c
+  A torn snapshot mixes two publishes. The copy of a snapshot is a handful
+  of instructions on the host, too short to race reliably, so vehicle.c is
+  linked with memcpy wrapped and the test publishes halfway through a
+  reader's copy, as the other core would: the reader must notice and copy
+  again. Then two writer tasks and a reader run freely for a second, which
+  on a multi-core host races them for real.
+  Writers publish every signal set to one value, or a VIN of one repeated
+  character, so a consistent snapshot is easy to tell.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "vehicle.h"
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+#define RUN_US 1000000
+
+static int failures;
+static bool stop;
+static SemaphoreHandle_t writers_done;
+static uint32_t publishes[2];
+
+// Publishes still to make in the middle of a snapshot copy, and the copies made
+static int interleave;
+static int snapshot_copies;
+
+// Called by vehicle_set_signals after every publish
+void obd_cache_refresh(void)
+{
+}
+
+static void publish(int32_t value, char vin_char)
+{
+	vehicle_signal_t signals[VEHICLE_SIGNAL_COUNT];
+	int32_t values[VEHICLE_SIGNAL_COUNT];
+	char vin[VEHICLE_VIN_LEN + 1];
+
+	for (int s = 0; s < VEHICLE_SIGNAL_COUNT; s++) {
+		signals[s] = (vehicle_signal_t)s;
+		values[s] = value;
+	}
+	if (vin_char != 0) {
+		memset(vin, vin_char, VEHICLE_VIN_LEN);
+		vin[VEHICLE_VIN_LEN] = 0;
+		vehicle_set_vin(vin);
+	}
+	vehicle_set_signals(signals, values, VEHICLE_SIGNAL_COUNT);
+}
+
+void *__real_memcpy(void *dest, const void *src, size_t n);
+
+// vehicle.c is built without the memcpy builtin and linked with --wrap=memcpy
+void *__wrap_memcpy(void *dest, const void *src, size_t n)
+{
+	// Two signals in, the rest of the copy sees the next publish
+	const size_t split = 2 * sizeof(int32_t);
+
+	if (n != sizeof(vehicle_state_t))
+		return __real_memcpy(dest, src, n);
+	snapshot_copies++;
+	__real_memcpy(dest, src, split);
+	if (interleave > 0) {
+		interleave--;
+		publish(-snapshot_copies, 0);
+	}
+	__real_memcpy((char *)dest + split, (const char *)src + split, n - split);
+	return dest;
+}
+
+/// Whether `state` is one whole publish of each kind
+static bool consistent(const vehicle_state_t *state)
+{
+	for (int s = 1; s < VEHICLE_SIGNAL_COUNT; s++) {
+		if (state->signals[s] != state->signals[0])
+			return false;
+	}
+	for (int i = 1; i < VEHICLE_VIN_LEN; i++) {
+		if (state->vin[i] != state->vin[0])
+			return false;
+	}
+	return true;
+}
+
+static void test_interleaved(void)
+{
+	vehicle_state_t state;
+
+	publish(1, 'A');
+
+	// Nothing in between: one copy
+	snapshot_copies = 0;
+	vehicle_read(&state);
+	CHECK(snapshot_copies == 1);
+	CHECK(consistent(&state) && state.signals[0] == 1);
+
+	// A publish during the copy: copied again, the newer state
+	snapshot_copies = 0;
+	interleave = 1;
+	vehicle_read(&state);
+	CHECK(snapshot_copies == 2);
+	CHECK(consistent(&state) && state.signals[0] == -1);
+
+	// Again during the second copy
+	snapshot_copies = 0;
+	interleave = 2;
+	vehicle_read(&state);
+	CHECK(snapshot_copies == 3);
+	CHECK(consistent(&state) && state.signals[0] == -2);
+}
+
+static void task_signals(void *arg)
+{
+	for (int32_t k = 1; !__atomic_load_n(&stop, __ATOMIC_RELAXED); k++) {
+		publish(k, 0);
+		publishes[0]++;
+	}
+	xSemaphoreGive(writers_done);
+	vTaskDelete(NULL);
+}
+
+static void task_vin(void *arg)
+{
+	for (int32_t k = 1; !__atomic_load_n(&stop, __ATOMIC_RELAXED); k++) {
+		publish(-k, 'A' + k % 26);
+		publishes[1]++;
+	}
+	xSemaphoreGive(writers_done);
+	vTaskDelete(NULL);
+}
+
+static void test_concurrent(void)
+{
+	vehicle_state_t state;
+	uint32_t reads = 0, torn = 0, changes = 0;
+	int32_t last = 0;
+
+	writers_done = xSemaphoreCreateCounting(2, 0);
+	xTaskCreate(task_signals, "signals", 4096, NULL, 5, NULL);
+	xTaskCreate(task_vin, "vin", 4096, NULL, 5, NULL);
+
+	for (int64_t start = esp_timer_get_time(); esp_timer_get_time() - start < RUN_US; reads++) {
+		vehicle_read(&state);
+		if (!consistent(&state) && torn++ == 0) {
+			printf("FAIL: torn snapshot, signals %d %d %d %d %d, VIN %.17s\n",
+			       (int)state.signals[0], (int)state.signals[1], (int)state.signals[2],
+			       (int)state.signals[3], (int)state.signals[4], state.vin);
+			failures++;
+		}
+		changes += state.signals[0] != last;
+		last = state.signals[0];
+	}
+	__atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+	CHECK(xSemaphoreTake(writers_done, pdMS_TO_TICKS(1000)) == pdTRUE);
+	CHECK(xSemaphoreTake(writers_done, pdMS_TO_TICKS(1000)) == pdTRUE);
+
+	printf("%u reads, %u changes seen, %u + %u publishes, %u torn\n",
+	       (unsigned)reads, (unsigned)changes, (unsigned)publishes[0], (unsigned)publishes[1], (unsigned)torn);
+	CHECK(publishes[0] > 0 && publishes[1] > 0 && changes > 1);
+}
+
+static void test_quiescent(void)
+{
+	vehicle_state_t state;
+
+	// Nothing else writing: a publish is seen at once, whole
+	publish(1234, 'Z');
+	vehicle_read(&state);
+	CHECK(consistent(&state));
+	CHECK(state.signals[VEHICLE_FUEL_LEVEL] == 1234 && state.vin[0] == 'Z');
+	CHECK(vehicle_get_signal(VEHICLE_RPM) == 1234);
+	vehicle_set_signal(VEHICLE_RPM, 800000);
+	vehicle_set_vin("WVW");
+	vehicle_read(&state);
+	CHECK(state.signals[VEHICLE_RPM] == 800000 && state.signals[VEHICLE_SPEED] == 1234);
+	CHECK(memcmp(state.vin, "WVW\0\0\0\0\0\0\0\0\0\0\0\0\0\0", VEHICLE_VIN_LEN) == 0);
+}
+
+int main(void)
+{
+	test_interleaved();
+	test_concurrent();
+	test_quiescent();
+
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}